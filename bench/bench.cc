@@ -0,0 +1,270 @@
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <openssl/rsa.h>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "../common/contextmanager.h"
+#include "../common/crypto.h"
+#include "../common/file.h"
+#include "../common/histogram.h"
+#include "../common/protocol.h"
+#include "../common/vec.h"
+
+#include "bench_args.h"
+#include "bench_client.h"
+
+using namespace std;
+
+/// The commands that the benchmark sends, in the order of the -m weights
+const vector<string> ops = {REQ_REG, REQ_SET, REQ_GET, REQ_ALL};
+
+/// op_stats_t is what one client measured for one kind of request
+struct op_stats_t {
+  /// The time spent in each phase
+  histogram phases[NPHASES];
+
+  /// The number of requests whose response was not "OK"
+  uint64_t errors = 0;
+};
+
+/// client_stats_t is everything that one client measured
+struct client_stats_t {
+  /// The measurements for each entry of ops
+  vector<op_stats_t> ops = vector<op_stats_t>(::ops.size());
+};
+
+/// Build the body that starts every authenticated request:
+/// len(@u).@u.len(@p).@p
+///
+/// @param user The name of the user doing the request
+/// @param pass The password of the user doing the request
+///
+/// @returns A vector holding the user and password
+static vec auth_body(const string &user, const string &pass) {
+  vec body;
+  vec_append(body, (int)user.length());
+  vec_append(body, user);
+  vec_append(body, (int)pass.length());
+  vec_append(body, pass);
+  return body;
+}
+
+/// Parse a mix of the form "a:b:c:d" into one weight per entry of ops
+///
+/// @param mix     The mix from the command line
+/// @param weights Receives the weights
+///
+/// @returns false if the mix is malformed or every weight is 0
+static bool parse_mix(const string &mix, vector<int> &weights) {
+  istringstream in(mix);
+  string w;
+  int total = 0;
+  weights.clear();
+  while (getline(in, w, ':')) {
+    int v = atoi(w.c_str());
+    if (v < 0)
+      return false;
+    weights.push_back(v);
+    total += v;
+  }
+  return weights.size() == ops.size() && total > 0;
+}
+
+/// Pick the size of a SET's content
+///
+/// @param args The benchmark's arguments
+/// @param rng  The client's random number generator
+///
+/// @returns A size from the configured distribution, capped at LEN_CONTENT
+static size_t pick_size(const bench_arg_t &args, mt19937_64 &rng) {
+  double s = args.size;
+  if (args.dist == "uniform")
+    s = uniform_int_distribution<int>(0, 2 * args.size)(rng);
+  else if (args.dist == "exp" && args.size > 0)
+    s = exponential_distribution<double>(1.0 / args.size)(rng);
+  return s > LEN_CONTENT ? LEN_CONTENT : (size_t)s;
+}
+
+/// Name the user that a client works as
+///
+/// @param id The client's number
+///
+/// @returns The name of the client's user
+static string user_name(int id) {
+  return "b" + to_string(getpid()) + "_" + to_string(id);
+}
+
+/// Register a client's user and give it content, so that its GETs succeed.
+/// This is done for every client before the clock starts.
+///
+/// @param args   The benchmark's arguments
+/// @param pubkey The public key of the server
+/// @param id     The client's number
+///
+/// @returns false if either request failed
+static bool setup_user(const bench_arg_t &args, RSA *pubkey, int id) {
+  vec auth = auth_body(user_name(id), "bench");
+  vec body = auth;
+  vec_append(body, (int)args.size);
+  body.resize(body.size() + args.size, 'x');
+  timing_t t;
+  if (timed_request(args.server, args.port, pubkey, REQ_REG, auth, t) !=
+          vec_from_string(RES_OK) ||
+      timed_request(args.server, args.port, pubkey, REQ_SET, body, t) !=
+          vec_from_string(RES_OK)) {
+    cerr << "Unable to set up user " << user_name(id) << endl;
+    return false;
+  }
+  return true;
+}
+
+/// Run one client: send requests as the client's user until the deadline
+///
+/// @param args     The benchmark's arguments
+/// @param pubkey   The public key of the server
+/// @param weights  The weight of each entry of ops
+/// @param id       The client's number, from 0 to args.clients - 1
+/// @param start    When the first request may be sent
+/// @param deadline When to stop sending requests
+/// @param stats    Receives the client's measurements
+static void run_client(const bench_arg_t &args, RSA *pubkey,
+                       const vector<int> &weights, int id,
+                       chrono::steady_clock::time_point start,
+                       chrono::steady_clock::time_point deadline,
+                       client_stats_t &stats) {
+  mt19937_64 rng(id);
+  discrete_distribution<int> pick_op(weights.begin(), weights.end());
+  vec payload(LEN_CONTENT);
+  for (auto &b : payload)
+    b = rng();
+
+  string user = user_name(id), pass = "bench";
+  vec auth = auth_body(user, pass);
+  timing_t t;
+
+  // In open-loop mode, client i owns every arrival i, i + clients, ..., so
+  // that together the clients send args.rate requests per second.  A request
+  // that starts late is charged for the time it spent waiting.
+  auto interval = chrono::duration_cast<chrono::steady_clock::duration>(
+      chrono::duration<double>(args.rate ? (double)args.clients / args.rate
+                                         : 0));
+  auto next = start + interval * id / args.clients;
+  for (int n = 0; next < deadline; ++n) {
+    if (args.rate > 0)
+      this_thread::sleep_until(next);
+    auto sent = chrono::steady_clock::now();
+    if (sent >= deadline)
+      break;
+
+    int op = pick_op(rng);
+    vec body;
+    if (ops[op] == REQ_REG) {
+      body = auth_body(user + "_" + to_string(n), pass);
+    } else if (ops[op] == REQ_SET) {
+      size_t len = pick_size(args, rng);
+      body = auth;
+      vec_append(body, (int)len);
+      body.insert(body.end(), payload.begin(), payload.begin() + len);
+    } else if (ops[op] == REQ_GET) {
+      body = auth;
+      vec_append(body, (int)user.length());
+      vec_append(body, user);
+    } else {
+      body = auth;
+    }
+    vec res = timed_request(args.server, args.port, pubkey, ops[op], body, t);
+    if (args.rate > 0 && sent > next)
+      t.us[PHASE_TOTAL] +=
+          chrono::duration_cast<chrono::microseconds>(sent - next).count();
+    op_stats_t &s = stats.ops[op];
+    for (int p = 0; p < NPHASES; ++p)
+      s.phases[p].record(t.us[p]);
+    if (res.size() < RES_OK.length() ||
+        memcmp(res.data(), RES_OK.c_str(), RES_OK.length()) != 0)
+      ++s.errors;
+    next = args.rate > 0 ? next + interval : chrono::steady_clock::now();
+  }
+}
+
+/// Print the throughput and latency of one kind of request
+///
+/// @param name    The name of the request
+/// @param s       The measurements for the request
+/// @param seconds The length of the run
+static void report(const string &name, const op_stats_t &s, int seconds) {
+  uint64_t n = s.phases[PHASE_TOTAL].count();
+  cout << name << ": " << n << " requests, " << s.errors << " errors, "
+       << fixed << setprecision(1) << (double)n / seconds << " req/s\n";
+  if (n == 0)
+    return;
+  for (int p = 0; p < NPHASES; ++p) {
+    const histogram &h = s.phases[p];
+    cout << "  " << left << setw(8) << PHASE_NAMES[p] << right
+         << " mean " << setw(9) << h.mean() << "  p50 " << setw(8)
+         << h.percentile(50) << "  p99 " << setw(8) << h.percentile(99)
+         << "  p999 " << setw(8) << h.percentile(99.9) << "  max " << setw(8)
+         << h.max() << " (us)\n";
+  }
+}
+
+int main(int argc, char **argv) {
+  // Parse the command-line arguments
+  bench_arg_t args;
+  parse_args(argc, argv, args);
+  vector<int> weights;
+  if (args.usage || !parse_mix(args.mix, weights)) {
+    usage(argv[0]);
+    return 0;
+  }
+
+  // If we don't have the keyfile on disk, get the file from server.  Once we
+  // have the file, load the server's key.
+  if (!file_exists(args.keyfile) &&
+      !fetch_key(args.server, args.port, args.keyfile))
+    return 1;
+  RSA *pubkey = load_pub(args.keyfile.c_str());
+  if (pubkey == nullptr)
+    return 1;
+  ContextManager pkr([&]() { RSA_free(pubkey); });
+
+  // Run the clients, and then combine their measurements
+  for (int i = 0; i < args.clients; ++i)
+    if (!setup_user(args, pubkey, i))
+      return 1;
+  vector<client_stats_t> stats(args.clients);
+  vector<thread> clients;
+  auto start = chrono::steady_clock::now();
+  auto deadline = start + chrono::seconds(args.seconds);
+  for (int i = 0; i < args.clients; ++i)
+    clients.emplace_back(run_client, cref(args), pubkey, cref(weights), i,
+                         start, deadline, ref(stats[i]));
+  for (auto &c : clients)
+    c.join();
+
+  cout << args.clients << " clients, " << args.seconds << " s, "
+       << (args.rate > 0 ? "open loop at " + to_string(args.rate) + " req/s"
+                         : string("closed loop"))
+       << ", " << args.dist << " sizes around " << args.size << " bytes\n";
+  op_stats_t all;
+  for (size_t op = 0; op < ops.size(); ++op) {
+    op_stats_t total;
+    for (auto &s : stats) {
+      for (int p = 0; p < NPHASES; ++p)
+        total.phases[p].merge(s.ops[op].phases[p]);
+      total.errors += s.ops[op].errors;
+    }
+    for (int p = 0; p < NPHASES; ++p)
+      all.phases[p].merge(total.phases[p]);
+    all.errors += total.errors;
+    if (weights[op] > 0)
+      report(ops[op], total, args.seconds);
+  }
+  report("all", all, args.seconds);
+}
@@ -0,0 +1,86 @@
+#include <iostream>
+#include <libgen.h>
+#include <unistd.h>
+
+#include "../common/protocol.h"
+
+#include "bench_args.h"
+
+using namespace std;
+
+/// Parse the command-line arguments, and use them to populate the provided args
+/// object.
+///
+/// @param argc The number of command-line arguments passed to the program
+/// @param argv The list of command-line arguments
+/// @param args The struct into which the parsed args should go
+void parse_args(int argc, char **argv, bench_arg_t &args) {
+  long opt;
+  while ((opt = getopt(argc, argv, "k:s:p:c:d:r:m:z:D:h")) != -1) {
+    switch (opt) {
+    case 'p': // port of server
+      args.port = atoi(optarg);
+      break;
+    case 's': // hostname of server
+      args.server = string(optarg);
+      break;
+    case 'k': // name of keyfile
+      args.keyfile = string(optarg);
+      break;
+    case 'c': // number of clients
+      args.clients = atoi(optarg);
+      args.usage |= args.clients < 1;
+      break;
+    case 'd': // duration
+      args.seconds = atoi(optarg);
+      args.usage |= args.seconds < 1;
+      break;
+    case 'r': // arrival rate
+      args.rate = atoi(optarg);
+      args.usage |= args.rate < 0;
+      break;
+    case 'm': // request mix
+      args.mix = string(optarg);
+      break;
+    case 'z': // mean content size
+      args.size = atoi(optarg);
+      args.usage |= args.size < 0 || args.size > LEN_CONTENT;
+      break;
+    case 'D': // content size distribution
+      args.dist = string(optarg);
+      args.usage |=
+          args.dist != "fixed" && args.dist != "uniform" && args.dist != "exp";
+      break;
+    case 'h': // help message
+      args.usage = true;
+      break;
+    default:
+      args.usage = true;
+      return;
+    }
+  }
+  args.usage |= args.server == "" || args.port == 0 || args.keyfile == "";
+}
+
+/// Display a help message to explain how the command-line parameters for this
+/// program work
+///
+/// @progname The name of the program
+void usage(char *progname) {
+  cout << basename(progname) << ": load generator for the company server\n"
+       << " Required Configuration Parameters:\n"
+       << "  -k [file]   The filename for storing the server's public key\n"
+       << "  -s [string] IP address or hostname of server\n"
+       << "  -p [int]    Port to use to connect to server\n"
+       << " Load Parameters:\n"
+       << "  -c [int]    Number of concurrent clients (default 4)\n"
+       << "  -d [int]    Number of seconds to run (default 10)\n"
+       << "  -r [int]    Requests per second, across all clients (open\n"
+       << "              loop).  0 (the default) sends each client's next\n"
+       << "              request when its last one is answered (closed loop)\n"
+       << "  -m [string] Weights of REG:SET:GET:ALL (default 1:4:4:1)\n"
+       << "  -z [int]    Mean size of SET content (default 1024)\n"
+       << "  -D [string] SET size distribution: fixed, uniform, or exp\n"
+       << " Other Options:\n"
+       << "  -h          Print help (this message)\n";
+}
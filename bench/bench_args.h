@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+
+/// bench_arg_t is used to store the command-line arguments of the benchmark
+struct bench_arg_t {
+  /// The port on which the server is listening
+  int port = 0;
+
+  /// The IP or hostname of the server
+  std::string server = "";
+
+  /// The file for storing the server's public key
+  std::string keyfile = "";
+
+  /// The number of concurrent clients
+  int clients = 4;
+
+  /// The number of seconds to run for
+  int seconds = 10;
+
+  /// The total number of requests per second to send, across all clients, or
+  /// 0 to have each client send its next request as soon as the last one is
+  /// answered
+  int rate = 0;
+
+  /// The relative weights of REG, SET, GET, and ALL requests, as a string of
+  /// the form "1:4:4:1"
+  std::string mix = "1:4:4:1";
+
+  /// The mean size of the content in a SET
+  int size = 1024;
+
+  /// The distribution of SET sizes: "fixed", "uniform" (from 0 to twice the
+  /// mean), or "exp" (exponential).  Sizes are capped at LEN_CONTENT.
+  std::string dist = "fixed";
+
+  /// Display a usage message?
+  bool usage = false;
+};
+
+/// Parse the command-line arguments, and use them to populate the provided args
+/// object.
+///
+/// @param argc The number of command-line arguments passed to the program
+/// @param argv The list of command-line arguments
+/// @param args The struct into which the parsed args should go
+void parse_args(int argc, char **argv, bench_arg_t &args);
+
+/// Display a help message to explain how the command-line parameters for this
+/// program work
+///
+/// @progname The name of the program
+void usage(char *progname);
@@ -0,0 +1,121 @@
+#include <chrono>
+#include <iostream>
+#include <openssl/rsa.h>
+#include <string>
+#include <unistd.h>
+
+#include "../common/contextmanager.h"
+#include "../common/crypto.h"
+#include "../common/file.h"
+#include "../common/net.h"
+#include "../common/protocol.h"
+#include "../common/vec.h"
+
+#include "bench_client.h"
+
+using namespace std;
+
+/// The clock for timing phases
+typedef chrono::steady_clock bench_clock;
+
+/// Report the microseconds since a time, and move the time up to now
+///
+/// @param mark The start of the phase that just ended; set to now
+///
+/// @returns The length of the phase, in microseconds
+static uint64_t lap(bench_clock::time_point &mark) {
+  auto now = bench_clock::now();
+  uint64_t res =
+      chrono::duration_cast<chrono::microseconds>(now - mark).count();
+  mark = now;
+  return res;
+}
+
+/// Run a message through a new AES context
+///
+/// @param aeskey  The AES key (and iv)
+/// @param encrypt True to encrypt, false to decrypt
+/// @param msg     The message
+///
+/// @returns The result, or an empty vector on error
+static vec aes_once(const vec &aeskey, bool encrypt, const vec &msg) {
+  EVP_CIPHER_CTX *ctx = create_aes_context(aeskey, encrypt);
+  if (ctx == nullptr)
+    return {};
+  ContextManager cm([&]() { reclaim_aes_context(ctx); });
+  return aes_crypt_msg(ctx, msg);
+}
+
+/// Fetch the server's public key with a REQ_KEY request, and save it to a file
+///
+/// @param server  The IP or hostname of the server
+/// @param port    The port on which the server is listening
+/// @param keyfile The name of the file to which the key should be written
+///
+/// @returns false on error
+bool fetch_key(const string &server, int port, const string &keyfile) {
+  int sd = connect_to_server(server, port);
+  if (sd < 0)
+    return false;
+  ContextManager sdc([&]() { close(sd); });
+  vec kblock = vec_from_string(REQ_KEY);
+  kblock.resize(LEN_RKBLOCK, '\0');
+  if (!send_reliably(sd, kblock))
+    return false;
+  vec key = reliable_get_to_eof(sd);
+  if (key.size() != LEN_RSA_PUBKEY) {
+    cerr << RES_ERR_XMIT << endl;
+    return false;
+  }
+  return write_file(keyfile, (const char *)key.data(), key.size());
+}
+
+/// Send one command to the server as a one-shot request, and time each phase.
+/// Unlike the client, this encrypts the whole ablock before sending it, so that
+/// AES time isn't mixed up with network time.
+///
+/// @param server The IP or hostname of the server
+/// @param port   The port on which the server is listening
+/// @param pubkey The public key of the server
+/// @param cmd    The command to send
+/// @param body   The unencrypted body of the request
+/// @param t      Receives the time spent in each phase
+///
+/// @returns The unencrypted response, or an unencrypted error code
+vec timed_request(const string &server, int port, RSA *pubkey,
+                  const string &cmd, const vec &body, timing_t &t) {
+  auto start = bench_clock::now(), mark = start;
+  int sd = connect_to_server(server, port);
+  t.us[PHASE_CONNECT] = lap(mark);
+  if (sd < 0)
+    return vec_from_string(RES_ERR_XMIT);
+  ContextManager sdc([&]() { close(sd); });
+
+  vec aeskey = create_aes_key();
+  vec ablock = aes_once(aeskey, true, body);
+  t.us[PHASE_AES] = lap(mark);
+  if (ablock.empty())
+    return vec_from_string(RES_ERR_CRYPTO);
+
+  vec content = vec_from_string(cmd);
+  vec_append(content, aeskey);
+  vec_append(content, (int)ablock.size());
+  vec rblock(RSA_size(pubkey));
+  int len = RSA_public_encrypt(content.size(), content.data(), rblock.data(),
+                               pubkey, RSA_PKCS1_OAEP_PADDING);
+  t.us[PHASE_RSA] = lap(mark);
+  if (len != LEN_RKBLOCK)
+    return vec_from_string(RES_ERR_CRYPTO);
+
+  if (!send_reliably(sd, rblock) || !send_reliably(sd, ablock))
+    return vec_from_string(RES_ERR_XMIT);
+  vec enc = reliable_get_to_eof(sd);
+  t.us[PHASE_SERVER] = lap(mark);
+
+  // If the response doesn't decrypt, then it is an unencrypted error code
+  vec res = aes_once(aeskey, false, enc);
+  t.us[PHASE_AES] += lap(mark);
+  t.us[PHASE_TOTAL] =
+      chrono::duration_cast<chrono::microseconds>(mark - start).count();
+  return res.empty() ? enc : res;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <openssl/rsa.h>
+#include <string>
+
+#include "../common/vec.h"
+
+/// The phases of a one-shot request, as the client sees them.  PHASE_SERVER
+/// runs from the first byte sent to the last byte received, so it includes
+/// the network transfer as well as the server's own RSA, AES and storage work.
+enum phase_t {
+  PHASE_CONNECT, // connect_to_server()
+  PHASE_RSA,     // encrypting the rblock
+  PHASE_AES,     // encrypting the request and decrypting the response
+  PHASE_SERVER,  // sending the request and waiting for the whole response
+  PHASE_TOTAL,   // the whole request, including any time spent queued
+  NPHASES
+};
+
+/// The names of the phases, for reports
+const char *const PHASE_NAMES[NPHASES] = {"connect", "rsa", "aes", "server",
+                                          "total"};
+
+/// timing_t is the number of microseconds that one request spent in each phase
+struct timing_t {
+  uint64_t us[NPHASES] = {0};
+};
+
+/// Fetch the server's public key with a REQ_KEY request, and save it to a file
+///
+/// @param server  The IP or hostname of the server
+/// @param port    The port on which the server is listening
+/// @param keyfile The name of the file to which the key should be written
+///
+/// @returns false on error
+bool fetch_key(const std::string &server, int port, const std::string &keyfile);
+
+/// Send one command to the server as a one-shot request, and time each phase.
+/// Unlike the client, this encrypts the whole ablock before sending it, so
+/// that AES time isn't mixed up with network time.
+///
+/// @param server The IP or hostname of the server
+/// @param port   The port on which the server is listening
+/// @param pubkey The public key of the server
+/// @param cmd    The command to send
+/// @param body   The unencrypted body of the request
+/// @param t      Receives the time spent in each phase
+///
+/// @returns The unencrypted response, or an unencrypted error code
+vec timed_request(const std::string &server, int port, RSA *pubkey,
+                  const std::string &cmd, const vec &body, timing_t &t);
@@ -0,0 +1,306 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <libgen.h>
+#include <openssl/bn.h>
+#include <openssl/rsa.h>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "../common/contextmanager.h"
+#include "../common/crypto.h"
+#include "../common/protocol.h"
+#include "../common/vec.h"
+
+using namespace std;
+
+/// micro_arg_t is used to store the command-line arguments of the
+/// microbenchmarks
+struct micro_arg_t {
+  /// The least number of milliseconds that one sample may take
+  int min_ms = 100;
+
+  /// The number of samples to take of each benchmark
+  int samples = 5;
+
+  /// Only run benchmarks whose names contain this string
+  string filter = "";
+
+  /// The file to which the JSON results should go, or "" for stdout
+  string outfile = "";
+
+  /// Display a usage message?
+  bool usage = false;
+};
+
+/// result_t is the outcome of one benchmark
+struct result_t {
+  /// The name of the benchmark
+  string name;
+
+  /// The number of bytes that one operation processes, or 0
+  size_t bytes;
+
+  /// The number of operations in each sample
+  uint64_t iters;
+
+  /// The median and fastest time per operation, over all samples
+  double ns_median, ns_min;
+};
+
+/// The clock for timing samples
+typedef chrono::steady_clock micro_clock;
+
+/// Every benchmark adds something from each operation's result here, so that
+/// the compiler can't optimize the operation away
+static volatile size_t sink;
+
+/// Check if a benchmark was selected with -f
+///
+/// @param args The microbenchmarks' arguments
+/// @param name The name of the benchmark
+///
+/// @returns true if the benchmark should run
+static bool wanted(const micro_arg_t &args, const string &name) {
+  return name.find(args.filter) != string::npos;
+}
+
+/// Time a function.  First, find the number of operations that makes one
+/// sample take at least args.min_ms.  Then take args.samples samples of that
+/// many operations.
+///
+/// @param args  The microbenchmarks' arguments
+/// @param name  The name of the benchmark
+/// @param bytes The number of bytes that one operation processes, or 0
+/// @param op    The operation to time
+/// @param res   The list of results, to which this result is appended
+template <class F>
+static void measure(const micro_arg_t &args, const string &name, size_t bytes,
+                    F op, vector<result_t> &res) {
+  if (!wanted(args, name))
+    return;
+  auto run = [&](uint64_t n) {
+    auto start = micro_clock::now();
+    for (uint64_t i = 0; i < n; ++i)
+      op();
+    return chrono::duration<double, nano>(micro_clock::now() - start).count();
+  };
+  uint64_t iters = 1;
+  while (run(iters) < args.min_ms * 1e6)
+    iters *= 2;
+  vector<double> ns;
+  for (int i = 0; i < args.samples; ++i)
+    ns.push_back(run(iters) / iters);
+  sort(ns.begin(), ns.end());
+  res.push_back({name, bytes, iters, ns[ns.size() / 2], ns[0]});
+  cerr << name << "/" << bytes << ": " << ns[ns.size() / 2] << " ns\n";
+}
+
+/// Make an RSA key pair in memory, without touching any files
+///
+/// @returns The key pair, or nullptr on error
+static RSA *make_rsa() {
+  BIGNUM *bn = BN_new();
+  if (bn == nullptr)
+    return nullptr;
+  ContextManager bnfree([&]() { BN_free(bn); });
+  RSA *rsa = RSA_new();
+  if (rsa == nullptr)
+    return nullptr;
+  if (BN_set_word(bn, RSA_F4) != 1 ||
+      RSA_generate_key_ex(rsa, RSA_KEYSIZE, bn, nullptr) != 1) {
+    cerr << "Error generating RSA key\n";
+    RSA_free(rsa);
+    return nullptr;
+  }
+  return rsa;
+}
+
+/// Run the AES benchmarks: aes_crypt_msg() in each direction, for sizes from
+/// one block to LEN_CONTENT, and the cost of getting a context ready
+///
+/// @param args The microbenchmarks' arguments
+/// @param res  The list of results
+static void bench_aes(const micro_arg_t &args, vector<result_t> &res) {
+  vec key = create_aes_key();
+  EVP_CIPHER_CTX *ctx = create_aes_context(key, true);
+  if (ctx == nullptr)
+    return;
+  ContextManager cm([&]() { reclaim_aes_context(ctx); });
+  for (size_t size = 16; size <= (size_t)LEN_CONTENT; size *= 4) {
+    vec plain(size, 'x');
+    reset_aes_context(ctx, key, true);
+    vec enc = aes_crypt_msg(ctx, plain);
+    measure(args, "aes_crypt_msg_encrypt", size, [&]() {
+      reset_aes_context(ctx, key, true);
+      sink = sink + aes_crypt_msg(ctx, plain).size();
+    }, res);
+    measure(args, "aes_crypt_msg_decrypt", size, [&]() {
+      reset_aes_context(ctx, key, false);
+      sink = sink + aes_crypt_msg(ctx, enc).size();
+    }, res);
+  }
+
+  // A context from the pool, a context that the pool has to allocate (since
+  // it is freed instead of reclaimed), and a reset of a context in hand
+  measure(args, "create_aes_context_pooled", 0, [&]() {
+    EVP_CIPHER_CTX *c = create_aes_context(key, true);
+    sink = sink + (c != nullptr);
+    reclaim_aes_context(c);
+  }, res);
+  measure(args, "create_aes_context_new", 0, [&]() {
+    EVP_CIPHER_CTX *c = create_aes_context(key, true);
+    sink = sink + (c != nullptr);
+    EVP_CIPHER_CTX_free(c);
+  }, res);
+  measure(args, "reset_aes_context", 0, [&]() {
+    sink = sink + reset_aes_context(ctx, key, true);
+  }, res);
+}
+
+/// Run the RSA benchmarks: encrypting an rblock's worth of content with the
+/// public key (as a client does), and decrypting a LEN_RKBLOCK block with the
+/// private key (as the server does for every request)
+///
+/// @param args The microbenchmarks' arguments
+/// @param res  The list of results
+static void bench_rsa(const micro_arg_t &args, vector<result_t> &res) {
+  // NB: making a key is slow, so skip it if no RSA benchmark was selected
+  if (!wanted(args, "rsa_public_encrypt") &&
+      !wanted(args, "rsa_private_decrypt"))
+    return;
+  RSA *rsa = make_rsa();
+  if (rsa == nullptr)
+    return;
+  ContextManager rsafree([&]() { RSA_free(rsa); });
+  vec plain(LEN_RBLOCK_CONTENT, 'x'), enc(RSA_size(rsa)), dec(RSA_size(rsa));
+  if (RSA_public_encrypt(plain.size(), plain.data(), enc.data(), rsa,
+                         RSA_PKCS1_OAEP_PADDING) != LEN_RKBLOCK)
+    return;
+  measure(args, "rsa_public_encrypt", LEN_RKBLOCK, [&]() {
+    sink = sink + RSA_public_encrypt(plain.size(), plain.data(), dec.data(),
+                                     rsa, RSA_PKCS1_OAEP_PADDING);
+  }, res);
+  measure(args, "rsa_private_decrypt", LEN_RKBLOCK, [&]() {
+    sink = sink + RSA_private_decrypt(LEN_RKBLOCK, enc.data(), dec.data(), rsa,
+                                      RSA_PKCS1_OAEP_PADDING);
+  }, res);
+}
+
+/// Run the vec_append() benchmarks: each overload, appending to a vector that
+/// already has room, so that only the append itself is timed
+///
+/// @param args The microbenchmarks' arguments
+/// @param res  The list of results
+static void bench_vec(const micro_arg_t &args, vector<result_t> &res) {
+  vec v;
+  v.reserve(LEN_CONTENT);
+  measure(args, "vec_append_int", sizeof(int), [&]() {
+    v.clear();
+    vec_append(v, (int)sink);
+    sink = sink + v.size();
+  }, res);
+  for (size_t size = 16; size <= (size_t)LEN_CONTENT; size *= 64) {
+    string s(size, 'x');
+    vec from(size, 'x');
+    measure(args, "vec_append_string", size, [&]() {
+      v.clear();
+      vec_append(v, s);
+      sink = sink + v.size();
+    }, res);
+    measure(args, "vec_append_vec", size, [&]() {
+      v.clear();
+      vec_append(v, from);
+      sink = sink + v.size();
+    }, res);
+  }
+}
+
+/// Format the results as JSON
+///
+/// @param args The microbenchmarks' arguments
+/// @param res  The results
+///
+/// @returns A JSON document with one object per result
+static string to_json(const micro_arg_t &args, const vector<result_t> &res) {
+  ostringstream out;
+  out.precision(6);
+  out << "{\n  \"min_ms\": " << args.min_ms
+      << ",\n  \"samples\": " << args.samples << ",\n  \"benchmarks\": [";
+  for (size_t i = 0; i < res.size(); ++i) {
+    const result_t &r = res[i];
+    out << (i ? ",\n" : "\n") << "    {\"name\": \"" << r.name
+        << "\", \"bytes\": " << r.bytes << ", \"iterations\": " << r.iters
+        << ", \"ns_per_op\": " << r.ns_median
+        << ", \"min_ns_per_op\": " << r.ns_min;
+    if (r.bytes > 0)
+      out << ", \"mb_per_s\": " << r.bytes * 1e3 / r.ns_median;
+    out << "}";
+  }
+  out << "\n  ]\n}\n";
+  return out.str();
+}
+
+/// Display a help message to explain how the command-line parameters for this
+/// program work
+///
+/// @progname The name of the program
+static void usage(char *progname) {
+  cout << basename(progname) << ": microbenchmarks of crypto and vec\n"
+       << "  -t [int]    Least milliseconds per sample (default 100)\n"
+       << "  -n [int]    Number of samples per benchmark (default 5)\n"
+       << "  -f [string] Only run benchmarks whose names contain this\n"
+       << "  -o [file]   Write JSON results to this file, not stdout\n"
+       << "  -h          Print help (this message)\n";
+}
+
+int main(int argc, char **argv) {
+  // Parse the command-line arguments
+  micro_arg_t args;
+  long opt;
+  while ((opt = getopt(argc, argv, "t:n:f:o:h")) != -1) {
+    switch (opt) {
+    case 't':
+      args.min_ms = atoi(optarg);
+      args.usage |= args.min_ms < 1;
+      break;
+    case 'n':
+      args.samples = atoi(optarg);
+      args.usage |= args.samples < 1;
+      break;
+    case 'f':
+      args.filter = string(optarg);
+      break;
+    case 'o':
+      args.outfile = string(optarg);
+      break;
+    default:
+      args.usage = true;
+    }
+  }
+  if (args.usage) {
+    usage(argv[0]);
+    return 0;
+  }
+
+  // Progress goes to stderr, and results to stdout or the output file
+  vector<result_t> res;
+  bench_aes(args, res);
+  bench_rsa(args, res);
+  bench_vec(args, res);
+  string json = to_json(args, res);
+  if (args.outfile == "") {
+    cout << json;
+    return 0;
+  }
+  ofstream out(args.outfile);
+  out << json;
+  if (!out) {
+    cerr << "Unable to write " << args.outfile << endl;
+    return 1;
+  }
+}
@@ -1,5 +1,14 @@
+#include <atomic>
+#include <csignal>
+#include <condition_variable>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <mutex>
 #include <openssl/rsa.h>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "../common/contextmanager.h"
@@ -7,12 +16,264 @@
 #include "../common/file.h"
 #include "../common/net.h"
 #include "../common/protocol.h"
+#include "../common/ring.h"
 
 #include "client_args.h"
 #include "client_commands.h"
+#include "client_router.h"
 
 using namespace std;
 
+/// The commands that a client can run, and the functions that run them
+const vector<string> cmds = {REQ_REG, REQ_BYE, REQ_SET, REQ_GET, REQ_ALL,
+                             REQ_SAV, REQ_MET, REQ_SOF, REQ_FUN};
+decltype(client_reg) *const funcs[] = {client_reg, client_bye, client_set,
+                                       client_get, client_all, client_sav,
+                                       client_met, client_sof, client_fun};
+
+/// Run one command through an exchange
+///
+/// @param xchg    The exchange through which to reach the server
+/// @param user    The name of the user doing the request
+/// @param pass    The password of the user doing the request
+/// @param command The command to run
+/// @param arg1    The first argument to the command
+/// @param arg2    The second argument to the command
+///
+/// @returns false if the command is not valid
+bool run_command(const exchange_t &xchg, const string &user,
+                 const string &pass, const string &command, const string &arg1,
+                 const string &arg2) {
+  for (size_t i = 0; i < cmds.size(); ++i) {
+    if (command == cmds[i]) {
+      funcs[i](xchg, user, pass, arg1, arg2);
+      return true;
+    }
+  }
+  return false;
+}
+
+/// batch_line_t is one command of a batch file, and its arguments
+struct batch_line_t {
+  string command, arg1, arg2;
+};
+
+/// Read the commands of a batch file.  Each line holds a command, followed by
+/// up to two whitespace-separated arguments.  Blank lines are skipped.
+///
+/// @param filename The name of the batch file
+/// @param lines    Receives the commands
+///
+/// @returns false if the file can't be opened
+bool read_batch(const string &filename, vector<batch_line_t> &lines) {
+  ifstream script(filename);
+  if (!script) {
+    cerr << "Unable to open " << filename << endl;
+    return false;
+  }
+  string line;
+  while (getline(script, line)) {
+    istringstream words(line);
+    batch_line_t l;
+    if (!(words >> l.command))
+      continue;
+    words >> l.arg1 >> l.arg2;
+    lines.push_back(l);
+  }
+  return true;
+}
+
+/// Run one command of a batch, reporting an invalid one
+///
+/// @param xchg The exchange through which to reach the server
+/// @param args The client's command-line arguments
+/// @param l    The command
+void run_line(const exchange_t &xchg, const client_arg_t &args,
+              const batch_line_t &l) {
+  if (!run_command(xchg, args.username, args.userpass, l.command, l.arg1,
+                   l.arg2))
+    cerr << "Invalid command in batch file: " << l.command << endl;
+}
+
+/// turns_t lets the threads of a pipelined batch take turns in script order.
+/// Command i sends its first request only after command i-1 has sent its
+/// first, and reports its result only after command i-1 has reported.
+struct turns_t {
+  /// A lock and condition variable to protect and signal the counters
+  mutex lock;
+  condition_variable cv;
+
+  /// The number of commands that have sent their first request, and that
+  /// have finished
+  size_t sent = 0, done = 0;
+
+  /// Wait until a counter reaches a command's turn
+  ///
+  /// @param count The counter
+  /// @param i     The command's position in the script
+  void await(size_t &count, size_t i) {
+    unique_lock<mutex> g(lock);
+    cv.wait(g, [&]() { return count == i; });
+  }
+
+  /// Advance a counter past the current command
+  ///
+  /// @param count The counter
+  void pass(size_t &count) {
+    lock_guard<mutex> g(lock);
+    ++count;
+    cv.notify_all();
+  }
+};
+
+/// Run the commands of a batch over a pool of sessions, with up to depth
+/// commands in flight on each.  Command i goes to session i % sessions.  The
+/// commands are sent in script order, and their results are reported in
+/// script order, so one session behaves just like an unpipelined one.  With
+/// many sessions, commands on different sessions may reach the server in any
+/// order.
+///
+/// @param args   The client's command-line arguments
+/// @param pubkey The public key of the server
+/// @param lines  The commands
+void run_pooled(const client_arg_t &args, RSA *pubkey,
+                const vector<batch_line_t> &lines) {
+  vector<int> sds;
+  ContextManager sdc([&]() {
+    for (int sd : sds)
+      close(sd);
+  });
+  // NB: The sessions must be destroyed before their sockets are closed
+  vector<pipeline_t> pipes;
+  for (int i = 0; i < args.sessions; ++i) {
+    int sd = connect_to_server(args.server, args.port);
+    if (sd < 0)
+      return;
+    sds.push_back(sd);
+    pipes.push_back(pipelined_session(sd, pubkey));
+    if (!pipes.back())
+      return;
+  }
+  turns_t turns;
+  atomic<size_t> next(0);
+  auto work = [&]() {
+    size_t i;
+    while ((i = next++) < lines.size()) {
+      const pipeline_t &pipe = pipes[i % pipes.size()];
+      bool first = true;
+      exchange_t xchg = [&](const string &cmd, const vec &body) {
+        if (!first)
+          return pipe(cmd, body).get();
+        first = false;
+        turns.await(turns.sent, i);
+        future<vec> res = pipe(cmd, body);
+        turns.pass(turns.sent);
+        vec v = res.get();
+        turns.await(turns.done, i);
+        return v;
+      };
+      run_line(xchg, args, lines[i]);
+      // A command that sent nothing still needs to take its turns
+      if (first) {
+        turns.await(turns.sent, i);
+        turns.pass(turns.sent);
+        turns.await(turns.done, i);
+      }
+      turns.pass(turns.done);
+    }
+  };
+  vector<thread> workers;
+  for (int i = 1; i < args.sessions * args.depth; ++i)
+    workers.emplace_back(work);
+  work();
+  for (auto &t : workers)
+    t.join();
+}
+
+/// Run every command in a batch file.  By default, they all go over a single
+/// session, one at a time.  With tickets, each command is a one-shot request
+/// instead, and only the first (or any whose ticket is refused) pays for RSA.
+/// With more sessions or a deeper pipeline, see run_pooled().  Either way, the
+/// server's key is loaded once, and RSA is paid once per session, not once
+/// per command.
+///
+/// @param args   The client's command-line arguments
+/// @param pubkey The public key of the server
+void run_batch(const client_arg_t &args, RSA *pubkey) {
+  vector<batch_line_t> lines;
+  if (!read_batch(args.batchfile, lines))
+    return;
+  if (args.sessions > 1 || args.depth > 1) {
+    run_pooled(args, pubkey, lines);
+    return;
+  }
+  int sd = -1;
+  ContextManager sdc([&]() {
+    if (sd >= 0)
+      close(sd);
+  });
+  exchange_t xchg;
+  if (args.tickets) {
+    xchg = ticket_exchange(args.server, args.port, pubkey);
+  } else {
+    sd = connect_to_server(args.server, args.port);
+    if (sd < 0)
+      return;
+    xchg = session_exchange(sd, pubkey);
+    if (!xchg)
+      return;
+  }
+  for (auto &l : lines)
+    run_line(xchg, args, l);
+}
+
+/// Run a command, or every command in a batch file, on the shards of a sharded
+/// deployment (see client_router.h).  In batch mode, one session is held open
+/// to each shard.  Otherwise, each shard that a command reaches gets a one-shot
+/// request.
+///
+/// @param args   The client's command-line arguments
+/// @param pubkey The public key of the servers
+/// @param nodes  The servers, in ring order
+void run_sharded(const client_arg_t &args, RSA *pubkey,
+                 const vector<string> &nodes) {
+  HashRing ring(nodes);
+  vector<int> sds;
+  ContextManager sdc([&]() {
+    for (int sd : sds)
+      close(sd);
+  });
+  vector<exchange_t> shards;
+  for (auto &node : nodes) {
+    string host;
+    int port;
+    route_endpoint(node, host, port);
+    if (args.batchfile == "") {
+      shards.push_back(oneshot_exchange(host, port, pubkey));
+      continue;
+    }
+    int sd = connect_to_server(host, port);
+    if (sd < 0)
+      return;
+    sds.push_back(sd);
+    shards.push_back(session_exchange(sd, pubkey));
+    if (!shards.back())
+      return;
+  }
+  if (args.batchfile == "") {
+    route_command(ring, shards, args.username, args.userpass, args.command,
+                  args.arg1, args.arg2);
+    return;
+  }
+  vector<batch_line_t> lines;
+  if (!read_batch(args.batchfile, lines))
+    return;
+  for (auto &l : lines)
+    if (!route_command(ring, shards, args.username, args.userpass, l.command,
+                       l.arg1, l.arg2))
+      cerr << "Invalid command in batch file: " << l.command << endl;
+}
+
 int main(int argc, char **argv) {
   // Parse the command-line arguments
   client_arg_t args;
@@ -22,6 +283,17 @@ int main(int argc, char **argv) {
     return 0;
   }
 
+  // With shards, they all share a key, so the first shard can provide it
+  vector<string> nodes = ring_parse(args.ring);
+  for (auto &node : nodes) {
+    if (!route_endpoint(node, args.server, args.port)) {
+      cerr << "Invalid server: " << node << endl;
+      return 1;
+    }
+  }
+  if (!nodes.empty())
+    route_endpoint(nodes.front(), args.server, args.port);
+
   // If we don't have the keyfile on disk, get the file from server.  Once we
   // have the file, load the server's key.
   if (!file_exists(args.keyfile)) {
@@ -30,19 +302,24 @@ int main(int argc, char **argv) {
     close(sd);
   }
   RSA *pubkey = load_pub(args.keyfile.c_str());
+  if (pubkey == nullptr)
+    return 1;
   ContextManager pkr([&]() { RSA_free(pubkey); });
 
-  // Connect to the server and perform the appropriate operation
-  int sd = connect_to_server(args.server, args.port);
-  ContextManager sdc([&]() { close(sd); });
+  client_compress(args.zlevel);
 
-  // Figure out which command was requested, and run it
-  vector<string> cmds = {REQ_REG, REQ_BYE, REQ_SET, REQ_GET, REQ_ALL, REQ_SAV};
-  decltype(client_reg) *funcs[] = {client_reg, client_bye, client_set,
-                                   client_get, client_all, client_sav};
-  for (size_t i = 0; i < cmds.size(); ++i) {
-    if (args.command == cmds[i]) {
-      funcs[i](sd, pubkey, args.username, args.userpass, args.arg1, args.arg2);
-    }
-  }
+  // A busy server may refuse a request before reading all of it, so a send
+  // must fail instead of killing the client
+  signal(SIGPIPE, SIG_IGN);
+
+  // In batch mode, run many commands over a few sessions.  Otherwise, figure
+  // out which command was requested, and run it as a one-shot request.
+  if (!nodes.empty())
+    run_sharded(args, pubkey, nodes);
+  else if (args.batchfile != "")
+    run_batch(args, pubkey);
+  else
+    run_command(oneshot_exchange(args.server, args.port, pubkey),
+                args.username, args.userpass, args.command, args.arg1,
+                args.arg2);
 }
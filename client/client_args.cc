@@ -2,10 +2,26 @@
 #include <libgen.h>
 #include <unistd.h>
 
+#include "../common/protocol.h"
+#include "../common/ring.h"
+
 #include "client_args.h"
 
 using namespace std;
 
+/// Check that an argument is a valid page size for ALL
+///
+/// @param arg The argument
+///
+/// @returns true if it is a number from 1 to ALL_PAGE_MAX
+static bool valid_page(const string &arg) {
+  if (arg.empty() || arg.length() > 6 ||
+      arg.find_first_not_of("0123456789") != string::npos)
+    return false;
+  int page = stoi(arg);
+  return page >= 1 && page <= ALL_PAGE_MAX;
+}
+
 /// Parse the command-line arguments, and use them to populate the provided args
 /// object.
 ///
@@ -14,7 +30,7 @@ using namespace std;
 /// @param args The struct into which the parsed args should go
 void parse_args(int argc, char **argv, client_arg_t &args) {
   long opt;
-  while ((opt = getopt(argc, argv, "k:u:w:s:p:C:1:2:h")) != -1) {
+  while ((opt = getopt(argc, argv, "k:u:w:s:p:C:1:2:B:TP:D:R:z:h")) != -1) {
     switch (opt) {
     case 'p': // port of server
       args.port = atoi(optarg);
@@ -43,6 +59,28 @@ void parse_args(int argc, char **argv, client_arg_t &args) {
       args.usage |= args.arg2 != "";
       args.arg2 = string(optarg);
       break;
+    case 'B': // batch file
+      args.batchfile = string(optarg);
+      break;
+    case 'T': // use tickets in batch mode
+      args.tickets = true;
+      break;
+    case 'P': // number of sessions in batch mode
+      args.sessions = atoi(optarg);
+      args.usage |= args.sessions < 1;
+      break;
+    case 'D': // pipeline depth in batch mode
+      args.depth = atoi(optarg);
+      args.usage |= args.depth < 1;
+      break;
+    case 'R': // servers of a sharded deployment
+      args.ring = string(optarg);
+      args.usage |= ring_parse(args.ring).empty();
+      break;
+    case 'z': // compress content on the wire
+      args.zlevel = atoi(optarg);
+      args.usage |= args.zlevel < 0 || args.zlevel > 9;
+      break;
     case 'h': // help message
       args.usage = true;
       break;
@@ -51,9 +89,20 @@ void parse_args(int argc, char **argv, client_arg_t &args) {
       return;
     }
   }
+  // In batch mode, the commands come from the batch file instead.  Tickets
+  // are for one-shot requests, which can't be pipelined, and neither can be
+  // routed to shards.
+  bool pooled = args.sessions > 1 || args.depth > 1;
+  args.usage |= args.ring != "" && (args.tickets || pooled);
+  if (args.batchfile != "") {
+    args.usage |= (args.command != "" || args.arg1 != "" || args.arg2 != "");
+    args.usage |= args.tickets && pooled;
+    return;
+  }
+  args.usage |= args.tickets || pooled;
   // Validate command formats
   string arg0[] = {"BYE", "SAV", "REG"};
-  string arg1[] = {"SET", "GET", "ALL"};
+  string arg1[] = {"SET", "GET", "ALL", "MET", "SOF", "FUN"};
   bool found = false;
   for (auto a : arg0) {
     if (args.command == a) {
@@ -64,7 +113,9 @@ void parse_args(int argc, char **argv, client_arg_t &args) {
   for (auto a : arg1) {
     if (args.command == a) {
       found = true;
-      args.usage |= (args.arg1 == "" || args.arg2 != "");
+      // NB: ALL takes an optional page size
+      bool page_ok = a == "ALL" && valid_page(args.arg2);
+      args.usage |= (args.arg1 == "" || (args.arg2 != "" && !page_ok));
     }
   }
   args.usage |= !found;
@@ -86,13 +137,32 @@ void usage(char *progname) {
        << " Admin Commands (pass via -C):\n"
        << "  BYE             Force the server to stop\n"
        << "  SAV             Instruct the server to save its data\n"
+       << "  MET -1 [file]   Get the server's metrics, and save to a file\n"
+       << "  SOF -1 [file]   Register a shared object, named for its file\n"
+       << "  FUN -1 [string] Run the shared object with this name over every\n"
+       << "                  user, and save the result to <name>.fun.dat\n"
        << " Auth Table Commands (pass via -C, with argument as -1)\n"
        << "  REG             Register a new user\n"
        << "  SET -1 [file]   Set user's data to the contents of the file\n"
        << "  GET -1 [string] Get data for the provided user\n"
        << "  ALL -1 [file]   Get list of all users' names, and save to a file\n"
+       << "      -2 [int]    Optionally, fetch the names that many at a time\n"
+       << " Batch Mode (instead of -C):\n"
+       << "  -B [file]   Run the commands in the file, one per line, over one\n"
+       << "              connection.  Each line is a command and its arguments,\n"
+       << "              e.g. 'SET myfile' or 'GET alice'\n"
+       << "  -T          With -B, send each command on its own connection,\n"
+       << "              using a session ticket to skip RSA when possible\n"
+       << "  -P [int]    With -B, spread the commands over this many sessions\n"
+       << "  -D [int]    With -B, let each session have this many commands in\n"
+       << "              flight, instead of waiting for each response\n"
+       << " Sharding:\n"
+       << "  -R [string] Instead of -s and -p, route each command to the\n"
+       << "              shards of this list of servers, e.g.\n"
+       << "              'host1:9000,host2:9000'\n"
        << " Other Options:\n"
        << "  -1          Provide first argument to a command\n"
        << "  -2          Provide second argument to a command\n"
+       << "  -z [int]    Send SET/GET content compressed, at this zlib level\n"
        << "  -h          Print help (this message)\n";
 }
@@ -28,6 +28,27 @@ struct client_arg_t {
   /// The second argument to the command (if any)
   std::string arg2 = "";
 
+  /// A file of commands to run, one per line, over a single session
+  std::string batchfile = "";
+
+  /// In batch mode, send one-shot requests that reuse a session ticket,
+  /// instead of holding one session open?
+  bool tickets = false;
+
+  /// In batch mode, the number of sessions over which to spread the commands
+  int sessions = 1;
+
+  /// In batch mode, the number of commands that each session may have sent
+  /// without having received their responses
+  int depth = 1;
+
+  /// The servers of a sharded deployment (host:port,host:port,...), in ring
+  /// order, to use instead of server and port
+  std::string ring = "";
+
+  /// The zlib level at which SET and GET send content packed (0 for never)
+  int zlevel = 0;
+
   /// Display a usage message?
   bool usage = false;
 };
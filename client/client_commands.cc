@@ -1,97 +1,754 @@
 #include <cassert>
 #include <cstring>
+#include <deque>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <openssl/rand.h>
 #include <openssl/rsa.h>
 #include <string>
+#include <sys/socket.h>
+#include <thread>
 
+#include "../common/compress.h"
 #include "../common/contextmanager.h"
 #include "../common/crypto.h"
 #include "../common/file.h"
 #include "../common/net.h"
 #include "../common/protocol.h"
+#include "../common/session.h"
 #include "../common/vec.h"
 
 #include "client_commands.h"
 
 using namespace std;
 
+/// The zlib level at which SET and GET send content packed, or 0 to send it as
+/// it is
+static int content_zlevel = 0;
+
+/// Build the rblock of a request, by encrypting cmd.aeskey.len(@ablock) with
+/// the server's public key.  Nonzero flags are appended, as .@f.
+///
+/// @param pubkey The public key of the server
+/// @param cmd    The command being requested
+/// @param aeskey The AES key that the ablock uses
+/// @param alen   The length of the encrypted ablock
+/// @param flags  The rblock flags (e.g., RBLOCK_FLAG_TICKET)
+///
+/// @returns The LEN_RKBLOCK bytes of the rblock, or an empty vector on error
+static vec make_rblock(RSA *pubkey, const string &cmd, const vec &aeskey,
+                       int alen, int flags) {
+  vec content = vec_from_string(cmd);
+  vec_append(content, aeskey);
+  vec_append(content, alen);
+  if (flags != 0)
+    vec_append(content, flags);
+  vec rblock(RSA_size(pubkey));
+  if (RSA_public_encrypt(content.size(), content.data(), rblock.data(), pubkey,
+                         RSA_PKCS1_OAEP_PADDING) != LEN_RKBLOCK) {
+    cerr << "Error in RSA_public_encrypt()\n";
+    return {};
+  }
+  return rblock;
+}
+
+/// Send the rblock and ablock of a request on an open socket.  The ablock is
+/// encrypted with a new AES key as it is sent, so that it is never held in
+/// memory in full.
+///
+/// @param sd     An open socket
+/// @param pubkey The public key of the server
+/// @param cmd    The command being requested
+/// @param body   The unencrypted contents of the ablock
+/// @param flags  The rblock flags (e.g., RBLOCK_FLAG_TICKET)
+///
+/// @returns The AES key that the server will use for the response, or an empty
+///          vector on error
+static vec send_request(int sd, RSA *pubkey, const string &cmd,
+                        const vec &body, int flags = 0) {
+  vec aeskey = create_aes_key();
+  if (aeskey.empty())
+    return {};
+  EVP_CIPHER_CTX *ctx = create_aes_context(aeskey, true);
+  if (ctx == nullptr)
+    return {};
+  ContextManager cm([&]() { reclaim_aes_context(ctx); });
+  // NB: CBC mode always pads the message out to the next whole block
+  const int block = EVP_CIPHER_CTX_block_size(ctx);
+  int alen = (body.size() / block + 1) * block;
+  vec rblock = make_rblock(pubkey, cmd, aeskey, alen, flags);
+  // NB: the rblock goes out with the start of the ablock
+  if (rblock.empty() ||
+      !send_encrypt(sd, ctx, body.data(), body.size(), rblock))
+    return {};
+  return aeskey;
+}
+
+/// A busy server may refuse a request before reading all of it, so when a
+/// request can't be sent, look for the refusal
+///
+/// @param sd The socket on which the request was being sent
+///
+/// @returns RES_ERR_BUSY if the server refused the request, or RES_ERR_XMIT
+static vec send_failed(int sd) {
+  vec res(RES_ERR_BUSY.length());
+  if (reliable_get_to_eof_or_n(sd, res.begin(), res.size()) ==
+          (int)res.size() &&
+      res == vec_from_string(RES_ERR_BUSY))
+    return res;
+  return vec_from_string(RES_ERR_XMIT);
+}
+
+/// Decrypt the AES-encrypted part of a one-shot response
+///
+/// @param aeskey The AES key of the request
+/// @param enc    The response bytes
+///
+/// @returns The decrypted response, or enc itself if it doesn't decrypt (in
+///          which case it is an unencrypted error code)
+static vec open_response(const vec &aeskey, const vec &enc) {
+  EVP_CIPHER_CTX *ctx = create_aes_context(aeskey, false);
+  if (ctx == nullptr)
+    return vec_from_string(RES_ERR_CRYPTO);
+  ContextManager cm([&]() { reclaim_aes_context(ctx); });
+  vec res = aes_crypt_msg(ctx, enc);
+  return res.empty() ? enc : res;
+}
+
+/// Create an exchange_t that sends each command as a one-shot request, on its
+/// own connection to the server
+///
+/// @param server The IP or hostname of the server
+/// @param port   The port on which the server is listening
+/// @param pubkey The public key of the server
+///
+/// @returns An exchange_t for one-shot requests
+exchange_t oneshot_exchange(const string &server, int port, RSA *pubkey) {
+  return [=](const string &cmd, const vec &body) {
+    int sd = connect_to_server(server, port);
+    if (sd < 0)
+      return vec_from_string(RES_ERR_XMIT);
+    ContextManager sdc([&]() { close(sd); });
+    vec aeskey = send_request(sd, pubkey, cmd, body);
+    if (aeskey.empty())
+      return send_failed(sd);
+    // If the response doesn't decrypt, then it is an unencrypted error code
+    EVP_CIPHER_CTX *ctx = create_aes_context(aeskey, false);
+    if (ctx == nullptr)
+      return vec_from_string(RES_ERR_CRYPTO);
+    ContextManager cm([&]() { reclaim_aes_context(ctx); });
+    vec res;
+    recv_decrypt_to_eof(sd, ctx, res);
+    return res.empty() ? vec_from_string(RES_ERR_CRYPTO) : res;
+  };
+}
+
+/// ticket_t is the most recent session ticket that a client holds, and the
+/// AES key that it stands for
+struct ticket_t {
+  /// The LEN_TICKET bytes of the ticket, or empty if there isn't one
+  vec ticket;
+
+  /// The AES key of the request that earned the ticket
+  vec aeskey;
+};
+
+/// Send one command as a REQ_RSM request, using a ticket instead of RSA
+///
+/// @param server The IP or hostname of the server
+/// @param port   The port on which the server is listening
+/// @param t      The ticket to present
+/// @param cmd    The command to send
+/// @param body   The unencrypted body of the request
+/// @param res    The vector that receives the unencrypted response
+///
+/// @returns false if the server didn't accept the ticket
+static bool resume_request(const string &server, int port, const ticket_t &t,
+                           const string &cmd, const vec &body, vec &res) {
+  vec msg = vec_from_string(cmd);
+  vec_append(msg, body);
+  vec frame = seal_frame(t.aeskey, msg);
+  if (frame.empty()) {
+    res = vec_from_string(RES_ERR_CRYPTO);
+    return true;
+  }
+  // The header is pad0("RSM".@t.len(@e)), and len(@e) starts the frame
+  vec block = vec_from_string(REQ_RSM);
+  vec_append(block, t.ticket);
+  block.insert(block.end(), frame.begin(), frame.begin() + sizeof(int));
+  block.resize(LEN_RKBLOCK, '\0');
+  block.insert(block.end(), frame.begin() + sizeof(int), frame.end());
+
+  int sd = connect_to_server(server, port);
+  if (sd < 0) {
+    res = vec_from_string(RES_ERR_XMIT);
+    return true;
+  }
+  ContextManager sdc([&]() { close(sd); });
+  if (!send_reliably(sd, block)) {
+    res = send_failed(sd);
+    return true;
+  }
+  vec enc = reliable_get_to_eof(sd);
+  if (enc == vec_from_string(RES_ERR_TICKET))
+    return false;
+  int len = -1;
+  if (enc.size() >= sizeof(int))
+    memcpy(&len, enc.data(), sizeof(int));
+  if (len <= 0 || enc.size() != sizeof(int) + AES_IVSIZE + len ||
+      !open_frame(t.aeskey, enc.data() + sizeof(int), enc.size() - sizeof(int),
+                  res))
+    res = enc;
+  return true;
+}
+
+/// Create an exchange_t that sends each command as a one-shot request, on its
+/// own connection to the server, but that only pays for RSA when it doesn't
+/// hold a session ticket.  Every RSA-protected request asks for a ticket, and
+/// later requests present it, until the server stops accepting it.
+///
+/// @param server The IP or hostname of the server
+/// @param port   The port on which the server is listening
+/// @param pubkey The public key of the server
+///
+/// @returns An exchange_t for one-shot requests that reuse tickets
+exchange_t ticket_exchange(const string &server, int port, RSA *pubkey) {
+  auto t = make_shared<ticket_t>();
+  return [=](const string &cmd, const vec &body) {
+    vec res;
+    if (!t->ticket.empty()) {
+      if (resume_request(server, port, *t, cmd, body, res))
+        return res;
+      t->ticket.clear();
+    }
+    int sd = connect_to_server(server, port);
+    if (sd < 0)
+      return vec_from_string(RES_ERR_XMIT);
+    ContextManager sdc([&]() { close(sd); });
+    vec aeskey = send_request(sd, pubkey, cmd, body, RBLOCK_FLAG_TICKET);
+    if (aeskey.empty())
+      return send_failed(sd);
+    // The response is len(@t).@t.enc(aeskey, ...), unless it is an
+    // unencrypted error code
+    vec enc = reliable_get_to_eof(sd);
+    int len = -1;
+    if (enc.size() >= sizeof(int))
+      memcpy(&len, enc.data(), sizeof(int));
+    if ((len != 0 && len != LEN_TICKET) || enc.size() < sizeof(int) + len)
+      return enc;
+    if (len == LEN_TICKET) {
+      t->ticket.assign(enc.begin() + sizeof(int),
+                       enc.begin() + sizeof(int) + len);
+      t->aeskey = aeskey;
+    }
+    return open_response(aeskey,
+                         vec(enc.begin() + sizeof(int) + len, enc.end()));
+  };
+}
+
+/// Perform the REQ_SES handshake on an open socket
+///
+/// @param sd     An open socket
+/// @param pubkey The public key of the server
+///
+/// @returns The session's AES key, or an empty vector if the handshake failed
+static vec start_session(int sd, RSA *pubkey) {
+  vec body;
+  vec_append(body, SESSION_VERSION);
+  vec aeskey = send_request(sd, pubkey, REQ_SES, body);
+  if (aeskey.empty()) {
+    vec res = send_failed(sd);
+    cerr << "Unable to start session: " << string(res.begin(), res.end())
+         << endl;
+    return {};
+  }
+  vec res;
+  int version;
+  if (recv_frame(sd, aeskey, INT32_MAX, res) != 1 ||
+      res.size() != RES_OK.length() + sizeof(int) ||
+      memcmp(res.data(), RES_OK.c_str(), RES_OK.length()) != 0) {
+    cerr << "Unable to start session: " << string(res.begin(), res.end())
+         << endl;
+    return {};
+  }
+  memcpy(&version, res.data() + RES_OK.length(), sizeof(int));
+  if (version < 1 || version > SESSION_VERSION) {
+    cerr << "Unsupported session version " << version << endl;
+    return {};
+  }
+  return aeskey;
+}
+
+/// Perform the REQ_SES handshake on an open socket, and then create an
+/// exchange_t that sends each command as a frame of that session.  The socket
+/// must stay open for as long as the exchange_t is in use.
+///
+/// @param sd     An open socket
+/// @param pubkey The public key of the server
+///
+/// @returns An exchange_t for the session, or an empty exchange_t if the
+///          handshake failed
+exchange_t session_exchange(int sd, RSA *pubkey) {
+  vec aeskey = start_session(sd, pubkey);
+  if (aeskey.empty())
+    return nullptr;
+  return [=](const string &cmd, const vec &body) {
+    vec msg = vec_from_string(cmd);
+    vec_append(msg, body);
+    vec res;
+    if (!send_frame(sd, aeskey, msg) ||
+        recv_frame(sd, aeskey, INT32_MAX, res) != 1)
+      return vec_from_string(RES_ERR_XMIT);
+    return res;
+  };
+}
+
+/// pipe_state_t is the shared state of a pipelined session.  Senders take
+/// turns with send_lock, so that the order of the waiting queue matches the
+/// order of the frames on the wire.  A reader thread receives the responses,
+/// which the server sends in that same order, and hands each to the oldest
+/// waiting sender.
+///
+/// NB: The reader never waits on send_lock.  Otherwise, a sender that is
+///     blocked on a full socket could keep the reader from draining the
+///     responses that the server is blocked on sending.
+struct pipe_state_t {
+  /// The session's socket and AES key
+  int sd;
+  vec aeskey;
+
+  /// A lock to keep frames and the waiting queue in the same order
+  mutex send_lock;
+
+  /// A lock to protect everything below
+  mutex lock;
+
+  /// The senders that are waiting for responses, oldest first
+  deque<promise<vec>> waiting;
+
+  /// Has the session failed?  After that, every command fails at once.
+  bool broken = false;
+
+  /// The thread that receives responses
+  thread reader;
+
+  /// Fail every waiting sender, and every later one
+  void fail() {
+    lock_guard<mutex> g(lock);
+    broken = true;
+    for (auto &p : waiting)
+      p.set_value(vec_from_string(RES_ERR_XMIT));
+    waiting.clear();
+  }
+
+  /// Receive responses until the socket closes or fails
+  void receive() {
+    while (true) {
+      vec res;
+      if (recv_frame(sd, aeskey, INT32_MAX, res) != 1)
+        break;
+      lock_guard<mutex> g(lock);
+      if (waiting.empty())
+        break;
+      waiting.front().set_value(move(res));
+      waiting.pop_front();
+    }
+    fail();
+  }
+
+  /// Stop the reader.  The socket stays open, since the caller owns it.
+  ~pipe_state_t() {
+    shutdown(sd, SHUT_RDWR);
+    if (reader.joinable())
+      reader.join();
+  }
+};
+
+/// Perform the REQ_SES handshake on an open socket, and then create a
+/// pipeline_t that sends each command as a frame of that session, without
+/// waiting for the responses to earlier ones.  The socket must stay open for
+/// as long as the pipeline_t is in use, and is shut down when the last copy of
+/// the pipeline_t is destroyed.
+///
+/// @param sd     An open socket
+/// @param pubkey The public key of the server
+///
+/// @returns A pipeline_t for the session, or an empty pipeline_t if the
+///          handshake failed
+pipeline_t pipelined_session(int sd, RSA *pubkey) {
+  vec aeskey = start_session(sd, pubkey);
+  if (aeskey.empty())
+    return nullptr;
+  auto p = make_shared<pipe_state_t>();
+  p->sd = sd;
+  p->aeskey = aeskey;
+  // NB: the reader uses a raw pointer, since the destructor joins it
+  p->reader = thread([state = p.get()]() { state->receive(); });
+  return [p](const string &cmd, const vec &body) {
+    vec msg = vec_from_string(cmd);
+    vec_append(msg, body);
+    lock_guard<mutex> s(p->send_lock);
+    future<vec> res;
+    {
+      lock_guard<mutex> g(p->lock);
+      if (p->broken) {
+        promise<vec> err;
+        err.set_value(vec_from_string(RES_ERR_XMIT));
+        return err.get_future();
+      }
+      p->waiting.emplace_back();
+      res = p->waiting.back().get_future();
+    }
+    if (!send_frame(p->sd, p->aeskey, msg)) {
+      // NB: the reader fails the waiting senders once it sees the shutdown
+      p->fail();
+      shutdown(p->sd, SHUT_RDWR);
+    }
+    return res;
+  };
+}
+
+/// Build the body that starts every authenticated request: len(@u).@u.len(@p).@p
+///
+/// @param user The name of the user doing the request
+/// @param pass The password of the user doing the request
+///
+/// @returns A vector holding the user and password
+static vec auth_body(const string &user, const string &pass) {
+  vec body;
+  vec_append(body, (int)user.length());
+  vec_append(body, user);
+  vec_append(body, (int)pass.length());
+  vec_append(body, pass);
+  return body;
+}
+
+/// Extract the payload of a response of the form "OK".len(@x).@x
+///
+/// @param res     The unencrypted response
+/// @param payload The vector that receives @x
+///
+/// @returns false if the response is an error or is malformed
+static bool ok_payload(const vec &res, vec &payload) {
+  size_t hdr = RES_OK.length() + sizeof(int);
+  if (res.size() < hdr ||
+      memcmp(res.data(), RES_OK.c_str(), RES_OK.length()) != 0)
+    return false;
+  int len;
+  memcpy(&len, res.data() + RES_OK.length(), sizeof(int));
+  if (len < 0 || res.size() != hdr + len)
+    return false;
+  payload.assign(res.begin() + hdr, res.end());
+  return true;
+}
+
+/// Print a response that carries no payload, such as "OK" or an error code
+///
+/// @param res The unencrypted response
+static void print_result(const vec &res) {
+  cout << string(res.begin(), res.end()) << endl;
+}
+
+/// Send a command with a payload result, and save the payload to a file
+///
+/// @param xchg     The exchange through which to reach the server
+/// @param cmd      The command to send
+/// @param body     The unencrypted body of the request
+/// @param filename The file where the payload should go
+static void save_payload(const exchange_t &xchg, const string &cmd,
+                         const vec &body, const string &filename) {
+  vec res = xchg(cmd, body), payload;
+  if (!ok_payload(res, payload)) {
+    print_result(res);
+    return;
+  }
+  if (write_file(filename, (const char *)payload.data(), payload.size()))
+    cout << RES_OK << endl;
+}
+
 /// client_key() writes a request for the server's key on a socket descriptor.
 /// When it gets it, it writes it to a file.
 ///
 /// @param sd      An open socket
 /// @param keyfile The name of the file to which the key should be written
 void client_key(int sd, const string &keyfile) {
-  cerr << "client_key is not implemented\n";
+  vec kblock = vec_from_string(REQ_KEY);
+  kblock.resize(LEN_RKBLOCK, '\0');
+  if (!send_reliably(sd, kblock)) {
+    cerr << RES_ERR_XMIT << endl;
+    return;
+  }
+  vec key = reliable_get_to_eof(sd, LEN_RSA_PUBKEY);
+  if (key.size() != LEN_RSA_PUBKEY) {
+    cerr << RES_ERR_XMIT << endl;
+    return;
+  }
+  write_file(keyfile, (const char *)key.data(), key.size());
 }
 
 /// client_reg() sends the REG command to register a new user
 ///
-/// @param sd      The socket descriptor for communicating with the server
-/// @param pubkey  The public key of the server
+/// @param xchg    The exchange through which to reach the server
 /// @param user    The name of the user doing the request
 /// @param pass    The password of the user doing the request
-void client_reg(int sd, RSA *pubkey, const string &user, const string &pass,
+void client_reg(const exchange_t &xchg, const string &user, const string &pass,
                 const string &, const string &) {
-  cerr << "client_reg is not implemented\n";
+  print_result(xchg(REQ_REG, auth_body(user, pass)));
 }
 
 /// client_bye() writes a request for the server to exit.
 ///
-/// @param sd An open socket
-/// @param pubkey  The public key of the server
+/// @param xchg    The exchange through which to reach the server
 /// @param user    The name of the user doing the request
 /// @param pass    The password of the user doing the request
-void client_bye(int sd, RSA *pubkey, const string &user, const string &pass,
+void client_bye(const exchange_t &xchg, const string &user, const string &pass,
                 const string &, const string &) {
-  cerr << "client_bye is not implemented\n";
+  print_result(xchg(REQ_BYE, auth_body(user, pass)));
 }
 
 /// client_sav() writes a request for the server to save its contents
 ///
-/// @param sd An open socket
-/// @param pubkey  The public key of the server
+/// @param xchg The exchange through which to reach the server
 /// @param user The name of the user doing the request
 /// @param pass The password of the user doing the request
-void client_sav(int sd, RSA *pubkey, const string &user, const string &pass,
+void client_sav(const exchange_t &xchg, const string &user, const string &pass,
                 const string &, const string &) {
-  cerr << "client_sav is not implemented\n";
+  print_result(xchg(REQ_SAV, auth_body(user, pass)));
+}
+
+/// Choose whether SET and GET send content packed (see CONTENT_FLAG_PACKED),
+/// so that it can cross the network compressed
+///
+/// @param level The zlib level at which to compress content, or 0 to send it
+///              as it is
+void client_compress(int level) { content_zlevel = level; }
+
+/// Send a SET or GET whose content may be packed.  A server that predates
+/// packed content rejects the flag as ERR_MSG_FMT, so then the request is sent
+/// again as it would have been without it.
+///
+/// @param xchg   The exchange through which to reach the server
+/// @param cmd    The command to send
+/// @param plain  The unencrypted body of the request, without packing
+/// @param packed The unencrypted body of the request, with packing
+/// @param used   Receives true if the packed request was accepted
+///
+/// @returns The response
+static vec send_packed(const exchange_t &xchg, const string &cmd,
+                       const vec &plain, const vec &packed, bool &used) {
+  vec res = xchg(cmd, packed);
+  used = res != vec_from_string(RES_ERR_MSG_FMT);
+  return used ? res : xchg(cmd, plain);
 }
 
 /// client_set() sends the SET command to set the content for a user
 ///
-/// @param sd      The socket descriptor for communicating with the server
-/// @param pubkey  The public key of the server
+/// @param xchg    The exchange through which to reach the server
 /// @param user    The name of the user doing the request
 /// @param pass    The password of the user doing the request
 /// @param setfile The file whose contents should be sent
-void client_set(int sd, RSA *pubkey, const string &user, const string &pass,
+void client_set(const exchange_t &xchg, const string &user, const string &pass,
                 const string &setfile, const string &) {
-  cerr << "client_set is not implemented\n";
+  vec content = load_entire_file(setfile);
+  if (content.size() > LEN_CONTENT) {
+    cerr << "File " << setfile << " is too large\n";
+    return;
+  }
+  vec body = auth_body(user, pass);
+  if (content_zlevel > 0) {
+    vec packed = body;
+    vec field = pack_content({content.data(), content.size()}, content_zlevel);
+    vec_append(packed, (int)field.size());
+    vec_append(packed, field);
+    vec_append(packed, CONTENT_FLAG_PACKED);
+    vec_append(body, (int)content.size());
+    vec_append(body, content);
+    bool used;
+    print_result(send_packed(xchg, REQ_SET, body, packed, used));
+    return;
+  }
+  vec_append(body, (int)content.size());
+  vec_append(body, content);
+  print_result(xchg(REQ_SET, body));
 }
 
 /// client_get() requests the content associated with a user, and saves it to a
 /// file called <user>.file.dat.
 ///
-/// @param sd      The socket descriptor for communicating with the server
-/// @param pubkey  The public key of the server
+/// @param xchg    The exchange through which to reach the server
 /// @param user    The name of the user doing the request
 /// @param pass    The password of the user doing the request
 /// @param getname The name of the user whose content should be fetched
-void client_get(int sd, RSA *pubkey, const string &user, const string &pass,
+void client_get(const exchange_t &xchg, const string &user, const string &pass,
                 const string &getname, const string &) {
-  cerr << "client_get is not implemented\n";
+  vec body = auth_body(user, pass);
+  vec_append(body, (int)getname.length());
+  vec_append(body, getname);
+  if (content_zlevel == 0) {
+    save_payload(xchg, REQ_GET, body, getname + ".file.dat");
+    return;
+  }
+  vec packed = body, payload, content;
+  vec_append(packed, CONTENT_FLAG_PACKED);
+  bool used;
+  vec res = send_packed(xchg, REQ_GET, body, packed, used);
+  if (!ok_payload(res, payload)) {
+    print_result(res);
+    return;
+  }
+  if (used && !unpack_content({payload.data(), payload.size()}, content)) {
+    cerr << RES_ERR_XMIT << endl;
+    return;
+  }
+  if (!used)
+    content.swap(payload);
+  if (write_file(getname + ".file.dat", (const char *)content.data(),
+                 content.size()))
+    cout << RES_OK << endl;
+}
+
+/// Extract the fields of one page of an ALL response, of the form
+/// "OK".len(@n).@n.len(@l).@l
+///
+/// @param res    The unencrypted response
+/// @param cursor Receives @n
+/// @param list   Receives @l
+///
+/// @returns false if the response is an error, or is malformed
+static bool ok_page(const vec &res, string &cursor, vec &list) {
+  size_t pos = RES_OK.length();
+  int len;
+  if (res.size() < pos + sizeof(int) ||
+      memcmp(res.data(), RES_OK.c_str(), RES_OK.length()) != 0)
+    return false;
+  memcpy(&len, res.data() + pos, sizeof(int));
+  pos += sizeof(int);
+  if (len != 0 && len != LEN_ALL_CURSOR)
+    return false;
+  if (res.size() < pos + len + sizeof(int))
+    return false;
+  cursor.assign(res.begin() + pos, res.begin() + pos + len);
+  pos += len;
+  memcpy(&len, res.data() + pos, sizeof(int));
+  pos += sizeof(int);
+  if (len < 0 || res.size() != pos + len)
+    return false;
+  list.assign(res.begin() + pos, res.end());
+  return true;
+}
+
+/// client_list() sends the ALL command to get a listing of all users, as text
+/// with one entry per line.  Given a page size, it asks for one page of names
+/// at a time, so that no single response is large.
+///
+/// @param xchg  The exchange through which to reach the server
+/// @param user  The name of the user doing the request
+/// @param pass  The password of the user doing the request
+/// @param page  The number of names per page ("" to get them all at once)
+/// @param names Receives the listing
+/// @param res   Receives the response, if it is an error
+///
+/// @returns false if the server responded with an error
+bool client_list(const exchange_t &xchg, const string &user, const string &pass,
+                 const string &page, vec &names, vec &res) {
+  names.clear();
+  if (page == "") {
+    res = xchg(REQ_ALL, auth_body(user, pass));
+    return ok_payload(res, names);
+  }
+  string cursor;
+  do {
+    vec query, body = auth_body(user, pass), list;
+    vec_append(query, atoi(page.c_str()));
+    vec_append(query, 0);
+    vec_append(query, cursor);
+    vec_append(body, (int)query.size());
+    vec_append(body, query);
+    res = xchg(REQ_ALL, body);
+    if (!ok_page(res, cursor, list))
+      return false;
+    if (!names.empty() && !list.empty())
+      names.push_back('\n');
+    vec_append(names, list);
+  } while (!cursor.empty());
+  return true;
 }
 
 /// client_all() sends the ALL command to get a listing of all users, formatted
-/// as text with one entry per line.
+/// as text with one entry per line, and saves it to a file
 ///
-/// @param sd The socket descriptor for communicating with the server
-/// @param pubkey  The public key of the server
-/// @param user The name of the user doing the request
-/// @param pass The password of the user doing the request
+/// @param xchg    The exchange through which to reach the server
+/// @param user    The name of the user doing the request
+/// @param pass    The password of the user doing the request
 /// @param allfile The file where the result should go
-void client_all(int sd, RSA *pubkey, const string &user, const string &pass,
-                const string &allfile, const string &) {
-  cerr << "client_all is not implemented\n";
+/// @param page    The number of names per page ("" to get them all at once)
+void client_all(const exchange_t &xchg, const string &user, const string &pass,
+                const string &allfile, const string &page) {
+  vec names, res;
+  if (!client_list(xchg, user, pass, page, names, res)) {
+    print_result(res);
+    return;
+  }
+  if (write_file(allfile, (const char *)names.data(), names.size()))
+    cout << RES_OK << endl;
+}
+
+/// client_met() sends the MET command to get a report of the server's metrics,
+/// formatted as text with one metric per line.  Only the admin user may do
+/// this.
+///
+/// @param xchg    The exchange through which to reach the server
+/// @param user    The name of the user doing the request
+/// @param pass    The password of the user doing the request
+/// @param metfile The file where the result should go
+void client_met(const exchange_t &xchg, const string &user, const string &pass,
+                const string &metfile, const string &) {
+  save_payload(xchg, REQ_MET, auth_body(user, pass), metfile);
+}
+
+/// client_sof() sends the SOF command to register a shared object with the
+/// server, under the name of its file (without any directory or ".so").  Only
+/// the admin user may do this.
+///
+/// @param xchg    The exchange through which to reach the server
+/// @param user    The name of the user doing the request
+/// @param pass    The password of the user doing the request
+/// @param sofile  The file holding the shared object
+void client_sof(const exchange_t &xchg, const string &user, const string &pass,
+                const string &sofile, const string &) {
+  vec so = load_entire_file(sofile);
+  if (so.empty() || so.size() > LEN_CONTENT) {
+    cerr << "File " << sofile << " is empty or too large\n";
+    return;
+  }
+  string name = sofile.substr(sofile.find_last_of('/') + 1);
+  if (name.size() > 3 && name.compare(name.size() - 3, 3, ".so") == 0)
+    name.resize(name.size() - 3);
+  vec field;
+  vec_append(field, (int)name.length());
+  vec_append(field, name);
+  vec_append(field, (int)so.size());
+  vec_append(field, so);
+  vec body = auth_body(user, pass);
+  vec_append(body, (int)field.size());
+  vec_append(body, field);
+  print_result(xchg(REQ_SOF, body));
+}
+
+/// client_fun() sends the FUN command to run a shared object over every user,
+/// and saves the result to a file called <name>.fun.dat.  Only the admin user
+/// may do this.
+///
+/// @param xchg    The exchange through which to reach the server
+/// @param user    The name of the user doing the request
+/// @param pass    The password of the user doing the request
+/// @param name    The name of the shared object
+void client_fun(const exchange_t &xchg, const string &user, const string &pass,
+                const string &name, const string &) {
+  vec body = auth_body(user, pass);
+  vec_append(body, (int)name.length());
+  vec_append(body, name);
+  save_payload(xchg, REQ_FUN, body, name + ".fun.dat");
 }
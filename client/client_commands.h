@@ -1,8 +1,75 @@
 #pragma once
 
+#include <functional>
+#include <future>
 #include <openssl/rsa.h>
 #include <string>
 
+#include "../common/vec.h"
+
+/// exchange_t is the way that a command reaches the server.  It takes a
+/// command (e.g., REQ_REG) and the unencrypted body of its request, and returns
+/// the unencrypted response.  On a transmission error, it returns
+/// RES_ERR_XMIT.  This lets every command work the same way, whether it is sent
+/// as a one-shot request or as one frame of a session.
+typedef std::function<vec(const std::string &cmd, const vec &body)> exchange_t;
+
+/// Create an exchange_t that sends each command as a one-shot request, on its
+/// own connection to the server
+///
+/// @param server The IP or hostname of the server
+/// @param port   The port on which the server is listening
+/// @param pubkey The public key of the server
+///
+/// @returns An exchange_t for one-shot requests
+exchange_t oneshot_exchange(const std::string &server, int port, RSA *pubkey);
+
+/// Create an exchange_t that sends each command as a one-shot request, on its
+/// own connection to the server, but that only pays for RSA when it doesn't
+/// hold a session ticket.  Every RSA-protected request asks for a ticket, and
+/// later requests present it, until the server stops accepting it.
+///
+/// @param server The IP or hostname of the server
+/// @param port   The port on which the server is listening
+/// @param pubkey The public key of the server
+///
+/// @returns An exchange_t for one-shot requests that reuse tickets
+exchange_t ticket_exchange(const std::string &server, int port, RSA *pubkey);
+
+/// Perform the REQ_SES handshake on an open socket, and then create an
+/// exchange_t that sends each command as a frame of that session.  The socket
+/// must stay open for as long as the exchange_t is in use.
+///
+/// @param sd     An open socket
+/// @param pubkey The public key of the server
+///
+/// @returns An exchange_t for the session, or an empty exchange_t if the
+///          handshake failed
+exchange_t session_exchange(int sd, RSA *pubkey);
+
+/// pipeline_t is a session whose frames go out without waiting for the
+/// responses to earlier ones.  It takes a command and the unencrypted body of
+/// its request, sends it at once, and returns a future for the unencrypted
+/// response (RES_ERR_XMIT on a transmission error).  It may be called from
+/// many threads at once.  The server runs a session's frames in order, so
+/// commands take effect in the order in which they were sent.
+typedef std::function<std::future<vec>(const std::string &cmd,
+                                       const vec &body)>
+    pipeline_t;
+
+/// Perform the REQ_SES handshake on an open socket, and then create a
+/// pipeline_t that sends each command as a frame of that session, without
+/// waiting for the responses to earlier ones.  The socket must stay open for
+/// as long as the pipeline_t is in use, and is shut down when the last copy of
+/// the pipeline_t is destroyed.
+///
+/// @param sd     An open socket
+/// @param pubkey The public key of the server
+///
+/// @returns A pipeline_t for the session, or an empty pipeline_t if the
+///          handshake failed
+pipeline_t pipelined_session(int sd, RSA *pubkey);
+
 /// client_key() writes a request for the server's key on a socket descriptor.
 /// When it gets it, it writes it to a file.
 ///
@@ -12,65 +79,119 @@ void client_key(int sd, const std::string &keyfile);
 
 /// client_reg() sends the REG command to register a new user
 ///
-/// @param sd      The socket descriptor for communicating with the server
-/// @param pubkey  The public key of the server
+/// @param xchg    The exchange through which to reach the server
 /// @param user    The name of the user doing the request
 /// @param pass    The password of the user doing the request
-void client_reg(int sd, RSA *pubkey, const std::string &user,
+void client_reg(const exchange_t &xchg, const std::string &user,
                 const std::string &pass, const std::string &,
                 const std::string &);
 
 /// client_bye() writes a request for the server to exit.
 ///
-/// @param sd An open socket
-/// @param pubkey  The public key of the server
+/// @param xchg    The exchange through which to reach the server
 /// @param user    The name of the user doing the request
 /// @param pass    The password of the user doing the request
-void client_bye(int sd, RSA *pubkey, const std::string &user,
+void client_bye(const exchange_t &xchg, const std::string &user,
                 const std::string &pass, const std::string &,
                 const std::string &);
 
 /// client_sav() writes a request for the server to save its contents
 ///
-/// @param sd An open socket
-/// @param pubkey  The public key of the server
+/// @param xchg The exchange through which to reach the server
 /// @param user The name of the user doing the request
 /// @param pass The password of the user doing the request
-void client_sav(int sd, RSA *pubkey, const std::string &user,
+void client_sav(const exchange_t &xchg, const std::string &user,
                 const std::string &pass, const std::string &,
                 const std::string &);
 
+/// Choose whether SET and GET send content packed (see CONTENT_FLAG_PACKED),
+/// so that it can cross the network compressed
+///
+/// @param level The zlib level at which to compress content, or 0 to send it
+///              as it is
+void client_compress(int level);
+
 /// client_set() sends the SET command to set the content for a user
 ///
-/// @param sd      The socket descriptor for communicating with the server
-/// @param pubkey  The public key of the server
+/// @param xchg    The exchange through which to reach the server
 /// @param user    The name of the user doing the request
 /// @param pass    The password of the user doing the request
 /// @param setfile The file whose contents should be sent
-void client_set(int sd, RSA *pubkey, const std::string &user,
+void client_set(const exchange_t &xchg, const std::string &user,
                 const std::string &pass, const std::string &setfile,
                 const std::string &);
 
 /// client_get() requests the content associated with a user, and saves it to a
 /// file called <user>.file.dat.
 ///
-/// @param sd      The socket descriptor for communicating with the server
-/// @param pubkey  The public key of the server
+/// @param xchg    The exchange through which to reach the server
 /// @param user    The name of the user doing the request
 /// @param pass    The password of the user doing the request
 /// @param getname The name of the user whose content should be fetched
-void client_get(int sd, RSA *pubkey, const std::string &user,
+void client_get(const exchange_t &xchg, const std::string &user,
                 const std::string &pass, const std::string &getname,
                 const std::string &);
 
+/// client_list() sends the ALL command to get a listing of all users, as text
+/// with one entry per line.  Given a page size, it asks for one page of names
+/// at a time, so that no single response is large.
+///
+/// @param xchg  The exchange through which to reach the server
+/// @param user  The name of the user doing the request
+/// @param pass  The password of the user doing the request
+/// @param page  The number of names per page ("" to get them all at once)
+/// @param names Receives the listing
+/// @param res   Receives the response, if it is an error
+///
+/// @returns false if the server responded with an error
+bool client_list(const exchange_t &xchg, const std::string &user,
+                 const std::string &pass, const std::string &page, vec &names,
+                 vec &res);
+
 /// client_all() sends the ALL command to get a listing of all users, formatted
-/// as text with one entry per line.
+/// as text with one entry per line, and saves it to a file
 ///
-/// @param sd The socket descriptor for communicating with the server
-/// @param pubkey  The public key of the server
-/// @param user The name of the user doing the request
-/// @param pass The password of the user doing the request
+/// @param xchg    The exchange through which to reach the server
+/// @param user    The name of the user doing the request
+/// @param pass    The password of the user doing the request
 /// @param allfile The file where the result should go
-void client_all(int sd, RSA *pubkey, const std::string &user,
+/// @param page    The number of names per page ("" to get them all at once)
+void client_all(const exchange_t &xchg, const std::string &user,
                 const std::string &pass, const std::string &allfile,
                 const std::string &);
+
+/// client_met() sends the MET command to get a report of the server's metrics,
+/// formatted as text with one metric per line.  Only the admin user may do
+/// this.
+///
+/// @param xchg    The exchange through which to reach the server
+/// @param user    The name of the user doing the request
+/// @param pass    The password of the user doing the request
+/// @param metfile The file where the result should go
+void client_met(const exchange_t &xchg, const std::string &user,
+                const std::string &pass, const std::string &metfile,
+                const std::string &);
+
+/// client_sof() sends the SOF command to register a shared object with the
+/// server, under the name of its file (without any directory or ".so").  Only
+/// the admin user may do this.
+///
+/// @param xchg    The exchange through which to reach the server
+/// @param user    The name of the user doing the request
+/// @param pass    The password of the user doing the request
+/// @param sofile  The file holding the shared object
+void client_sof(const exchange_t &xchg, const std::string &user,
+                const std::string &pass, const std::string &sofile,
+                const std::string &);
+
+/// client_fun() sends the FUN command to run a shared object over every user,
+/// and saves the result to a file called <name>.fun.dat.  Only the admin user
+/// may do this.
+///
+/// @param xchg    The exchange through which to reach the server
+/// @param user    The name of the user doing the request
+/// @param pass    The password of the user doing the request
+/// @param name    The name of the shared object
+void client_fun(const exchange_t &xchg, const std::string &user,
+                const std::string &pass, const std::string &name,
+                const std::string &);
@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../common/file.h"
+#include "../common/protocol.h"
+#include "../common/ring.h"
+#include "../common/vec.h"
+
+#include "client_commands.h"
+#include "client_router.h"
+
+using namespace std;
+
+/// Split one server of a ring (host:port) into its host and port
+///
+/// @param node The server
+/// @param host Receives the IP or hostname
+/// @param port Receives the port
+///
+/// @returns false if the server isn't of the form host:port
+bool route_endpoint(const string &node, string &host, int &port) {
+  size_t colon = node.rfind(':');
+  if (colon == string::npos || colon == 0 || colon + 1 == node.length() ||
+      node.find_first_not_of("0123456789", colon + 1) != string::npos)
+    return false;
+  host = node.substr(0, colon);
+  port = atoi(node.c_str() + colon + 1);
+  return port > 0;
+}
+
+/// Run a function once per shard, each on its own thread
+///
+/// @param n    The number of shards
+/// @param func The function, which takes the index of a shard
+static void each_shard(size_t n, const function<void(size_t)> &func) {
+  vector<thread> threads;
+  for (size_t i = 0; i < n; ++i)
+    threads.emplace_back(func, i);
+  for (auto &t : threads)
+    t.join();
+}
+
+/// Create an exchange_t that sends each command to every shard in parallel.
+/// Its response is the first error that any shard reports, or else the first
+/// shard's response.
+///
+/// @param shards The exchanges through which to reach each shard
+///
+/// @returns An exchange_t for all of the shards
+static exchange_t fan_out(const vector<exchange_t> &shards) {
+  return [&shards](const string &cmd, const vec &body) {
+    vector<vec> res(shards.size());
+    each_shard(shards.size(),
+               [&](size_t i) { res[i] = shards[i](cmd, body); });
+    for (auto &r : res)
+      if (r != vec_from_string(RES_OK))
+        return r;
+    return res.front();
+  };
+}
+
+/// Send ALL to every shard in parallel, merge their listings, and save the
+/// result to a file.  Since every shard holds every user's credentials, a
+/// name may come from many shards, but is only listed once.
+///
+/// @param shards  The exchanges through which to reach each shard
+/// @param user    The name of the user doing the request
+/// @param pass    The password of the user doing the request
+/// @param allfile The file where the result should go
+/// @param page    The number of names per page ("" to get them all at once)
+static void route_all(const vector<exchange_t> &shards, const string &user,
+                      const string &pass, const string &allfile,
+                      const string &page) {
+  vector<vec> names(shards.size()), res(shards.size());
+  vector<char> ok(shards.size());
+  each_shard(shards.size(), [&](size_t i) {
+    ok[i] = client_list(shards[i], user, pass, page, names[i], res[i]);
+  });
+  set<string> merged;
+  for (size_t i = 0; i < shards.size(); ++i) {
+    if (!ok[i]) {
+      cout << string(res[i].begin(), res[i].end()) << endl;
+      return;
+    }
+    size_t start = 0;
+    while (start < names[i].size()) {
+      auto begin = names[i].begin() + start;
+      auto end = find(begin, names[i].end(), '\n');
+      if (end != begin)
+        merged.emplace(begin, end);
+      start = end - names[i].begin() + 1;
+    }
+  }
+  vec all;
+  for (auto &name : merged) {
+    if (!all.empty())
+      all.push_back('\n');
+    vec_append(all, name);
+  }
+  if (write_file(allfile, (const char *)all.data(), all.size()))
+    cout << RES_OK << endl;
+}
+
+/// Run one command on the shards of a sharded deployment
+///
+/// @param ring    The ring that assigns users to shards
+/// @param shards  The exchanges through which to reach each shard, in ring
+///                order
+/// @param user    The name of the user doing the request
+/// @param pass    The password of the user doing the request
+/// @param command The command to run
+/// @param arg1    The first argument to the command
+/// @param arg2    The second argument to the command
+///
+/// @returns false if the command is not valid
+bool route_command(const HashRing &ring, const vector<exchange_t> &shards,
+                   const string &user, const string &pass,
+                   const string &command, const string &arg1,
+                   const string &arg2) {
+  if (command == REQ_SET)
+    client_set(shards[ring.owner(user)], user, pass, arg1, arg2);
+  else if (command == REQ_GET)
+    client_get(shards[ring.owner(arg1)], user, pass, arg1, arg2);
+  else if (command == REQ_ALL)
+    route_all(shards, user, pass, arg1, arg2);
+  else if (command == REQ_REG)
+    client_reg(fan_out(shards), user, pass, arg1, arg2);
+  else if (command == REQ_BYE)
+    client_bye(fan_out(shards), user, pass, arg1, arg2);
+  else if (command == REQ_SAV)
+    client_sav(fan_out(shards), user, pass, arg1, arg2);
+  else if (command == REQ_SOF)
+    client_sof(fan_out(shards), user, pass, arg1, arg2);
+  else if (command == REQ_MET)
+    for (size_t i = 0; i < shards.size(); ++i)
+      client_met(shards[i], user, pass, arg1 + "." + to_string(i), arg2);
+  else if (command == REQ_FUN)
+    for (size_t i = 0; i < shards.size(); ++i) {
+      // NB: a stale result mustn't pass for this shard's
+      string file = arg1 + ".fun.dat";
+      remove(file.c_str());
+      client_fun(shards[i], user, pass, arg1, arg2);
+      if (file_exists(file))
+        rename(file.c_str(), (file + "." + to_string(i)).c_str());
+    }
+  else
+    return false;
+  return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "../common/ring.h"
+
+#include "client_commands.h"
+
+/// In a sharded deployment, each server holds the content of the users that
+/// a HashRing assigns to it, and every server holds every user's credentials,
+/// so that any of them can check who is asking.  The client routes each
+/// command to the shards that should run it:
+///
+/// - SET goes to the shard that owns the requesting user, and GET goes to the
+///   shard that owns the user being fetched.
+/// - REG, BYE, SAV, and SOF go to every shard, in parallel.  The result is
+///   the first error that any shard reports, or OK.
+/// - ALL asks every shard in parallel, and merges their listings.
+/// - MET and FUN run on each shard in turn, and save each shard's result to
+///   its own file, with the shard's index appended to the file's name.
+///
+/// Note that REG is not atomic across shards: if some shards refuse it, the
+/// others have still registered the user.
+
+/// Split one server of a ring (host:port) into its host and port
+///
+/// @param node The server
+/// @param host Receives the IP or hostname
+/// @param port Receives the port
+///
+/// @returns false if the server isn't of the form host:port
+bool route_endpoint(const std::string &node, std::string &host, int &port);
+
+/// Run one command on the shards of a sharded deployment
+///
+/// @param ring    The ring that assigns users to shards
+/// @param shards  The exchanges through which to reach each shard, in ring
+///                order
+/// @param user    The name of the user doing the request
+/// @param pass    The password of the user doing the request
+/// @param command The command to run
+/// @param arg1    The first argument to the command
+/// @param arg2    The second argument to the command
+///
+/// @returns false if the command is not valid
+bool route_command(const HashRing &ring, const std::vector<exchange_t> &shards,
+                   const std::string &user, const std::string &pass,
+                   const std::string &command, const std::string &arg1,
+                   const std::string &arg2);
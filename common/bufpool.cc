@@ -0,0 +1,185 @@
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "bufpool.h"
+
+using namespace std;
+
+/// The number of size classes, from BUF_POOL_MIN to BUF_POOL_MAX
+static const int NCLASSES = 14;
+static_assert((BUF_POOL_MIN << (NCLASSES - 1)) == BUF_POOL_MAX,
+              "NCLASSES must cover BUF_POOL_MIN to BUF_POOL_MAX");
+
+/// The most bytes that one thread keeps for itself
+static const size_t THREAD_CACHE_MAX = 4 * 1048576;
+
+/// The most bytes that the shared backstop keeps
+static const size_t SHARED_CACHE_MAX = 64 * 1048576;
+
+/// The counters that buf_pool_stats() reports
+static atomic<uint64_t> pool_hits(0), pool_misses(0), shared_bytes(0);
+
+/// One size class of the shared backstop
+struct shared_class_t {
+  /// A lock protecting bufs
+  mutex lock;
+
+  /// The buffers of this class that no thread is using
+  vector<vec> bufs;
+};
+
+/// The shared backstop, one entry per size class
+static shared_class_t shared[NCLASSES];
+
+/// Give a buffer to the shared backstop, or free it if the backstop is full
+///
+/// @param c The buffer's size class
+/// @param v The buffer
+static void shared_give(int c, vec &v) {
+  size_t cap = v.capacity();
+  if (shared_bytes.fetch_add(cap) + cap > SHARED_CACHE_MAX) {
+    shared_bytes.fetch_sub(cap);
+    vec().swap(v);
+    return;
+  }
+  lock_guard<mutex> g(shared[c].lock);
+  shared[c].bufs.push_back(move(v));
+}
+
+/// thread_cache_t is the buffers that one thread keeps for itself.  When the
+/// thread exits, they go to the shared backstop.
+struct thread_cache_t {
+  /// The buffers of each class
+  vector<vec> bufs[NCLASSES];
+
+  /// The bytes held in bufs
+  size_t bytes = 0;
+
+  /// Hand every buffer to the shared backstop
+  ~thread_cache_t() {
+    for (int c = 0; c < NCLASSES; ++c)
+      for (auto &v : bufs[c])
+        shared_give(c, v);
+  }
+};
+
+/// The calling thread's cache
+static thread_local thread_cache_t cache;
+
+/// Find the smallest class whose buffers can hold n bytes
+///
+/// @param n The number of bytes
+///
+/// @returns The class, or NCLASSES if n is larger than BUF_POOL_MAX
+static int class_for_take(size_t n) {
+  int c = 0;
+  while (c < NCLASSES && (BUF_POOL_MIN << c) < n)
+    ++c;
+  return c;
+}
+
+/// Find the class of a buffer that is being given back.  Only buffers that are
+/// exactly the size of a class are pooled: those are the ones that the pool
+/// made, and any other buffer (one that grew, or that came from elsewhere)
+/// would sit in a class that is too small for it, wasting memory.
+///
+/// @param cap The capacity of the buffer
+///
+/// @returns The class, or -1 if the buffer should not be pooled
+static int class_for_give(size_t cap) {
+  for (int c = 0; c < NCLASSES; ++c)
+    if ((BUF_POOL_MIN << c) == cap)
+      return c;
+  return -1;
+}
+
+/// Take a buffer from the pool
+///
+/// @param n The number of bytes that the buffer must be able to hold
+///
+/// @returns An empty vec whose capacity is at least n
+vec pool_take(size_t n) {
+  vec v;
+  int c = class_for_take(n);
+  if (c == NCLASSES) {
+    ++pool_misses;
+    v.reserve(n);
+    return v;
+  }
+  // First the thread's own buffers, then the shared ones
+  if (!cache.bufs[c].empty()) {
+    v = move(cache.bufs[c].back());
+    cache.bufs[c].pop_back();
+    cache.bytes -= v.capacity();
+  } else {
+    lock_guard<mutex> g(shared[c].lock);
+    if (!shared[c].bufs.empty()) {
+      v = move(shared[c].bufs.back());
+      shared[c].bufs.pop_back();
+      shared_bytes.fetch_sub(v.capacity());
+    }
+  }
+  if (v.capacity() != 0) {
+    ++pool_hits;
+    return v;
+  }
+  ++pool_misses;
+  v.reserve(BUF_POOL_MIN << c);
+  return v;
+}
+
+/// Give a buffer back to the pool, so that its memory can be reused.  Buffers
+/// that the pool did not make (or that have grown since) are freed.
+///
+/// @param v The buffer.  It is left empty, with no capacity.
+void pool_give(vec &v) {
+  int c = class_for_give(v.capacity());
+  if (c < 0) {
+    vec().swap(v);
+    return;
+  }
+  v.clear();
+  if (cache.bytes + v.capacity() <= THREAD_CACHE_MAX) {
+    cache.bytes += v.capacity();
+    cache.bufs[c].push_back(move(v));
+  } else {
+    shared_give(c, v);
+  }
+  vec().swap(v);
+}
+
+/// Report the buffer pool's counters
+///
+/// @returns The pool's counters
+buf_pool_stats_t buf_pool_stats() {
+  return {pool_hits.load(), pool_misses.load(), shared_bytes.load()};
+}
+
+/// Get the next buffer for the current request
+///
+/// @param n The number of bytes that the buffer must be able to hold
+///
+/// @returns An empty vec whose capacity is at least n, which is valid until
+///          the next reset()
+vec &buf_arena::get(size_t n) {
+  if (used == bufs.size())
+    bufs.push_back(pool_take(n));
+  vec &v = bufs[used++];
+  v.clear();
+  if (v.capacity() < n) {
+    pool_give(v);
+    v = pool_take(n);
+  }
+  return v;
+}
+
+/// Make every buffer available again, once a request is done with them
+void buf_arena::reset() { used = 0; }
+
+/// Give every buffer back to the pool
+buf_arena::~buf_arena() {
+  for (auto &v : bufs)
+    pool_give(v);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+
+#include "vec.h"
+
+/// The buffer pool recycles the memory of large vecs, so that a long-running
+/// server doesn't ask the allocator for (and hand back) a fresh megabyte for
+/// every request.  Buffers are kept in size classes, one per power of two from
+/// BUF_POOL_MIN to BUF_POOL_MAX, and every buffer that the pool allocates is
+/// exactly the size of its class, so the heap sees only a few distinct sizes
+/// and fragments less.
+///
+/// Each thread keeps a few buffers of each class for itself, so that most
+/// takes and gives touch no shared state.  Beyond that, buffers go to a shared
+/// backstop (one lock per class), which lets a buffer that one thread gives
+/// back be taken by another, e.g., when a user's content is replaced.
+
+/// The smallest buffer that is worth pooling
+const size_t BUF_POOL_MIN = 256;
+
+/// The largest buffer that is pooled; larger ones are simply freed
+const size_t BUF_POOL_MAX = 2 * 1048576;
+
+/// buf_pool_stats_t reports how well the buffer pool is working
+struct buf_pool_stats_t {
+  /// The number of times pool_take() reused a buffer
+  uint64_t hits;
+
+  /// The number of times pool_take() had to allocate a buffer
+  uint64_t misses;
+
+  /// The number of bytes held in the shared backstop
+  uint64_t cached_bytes;
+};
+
+/// Take a buffer from the pool
+///
+/// @param n The number of bytes that the buffer must be able to hold
+///
+/// @returns An empty vec whose capacity is at least n
+vec pool_take(size_t n);
+
+/// Give a buffer back to the pool, so that its memory can be reused.  Buffers
+/// that the pool did not make (or that have grown since) are freed.
+///
+/// @param v The buffer.  It is left empty, with no capacity.
+void pool_give(vec &v);
+
+/// Report the buffer pool's counters
+///
+/// @returns The pool's counters
+buf_pool_stats_t buf_pool_stats();
+
+/// buf_arena holds the buffers that one connection uses for its requests.  The
+/// first request takes buffers from the pool, and reset() makes them available
+/// to the next request without freeing them, so a session of many requests
+/// allocates only once.  The buffers go back to the pool with the arena.
+class buf_arena {
+  /// The buffers.  NB: a deque, so that references to buffers stay valid as
+  ///     more are added.
+  std::deque<vec> bufs;
+
+  /// The number of buffers that the current request is using
+  size_t used = 0;
+
+public:
+  /// Get the next buffer for the current request
+  ///
+  /// @param n The number of bytes that the buffer must be able to hold
+  ///
+  /// @returns An empty vec whose capacity is at least n, which is valid until
+  ///          the next reset()
+  vec &get(size_t n);
+
+  /// Make every buffer available again, once a request is done with them
+  void reset();
+
+  /// Give every buffer back to the pool
+  ~buf_arena();
+};
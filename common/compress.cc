@@ -0,0 +1,102 @@
+#include <cstring>
+#include <zlib.h>
+
+#include "compress.h"
+#include "protocol.h"
+
+using namespace std;
+
+/// Compress bytes with zlib
+///
+/// @param raw   The bytes to compress
+/// @param level The zlib compression level, from 1 (fastest) to 9 (smallest)
+/// @param out   Receives the compressed bytes
+///
+/// @returns false if the bytes are shorter than COMPRESS_MIN, or did not shrink
+///          by at least an eighth, in which case they are best kept as they
+///          are
+bool zlib_deflate(bytes_t raw, int level, vec &out) {
+  if (raw.size < COMPRESS_MIN)
+    return false;
+  // NB: compress2() fails if the output doesn't fit, so out never needs to be
+  //     bigger than the most that is worth keeping
+  uLongf len = raw.size - raw.size / 8;
+  out.resize(len);
+  if (compress2(out.data(), &len, raw.data, raw.size, level) != Z_OK)
+    return false;
+  out.resize(len);
+  return true;
+}
+
+/// Decompress bytes that zlib_deflate() produced
+///
+/// @param packed The compressed bytes
+/// @param size   The length of the bytes once they are decompressed
+/// @param out    Receives the decompressed bytes
+///
+/// @returns false if the bytes are not valid, or don't decompress to exactly
+///          size bytes
+bool zlib_inflate(bytes_t packed, size_t size, vec &out) {
+  // NB: uncompress() fails if the output would not fit, so a bad size can't
+  //     make this write more than size bytes
+  uLongf len = size;
+  out.resize(size);
+  return uncompress(out.data(), &len, packed.data, packed.size) == Z_OK &&
+         len == size;
+}
+
+/// Produce a packed content field (see CONTENT_FLAG_PACKED in protocol.h),
+/// compressing the content if that makes it smaller
+///
+/// @param raw   The content
+/// @param level The zlib compression level, from 1 to 9
+///
+/// @returns The packed field, len(content).@d
+vec pack_content(bytes_t raw, int level) {
+  vec field, packed;
+  vec_append(field, (int)raw.size);
+  if (zlib_deflate(raw, level, packed))
+    vec_append(field, packed);
+  else
+    field.insert(field.end(), raw.data, raw.data + raw.size);
+  return field;
+}
+
+/// Split a packed content field into its parts, without decompressing it
+///
+/// @param field The packed field
+/// @param size  Receives the length of the content
+/// @param data  Receives a view of @d, which is compressed if it is not size
+///              bytes long
+///
+/// @returns false if the field is too short, or its length is more than
+///          LEN_CONTENT
+bool split_packed(bytes_t field, size_t &size, bytes_t &data) {
+  int len;
+  if (field.size < sizeof(int))
+    return false;
+  memcpy(&len, field.data, sizeof(int));
+  if (len < 0 || len > LEN_CONTENT)
+    return false;
+  size = len;
+  data = bytes_t{field.data + sizeof(int), field.size - sizeof(int)};
+  return true;
+}
+
+/// Extract the content from a packed content field
+///
+/// @param field The packed field
+/// @param out   Receives the content
+///
+/// @returns false if the field is malformed
+bool unpack_content(bytes_t field, vec &out) {
+  size_t size;
+  bytes_t data;
+  if (!split_packed(field, size, data))
+    return false;
+  if (data.size == size) {
+    out.assign(data.data, data.data + data.size);
+    return true;
+  }
+  return zlib_inflate(data, size, out);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "vec.h"
+
+/// Content that is shorter than this is never compressed, since zlib's header
+/// and checksum would eat most of the savings
+const size_t COMPRESS_MIN = 256;
+
+/// The zlib level to use when compressing content for the wire, where speed
+/// matters more than size
+const int COMPRESS_FAST = 1;
+
+/// Compress bytes with zlib
+///
+/// @param raw   The bytes to compress
+/// @param level The zlib compression level, from 1 (fastest) to 9 (smallest)
+/// @param out   Receives the compressed bytes
+///
+/// @returns false if the bytes are shorter than COMPRESS_MIN, or did not
+///          shrink by at least an eighth, in which case they are best kept as
+///          they are
+bool zlib_deflate(bytes_t raw, int level, vec &out);
+
+/// Decompress bytes that zlib_deflate() produced
+///
+/// @param packed The compressed bytes
+/// @param size   The length of the bytes once they are decompressed
+/// @param out    Receives the decompressed bytes
+///
+/// @returns false if the bytes are not valid, or don't decompress to exactly
+///          size bytes
+bool zlib_inflate(bytes_t packed, size_t size, vec &out);
+
+/// Produce a packed content field (see CONTENT_FLAG_PACKED in protocol.h),
+/// compressing the content if that makes it smaller
+///
+/// @param raw   The content
+/// @param level The zlib compression level, from 1 to 9
+///
+/// @returns The packed field, len(content).@d
+vec pack_content(bytes_t raw, int level);
+
+/// Split a packed content field into its parts, without decompressing it
+///
+/// @param field The packed field
+/// @param size  Receives the length of the content
+/// @param data  Receives a view of @d, which is compressed if it is not size
+///              bytes long
+///
+/// @returns false if the field is too short, or its length is more than
+///          LEN_CONTENT
+bool split_packed(bytes_t field, size_t &size, bytes_t &data);
+
+/// Extract the content from a packed content field
+///
+/// @param field The packed field
+/// @param out   Receives the content
+///
+/// @returns false if the field is malformed
+bool unpack_content(bytes_t field, vec &out);
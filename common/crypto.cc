@@ -1,16 +1,31 @@
+#include <atomic>
+#include <cerrno>
+#include <chrono>
 #include <iostream>
 #include <openssl/err.h>
 #include <openssl/pem.h>
 #include <openssl/rand.h>
 #include <string>
 #include <sys/stat.h>
+#include <vector>
 
 #include "contextmanager.h"
 #include "crypto.h"
+#include "err.h"
+#include "log.h"
 #include "vec.h"
 
 using namespace std;
 
+/// Print an error message that combines some application-specific text with
+/// OpenSSL's description of the most recent error on this thread
+///
+/// @param prefix The text to display before the error message
+static void ssl_error(const char *prefix) {
+  log_msg(LOG_ERROR,
+          string(prefix) + " " + ERR_error_string(ERR_get_error(), nullptr));
+}
+
 /// Load an RSA public key from the given filename
 ///
 /// @param filename The name of the file that has the public key in it
@@ -20,13 +35,13 @@ using namespace std;
 RSA *load_pub(const char *filename) {
   FILE *pub = fopen(filename, "r");
   if (pub == nullptr) {
-    cerr << "Error opening public key file\n";
+    sys_error(errno, "Error opening public key file:");
     return nullptr;
   }
   RSA *rsa = PEM_read_RSAPublicKey(pub, nullptr, nullptr, nullptr);
   if (rsa == nullptr) {
     fclose(pub);
-    cerr << "Error reading public key file\n";
+    log_msg(LOG_ERROR, "Error reading public key file");
     return nullptr;
   }
   return rsa;
@@ -41,13 +56,13 @@ RSA *load_pub(const char *filename) {
 RSA *load_pri(const char *filename) {
   FILE *pri = fopen(filename, "r");
   if (pri == nullptr) {
-    cerr << "Error opening private key file\n";
+    sys_error(errno, "Error opening private key file:");
     return nullptr;
   }
   RSA *rsa = PEM_read_RSAPrivateKey(pri, nullptr, nullptr, nullptr);
   if (rsa == nullptr) {
     fclose(pri);
-    cerr << "Error reading public key file\n";
+    log_msg(LOG_ERROR, "Error reading public key file");
     return nullptr;
   }
   return rsa;
@@ -66,40 +81,40 @@ bool generate_rsa_key_files(const string &pub, const string &pri) {
   // needs to be a bignum.  We'll use the RSA_F4 default value:
   BIGNUM *bn = BN_new();
   if (bn == nullptr) {
-    cerr << "Error in BN_new()\n";
+    log_msg(LOG_ERROR, "Error in BN_new()");
     return false;
   }
   ContextManager bnfree([&]() { BN_free(bn); }); // ensure bn gets freed
 
   if (BN_set_word(bn, RSA_F4) != 1) {
-    cerr << "Error in BN_set_word()\n";
+    log_msg(LOG_ERROR, "Error in BN_set_word()");
     return false;
   }
 
   // Now we can create the key pair
   RSA *rsa = RSA_new();
   if (rsa == nullptr) {
-    cerr << "Error in RSA_new()\n";
+    log_msg(LOG_ERROR, "Error in RSA_new()");
     return false;
   }
   ContextManager rsafree([&]() { RSA_free(rsa); }); // ensure rsa gets freed
 
   if (RSA_generate_key_ex(rsa, RSA_KEYSIZE, bn, nullptr) != 1) {
-    cerr << "Error in RSA_genreate_key_ex()\n";
+    log_msg(LOG_ERROR, "Error in RSA_genreate_key_ex()");
     return false;
   }
 
   // Create/truncate the files
   FILE *pubfile = fopen(pub.c_str(), "w");
   if (pubfile == nullptr) {
-    cerr << "Error opening public key file for output\n";
+    sys_error(errno, "Error opening public key file for output:");
     return false;
   }
   ContextManager pubclose([&]() { fclose(pubfile); }); // ensure pub gets closed
 
   FILE *prifile = fopen(pri.c_str(), "w");
   if (prifile == nullptr) {
-    cerr << "Error opening private key file for output\n";
+    sys_error(errno, "Error opening private key file for output:");
     return false;
   }
   ContextManager priclose([&]() { fclose(prifile); }); // ensure pub gets closed
@@ -107,29 +122,102 @@ bool generate_rsa_key_files(const string &pub, const string &pri) {
   // Perform the writes.  Defer cleanup on error, because the cleanup is the
   // same
   if (PEM_write_RSAPublicKey(pubfile, rsa) != 1) {
-    cerr << "Error writing public key\n";
+    log_msg(LOG_ERROR, "Error writing public key");
     return false;
   } else if (PEM_write_RSAPrivateKey(prifile, rsa, nullptr, nullptr, 0, nullptr,
                                      nullptr) != 1) {
-    cerr << "Error writing private key\n";
+    log_msg(LOG_ERROR, "Error writing private key");
     return false;
   }
 
   return true;
 }
 
+/// The time that this thread has spent running AES, in nanoseconds
+static thread_local uint64_t aes_ns = 0;
+
+/// aes_clock_t adds the time between its construction and destruction to
+/// aes_ns
+struct aes_clock_t {
+  /// When the clock started
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  /// Stop the clock, and charge the elapsed time to this thread
+  ~aes_clock_t() {
+    aes_ns += chrono::duration_cast<chrono::nanoseconds>(
+                  chrono::steady_clock::now() - start)
+                  .count();
+  }
+};
+
+/// Run one chunk of a message through AES, as part of a streaming encryption
+/// or decryption.  The chunks of a message must be passed in order, and then
+/// aes_crypt_final() must be called.
+///
+/// @param ctx The pre-configured AES context to use for this operation
+/// @param in  A pointer to the bytes of the chunk
+/// @param len The number of bytes in the chunk
+/// @param out The buffer that receives the result.  It must have room for
+///            len + EVP_MAX_BLOCK_LENGTH bytes.
+///
+/// @returns The number of bytes written to out, or -1 on error
+int aes_crypt_update(EVP_CIPHER_CTX *ctx, const unsigned char *in, int len,
+                     unsigned char *out) {
+  aes_clock_t clock;
+  int out_len = 0;
+  if (!EVP_CipherUpdate(ctx, out, &out_len, in, len)) {
+    ssl_error("Error in EVP_CipherUpdate:");
+    return -1;
+  }
+  return out_len;
+}
+
+/// Finish a streaming encryption or decryption, by processing the final
+/// (padded) block.  After calling, the CTX cannot be used until it is reset.
+///
+/// @param ctx The AES context that was passed to aes_crypt_update()
+/// @param out The buffer that receives the result.  It must have room for
+///            EVP_MAX_BLOCK_LENGTH bytes.
+///
+/// @returns The number of bytes written to out, or -1 on error
+int aes_crypt_final(EVP_CIPHER_CTX *ctx, unsigned char *out) {
+  aes_clock_t clock;
+  int out_len = 0;
+  if (!EVP_CipherFinal_ex(ctx, out, &out_len)) {
+    ssl_error("Error in EVP_CipherFinal_ex:");
+    return -1;
+  }
+  return out_len;
+}
+
 /// Run the AES symmetric encryption/decryption algorithm on a buffer of bytes.
 /// Note that this will do either encryption or decryption, depending on how the
 /// provided CTX has been configured.  After calling, the CTX cannot be used
 /// until it is reset.
 ///
-/// @param ctx The pre-configured AES context to use for this operatoin
-/// @param msg A buffer of bytes to encrypt/decrypt
+/// @param ctx   The pre-configured AES context to use for this operatoin
+/// @param start A pointer to the bytes to encrypt/decrypt
+/// @param count The number of bytes to encrypt/decrypt
 ///
 /// @returns A vector with the encrypted or decrypted result, or an empty vector
 vec aes_crypt_msg(EVP_CIPHER_CTX *ctx, const unsigned char *start, int count) {
-  cerr << "aes_crypt_msg is not implemented\n";
-  return vec();
+  // The output can be up to one cipher block longer than the input, due to
+  // padding.  We feed the input to OpenSSL in AES_BLOCKSIZE chunks.
+  vec res(count + EVP_MAX_BLOCK_LENGTH);
+  int total = 0;
+  for (int pos = 0; pos < count; pos += AES_BLOCKSIZE) {
+    int chunk = (count - pos < AES_BLOCKSIZE) ? (count - pos) : AES_BLOCKSIZE;
+    int out_len = aes_crypt_update(ctx, start + pos, chunk, res.data() + total);
+    if (out_len < 0)
+      return {};
+    total += out_len;
+  }
+  // Now process the final block
+  int out_len = aes_crypt_final(ctx, res.data() + total);
+  if (out_len < 0)
+    return {};
+  res.resize(total + out_len);
+  return res;
 }
 
 /// Run the AES symmetric encryption/decryption algorithm on a vector of bytes.
@@ -168,53 +256,97 @@ vec create_aes_key() {
   vec key(AES_KEYSIZE + AES_IVSIZE);
   if (!RAND_bytes(key.data(), AES_KEYSIZE) ||
       !RAND_bytes(key.data() + AES_KEYSIZE, AES_IVSIZE)) {
-    cerr << "Error in RAND_bytes()\n";
+    log_msg(LOG_ERROR, "Error in RAND_bytes()");
     return {};
   }
   return key;
 }
 
-/// Create an aes context for doing a single encryption or decryption.  The
-/// context must be reset after each full encrypt/decrypt.
+/// The most idle contexts that each thread keeps in its pool.  A request
+/// rarely holds more than two at once, so this is plenty.
+const size_t AES_POOL_MAX = 16;
+
+/// Pool-wide counters, shared by every thread
+static atomic<uint64_t> pool_hits(0), pool_misses(0), pool_live(0);
+
+/// ctx_pool_t is one thread's stash of idle AES contexts.  Each one already
+/// has its cipher set, so checking it out only needs a key/iv reset.  When the
+/// thread exits, its idle contexts are freed.
+struct ctx_pool_t {
+  /// The idle contexts
+  std::vector<EVP_CIPHER_CTX *> idle;
+
+  /// Free every idle context
+  ~ctx_pool_t() {
+    for (auto ctx : idle)
+      EVP_CIPHER_CTX_free(ctx);
+    pool_live -= idle.size();
+  }
+};
+
+/// The calling thread's pool of idle contexts
+static thread_local ctx_pool_t ctx_pool;
+
+/// Allocate a new AES context, and set its cipher
 ///
-/// @param key     A vector holding the bits of the key and iv
 /// @param encrypt True to encrypt, false to decrypt
 ///
-/// @returns An AES context for doing encryption.  Note that the context can be
-///          reset in order to re-use this object for another encryption.
-EVP_CIPHER_CTX *create_aes_context(const vec &key, bool encrypt) {
+/// @returns A context that has a cipher but no key, or nullptr on error
+static EVP_CIPHER_CTX *new_aes_context(bool encrypt) {
   // create and initialize a context for the AES operations we are going to do
   EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
   if (ctx == nullptr) {
-    cerr << "Error: OpenSSL couldn't create context: "
-         << ERR_error_string(ERR_get_error(), nullptr) << endl;
+    ssl_error("Error: OpenSSL couldn't create context:");
     return nullptr;
   }
-  ContextManager c([&]() { EVP_CIPHER_CTX_cleanup(ctx); }); // reclaim on exit
+  ContextManager c([&]() { EVP_CIPHER_CTX_free(ctx); }); // reclaim on error
 
   // Make sure the key and iv lengths we have up above are valid
   if (!EVP_CipherInit_ex(ctx, EVP_aes_256_cbc(), nullptr, nullptr, nullptr,
                          encrypt)) {
-    cerr << "Error: OpenSSL couldn't initialize context: "
-         << ERR_error_string(ERR_get_error(), nullptr) << endl;
+    ssl_error("Error: OpenSSL couldn't initialize context:");
     return nullptr;
   }
   if ((EVP_CIPHER_CTX_key_length(ctx) != AES_KEYSIZE) ||
       (EVP_CIPHER_CTX_iv_length(ctx) != AES_IVSIZE)) {
-    cerr << "Error: OpenSSL couldn't initialize context: "
-         << ERR_error_string(ERR_get_error(), nullptr) << endl;
+    ssl_error("Error: OpenSSL couldn't initialize context:");
     return nullptr;
   }
+  c.cancel(); // don't reclaim ctx on exit, because we're good
+  ++pool_live;
+  return ctx;
+}
+
+/// Create an aes context for doing a single encryption or decryption.  The
+/// context must be reset after each full encrypt/decrypt.  Contexts come from
+/// a per-thread pool, so this usually just sets the key and iv on a context
+/// that an earlier request gave back through reclaim_aes_context().
+///
+/// @param key     A vector holding the bits of the key and iv
+/// @param encrypt True to encrypt, false to decrypt
+///
+/// @returns An AES context for doing encryption.  Note that the context can be
+///          reset in order to re-use this object for another encryption.
+EVP_CIPHER_CTX *create_aes_context(const vec &key, bool encrypt) {
+  EVP_CIPHER_CTX *ctx;
+  if (!ctx_pool.idle.empty()) {
+    ctx = ctx_pool.idle.back();
+    ctx_pool.idle.pop_back();
+    ++pool_hits;
+  } else {
+    ctx = new_aes_context(encrypt);
+    if (ctx == nullptr)
+      return nullptr;
+    ++pool_misses;
+  }
 
   // Set the key and iv on the AES context, and set the mode to encrypt or
-  // decrypt
-  if (!EVP_CipherInit_ex(ctx, nullptr, nullptr, key.data(),
-                         key.data() + AES_KEYSIZE, encrypt)) {
-    cerr << "Error: OpenSSL couldn't re-init context: "
-         << ERR_error_string(ERR_get_error(), nullptr) << endl;
+  // decrypt.  On failure, the context has been cleaned up, so free it.
+  if (!reset_aes_context(ctx, key, encrypt)) {
+    EVP_CIPHER_CTX_free(ctx);
+    --pool_live;
     return nullptr;
   }
-  c.cancel(); // don't reclaim ctx on exit, because we're good
   return ctx;
 }
 
@@ -228,21 +360,47 @@ EVP_CIPHER_CTX *create_aes_context(const vec &key, bool encrypt) {
 ///                decryption context
 ///
 /// @returns false on error, true if the context is reset and ready to use again
-bool reset_aes_context(EVP_CIPHER_CTX *ctx, vec &key, bool encrypt) {
+bool reset_aes_context(EVP_CIPHER_CTX *ctx, const vec &key, bool encrypt) {
   if (!EVP_CipherInit_ex(ctx, nullptr, nullptr, key.data(),
                          key.data() + AES_KEYSIZE, encrypt)) {
-    cerr << "Error: OpenSSL couldn't re-init context: "
-         << ERR_error_string(ERR_get_error(), nullptr) << endl;
+    ssl_error("Error: OpenSSL couldn't re-init context:");
     EVP_CIPHER_CTX_cleanup(ctx);
     return false;
   }
   return true;
 }
 
-/// When an AES context is done being used, call this to reclaim its memory
+/// When an AES context is done being used, call this to return it to the
+/// calling thread's pool.  If the pool is full, or the context lost its cipher
+/// in a failed reset, then its memory is freed instead.
 ///
 /// @param ctx The context to reclaim
-void reclaim_aes_context(EVP_CIPHER_CTX *ctx) { EVP_CIPHER_CTX_cleanup(ctx); }
+void reclaim_aes_context(EVP_CIPHER_CTX *ctx) {
+  if (ctx == nullptr)
+    return;
+  if (ctx_pool.idle.size() < AES_POOL_MAX &&
+      EVP_CIPHER_CTX_cipher(ctx) != nullptr) {
+    ctx_pool.idle.push_back(ctx);
+    return;
+  }
+  EVP_CIPHER_CTX_free(ctx);
+  --pool_live;
+}
+
+/// Report on the pool of AES contexts, across all threads
+///
+/// @returns The pool's counters
+aes_pool_stats_t aes_pool_stats() {
+  return {pool_hits.load(), pool_misses.load(), pool_live.load()};
+}
+
+/// Report the time that the calling thread has spent running AES, in
+/// aes_crypt_update() and aes_crypt_final().  The difference between two calls
+/// is the AES time of whatever ran in between, even if it was interleaved with
+/// network I/O.
+///
+/// @returns The calling thread's total AES time, in nanoseconds
+uint64_t aes_thread_ns() { return aes_ns; }
 
 /// If the given basename resolves to basename.pri and basename.pub, then load
 /// basename.pri and return it.  If one or the other doesn't exist, then there's
@@ -261,10 +419,10 @@ RSA *init_RSA(const string &basename) {
   if (!pub_exists && !pri_exists) {
     generate_rsa_key_files(pubfile, prifile);
   } else if (pub_exists && !pri_exists) {
-    cerr << "Error: cannot find " << basename << ".pri\n";
+    log_msg(LOG_ERROR, "Error: cannot find " + basename + ".pri");
     return nullptr;
   } else if (!pub_exists && pri_exists) {
-    cerr << "Error: cannot find " << basename << ".pub\n";
+    log_msg(LOG_ERROR, "Error: cannot find " + basename + ".pub");
     return nullptr;
   }
   return load_pri(prifile.c_str());
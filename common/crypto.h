@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <openssl/pem.h>
 
 #include "vec.h"
@@ -24,6 +25,42 @@ const int AES_BLOCKSIZE = 1024;
 ///          nullptr on error
 RSA *load_pub(const char *filename);
 
+/// Run one chunk of a message through AES, as part of a streaming encryption
+/// or decryption.  The chunks of a message must be passed in order, and then
+/// aes_crypt_final() must be called.
+///
+/// @param ctx The pre-configured AES context to use for this operation
+/// @param in  A pointer to the bytes of the chunk
+/// @param len The number of bytes in the chunk
+/// @param out The buffer that receives the result.  It must have room for
+///            len + EVP_MAX_BLOCK_LENGTH bytes.
+///
+/// @returns The number of bytes written to out, or -1 on error
+int aes_crypt_update(EVP_CIPHER_CTX *ctx, const unsigned char *in, int len,
+                     unsigned char *out);
+
+/// Finish a streaming encryption or decryption, by processing the final
+/// (padded) block.  After calling, the CTX cannot be used until it is reset.
+///
+/// @param ctx The AES context that was passed to aes_crypt_update()
+/// @param out The buffer that receives the result.  It must have room for
+///            EVP_MAX_BLOCK_LENGTH bytes.
+///
+/// @returns The number of bytes written to out, or -1 on error
+int aes_crypt_final(EVP_CIPHER_CTX *ctx, unsigned char *out);
+
+/// Run the AES symmetric encryption/decryption algorithm on a buffer of bytes.
+/// Note that this will do either encryption or decryption, depending on how the
+/// provided CTX has been configured.  After calling, the CTX cannot be used
+/// until it is reset.
+///
+/// @param ctx   The pre-configured AES context to use for this operatoin
+/// @param start A pointer to the bytes to encrypt/decrypt
+/// @param count The number of bytes to encrypt/decrypt
+///
+/// @returns A vector with the encrypted or decrypted result, or an empty vector
+vec aes_crypt_msg(EVP_CIPHER_CTX *ctx, const unsigned char *start, int count);
+
 /// Run the AES symmetric encryption/decryption algorithm on a vector of bytes.
 /// Note that this will do either encryption or decryption, depending on how the
 /// provided CTX has been configured.  After calling, the CTX cannot be used
@@ -55,7 +92,9 @@ vec aes_crypt_msg(EVP_CIPHER_CTX *ctx, const std::string &msg);
 vec create_aes_key();
 
 /// Create an aes context for doing a single encryption or decryption.  The
-/// context must be reset after each full encrypt/decrypt.
+/// context must be reset after each full encrypt/decrypt.  Contexts come from
+/// a per-thread pool, so this usually just sets the key and iv on a context
+/// that an earlier request gave back through reclaim_aes_context().
 ///
 /// @param key     A vector holding the bits of the key and iv
 /// @param encrypt True to encrypt, false to decrypt
@@ -74,13 +113,40 @@ EVP_CIPHER_CTX *create_aes_context(const vec &key, bool encrypt);
 ///                decryption context
 ///
 /// @returns false on error, true if the context is reset and ready to use again
-bool reset_aes_context(EVP_CIPHER_CTX *ctx, vec &key, bool encrypt);
+bool reset_aes_context(EVP_CIPHER_CTX *ctx, const vec &key, bool encrypt);
 
-/// When an AES context is done being used, call this to reclaim its memory
+/// When an AES context is done being used, call this to return it to the
+/// calling thread's pool.  If the pool is full, or the context lost its cipher
+/// in a failed reset, then its memory is freed instead.
 ///
 /// @param ctx The context to reclaim
 void reclaim_aes_context(EVP_CIPHER_CTX *ctx);
 
+/// aes_pool_stats_t reports on the per-thread pools of AES contexts
+struct aes_pool_stats_t {
+  /// The number of times create_aes_context() reused a pooled context
+  uint64_t hits;
+
+  /// The number of times create_aes_context() had to allocate a context
+  uint64_t misses;
+
+  /// The number of contexts that exist right now, in use or pooled
+  uint64_t live;
+};
+
+/// Report on the pool of AES contexts, across all threads
+///
+/// @returns The pool's counters
+aes_pool_stats_t aes_pool_stats();
+
+/// Report the time that the calling thread has spent running AES, in
+/// aes_crypt_update() and aes_crypt_final().  The difference between two calls
+/// is the AES time of whatever ran in between, even if it was interleaved with
+/// network I/O.
+///
+/// @returns The calling thread's total AES time, in nanoseconds
+uint64_t aes_thread_ns();
+
 /// If the given basename resolves to basename.pri and basename.pub, then load
 /// basename.pri and return it.  If one or the other doesn't exist, then there's
 /// an error.  If both don't exist, create them and then load basename.pri.
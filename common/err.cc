@@ -1,5 +1,7 @@
 #include <cstring>
-#include <iostream>
+#include <string>
+
+#include "log.h"
 
 using namespace std;
 
@@ -10,5 +12,6 @@ using namespace std;
 /// @param prefix The text to display before the error message
 void sys_error(int err, const char *prefix) {
   char buf[1024];
-  cerr << prefix << " " << strerror_r(err, buf, sizeof(buf)) << endl;
+  log_msg(LOG_ERROR,
+          string(prefix) + " " + strerror_r(err, buf, sizeof(buf)));
 }
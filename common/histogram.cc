@@ -0,0 +1,124 @@
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "histogram.h"
+
+using namespace std;
+
+/// The number of bits needed to pick a bucket within a power of two
+static const int SUB_BITS = 4;
+static_assert((1 << SUB_BITS) == histogram::HIST_SUB, "HIST_SUB is 2^SUB_BITS");
+static_assert((64 - SUB_BITS + 1) * histogram::HIST_SUB ==
+                  histogram::HIST_BUCKETS,
+              "HIST_BUCKETS covers every 64-bit value");
+
+/// The number of buckets
+static const int NBUCKETS = histogram::HIST_BUCKETS;
+
+/// Find the bucket for a value.  Values below HIST_SUB each get their own
+/// bucket.  Above that, the top SUB_BITS + 1 bits of a value select its bucket.
+///
+/// @param v The value
+///
+/// @returns The index of v's bucket, which is less than HIST_BUCKETS
+int histogram::bucket_of(uint64_t v) {
+  if (v < (uint64_t)histogram::HIST_SUB)
+    return v;
+  int msb = 63 - __builtin_clzll(v);
+  int shift = msb - SUB_BITS;
+  return (shift + 1) * histogram::HIST_SUB +
+         ((v >> shift) & (histogram::HIST_SUB - 1));
+}
+
+/// Find the largest value that a bucket holds
+///
+/// @param b The index of the bucket
+///
+/// @returns The largest value that maps to bucket b
+static uint64_t bucket_top(int b) {
+  if (b < histogram::HIST_SUB)
+    return b;
+  int shift = b / histogram::HIST_SUB - 1;
+  uint64_t low = (uint64_t)(histogram::HIST_SUB + b % histogram::HIST_SUB)
+                 << shift;
+  return low + ((uint64_t)1 << shift) - 1;
+}
+
+/// Construct an empty histogram
+histogram::histogram() : counts(NBUCKETS, 0) {}
+
+/// Count one value
+///
+/// @param v The value to count
+void histogram::record(uint64_t v) {
+  ++counts[bucket_of(v)];
+  ++n;
+  sum += v;
+  if (v > largest)
+    largest = v;
+}
+
+/// Add all of the counts in another histogram to this one
+///
+/// @param other The histogram to add
+void histogram::merge(const histogram &other) {
+  for (int i = 0; i < NBUCKETS; ++i)
+    counts[i] += other.counts[i];
+  n += other.n;
+  sum += other.sum;
+  if (other.largest > largest)
+    largest = other.largest;
+}
+
+/// Add counts that were gathered elsewhere, bucket by bucket
+///
+/// @param buckets HIST_BUCKETS counts, one per bucket
+/// @param sum     The sum of the values that were counted
+/// @param max     The largest value that was counted
+void histogram::merge(const uint64_t *buckets, uint64_t sum, uint64_t max) {
+  for (int i = 0; i < NBUCKETS; ++i) {
+    counts[i] += buckets[i];
+    n += buckets[i];
+  }
+  this->sum += sum;
+  if (max > largest)
+    largest = max;
+}
+
+/// Report the number of values counted
+///
+/// @returns The number of calls to record()
+uint64_t histogram::count() const { return n; }
+
+/// Report the mean of the values counted
+///
+/// @returns The mean, or 0 if there are no values
+double histogram::mean() const { return n == 0 ? 0 : (double)sum / n; }
+
+/// Report the largest value counted
+///
+/// @returns The largest value, or 0 if there are no values
+uint64_t histogram::max() const { return largest; }
+
+/// Estimate a percentile of the values counted
+///
+/// @param p The percentile, from 0 to 100
+///
+/// @returns The smallest bucket bound that covers p percent of the values, or
+///          0 if there are no values
+uint64_t histogram::percentile(double p) const {
+  if (n == 0)
+    return 0;
+  // NB: round the rank up, so that small samples don't understate the tail
+  uint64_t rank = (uint64_t)ceil(p / 100 * n);
+  if (rank < 1)
+    rank = 1;
+  uint64_t seen = 0;
+  for (int i = 0; i < NBUCKETS; ++i) {
+    seen += counts[i];
+    if (seen >= rank)
+      return bucket_top(i) < largest ? bucket_top(i) : largest;
+  }
+  return largest;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/// histogram counts a stream of non-negative values (typically latencies, in
+/// microseconds) in log-linear buckets: each power of two is split into
+/// HIST_SUB equal buckets, so any value is recorded to within 1/HIST_SUB of its
+/// true size, while the whole 64-bit range needs only a few hundred counters.
+///
+/// A histogram is not thread-safe.  Each thread should record into its own,
+/// and the results should be combined with merge().
+class histogram {
+  /// The counts for each bucket
+  std::vector<uint64_t> counts;
+
+  /// The number of values, their sum, and the largest one
+  uint64_t n = 0, sum = 0, largest = 0;
+
+public:
+  /// The number of buckets in each power of two
+  static const int HIST_SUB = 16;
+
+  /// The number of buckets needed to cover every 64-bit value
+  static const int HIST_BUCKETS = 61 * HIST_SUB;
+
+  /// Find the bucket for a value, for callers that keep their own counts
+  /// (e.g., in atomics) and merge them in later
+  ///
+  /// @param v The value
+  ///
+  /// @returns The index of v's bucket, which is less than HIST_BUCKETS
+  static int bucket_of(uint64_t v);
+
+  /// Construct an empty histogram
+  histogram();
+
+  /// Count one value
+  ///
+  /// @param v The value to count
+  void record(uint64_t v);
+
+  /// Add all of the counts in another histogram to this one
+  ///
+  /// @param other The histogram to add
+  void merge(const histogram &other);
+
+  /// Add counts that were gathered elsewhere, bucket by bucket
+  ///
+  /// @param buckets HIST_BUCKETS counts, one per bucket
+  /// @param sum     The sum of the values that were counted
+  /// @param max     The largest value that was counted
+  void merge(const uint64_t *buckets, uint64_t sum, uint64_t max);
+
+  /// Report the number of values counted
+  ///
+  /// @returns The number of calls to record()
+  uint64_t count() const;
+
+  /// Report the mean of the values counted
+  ///
+  /// @returns The mean, or 0 if there are no values
+  double mean() const;
+
+  /// Report the largest value counted
+  ///
+  /// @returns The largest value, or 0 if there are no values
+  uint64_t max() const;
+
+  /// Estimate a percentile of the values counted
+  ///
+  /// @param p The percentile, from 0 to 100
+  ///
+  /// @returns The smallest bucket bound that covers p percent of the values,
+  ///          or 0 if there are no values
+  uint64_t percentile(double p) const;
+};
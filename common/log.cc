@@ -0,0 +1,255 @@
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+#include "log.h"
+
+using namespace std;
+
+/// How long the writer sleeps when the ring is empty, in milliseconds
+const int LOG_POLL_MS = 5;
+
+/// slot_t is one entry of the ring.  Its sequence number says whose turn it
+/// is: a producer may fill slot i when seq == i, and the writer may empty it
+/// when seq == i + 1.  This is Dmitry Vyukov's bounded queue, with a single
+/// consumer.
+struct slot_t {
+  /// The slot's sequence number
+  atomic<size_t> seq;
+
+  /// The level of the message in the slot
+  log_level_t level;
+
+  /// The length of the message in the slot
+  int len;
+
+  /// The text of the message in the slot
+  char text[LOG_LINE_MAX];
+};
+
+/// The global state of the log
+static struct {
+  /// The lowest level that is logged
+  atomic<int> level{LOG_INFO};
+
+  /// True while the background writer is running
+  atomic<bool> running{false};
+
+  /// True once log_stop() has asked the writer to finish
+  atomic<bool> stopping{false};
+
+  /// The ring, and one less than its size
+  unique_ptr<slot_t[]> ring;
+  size_t mask = 0;
+
+  /// The next position that a producer will claim, and the next position
+  /// that the writer will empty
+  atomic<size_t> tail{0};
+  size_t head = 0;
+
+  /// The most messages per second (0 for no limit), the second that is being
+  /// counted, and the number of messages in that second
+  int per_sec = 0;
+  atomic<uint64_t> window{0};
+  atomic<int> in_window{0};
+
+  /// The number of messages dropped because the ring was full or the rate
+  /// was exceeded
+  atomic<uint64_t> dropped{0};
+
+  /// The background writer
+  thread writer;
+} logger;
+
+/// Parse the name of a log level
+///
+/// @param name  One of "debug", "info", "warn", or "error"
+/// @param level Receives the level
+///
+/// @returns false if the name is not a level
+bool log_parse_level(const string &name, log_level_t &level) {
+  const char *names[] = {"debug", "info", "warn", "error"};
+  for (int i = LOG_DEBUG; i <= LOG_ERROR; ++i) {
+    if (name == names[i]) {
+      level = (log_level_t)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Check if messages at a level would be logged, so that callers can skip
+/// building messages that would be thrown away
+///
+/// @param level The level of the message
+///
+/// @returns true if the level is at least the log's level
+bool log_enabled(log_level_t level) {
+  return level >= logger.level.load(memory_order_relaxed);
+}
+
+/// Check the rate limit, and count one more message against it
+///
+/// @returns true if the message may be logged
+static bool within_rate() {
+  if (logger.per_sec == 0)
+    return true;
+  uint64_t now = chrono::duration_cast<chrono::seconds>(
+                     chrono::steady_clock::now().time_since_epoch())
+                     .count();
+  uint64_t w = logger.window.load(memory_order_relaxed);
+  if (w != now && logger.window.compare_exchange_strong(w, now))
+    logger.in_window.store(0, memory_order_relaxed);
+  return logger.in_window.fetch_add(1, memory_order_relaxed) < logger.per_sec;
+}
+
+/// Copy a message into the ring, without taking any locks
+///
+/// @param level The level of the message
+/// @param msg   The text of the message
+///
+/// @returns false if the ring is full
+static bool push(log_level_t level, const string &msg) {
+  size_t pos = logger.tail.load(memory_order_relaxed);
+  slot_t *s;
+  while (true) {
+    s = &logger.ring[pos & logger.mask];
+    size_t seq = s->seq.load(memory_order_acquire);
+    if (seq == pos) {
+      if (logger.tail.compare_exchange_weak(pos, pos + 1,
+                                            memory_order_relaxed))
+        break;
+    } else if ((ptrdiff_t)(seq - pos) < 0) {
+      return false;
+    } else {
+      pos = logger.tail.load(memory_order_relaxed);
+    }
+  }
+  s->level = level;
+  s->len = msg.length() < LOG_LINE_MAX ? msg.length() : LOG_LINE_MAX;
+  memcpy(s->text, msg.data(), s->len);
+  s->seq.store(pos + 1, memory_order_release);
+  return true;
+}
+
+/// Log a message.  A newline is added to it.
+///
+/// @param level The level of the message
+/// @param msg   The text of the message
+void log_msg(log_level_t level, const string &msg) {
+  if (!log_enabled(level))
+    return;
+  if (!logger.running.load(memory_order_acquire)) {
+    if (level >= LOG_WARN)
+      cerr << msg << "\n";
+    else
+      cout << msg << endl;
+    return;
+  }
+  if (!within_rate() || !push(level, msg))
+    logger.dropped.fetch_add(1, memory_order_relaxed);
+}
+
+/// Write all of a buffer to a file descriptor, ignoring errors, since there is
+/// nowhere left to report them
+///
+/// @param fd  The file descriptor
+/// @param buf The bytes to write
+static void write_all(int fd, const string &buf) {
+  size_t pos = 0;
+  while (pos < buf.size()) {
+    ssize_t n = write(fd, buf.data() + pos, buf.size() - pos);
+    if (n > 0)
+      pos += n;
+    else if (n < 0 && errno != EINTR)
+      return;
+  }
+}
+
+/// The background writer: empty the ring into one buffer per stream, and
+/// write each buffer with one system call.  Drops are reported at most once a
+/// second, so that the report doesn't add to a flood.
+static void write_loop() {
+  string out[2]; // stdout, stderr
+  uint64_t reported = 0;
+  auto last_report = chrono::steady_clock::now();
+  while (true) {
+    // NB: check for a stop before draining, so the last drain is complete
+    bool stopping = logger.stopping.load(memory_order_acquire);
+    size_t n = 0;
+    while (true) {
+      slot_t &s = logger.ring[logger.head & logger.mask];
+      if (s.seq.load(memory_order_acquire) != logger.head + 1)
+        break;
+      string &o = out[s.level >= LOG_WARN];
+      o.append(s.text, s.len);
+      o.push_back('\n');
+      s.seq.store(logger.head + logger.mask + 1, memory_order_release);
+      ++logger.head;
+      ++n;
+    }
+    uint64_t dropped = logger.dropped.load(memory_order_relaxed);
+    auto now = chrono::steady_clock::now();
+    if (dropped != reported &&
+        (stopping || now - last_report >= chrono::seconds(1))) {
+      out[1] += "Dropped " + to_string(dropped - reported) + " log messages\n";
+      reported = dropped;
+      last_report = now;
+    }
+    write_all(STDOUT_FILENO, out[0]);
+    write_all(STDERR_FILENO, out[1]);
+    out[0].clear();
+    out[1].clear();
+    if (n == 0) {
+      if (stopping)
+        return;
+      this_thread::sleep_for(chrono::milliseconds(LOG_POLL_MS));
+    }
+  }
+}
+
+/// Start the background writer.  After this, log_msg() never blocks.
+///
+/// @param level    The lowest level that is logged
+/// @param per_sec  The most messages that may be logged each second (0 for no
+///                 limit)
+/// @param capacity The number of messages that the ring holds (rounded up to a
+///                 power of two)
+void log_start(log_level_t level, int per_sec, size_t capacity) {
+  logger.level.store(level, memory_order_relaxed);
+  if (logger.running.load())
+    return;
+  size_t size = 1;
+  while (size < capacity)
+    size *= 2;
+  logger.ring.reset(new slot_t[size]);
+  for (size_t i = 0; i < size; ++i)
+    logger.ring[i].seq.store(i, memory_order_relaxed);
+  logger.mask = size - 1;
+  logger.tail.store(0, memory_order_relaxed);
+  logger.head = 0;
+  logger.per_sec = per_sec;
+  logger.stopping.store(false, memory_order_relaxed);
+
+  // Anything already buffered in cout must come out before the writer's lines
+  cout.flush();
+  logger.writer = thread(write_loop);
+  logger.running.store(true, memory_order_release);
+}
+
+/// Stop the background writer, once it has written every queued message.
+/// After this, log_msg() writes messages right away again.
+void log_stop() {
+  if (!logger.running.load())
+    return;
+  // NB: the ring stays allocated, in case a late producer is still in push()
+  logger.running.store(false, memory_order_release);
+  logger.stopping.store(true, memory_order_release);
+  logger.writer.join();
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+
+/// The log is how the server and the common code report what they are doing.
+/// Until log_start() is called, a message is written to its stream right away,
+/// which suits the client and the server's startup.  Once the log is started,
+/// a message is copied into a lock-free ring buffer, and a background thread
+/// writes the messages out in batches, so that threads serving clients never
+/// wait on a shared stream.
+///
+/// Messages below the log's level are skipped before any work is done.  If the
+/// ring is full, or more than the configured number of messages per second
+/// arrive, then messages are dropped, and the writer reports how many.
+
+/// The levels of messages.  LOG_DEBUG and LOG_INFO go to stdout, and LOG_WARN
+/// and LOG_ERROR go to stderr.
+enum log_level_t { LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR };
+
+/// The longest message that the ring holds; longer ones are truncated
+const int LOG_LINE_MAX = 240;
+
+/// Parse the name of a log level
+///
+/// @param name  One of "debug", "info", "warn", or "error"
+/// @param level Receives the level
+///
+/// @returns false if the name is not a level
+bool log_parse_level(const std::string &name, log_level_t &level);
+
+/// Check if messages at a level would be logged, so that callers can skip
+/// building messages that would be thrown away
+///
+/// @param level The level of the message
+///
+/// @returns true if the level is at least the log's level
+bool log_enabled(log_level_t level);
+
+/// Log a message.  A newline is added to it.
+///
+/// @param level The level of the message
+/// @param msg   The text of the message
+void log_msg(log_level_t level, const std::string &msg);
+
+/// Start the background writer.  After this, log_msg() never blocks.
+///
+/// @param level    The lowest level that is logged
+/// @param per_sec  The most messages that may be logged each second (0 for no
+///                 limit)
+/// @param capacity The number of messages that the ring holds (rounded up to a
+///                 power of two)
+void log_start(log_level_t level, int per_sec, size_t capacity = 4096);
+
+/// Stop the background writer, once it has written every queued message.
+/// After this, log_msg() writes messages right away again.
+void log_stop();
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+#include "vec.h"
+
+/// A shared object that the server can run (see REQ_SOF and REQ_FUN) provides
+/// two functions, map() and reduce(), with C linkage and these types.  The
+/// server calls map() once for every user, from several threads at once, so
+/// map() must not keep any state of its own.  Then it calls reduce() once,
+/// with every result of map(), and sends reduce()'s result to the client.
+///
+/// The order of the results that reduce() receives is not meaningful.
+
+/// The type of map(): it receives a user's name and content (which is empty
+/// if the user has none), and returns a result of its choosing
+typedef vec (*map_func)(std::string_view user, bytes_t content);
+
+/// The type of reduce(): it receives every result of map(), and returns the
+/// result of the whole computation
+typedef vec (*reduce_func)(const std::vector<vec> &results);
@@ -1,17 +1,47 @@
+#include <algorithm>
 #include <arpa/inet.h>
+#include <chrono>
+#include <climits>
 #include <cstdlib>
 #include <functional>
-#include <iostream>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <string>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <vector>
 
 #include "err.h"
+#include "log.h"
 #include "net.h"
+#include "pool.h"
 #include "vec.h"
 
 using namespace std;
 
+/// The options that are set on every connected socket
+static net_opts_t net_opts;
+
+/// Set the options for every socket that is connected or accepted from now on
+///
+/// @param opts The options
+void net_configure(const net_opts_t &opts) { net_opts = opts; }
+
+/// Apply the configured options to a socket
+///
+/// @param sd The socket
+void net_tune(int sd) {
+  // NB: a failure here only costs performance, so it is not an error
+  int on = net_opts.nodelay ? 1 : 0;
+  setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  if (net_opts.sndbuf > 0)
+    setsockopt(sd, SOL_SOCKET, SO_SNDBUF, &net_opts.sndbuf, sizeof(int));
+  if (net_opts.rcvbuf > 0)
+    setsockopt(sd, SOL_SOCKET, SO_RCVBUF, &net_opts.rcvbuf, sizeof(int));
+}
+
 /// Internal method to send a buffer of data over a socket.
 ///
 /// @param sd    The socket on which to send
@@ -51,6 +81,42 @@ bool send_reliably(int sd, const vec &msg) {
   return reliable_send(sd, msg.data(), msg.size());
 }
 
+/// Send several buffers over a socket, as one message, with as few system
+/// calls as possible
+///
+/// @param sd    The socket on which to send
+/// @param parts The buffers (empty ones are skipped)
+///
+/// @returns True if every buffer was sent, false otherwise
+bool send_gather(int sd, vector<iovec> parts) {
+  size_t next = 0;
+  while (true) {
+    // NB: skip finished buffers, and send at most IOV_MAX at a time
+    while (next < parts.size() && parts[next].iov_len == 0)
+      ++next;
+    if (next == parts.size())
+      return true;
+    msghdr msg = {};
+    msg.msg_iov = parts.data() + next;
+    msg.msg_iovlen = min(parts.size() - next, (size_t)IOV_MAX);
+    ssize_t sent = sendmsg(sd, &msg, 0);
+    if (sent <= 0) {
+      if (errno != EINTR) {
+        sys_error(errno, "Error in sendmsg():");
+        return false;
+      }
+      continue;
+    }
+    // Advance past whatever was sent, which may end inside of a buffer
+    for (size_t i = next; sent > 0; ++i) {
+      size_t n = min((size_t)sent, parts[i].iov_len);
+      parts[i].iov_base = (char *)parts[i].iov_base + n;
+      parts[i].iov_len -= n;
+      sent -= n;
+    }
+  }
+}
+
 /// Send a string over a socket.
 ///
 /// @param sd  The socket on which to send
@@ -99,15 +165,15 @@ int reliable_get_to_eof_or_n(int sd, vec::iterator pos, int amnt) {
 /// Perform a reliable read when we are not sure how many bytes we are going to
 /// receive.
 ///
-/// @param sd     The socket from which to read
-/// @param buffer The buffer into which the data should go.  It is assumed to be
-///               pre-allocated to max bytes.
-/// @param max    The maximum number of bytes to get
+/// @param sd   The socket from which to read
+/// @param hint The number of bytes that are expected.  The buffer starts out
+///             big enough for them, and doubles whenever more arrive.
 ///
 /// @returns A vector with the data that was read, or an empty vector on error
-vec reliable_get_to_eof(int sd) {
-  // set up the initial buffer
-  vec res(16);
+vec reliable_get_to_eof(int sd, size_t hint) {
+  // set up the initial buffer.  NB: one byte more than expected, so that the
+  //     EOF after the expected bytes is seen without doubling the buffer
+  vec res(hint + 1);
   int recd = 0;
   // start reading.  Double the buffer any time we fill up
   while (true) {
@@ -146,7 +212,8 @@ int connect_to_server(const string &hostname, int port) {
   // figure out the IP address that we need to use and put it in a sockaddr_in
   struct hostent *host = gethostbyname(hostname.c_str());
   if (host == nullptr) {
-    cerr << "connect_to_server():DNS error:" << hstrerror(h_errno) << endl;
+    log_msg(LOG_ERROR,
+            string("connect_to_server():DNS error:") + hstrerror(h_errno));
     return -1;
   }
   sockaddr_in addr = {0};
@@ -160,6 +227,8 @@ int connect_to_server(const string &hostname, int port) {
     sys_error(errno, "Error making client socket: ");
     return -1;
   }
+  // NB: buffer sizes must be set before connecting, to affect the TCP window
+  net_tune(sd);
   if (connect(sd, (sockaddr *)&addr, sizeof(addr)) < 0) {
     close(sd);
     sys_error(errno, "Error connecting socket to address: ");
@@ -170,10 +239,12 @@ int connect_to_server(const string &hostname, int port) {
 
 /// Create a server socket that we can use to listen for new incoming requests
 ///
-/// @param port The port on which the program should listen for new connections
+/// @param port    The port on which the program should listen for new
+///                connections
+/// @param backlog The most connections that may wait to be accepted
 ///
 /// @returns The new listening socket, or -1 on error
-int create_server_socket(size_t port) {
+int create_server_socket(size_t port, int backlog) {
   // A socket is just a kind of file descriptor.  We want our connections to use
   // IPV4 and TCP:
   int sd = socket(AF_INET, SOCK_STREAM, 0);
@@ -201,7 +272,10 @@ int create_server_socket(size_t port) {
     sys_error(errno, "Error binding socket to local address: ");
     return -1;
   }
-  if (listen(sd, 0) < 0) {
+  // NB: accepted sockets inherit the buffer sizes, which must be set before
+  //     listening, to affect the TCP window
+  net_tune(sd);
+  if (listen(sd, backlog) < 0) {
     close(sd);
     sys_error(errno, "Error listening on socket: ");
     return -1;
@@ -209,6 +283,18 @@ int create_server_socket(size_t port) {
   return sd;
 }
 
+/// Log the address of a client that just connected.  The address is only
+/// formatted if the message will be logged.
+///
+/// @param addr The client's address, from accept()
+static void log_connected(const sockaddr_in &addr) {
+  if (!log_enabled(LOG_INFO))
+    return;
+  char clientname[INET_ADDRSTRLEN];
+  if (inet_ntop(AF_INET, &addr.sin_addr, clientname, sizeof(clientname)))
+    log_msg(LOG_INFO, string("Connected to ") + clientname);
+}
+
 /// Given a listening socket, start calling accept() on it to get new
 /// connections.  Each time a connection comes in, use the provided handler to
 /// process the request.  Note that this is not multithreaded.  Only one client
@@ -220,7 +306,7 @@ void accept_client(int sd, function<bool(int)> handler) {
   // Use accept() to wait for a client to connect.  When it connects, service
   // it.  When it disconnects, then and only then will we accept a new client.
   while (true) {
-    cout << "Waiting for a client to connect...\n";
+    log_msg(LOG_DEBUG, "Waiting for a client to connect...");
     sockaddr_in clientAddr = {0};
     socklen_t clientAddrSize = sizeof(clientAddr);
     int connSd = accept(sd, (sockaddr *)&clientAddr, &clientAddrSize);
@@ -229,11 +315,8 @@ void accept_client(int sd, function<bool(int)> handler) {
       sys_error(errno, "Error accepting request from client: ");
       return;
     }
-    char clientname[1024];
-    cout << "Connected to "
-         << inet_ntop(AF_INET, &clientAddr.sin_addr, clientname,
-                      sizeof(clientname))
-         << endl;
+    log_connected(clientAddr);
+    net_tune(connSd);
     bool done = handler(connSd);
     // NB: ignore errors in close()
     close(connSd);
@@ -241,3 +324,64 @@ void accept_client(int sd, function<bool(int)> handler) {
       return;
   }
 }
+
+/// Given a listening socket, start calling accept() on it to get new
+/// connections.  Each time a connection comes in, hand it to the pool, so that
+/// a worker thread can run the provided handler on it and then close it.  The
+/// listening thread goes straight back to accept(), so many clients can be
+/// served at once.
+///
+/// The handler also gets the time at which the connection was accepted, so
+/// that it can tell how long the connection waited for a worker.  Given a
+/// refuse function, a connection that arrives while the pool's queue is full
+/// goes to it, on the listening thread, instead of waiting for room.
+///
+/// When a handler returns true, the pool is shut down and the listening socket
+/// is shut down, which wakes up the blocked accept().  This function returns
+/// once every queued connection has been served and the workers have exited.
+///
+/// @param sd      The socket file descriptor on which to call accept
+/// @param pool    The pool of worker threads that will run the handler
+/// @param handler A function to call when a new connection comes in
+/// @param refuse  A function to call on a connection that can't be queued
+///                (nullptr to wait for room instead)
+void accept_client(
+    int sd, thread_pool &pool,
+    function<bool(int, chrono::steady_clock::time_point)> handler,
+    function<void(int)> refuse) {
+  while (pool.check_active()) {
+    log_msg(LOG_DEBUG, "Waiting for a client to connect...");
+    sockaddr_in clientAddr = {0};
+    socklen_t clientAddrSize = sizeof(clientAddr);
+    int connSd = accept(sd, (sockaddr *)&clientAddr, &clientAddrSize);
+    if (connSd < 0) {
+      // If a handler shut the pool down, then accept() failed because we shut
+      // down the listening socket, and this is a normal exit
+      if (errno == EINTR)
+        continue;
+      if (pool.check_active())
+        sys_error(errno, "Error accepting request from client: ");
+      break;
+    }
+    log_connected(clientAddr);
+    net_tune(connSd);
+    // NB: the task owns connSd, and handler is captured by reference, which is
+    //     safe because we await the pool's shutdown before returning
+    auto accepted = chrono::steady_clock::now();
+    auto task = [&, connSd, accepted]() {
+      bool done = handler(connSd, accepted);
+      // NB: ignore errors in close()
+      close(connSd);
+      if (done) {
+        pool.signal_shutdown();
+        shutdown(sd, SHUT_RDWR);
+      }
+    };
+    bool queued = refuse ? pool.try_submit(task) : pool.submit(task);
+    if (!queued && refuse && pool.check_active())
+      refuse(connSd);
+    if (!queued)
+      close(connSd);
+  }
+  pool.await_shutdown();
+}
@@ -1,16 +1,41 @@
 #pragma once
 
 #include <arpa/inet.h>
+#include <chrono>
 #include <cstdlib>
 #include <functional>
 #include <iostream>
 #include <netdb.h>
 #include <string>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <vector>
 
 #include "err.h"
+#include "pool.h"
 #include "vec.h"
 
+/// net_opts_t holds the options that are set on every connected socket
+struct net_opts_t {
+  /// Send each message at once, instead of letting Nagle's algorithm hold
+  /// small ones back until earlier ones are acknowledged?
+  bool nodelay = true;
+
+  /// The sizes of the kernel's send and receive buffers, in bytes (0 for the
+  /// kernel's defaults)
+  int sndbuf = 0, rcvbuf = 0;
+};
+
+/// Set the options for every socket that is connected or accepted from now on
+///
+/// @param opts The options
+void net_configure(const net_opts_t &opts);
+
+/// Apply the configured options to a socket
+///
+/// @param sd The socket
+void net_tune(int sd);
+
 /// Send a vector of data over a socket.
 ///
 /// @param sd  The socket on which to send
@@ -19,6 +44,15 @@
 /// @returns True if the whole vector was sent, false otherwise
 bool send_reliably(int sd, const vec &msg);
 
+/// Send several buffers over a socket, as one message, with as few system
+/// calls as possible
+///
+/// @param sd    The socket on which to send
+/// @param parts The buffers (empty ones are skipped)
+///
+/// @returns True if every buffer was sent, false otherwise
+bool send_gather(int sd, std::vector<iovec> parts);
+
 /// Send a string over a socket.
 ///
 /// @param sd  The socket on which to send
@@ -38,18 +72,20 @@ bool send_reliably(int sd, const std::string &msg);
 /// @returns The actual number of bytes read, or -1 on a non-eof error
 int reliable_get_to_eof_or_n(int sd, vec::iterator pos, int amnt);
 
+/// The initial size of the buffer in reliable_get_to_eof(), when the caller
+/// has no better guess
+const size_t GET_TO_EOF_INITIAL = 4096;
+
 /// Perform a reliable read when we are not sure how many bytes we are going
 /// to receive.
 ///
-/// @param sd     The socket from which to read
-/// @param buffer The buffer into which the data should go.  It is assumed
-/// to be
-///               pre-allocated to max bytes.
-/// @param max    The maximum number of bytes to get
+/// @param sd   The socket from which to read
+/// @param hint The number of bytes that are expected.  The buffer starts out
+///             big enough for them, and doubles whenever more arrive.
 ///
 /// @returns A vector with the data that was read, or an empty vector on
-/// error
-vec reliable_get_to_eof(int sd);
+///          error
+vec reliable_get_to_eof(int sd, size_t hint = GET_TO_EOF_INITIAL);
 
 /// Connect to a server so that we can have bidirectional communication on the
 /// socket (represented by a file descriptor) that this function returns
@@ -60,12 +96,18 @@ vec reliable_get_to_eof(int sd);
 /// @returns The socket descriptor for further communication, or -1 on error
 int connect_to_server(const std::string &hostname, int port);
 
+/// The default number of connections that the kernel may hold for a listening
+/// socket, once they have connected but before they are accepted
+const int LISTEN_BACKLOG = 128;
+
 /// Create a server socket that we can use to listen for new incoming requests
 ///
-/// @param port The port on which the program should listen for new connections
+/// @param port    The port on which the program should listen for new
+///                connections
+/// @param backlog The most connections that may wait to be accepted
 ///
 /// @returns The new listening socket, or -1 on error
-int create_server_socket(size_t port);
+int create_server_socket(size_t port, int backlog = LISTEN_BACKLOG);
 
 /// Given a listening socket, start calling accept() on it to get new
 /// connections.  Each time a connection comes in, use the provided handler to
@@ -75,3 +117,28 @@ int create_server_socket(size_t port);
 /// @param sd The socket file descriptor on which to call accept
 /// @param handler A function to call when a new connection comes in
 void accept_client(int sd, std::function<bool(int)> handler);
+
+/// Given a listening socket, start calling accept() on it to get new
+/// connections.  Each time a connection comes in, hand it to the pool, so that
+/// a worker thread can run the provided handler on it and then close it.  The
+/// listening thread goes straight back to accept(), so many clients can be
+/// served at once.
+///
+/// The handler also gets the time at which the connection was accepted, so
+/// that it can tell how long the connection waited for a worker.  Given a
+/// refuse function, a connection that arrives while the pool's queue is full
+/// goes to it, on the listening thread, instead of waiting for room.
+///
+/// When a handler returns true, the pool is shut down and the listening socket
+/// is shut down, which wakes up the blocked accept().  This function returns
+/// once every queued connection has been served and the workers have exited.
+///
+/// @param sd      The socket file descriptor on which to call accept
+/// @param pool    The pool of worker threads that will run the handler
+/// @param handler A function to call when a new connection comes in
+/// @param refuse  A function to call on a connection that can't be queued
+///                (nullptr to wait for room instead)
+void accept_client(
+    int sd, thread_pool &pool,
+    std::function<bool(int, std::chrono::steady_clock::time_point)> handler,
+    std::function<void(int)> refuse = nullptr);
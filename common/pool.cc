@@ -0,0 +1,152 @@
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "pool.h"
+
+using namespace std;
+
+/// thread_pool::Internal is the private struct that holds all of the fields of
+/// the thread_pool object.  Organizing the fields as an Internal is part of the
+/// PIMPL pattern.
+struct thread_pool::Internal {
+  /// The worker threads
+  vector<thread> workers;
+
+  /// The tasks that have been submitted but not yet started
+  deque<function<void()>> queue;
+
+  /// The maximum number of tasks that may sit in the queue
+  size_t capacity;
+
+  /// A lock protecting queue and active
+  mutex lock;
+
+  /// Workers wait on this until there is a task, or until shutdown
+  condition_variable not_empty;
+
+  /// Submitters wait on this until there is room in the queue, or until
+  /// shutdown
+  condition_variable not_full;
+
+  /// False once signal_shutdown() has been called
+  bool active = true;
+
+  /// Construct the Internal object by setting the capacity; the threads are
+  /// started by the thread_pool constructor
+  ///
+  /// @param cap The maximum number of queued tasks
+  Internal(size_t cap) : capacity(cap == 0 ? 1 : cap) {}
+
+  /// The loop that each worker runs: pull a task, run it, repeat.  Once the
+  /// pool is shut down, workers keep going until the queue is empty.
+  void worker_loop() {
+    while (true) {
+      function<void()> task;
+      {
+        unique_lock<mutex> g(lock);
+        not_empty.wait(g, [&]() { return !queue.empty() || !active; });
+        if (queue.empty())
+          return;
+        task = move(queue.front());
+        queue.pop_front();
+      }
+      not_full.notify_one();
+      task();
+    }
+  }
+};
+
+/// Construct a thread pool and start its worker threads
+///
+/// @param size     The number of worker threads to run
+/// @param capacity The maximum number of tasks that can be waiting in the
+///                 queue before submit() blocks
+thread_pool::thread_pool(size_t size, size_t capacity)
+    : fields(new Internal(capacity)) {
+  if (size == 0)
+    size = 1;
+  for (size_t i = 0; i < size; ++i)
+    fields->workers.emplace_back([this]() { fields->worker_loop(); });
+}
+
+/// Destroy the thread pool.  If it is still running, this signals a shutdown
+/// and waits for the workers to finish.
+thread_pool::~thread_pool() { await_shutdown(); }
+
+/// Add a task to the queue.  If the queue is full, block until there is room.
+///
+/// @param task The task to run on a worker thread
+///
+/// @returns false if the pool has been shut down (in which case the task will
+///          not run), true otherwise
+bool thread_pool::submit(function<void()> task) {
+  {
+    unique_lock<mutex> g(fields->lock);
+    fields->not_full.wait(g, [&]() {
+      return fields->queue.size() < fields->capacity || !fields->active;
+    });
+    if (!fields->active)
+      return false;
+    fields->queue.push_back(move(task));
+  }
+  fields->not_empty.notify_one();
+  return true;
+}
+
+/// Add a task to the queue, unless the queue is full
+///
+/// @param task The task to run on a worker thread
+///
+/// @returns false if the queue is full or the pool has been shut down (in
+///          which case the task will not run), true otherwise
+bool thread_pool::try_submit(function<void()> task) {
+  {
+    lock_guard<mutex> g(fields->lock);
+    if (fields->queue.size() >= fields->capacity || !fields->active)
+      return false;
+    fields->queue.push_back(move(task));
+  }
+  fields->not_empty.notify_one();
+  return true;
+}
+
+/// Stop accepting new tasks and wake up all threads that are waiting on the
+/// pool.  Tasks that are already in the queue will still run.  This does not
+/// block, so it is safe to call it from inside of a task.
+void thread_pool::signal_shutdown() {
+  {
+    lock_guard<mutex> g(fields->lock);
+    fields->active = false;
+  }
+  fields->not_empty.notify_all();
+  fields->not_full.notify_all();
+}
+
+/// Wait for the pool to shut down: the queue is drained and every worker
+/// thread has been joined.  This must not be called from inside of a task.
+void thread_pool::await_shutdown() {
+  signal_shutdown();
+  for (auto &t : fields->workers)
+    if (t.joinable())
+      t.join();
+}
+
+/// Check if the pool is still accepting tasks
+///
+/// @returns true if signal_shutdown() has not been called yet
+bool thread_pool::check_active() {
+  lock_guard<mutex> g(fields->lock);
+  return fields->active;
+}
+
+/// Report the number of tasks that are waiting in the queue
+///
+/// @returns The number of queued tasks that have not yet started
+size_t thread_pool::queue_depth() {
+  lock_guard<mutex> g(fields->lock);
+  return fields->queue.size();
+}
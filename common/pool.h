@@ -0,0 +1,69 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+
+/// thread_pool is a fixed-size set of worker threads that pull tasks from a
+/// bounded queue.  The server's listening thread uses it to hand off accepted
+/// connections, so that one slow client only occupies one worker, instead of
+/// stalling every other client.
+///
+/// The queue is bounded so that a burst of connections applies back-pressure
+/// to the thread that is submitting tasks, rather than growing without limit.
+class thread_pool {
+  /// Internal is the class that stores all the members of a thread_pool
+  /// object.  To avoid pulling too much into the .h file, we are using the
+  /// PIMPL pattern (https://www.geeksforgeeks.org/pimpl-idiom-in-c-with-examples/)
+  struct Internal;
+
+  /// A reference to the internal fields of the thread_pool object
+  std::unique_ptr<Internal> fields;
+
+public:
+  /// Construct a thread pool and start its worker threads
+  ///
+  /// @param size     The number of worker threads to run
+  /// @param capacity The maximum number of tasks that can be waiting in the
+  ///                 queue before submit() blocks
+  thread_pool(size_t size, size_t capacity);
+
+  /// Destroy the thread pool.  If it is still running, this signals a
+  /// shutdown and waits for the workers to finish.
+  ~thread_pool();
+
+  /// Add a task to the queue.  If the queue is full, block until there is
+  /// room.
+  ///
+  /// @param task The task to run on a worker thread
+  ///
+  /// @returns false if the pool has been shut down (in which case the task
+  ///          will not run), true otherwise
+  bool submit(std::function<void()> task);
+
+  /// Add a task to the queue, unless the queue is full
+  ///
+  /// @param task The task to run on a worker thread
+  ///
+  /// @returns false if the queue is full or the pool has been shut down (in
+  ///          which case the task will not run), true otherwise
+  bool try_submit(std::function<void()> task);
+
+  /// Stop accepting new tasks and wake up all threads that are waiting on the
+  /// pool.  Tasks that are already in the queue will still run.  This does not
+  /// block, so it is safe to call it from inside of a task.
+  void signal_shutdown();
+
+  /// Wait for the pool to shut down: the queue is drained and every worker
+  /// thread has been joined.  This must not be called from inside of a task.
+  void await_shutdown();
+
+  /// Check if the pool is still accepting tasks
+  ///
+  /// @returns true if signal_shutdown() has not been called yet
+  bool check_active();
+
+  /// Report the number of tasks that are waiting in the queue
+  ///
+  /// @returns The number of queued tasks that have not yet started
+  size_t queue_depth();
+};
@@ -37,6 +37,42 @@
 ///
 /// Finally, note that some error messages do not correspond directly to any
 /// specific message, but are possible nonetheless (i.e., RES_ERR_INV_CMD).
+///
+/// The exception to the two-message rule is a session (see REQ_SES).  After a
+/// single RSA-protected handshake, the client and server keep the connection
+/// open and exchange any number of AES-encrypted frames, all using the AES key
+/// from the handshake.  Each frame has the form
+///
+///   len(@e).@iv.@e, where @e = enc(aeskey/@iv, @m)
+///
+/// That is, every frame is encrypted with the session's AES key, but with a
+/// fresh random @iv of AES_IVSIZE bytes, which replaces the iv part of aeskey.
+/// len(@e) does not count the bytes of @iv.  A request frame's message (@m) is
+/// cmd.@b, where cmd is one of REQ_REG, REQ_BYE, REQ_SAV, REQ_SET, REQ_GET, or
+/// REQ_ALL, and @b is exactly what the unencrypted @ablock of a one-shot
+/// request with that cmd would hold.  A response frame's message is exactly
+/// what the unencrypted response to a one-shot request would hold.  The
+/// session ends when the client closes the connection, when the server
+/// receives a frame it cannot decrypt, or after a successful BYE.
+///
+/// Any rblock may carry an optional 4-byte set of flags (@f) after
+/// len(@ablock), i.e., enc(pubkey, cmd.aeskey.len(@ablock).@f).  When @f
+/// includes RBLOCK_FLAG_TICKET, the response to a one-shot request is prefixed
+/// with a session ticket: len(@t).@t.enc(aeskey, ...), where len(@t) is either
+/// 0 (no ticket was issued) or LEN_TICKET.  The server only issues tickets for
+/// successful requests.  A ticket lets the client skip RSA on later requests
+/// that reuse the same aeskey (see REQ_RSM).
+///
+/// A server may limit how much each user (@u) does in a sliding interval: the
+/// number of requests, the bytes of their decrypted requests, and the bytes of
+/// the decrypted responses to GET, ALL, MET, and FUN.  A request that would go
+/// over a limit is refused with ERR_QUOTA_REQ, ERR_QUOTA_UP, or ERR_QUOTA_DOWN,
+/// and has no effect.  Requests that fail with ERR_LOGIN, and REG, are not
+/// counted.
+///
+/// When a server is overloaded, it may answer any request (other than KEY,
+/// and the frames of a session that has started) with an unencrypted
+/// ERR_BUSY.<EOF>, without reading all of it.  Such a request has no effect.
 
 /// Maximum length of a user name
 const int LEN_UNAME = 64;
@@ -56,6 +92,31 @@ const int LEN_RSA_PUBKEY = 426;
 /// Length of pre-encryption rblock content
 const int LEN_RBLOCK_CONTENT = 128;
 
+/// Maximum length of the encrypted part of a request frame in a session.  This
+/// is enough for the largest SET.
+const int LEN_FRAME_MAX = LEN_CONTENT + 4096;
+
+/// The newest version of the session protocol that this code speaks
+const int SESSION_VERSION = 1;
+
+/// Length of a session ticket
+const int LEN_TICKET = 48;
+
+/// The rblock flag that asks the server for a session ticket
+const int RBLOCK_FLAG_TICKET = 1;
+
+/// The SET/GET flag that says the content is sent as a packed content field
+const int CONTENT_FLAG_PACKED = 1;
+
+/// The most names in one page of an ALL query
+const int ALL_PAGE_MAX = 65536;
+
+/// Length of the cursor in a page of an ALL query
+const int LEN_ALL_CURSOR = 12;
+
+/// The ALL query flag that asks for every page in one response
+const int ALL_FLAG_STREAM = 1;
+
 /// Request the server's public key (@pubkey), to use for subsequent interaction
 /// with the server by the client
 ///
@@ -76,6 +137,7 @@ const std::string REQ_KEY = "KEY";
 ///           enc(aeskey, error_code).<EOF> -- Error (see @errors)
 ///           ERR_CRYPTO.<EOF>              -- Error (see @errors)
 /// @errors   ERR_USER_EXISTS -- @u already exists as a user
+///           ERR_SERVER      -- Server could not make the new user durable
 ///           ERR_MSG_FMT     -- Server unable to extract @u or @p
 ///           ERR_CRYPTO      -- Server could not decrypt @ablock
 const std::string REQ_REG = "REG";
@@ -136,6 +198,14 @@ const std::string REQ_SAV = "SAV";
 ///           ERR_LOGIN       -- @p is not @u's password
 ///           ERR_MSG_FMT     -- Server unable to extract @u or @p or @b
 ///           ERR_CRYPTO      -- Server could not decrypt @ablock
+///           ERR_SERVER      -- Server could not make the content durable
+///
+/// The @ablock may end with a 4-byte set of flags (@f), i.e.,
+/// enc(aeskey, len(@u).@u.len(@p).@p.len(@b).@b.@f).  When @f includes
+/// CONTENT_FLAG_PACKED, @b is a packed content field: len(@c).@d, where @c is
+/// the content and @d is either @c itself (if it is len(@c) bytes long) or
+/// the zlib compression of @c.
+///           ERR_MSG_FMT     -- @b is packed, but does not unpack to @c
 const std::string REQ_SET = "SET";
 
 /// Allow user @u (with password @p) to fetch the profile content @c associated
@@ -155,6 +225,12 @@ const std::string REQ_SET = "SET";
 ///           ERR_NO_DATA     -- @w has a null profile content
 ///           ERR_MSG_FMT     -- Server unable to extract @u or @p or @w
 ///           ERR_CRYPTO      -- Server could not decrypt @ablock
+///
+/// As with SET, the @ablock may end with a 4-byte set of flags (@f).  When @f
+/// includes CONTENT_FLAG_PACKED, the response carries a packed content field
+/// in place of @c, so the server may send the content compressed:
+///
+/// @response enc(aeskey, "OK".len(@z).@z).<EOF>    -- Success, @z = len(@c).@d
 const std::string REQ_GET = "GET";
 
 /// Allow user @u (with password @p) to get a newline-separated list (@l) of the
@@ -173,8 +249,125 @@ const std::string REQ_GET = "GET";
 ///           ERR_LOGIN       -- @p is not @u's password
 ///           ERR_MSG_FMT     -- Server unable to extract @u or @p or @w
 ///           ERR_CRYPTO      -- Server could not decrypt @ablock
+///
+/// Since @l grows with the number of users, the list can also be fetched a
+/// page at a time, by adding a query (@q) to the @ablock:
+///
+///   @ablock   enc(aeskey, len(@u).@u.len(@p).@p.len(@q).@q)
+///
+/// where @q is @k.@f.@c: @k is a 4-byte page size (1 to ALL_PAGE_MAX names),
+/// @f is a 4-byte set of flags, and @c is empty for the first page, or the
+/// LEN_ALL_CURSOR-byte cursor from the previous page.  The response to a
+/// query is a page (@g), which lists about @k names (more, rarely, if several
+/// names hash alike), and the cursor for the next page (@n), which is empty
+/// once every name has been listed:
+///
+///   @g        "OK".len(@n).@n.len(@l).@l
+///
+/// A user who exists for the whole listing appears in exactly one page.  When
+/// @f includes ALL_FLAG_STREAM, the response holds every page from @c to the
+/// end, one after another, in a single response: enc(aeskey, @g.@g...@g).  A
+/// one-shot server encrypts and sends each page as soon as it is listed.
+/// @errors   ERR_MSG_FMT     -- @k or @c is invalid
 const std::string REQ_ALL = "ALL";
 
+/// Allow the admin user @u (with password @p) to get a report (@r) of the
+/// server's metrics: counters, latency histograms, and gauges, as text with one
+/// metric per line.  The admin user is named on the server's command line.
+///
+/// The user name (@u) and user password (@p) must conform to LEN_UNAME and
+/// LEN_PASS.
+///
+/// @rblock   enc(pubkey, "MET".aeskey.length(@ablock))
+/// @ablock   enc(aeskey, len(@u).@u.len(@p).@p)
+/// @response enc(aeskey, "OK".len(@r).@r).<EOF>    -- Success
+///           enc(aeskey, error_code).<EOF>         -- Error (see @errors)
+///           ERR_CRYPTO.<EOF>                      -- Error (see @errors)
+/// @errors   ERR_LOGIN       -- @u is not a valid user, or not the admin
+///           ERR_LOGIN       -- @p is not @u's password
+///           ERR_MSG_FMT     -- Server unable to extract @u or @p
+///           ERR_CRYPTO      -- Server could not decrypt @ablock
+const std::string REQ_MET = "MET";
+
+/// Allow the admin user @u (with password @p) to register a shared object (@b)
+/// under a name (@s), replacing any shared object that already has that name.
+/// The shared object must provide map() and reduce() (see
+/// common/mapreduce.h).  Registrations last until the server stops.
+///
+/// The user name (@u) and user password (@p) must conform to LEN_UNAME and
+/// LEN_PASS.  @s must be no more than LEN_UNAME bytes, and @b must be no more
+/// than LEN_CONTENT bytes.
+///
+/// @rblock   enc(pubkey, "SOF".aeskey.length(@ablock))
+/// @ablock   enc(aeskey, len(@u).@u.len(@p).@p.len(@x).@x), where @x =
+///           len(@s).@s.len(@b).@b
+/// @response enc(aeskey, "OK").<EOF>       -- Success
+///           enc(aeskey, error_code).<EOF> -- Error (see @errors)
+///           ERR_CRYPTO.<EOF>              -- Error (see @errors)
+/// @errors   ERR_LOGIN       -- @u is not a valid user, or not the admin
+///           ERR_LOGIN       -- @p is not @u's password
+///           ERR_MSG_FMT     -- Server unable to extract @u or @p or @s or @b
+///           ERR_SO          -- @b can't be loaded, or lacks map() or reduce()
+///           ERR_CRYPTO      -- Server could not decrypt @ablock
+const std::string REQ_SOF = "SOF";
+
+/// Allow the admin user @u (with password @p) to run the shared object that
+/// was registered as @s: map() is applied to every user's name and content,
+/// and then reduce() to all of the results, which yields @r.
+///
+/// The user name (@u) and user password (@p) must conform to LEN_UNAME and
+/// LEN_PASS.  @s must be no more than LEN_UNAME bytes.
+///
+/// @rblock   enc(pubkey, "FUN".aeskey.length(@ablock))
+/// @ablock   enc(aeskey, len(@u).@u.len(@p).@p.len(@s).@s)
+/// @response enc(aeskey, "OK".len(@r).@r).<EOF>    -- Success
+///           enc(aeskey, error_code).<EOF>         -- Error (see @errors)
+///           ERR_CRYPTO.<EOF>                      -- Error (see @errors)
+/// @errors   ERR_LOGIN       -- @u is not a valid user, or not the admin
+///           ERR_LOGIN       -- @p is not @u's password
+///           ERR_MSG_FMT     -- Server unable to extract @u or @p or @s
+///           ERR_SO          -- No shared object is registered as @s
+///           ERR_CRYPTO      -- Server could not decrypt @ablock
+const std::string REQ_FUN = "FUN";
+
+/// Begin a session, so that many requests can share one connection and one
+/// RSA-encrypted handshake.  @v is a 4-byte binary value holding the newest
+/// session version that the client speaks.  The server replies with the
+/// version (@s) that it will use for the session, which is no newer than @v.
+/// Unlike every other response, the response to a successful SES is a frame,
+/// and the connection stays open for more frames (see the top of this file).
+///
+/// @rblock   enc(pubkey, "SES".aeskey.length(@ablock))
+/// @ablock   enc(aeskey, @v)
+/// @response len(@e).@iv.@e                   -- Success, @e = enc(aeskey/@iv,
+///                                                "OK".@s)
+///           len(@e).@iv.@e.<EOF>             -- Error, @e = enc(aeskey/@iv,
+///                                                error_code)
+///           ERR_CRYPTO.<EOF>                 -- Error (see @errors)
+/// @errors   ERR_MSG_FMT     -- Server unable to extract @v, or @v < 1
+///           ERR_CRYPTO      -- Server could not decrypt @rblock or @ablock
+const std::string REQ_SES = "SES";
+
+/// Run one request without RSA, by presenting a session ticket (@t) that the
+/// server issued for an earlier request (see RBLOCK_FLAG_TICKET).  The ticket
+/// stands for that request's aeskey.  The rest of the request and the
+/// response are exactly like one frame of a session: @m is cmd.@b, where cmd
+/// is any command other than KEY, SES, or RSM, and the response frame holds
+/// the response that a one-shot request with that cmd would get.  Like the
+/// kblock, the header of this request is unencrypted and padded with '\0'.
+/// Tickets expire, and the server may forget them at any time, in which case
+/// the client should fall back to a regular request.
+///
+/// @kblock   pad0("RSM".@t.len(@e))
+/// @ablock   @iv.@e, where @e = enc(aeskey/@iv, @m)
+/// @response len(@e).@iv.@e.<EOF>             -- Success or error, @e =
+///                                                enc(aeskey/@iv, response)
+///           ERR_TICKET.<EOF>                 -- Error (see @errors)
+///           ERR_CRYPTO.<EOF>                 -- Error (see @errors)
+/// @errors   ERR_TICKET      -- @t is invalid, expired, or forgotten
+///           ERR_CRYPTO      -- Server could not decrypt @ablock
+const std::string REQ_RSM = "RSM";
+
 /// Response code to indicate that the command was successful
 const std::string RES_OK = "OK";
 
@@ -203,3 +396,38 @@ const std::string RES_ERR_XMIT = "ERR_XMIT";
 /// Response code to indicate that the client data can't be decrypted with the
 /// provided AES key
 const std::string RES_ERR_CRYPTO = "ERR_CRYPTO";
+
+/// Response code to indicate that the server does not recognize a session
+/// ticket
+const std::string RES_ERR_TICKET = "ERR_TICKET";
+
+/// Response code to indicate that a shared object could not be loaded, or is
+/// not registered
+const std::string RES_ERR_SO = "ERR_SO";
+
+/// Response code to indicate that the user has made too many requests in the
+/// server's quota interval
+const std::string RES_ERR_QUOTA_REQ = "ERR_QUOTA_REQ";
+
+/// Response code to indicate that the user has sent too many bytes in the
+/// server's quota interval
+const std::string RES_ERR_QUOTA_UP = "ERR_QUOTA_UP";
+
+/// Response code to indicate that the user has fetched too many bytes in the
+/// server's quota interval
+const std::string RES_ERR_QUOTA_DOWN = "ERR_QUOTA_DOWN";
+
+/// Response code to indicate that the server is too busy to take the request,
+/// which had no effect and may be retried later.  It is always sent
+/// unencrypted, since it is sent before the rblock is decrypted.
+const std::string RES_ERR_BUSY = "ERR_BUSY";
+
+/// Response code to indicate that the server is a read-only follower of
+/// another server (see server_replication.h), so it can't register users or
+/// change their content
+const std::string RES_ERR_READONLY = "ERR_READONLY";
+
+/// Response code to indicate that the server could not make a change durable,
+/// because its write-ahead log could not be written or synced.  The change
+/// may be visible until the server restarts, but may not survive a crash.
+const std::string RES_ERR_SERVER = "ERR_SERVER";
@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <openssl/md5.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ring.h"
+
+using namespace std;
+
+/// Hash a string onto the ring
+///
+/// @param s The string
+///
+/// @returns The first 8 bytes of the string's MD5 digest
+static uint64_t ring_hash(string_view s) {
+  unsigned char digest[MD5_DIGEST_LENGTH];
+  MD5((const unsigned char *)s.data(), s.length(), digest);
+  uint64_t h;
+  memcpy(&h, digest, sizeof(h));
+  return h;
+}
+
+/// Internal is the class that stores all the members of a HashRing object.
+/// To avoid pulling too much into the .h file, we are using the PIMPL pattern
+/// (https://www.geeksforgeeks.org/pimpl-idiom-in-c-with-examples/)
+struct HashRing::Internal {
+  /// The points on the ring, sorted by hash, each with the index of the
+  /// server that it belongs to
+  vector<pair<uint64_t, size_t>> points;
+
+  /// The number of servers
+  size_t nodes;
+};
+
+/// Construct a ring of servers
+///
+/// @param nodes The names of the servers (e.g., host:port), which must not be
+///              empty
+HashRing::HashRing(const vector<string> &nodes) : fields(new Internal) {
+  fields->nodes = nodes.size();
+  for (size_t i = 0; i < nodes.size(); ++i)
+    for (size_t p = 0; p < RING_POINTS; ++p)
+      fields->points.push_back({ring_hash(nodes[i] + "#" + to_string(p)), i});
+  sort(fields->points.begin(), fields->points.end());
+}
+
+/// Destructor for the ring
+///
+/// NB: The compiler doesn't know that it can create the default destructor in
+///     the .h file, because PIMPL prevents it from knowing the size of
+///     HashRing::Internal.  Now that we have reified HashRing::Internal, the
+///     compiler can make a destructor for us.
+HashRing::~HashRing() = default;
+
+/// Find the server that owns a user
+///
+/// @param user The name of the user
+///
+/// @returns The index of the server, in the order given to the constructor
+size_t HashRing::owner(string_view user) const {
+  auto &points = fields->points;
+  auto i = lower_bound(points.begin(), points.end(),
+                       make_pair(ring_hash(user), (size_t)0));
+  return i == points.end() ? points.front().second : i->second;
+}
+
+/// Report the number of servers in the ring
+///
+/// @returns The number of servers
+size_t HashRing::size() const { return fields->nodes; }
+
+/// Split a comma-separated list of servers, e.g. "host1:9000,host2:9000"
+///
+/// @param spec The list
+///
+/// @returns The servers, or an empty vector if any of them is empty
+vector<string> ring_parse(const string &spec) {
+  vector<string> res;
+  size_t start = 0;
+  while (true) {
+    size_t comma = spec.find(',', start);
+    string node = spec.substr(start, comma - start);
+    if (node.empty())
+      return {};
+    res.push_back(node);
+    if (comma == string::npos)
+      return res;
+    start = comma + 1;
+  }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// The number of points that each server puts on a hash ring.  More points
+/// spread users more evenly, at the cost of a larger ring.
+const size_t RING_POINTS = 128;
+
+/// HashRing maps user names to the servers of a sharded deployment with
+/// consistent hashing.  Each server is placed at RING_POINTS points on a ring
+/// of 64-bit hashes, and a user belongs to the server at the first point at or
+/// after the hash of their name.  Adding a server to the ring only moves the
+/// users whose names fall just before its points, and removing one only moves
+/// its own users.
+///
+/// The hashes are MD5 digests, so that every client and server, on any
+/// machine, agrees on which server owns each user, as long as they list the
+/// same servers in the same order.
+class HashRing {
+  /// Internal is the class that stores all the members of a HashRing object.
+  /// To avoid pulling too much into the .h file, we are using the PIMPL
+  /// pattern (https://www.geeksforgeeks.org/pimpl-idiom-in-c-with-examples/)
+  struct Internal;
+
+  /// A reference to the internal fields of the HashRing object
+  std::unique_ptr<Internal> fields;
+
+public:
+  /// Construct a ring of servers
+  ///
+  /// @param nodes The names of the servers (e.g., host:port), which must not
+  ///              be empty
+  HashRing(const std::vector<std::string> &nodes);
+
+  /// Destructor for the ring
+  ~HashRing();
+
+  /// Find the server that owns a user
+  ///
+  /// @param user The name of the user
+  ///
+  /// @returns The index of the server, in the order given to the constructor
+  size_t owner(std::string_view user) const;
+
+  /// Report the number of servers in the ring
+  ///
+  /// @returns The number of servers
+  size_t size() const;
+};
+
+/// Split a comma-separated list of servers, e.g. "host1:9000,host2:9000"
+///
+/// @param spec The list
+///
+/// @returns The servers, or an empty vector if any of them is empty
+std::vector<std::string> ring_parse(const std::string &spec);
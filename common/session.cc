@@ -0,0 +1,282 @@
+#include <algorithm>
+#include <cstring>
+#include <openssl/rand.h>
+#include <sys/uio.h>
+#include <vector>
+
+#include "contextmanager.h"
+#include "crypto.h"
+#include "log.h"
+#include "net.h"
+#include "session.h"
+#include "vec.h"
+
+using namespace std;
+
+/// Build the key that encrypts one frame: the key part of the session key,
+/// followed by the frame's iv
+///
+/// @param key The session's AES key
+/// @param iv  A pointer to the AES_IVSIZE bytes of the frame's iv
+///
+/// @returns A key/iv vector suitable for create_aes_context()
+static vec frame_key(const vec &key, const unsigned char *iv) {
+  vec res(AES_KEYSIZE + AES_IVSIZE);
+  memcpy(res.data(), key.data(), AES_KEYSIZE);
+  memcpy(res.data() + AES_KEYSIZE, iv, AES_IVSIZE);
+  return res;
+}
+
+/// Encrypt a message as a session frame, using the session's AES key and a
+/// fresh random iv.  The result is len(@e).@iv.@e, ready to send.
+///
+/// @param key The session's AES key.  Only the key part is used; the iv part
+///            is replaced by the frame's iv.
+/// @param msg The message to encrypt
+///
+/// @returns The bytes of the frame, or an empty vector on error
+vec seal_frame(const vec &key, const vec &msg) {
+  unsigned char iv[AES_IVSIZE];
+  if (!RAND_bytes(iv, AES_IVSIZE)) {
+    log_msg(LOG_ERROR, "Error in RAND_bytes()");
+    return {};
+  }
+  EVP_CIPHER_CTX *ctx = create_aes_context(frame_key(key, iv), true);
+  if (ctx == nullptr)
+    return {};
+  ContextManager cm([&]() { reclaim_aes_context(ctx); });
+  vec enc = aes_crypt_msg(ctx, msg);
+  if (enc.empty())
+    return {};
+  vec res;
+  res.reserve(sizeof(int) + AES_IVSIZE + enc.size());
+  vec_append(res, (int)enc.size());
+  res.insert(res.end(), iv, iv + AES_IVSIZE);
+  vec_append(res, enc);
+  return res;
+}
+
+/// Decrypt the body of a session frame, i.e., the @iv.@e that follows len(@e)
+///
+/// @param key   The session's AES key
+/// @param frame A pointer to the first byte of @iv
+/// @param len   The number of bytes in @iv.@e
+/// @param msg   The vector that receives the decrypted message
+///
+/// @returns false if the frame is malformed or can't be decrypted
+bool open_frame(const vec &key, const unsigned char *frame, size_t len,
+                vec &msg) {
+  if (len <= (size_t)AES_IVSIZE)
+    return false;
+  EVP_CIPHER_CTX *ctx = create_aes_context(frame_key(key, frame), false);
+  if (ctx == nullptr)
+    return false;
+  ContextManager cm([&]() { reclaim_aes_context(ctx); });
+  msg = aes_crypt_msg(ctx, frame + AES_IVSIZE, len - AES_IVSIZE);
+  return !msg.empty();
+}
+
+/// Encrypt a message as a session frame and send it over a socket
+///
+/// @param sd  The socket on which to send
+/// @param key The session's AES key
+/// @param msg The message to send
+///
+/// @returns true if the whole frame was sent, false otherwise
+bool send_frame(int sd, const vec &key, const vec &msg) {
+  vec frame = seal_frame(key, msg);
+  return !frame.empty() && send_reliably(sd, frame);
+}
+
+/// Receive one session frame from a socket and decrypt it
+///
+/// @param sd  The socket from which to read
+/// @param key The session's AES key
+/// @param max The largest acceptable len(@e)
+/// @param msg The vector that receives the decrypted message
+///
+/// @returns 1 if a frame was received, 0 if the socket reached EOF cleanly
+///          before a new frame, and -1 on any error
+int recv_frame(int sd, const vec &key, int max, vec &msg) {
+  vec lenbuf(sizeof(int));
+  int got = reliable_get_to_eof_or_n(sd, lenbuf.begin(), sizeof(int));
+  if (got == 0)
+    return 0;
+  if (got != sizeof(int))
+    return -1;
+  int len;
+  memcpy(&len, lenbuf.data(), sizeof(int));
+  if (len <= 0 || len > max)
+    return -1;
+  vec frame(AES_IVSIZE + len);
+  if (reliable_get_to_eof_or_n(sd, frame.begin(), frame.size()) !=
+      (int)frame.size())
+    return -1;
+  return open_frame(key, frame.data(), frame.size(), msg) ? 1 : -1;
+}
+
+/// Read exactly n AES-encrypted bytes from a socket, and decrypt them as they
+/// arrive, AES_IO_CHUNK bytes at a time.  The ciphertext is never buffered in
+/// full, so the only large allocation is the caller's output vector.
+///
+/// @param sd  The socket from which to read
+/// @param ctx A decryption context whose key is already set
+/// @param n   The number of encrypted bytes to read
+/// @param out The vector that receives the decrypted bytes
+///
+/// @returns 1 on success, 0 if the socket closed (or failed) before n bytes
+///          arrived, and -1 if the bytes could not be decrypted, in which case
+///          the rest of them are left unread
+int recv_decrypt(int sd, EVP_CIPHER_CTX *ctx, int n, vec &out) {
+  const int most = AES_IO_CHUNK;
+  vec chunk(min(n, most));
+  out.resize(n + EVP_MAX_BLOCK_LENGTH);
+  int total = 0;
+  for (int pos = 0; pos < n; pos += most) {
+    int want = min(n - pos, most);
+    if (reliable_get_to_eof_or_n(sd, chunk.begin(), want) != want) {
+      out.clear();
+      return 0;
+    }
+    int got = aes_crypt_update(ctx, chunk.data(), want, out.data() + total);
+    if (got < 0) {
+      out.clear();
+      return -1;
+    }
+    total += got;
+  }
+  int got = aes_crypt_final(ctx, out.data() + total);
+  if (got < 0) {
+    out.clear();
+    return -1;
+  }
+  out.resize(total + got);
+  return 1;
+}
+
+/// Read AES-encrypted bytes from a socket until EOF, and decrypt them as they
+/// arrive.  If the bytes turn out not to be valid ciphertext, then they are
+/// probably an unencrypted error code, so out receives the raw bytes instead,
+/// as long as there are no more than AES_BLOCKSIZE of them.
+///
+/// @param sd  The socket from which to read
+/// @param ctx A decryption context whose key is already set
+/// @param out The vector that receives the decrypted (or raw) bytes
+///
+/// @returns true if out holds decrypted bytes
+bool recv_decrypt_to_eof(int sd, EVP_CIPHER_CTX *ctx, vec &out) {
+  vec chunk(AES_IO_CHUNK), head;
+  out.clear();
+  size_t total = 0, seen = 0;
+  bool ok = true;
+  while (true) {
+    int got = reliable_get_to_eof_or_n(sd, chunk.begin(), AES_IO_CHUNK);
+    if (got < 0) {
+      out.clear();
+      return false;
+    }
+    // NB: only a short response can be an unencrypted error code
+    if (seen == 0)
+      head.assign(chunk.begin(), chunk.begin() + min(got, AES_BLOCKSIZE));
+    seen += got;
+    if (got > 0 && ok) {
+      out.resize(total + got + EVP_MAX_BLOCK_LENGTH);
+      int dec = aes_crypt_update(ctx, chunk.data(), got, out.data() + total);
+      ok = dec >= 0;
+      total += ok ? dec : 0;
+    }
+    if (got < (int)AES_IO_CHUNK)
+      break;
+  }
+  if (ok) {
+    out.resize(total + EVP_MAX_BLOCK_LENGTH);
+    int dec = aes_crypt_final(ctx, out.data() + total);
+    ok = dec >= 0;
+    total += ok ? dec : 0;
+  }
+  if (!ok) {
+    out = seen <= (size_t)AES_BLOCKSIZE ? head : vec();
+    return false;
+  }
+  out.resize(total);
+  return true;
+}
+
+/// Encrypt part of a message and send it over a socket, AES_IO_CHUNK bytes at
+/// a time.  The last partial cipher block stays in the context, so parts can
+/// be sent one after another, until send_encrypt_final() ends the message.
+///
+/// @param sd  The socket on which to send
+/// @param ctx An encryption context whose key is already set
+/// @param msg A pointer to the bytes to encrypt
+/// @param len The number of bytes to encrypt
+///
+/// @returns true if the part was encrypted and sent
+bool send_encrypt_part(int sd, EVP_CIPHER_CTX *ctx, const unsigned char *msg,
+                       size_t len) {
+  vec enc(min(len, AES_IO_CHUNK) + EVP_MAX_BLOCK_LENGTH);
+  for (size_t pos = 0; pos < len; pos += AES_IO_CHUNK) {
+    size_t chunk = min(len - pos, AES_IO_CHUNK);
+    int got = aes_crypt_update(ctx, msg + pos, chunk, enc.data());
+    if (got < 0)
+      return false;
+    if (got > 0 && !send_gather(sd, {{enc.data(), (size_t)got}}))
+      return false;
+  }
+  return true;
+}
+
+/// Finish a message that was sent with send_encrypt_part(), by padding and
+/// sending its last cipher block
+///
+/// @param sd  The socket on which to send
+/// @param ctx The encryption context that encrypted the message's parts
+///
+/// @returns true if the last block was sent
+bool send_encrypt_final(int sd, EVP_CIPHER_CTX *ctx) {
+  vec enc(EVP_MAX_BLOCK_LENGTH);
+  int got = aes_crypt_final(ctx, enc.data());
+  if (got < 0)
+    return false;
+  enc.resize(got);
+  return got == 0 || send_reliably(sd, enc);
+}
+
+/// Encrypt a message and send it over a socket, AES_IO_CHUNK bytes at a time,
+/// so that the ciphertext is never buffered in full.  An unencrypted header
+/// goes out with the first chunk, and the padding with the last, so a short
+/// message takes a single system call.
+///
+/// @param sd   The socket on which to send
+/// @param ctx  An encryption context whose key is already set
+/// @param msg  A pointer to the bytes to encrypt
+/// @param len  The number of bytes to encrypt
+/// @param head Bytes to send, unencrypted, before the message
+///
+/// @returns true if the whole message was encrypted and sent
+bool send_encrypt(int sd, EVP_CIPHER_CTX *ctx, const unsigned char *msg,
+                  size_t len, const vec &head) {
+  // NB: room for a whole chunk, plus what update() and final() may add
+  vec enc(min(len, AES_IO_CHUNK) + 2 * EVP_MAX_BLOCK_LENGTH);
+  size_t pos = 0;
+  do {
+    size_t chunk = min(len - pos, AES_IO_CHUNK);
+    int got = aes_crypt_update(ctx, msg + pos, chunk, enc.data());
+    if (got < 0)
+      return false;
+    if (pos + chunk == len) {
+      int fin = aes_crypt_final(ctx, enc.data() + got);
+      if (fin < 0)
+        return false;
+      got += fin;
+    }
+    vector<iovec> parts;
+    if (pos == 0)
+      parts.push_back({(void *)head.data(), head.size()});
+    parts.push_back({enc.data(), (size_t)got});
+    if (!send_gather(sd, parts))
+      return false;
+    pos += chunk;
+  } while (pos < len);
+  return true;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+
+#include "crypto.h"
+#include "vec.h"
+
+/// The most bytes that are encrypted and sent, or received and decrypted, at
+/// once when a message is streamed.  Larger chunks mean fewer system calls,
+/// at the cost of a larger buffer per message.
+const size_t AES_IO_CHUNK = 65536;
+
+/// Encrypt a message as a session frame, using the session's AES key and a
+/// fresh random iv.  The result is len(@e).@iv.@e, ready to send.
+///
+/// @param key The session's AES key.  Only the key part is used; the iv part
+///            is replaced by the frame's iv.
+/// @param msg The message to encrypt
+///
+/// @returns The bytes of the frame, or an empty vector on error
+vec seal_frame(const vec &key, const vec &msg);
+
+/// Decrypt the body of a session frame, i.e., the @iv.@e that follows len(@e)
+///
+/// @param key   The session's AES key
+/// @param frame A pointer to the first byte of @iv
+/// @param len   The number of bytes in @iv.@e
+/// @param msg   The vector that receives the decrypted message
+///
+/// @returns false if the frame is malformed or can't be decrypted
+bool open_frame(const vec &key, const unsigned char *frame, size_t len,
+                vec &msg);
+
+/// Encrypt a message as a session frame and send it over a socket
+///
+/// @param sd  The socket on which to send
+/// @param key The session's AES key
+/// @param msg The message to send
+///
+/// @returns true if the whole frame was sent, false otherwise
+bool send_frame(int sd, const vec &key, const vec &msg);
+
+/// Receive one session frame from a socket and decrypt it
+///
+/// @param sd  The socket from which to read
+/// @param key The session's AES key
+/// @param max The largest acceptable len(@e)
+/// @param msg The vector that receives the decrypted message
+///
+/// @returns 1 if a frame was received, 0 if the socket reached EOF cleanly
+///          before a new frame, and -1 on any error
+int recv_frame(int sd, const vec &key, int max, vec &msg);
+
+/// Read exactly n AES-encrypted bytes from a socket, and decrypt them as they
+/// arrive, AES_IO_CHUNK bytes at a time.  The ciphertext is never buffered in
+/// full, so the only large allocation is the caller's output vector.
+///
+/// @param sd  The socket from which to read
+/// @param ctx A decryption context whose key is already set
+/// @param n   The number of encrypted bytes to read
+/// @param out The vector that receives the decrypted bytes
+///
+/// @returns 1 on success, 0 if the socket closed (or failed) before n bytes
+///          arrived, and -1 if the bytes could not be decrypted, in which case
+///          the rest of them are left unread
+int recv_decrypt(int sd, EVP_CIPHER_CTX *ctx, int n, vec &out);
+
+/// Read AES-encrypted bytes from a socket until EOF, and decrypt them as they
+/// arrive.  If the bytes turn out not to be valid ciphertext, then they are
+/// probably an unencrypted error code, so out receives the raw bytes instead,
+/// as long as there are no more than AES_BLOCKSIZE of them.
+///
+/// @param sd  The socket from which to read
+/// @param ctx A decryption context whose key is already set
+/// @param out The vector that receives the decrypted (or raw) bytes
+///
+/// @returns true if out holds decrypted bytes
+bool recv_decrypt_to_eof(int sd, EVP_CIPHER_CTX *ctx, vec &out);
+
+/// Encrypt part of a message and send it over a socket, AES_IO_CHUNK bytes at
+/// a time.  The last partial cipher block stays in the context, so parts can
+/// be sent one after another, until send_encrypt_final() ends the message.
+///
+/// @param sd  The socket on which to send
+/// @param ctx An encryption context whose key is already set
+/// @param msg A pointer to the bytes to encrypt
+/// @param len The number of bytes to encrypt
+///
+/// @returns true if the part was encrypted and sent
+bool send_encrypt_part(int sd, EVP_CIPHER_CTX *ctx, const unsigned char *msg,
+                       size_t len);
+
+/// Finish a message that was sent with send_encrypt_part(), by padding and
+/// sending its last cipher block
+///
+/// @param sd  The socket on which to send
+/// @param ctx The encryption context that encrypted the message's parts
+///
+/// @returns true if the last block was sent
+bool send_encrypt_final(int sd, EVP_CIPHER_CTX *ctx);
+
+/// Encrypt a message and send it over a socket, AES_IO_CHUNK bytes at a time,
+/// so that the ciphertext is never buffered in full.  An unencrypted header
+/// goes out with the first chunk, and the padding with the last, so a short
+/// message takes a single system call.
+///
+/// @param sd   The socket on which to send
+/// @param ctx  An encryption context whose key is already set
+/// @param msg  A pointer to the bytes to encrypt
+/// @param len  The number of bytes to encrypt
+/// @param head Bytes to send, unencrypted, before the message
+///
+/// @returns true if the whole message was encrypted and sent
+bool send_encrypt(int sd, EVP_CIPHER_CTX *ctx, const unsigned char *msg,
+                  size_t len, const vec &head = {});
@@ -7,6 +7,16 @@
 /// clutter the code with long names
 typedef std::vector<unsigned char> vec;
 
+/// bytes_t is a non-owning view of a run of bytes inside a larger buffer.  It
+/// is only valid for as long as that buffer is unchanged.
+struct bytes_t {
+  /// The first byte of the run
+  const unsigned char *data = nullptr;
+
+  /// The number of bytes in the run
+  size_t size = 0;
+};
+
 /// Create a vector from a string, by copying the string contents into the
 /// vector
 ///
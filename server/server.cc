@@ -1,26 +1,116 @@
+#include <chrono>
+#include <csignal>
+#include <fstream>
 #include <iostream>
 #include <openssl/rsa.h>
+#include <thread>
 
+#include "../common/bufpool.h"
 #include "../common/contextmanager.h"
 #include "../common/crypto.h"
 #include "../common/file.h"
+#include "../common/log.h"
 #include "../common/net.h"
+#include "../common/pool.h"
+#include "../common/protocol.h"
+#include "../common/ring.h"
 
+#include "server_admission.h"
 #include "server_args.h"
+#include "server_mapreduce.h"
+#include "server_metrics.h"
 #include "server_parsing.h"
+#include "server_passhash.h"
+#include "server_quotas.h"
+#include "server_reactor.h"
+#include "server_replication.h"
 #include "server_storage.h"
+#include "server_tickets.h"
+#include "server_topk.h"
 
 using namespace std;
 
+/// The number of accepted connections that may wait in the queue, per worker
+/// thread
+const int QUEUE_PER_THREAD = 4;
+
+/// The number of users to hash and register at once during an import
+const size_t IMPORT_BATCH = 256;
+
+/// Register every user in a file, one name:password per line.  The name ends
+/// at the first ':', so a password may contain ':' but a name may not.
+/// Passwords are hashed a batch at a time, in parallel.
+///
+/// @param storage The Storage object into which users are imported
+/// @param file    The name of the file
+///
+/// @returns false if the file can't be read or holds an invalid line, or if
+///          the users can't be logged
+static bool import_users(Storage &storage, const string &file) {
+  ifstream in(file);
+  if (!in) {
+    log_msg(LOG_ERROR, "Unable to open " + file);
+    return false;
+  }
+  size_t added = 0, existed = 0, lineno = 0;
+  vector<string> lines;
+  string line;
+  bool ok = true;
+  while (ok) {
+    ok = (bool)getline(in, line);
+    if (ok) {
+      ++lineno;
+      size_t colon = line.find(':');
+      if (colon == 0 || colon == string::npos || colon > (size_t)LEN_UNAME ||
+          line.length() - colon - 1 > (size_t)LEN_PASS) {
+        log_msg(LOG_ERROR,
+                "Invalid line " + to_string(lineno) + " in " + file);
+        return false;
+      }
+      lines.push_back(line);
+    }
+    if (lines.size() == IMPORT_BATCH || (!ok && !lines.empty())) {
+      vector<pair<string_view, string_view>> users;
+      for (auto &l : lines) {
+        string_view v(l);
+        size_t colon = v.find(':');
+        users.push_back({v.substr(0, colon), v.substr(colon + 1)});
+      }
+      for (auto &res : storage.add_users(users)) {
+        if (res == vec_from_string(RES_ERR_SERVER)) {
+          log_msg(LOG_ERROR, "Could not log the users imported from " + file);
+          return false;
+        }
+        ++(res == vec_from_string(RES_OK) ? added : existed);
+      }
+      lines.clear();
+    }
+  }
+  log_msg(LOG_INFO, "Imported " + to_string(added) + " users from " + file +
+                        " (" + to_string(existed) + " already existed)");
+  // NB: make the import durable right away, instead of waiting for a SAV
+  storage.persist();
+  return true;
+}
+
 int main(int argc, char **argv) {
   // Parse the command-line arguments
   server_arg_t args;
   parse_args(argc, argv, args);
+  log_level_t level;
+  args.usage |= !log_parse_level(args.log_level, level);
   if (args.usage) {
     usage(argv[0]);
     return 0;
   }
 
+  // Every socket, for clients and for replication, gets the same options
+  net_opts_t net;
+  net.nodelay = !args.nagle;
+  net.sndbuf = args.sndbuf_kb * 1024;
+  net.rcvbuf = args.rcvbuf_kb * 1024;
+  net_configure(net);
+
   // print the configuration
   cout << "Listening on port " << args.port << " using (key/data) = ("
        << args.keyfile << ", " << args.datafile << ")\n";
@@ -40,21 +130,123 @@ int main(int argc, char **argv) {
 
   // If the data file exists, load the data into a Storage object.  Otherwise,
   // create an empty Storage object.
-  Storage storage(args.datafile);
+  log_opts_t log;
+  log.enabled = args.wal;
+  log.sync_ms = args.wal_sync_ms;
+  log.compact_bytes = (size_t)args.compact_kb * 1024;
+  log.compact_secs = args.compact_secs;
+  Storage storage(args.datafile, args.buckets, log, args.zlevel,
+                  (size_t)args.cache_mb * 1048576, args.segments, args.verify);
   if (!storage.load()) {
     return 0;
   }
 
-  // Start listening for connections.
-  int sd = create_server_socket(args.port);
+  // A shard keeps only the content of its own users, and takes them from the
+  // old shards' files when the ring changes
+  if (args.ring != "") {
+    HashRing ring(ring_parse(args.ring));
+    auto owns = [&](string_view user) {
+      return ring.owner(user) == (size_t)args.shard;
+    };
+    if (!storage.reshard(args.reshard_files, owns))
+      return 0;
+  }
+
+  // Salted hashes are slow, so batches of them are spread over every core
+  pass_hash_init(args.hash_iters, thread::hardware_concurrency());
+  ContextManager ph([&]() { pass_hash_stop(); });
+  // Map/reduce runs spread the auth table's shards over every core, too
+  mr_init(args.datafile, thread::hardware_concurrency());
+  ContextManager mr([&]() { mr_stop(); });
+  quota_init(args.quota_secs, args.quota_reqs, args.quota_up, args.quota_down);
+  if (args.import_file != "" && !import_users(storage, args.import_file))
+    return 0;
+
+  // From here on, messages are written by a background thread, so that the
+  // threads serving clients never block on stdout or stderr
+  log_start(level, args.log_rate);
+
+  // A primary streams every change to its followers, and a follower applies
+  // them.  Both use the server's RSA key to agree on a key for the stream.
+  if (args.repl_port > 0 && !repl_serve(args.repl_port, pri, storage))
+    return 0;
+  if (args.primary != "")
+    repl_follow(args.primary.substr(0, args.primary.rfind(':')),
+                primary_port(args.primary), pri, storage);
+
+  // Tickets let repeat clients skip RSA.  They live only in memory.
+  TicketCache tickets(args.ticket_cap, args.ticket_ttl);
+
+  // Start listening for connections.  A client that disconnects early must
+  // not kill the whole server, so ignore SIGPIPE and let send() fail instead.
+  signal(SIGPIPE, SIG_IGN);
+  int sd = create_server_socket(args.port, args.backlog);
   ContextManager csd([&]() { close(sd); });
 
-  // On a connection, parse the message, then dispatch
-  accept_client(sd,
-                [&](int sd) { return serve_client(sd, pri, pub, storage); });
+  // The queue holds a few connections (or requests) per worker, so that short
+  // bursts don't stall the listening thread.  With admission control, it holds
+  // as many as asked, and requests beyond that are refused instead.
+  admission_init(args.queue > 0, args.deadline_ms);
+  thread_pool pool(args.threads, args.queue > 0
+                                     ? args.queue
+                                     : args.threads * QUEUE_PER_THREAD);
+
+  // Let the admin read the metrics, and add the gauges that other modules keep
+  metrics_set_admin(args.admin);
+  topk_init(args.top_k);
+  metric_section(topk_report);
+  metric_gauge("queue_depth", [&]() { return pool.queue_depth(); });
+  metric_gauge("aes_pool_hits", []() { return aes_pool_stats().hits; });
+  metric_gauge("aes_pool_misses", []() { return aes_pool_stats().misses; });
+  metric_gauge("aes_pool_live", []() { return aes_pool_stats().live; });
+  metric_gauge("buf_pool_hits", []() { return buf_pool_stats().hits; });
+  metric_gauge("buf_pool_misses", []() { return buf_pool_stats().misses; });
+  metric_gauge("buf_pool_cached_bytes",
+               []() { return buf_pool_stats().cached_bytes; });
+  metric_gauge("get_cache_hits",
+               [&]() { return storage.response_cache_stats().hits; });
+  metric_gauge("get_cache_misses",
+               [&]() { return storage.response_cache_stats().misses; });
+  metric_gauge("get_cache_bytes",
+               [&]() { return storage.response_cache_stats().bytes; });
+  metric_gauge("get_cache_entries",
+               [&]() { return storage.response_cache_stats().entries; });
+  metric_gauge("repl_followers", []() { return repl_stats().followers; });
+  metric_gauge("repl_records_sent", []() { return repl_stats().sent; });
+  metric_gauge("repl_records_applied", []() { return repl_stats().applied; });
+  metric_gauge("repl_queued_bytes",
+               []() { return repl_stats().queued_bytes; });
+  metric_gauge("compaction_runs",
+               [&]() { return storage.compaction_stats().runs; });
+  metric_gauge("compaction_last_ms",
+               [&]() { return storage.compaction_stats().last_ms; });
+  metric_gauge("compaction_total_ms",
+               [&]() { return storage.compaction_stats().total_ms; });
+  metric_gauge("compaction_bytes_reclaimed",
+               [&]() { return storage.compaction_stats().bytes_reclaimed; });
+  if (args.metrics_file != "")
+    metrics_start_dump(args.metrics_file, args.metrics_secs);
+
+  if (args.reactor) {
+    // Let the event loop read requests, and use the pool for RSA/AES work
+    serve_reactor(sd, pool, pri, pub, storage, tickets);
+  } else {
+    // On a connection, hand the socket to a worker thread, which will parse
+    // the message and then dispatch it.
+    accept_client(
+        sd, pool,
+        [&](int sd, chrono::steady_clock::time_point accepted) {
+          return serve_client(sd, pri, pub, storage, tickets, accepted);
+        },
+        admission_refuses() ? admission_refuse : nullptr);
+  }
 
-  // When accept_client returns, it means we received a BYE command, so shut
-  // down the storage and close the server socket
+  // When accept_client returns, it means we received a BYE command and every
+  // worker has finished, so stop replication, shut down the storage, and
+  // close the server socket
+  metrics_stop_dump();
+  repl_stop();
   storage.shutdown();
+  log_stop();
   cerr << "Server terminated\n";
 }
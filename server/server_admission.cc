@@ -0,0 +1,80 @@
+#include <chrono>
+#include <sys/socket.h>
+
+#include "../common/net.h"
+#include "../common/protocol.h"
+
+#include "server_admission.h"
+#include "server_metrics.h"
+
+using namespace std;
+
+/// Refuse connections when the queue is full?
+static bool refuse_full = false;
+
+/// The longest that a request may wait for a worker (0 for no limit)
+static chrono::milliseconds deadline(0);
+
+/// Configure admission control.  Until this is called, nothing is refused.
+///
+/// @param refuse_when_full Refuse connections when the queue is full?
+/// @param deadline_ms      The longest that a request may wait for a worker,
+///                         in milliseconds (0 for no limit)
+void admission_init(bool refuse_when_full, int deadline_ms) {
+  refuse_full = refuse_when_full;
+  deadline = chrono::milliseconds(deadline_ms > 0 ? deadline_ms : 0);
+}
+
+/// Check if connections should be refused when the queue is full
+///
+/// @returns true if admission_init() asked for it
+bool admission_refuses() { return refuse_full; }
+
+/// Check if a request has waited too long to be worth doing, and count it if
+/// so
+///
+/// @param queued The time at which the request started waiting
+///
+/// @returns true if the request should be refused
+bool admission_late(chrono::steady_clock::time_point queued) {
+  if (deadline.count() == 0 ||
+      chrono::steady_clock::now() - queued <= deadline)
+    return false;
+  metric_add(CNT_SHED_LATE);
+  return true;
+}
+
+/// Count a connection that is refused because the queue is full
+void admission_count_full() { metric_add(CNT_SHED_FULL); }
+
+/// Send RES_ERR_BUSY on a connection, without reading the request, and get it
+/// ready to close (see admission_linger())
+///
+/// @param sd The connection's socket
+void admission_send_busy(int sd) {
+  send_reliably(sd, RES_ERR_BUSY);
+  admission_linger(sd);
+}
+
+/// Get a connection that was refused ready to close.  Closing a socket with
+/// unread bytes resets the connection, which may destroy the response before
+/// the client reads it.  So this ends the response, and then reads whatever
+/// part of the request has already arrived, without waiting for the rest.
+///
+/// @param sd The connection's socket
+void admission_linger(int sd) {
+  shutdown(sd, SHUT_WR);
+  unsigned char junk[4096];
+  while (recv(sd, junk, sizeof(junk), MSG_DONTWAIT) > 0)
+    ;
+}
+
+/// Refuse a connection because the queue is full: count it, and send
+/// RES_ERR_BUSY without reading the request
+///
+/// @param sd The connection's socket
+void admission_refuse(int sd) {
+  admission_count_full();
+  metric_add(CNT_CONNECTIONS);
+  admission_send_busy(sd);
+}
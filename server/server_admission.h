@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+
+/// When the server is overloaded, it is better to refuse some requests quickly
+/// than to make every request wait longer and longer.  Admission control sheds
+/// load at two points, both before any RSA or AES work is done:
+///
+/// - A connection that arrives while the queue of work for the worker threads
+///   is full is refused at once, instead of waiting for room.
+/// - A request that waited longer than the deadline before a worker got to it
+///   is refused, since its client has likely given up.
+///
+/// A refused request gets an unencrypted RES_ERR_BUSY, and has no effect.  In
+/// a session, only the handshake can be refused: once a client holds a
+/// session, its frames are always served.  Refusals are counted in the
+/// shed_queue_full and shed_deadline metrics.
+
+/// Configure admission control.  Until this is called, nothing is refused.
+///
+/// @param refuse_when_full Refuse connections when the queue is full?
+/// @param deadline_ms      The longest that a request may wait for a worker,
+///                         in milliseconds (0 for no limit)
+void admission_init(bool refuse_when_full, int deadline_ms);
+
+/// Check if connections should be refused when the queue is full
+///
+/// @returns true if admission_init() asked for it
+bool admission_refuses();
+
+/// Check if a request has waited too long to be worth doing, and count it if
+/// so
+///
+/// @param queued The time at which the request started waiting
+///
+/// @returns true if the request should be refused
+bool admission_late(std::chrono::steady_clock::time_point queued);
+
+/// Count a connection that is refused because the queue is full
+void admission_count_full();
+
+/// Send RES_ERR_BUSY on a connection, without reading the request, and get it
+/// ready to close (see admission_linger())
+///
+/// @param sd The connection's socket
+void admission_send_busy(int sd);
+
+/// Get a connection that was refused ready to close.  Closing a socket with
+/// unread bytes resets the connection, which may destroy the response before
+/// the client reads it.  So this ends the response, and then reads whatever
+/// part of the request has already arrived, without waiting for the rest.
+///
+/// @param sd The connection's socket
+void admission_linger(int sd);
+
+/// Refuse a connection because the queue is full: count it, and send
+/// RES_ERR_BUSY without reading the request
+///
+/// @param sd The connection's socket
+void admission_refuse(int sd);
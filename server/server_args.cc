@@ -2,10 +2,26 @@
 #include <libgen.h>
 #include <unistd.h>
 
+#include "../common/ring.h"
+
 #include "server_args.h"
+#include "server_snapshot.h"
 
 using namespace std;
 
+/// Find the port in a host:port address
+///
+/// @param addr The address
+///
+/// @returns The port, or 0 if the address has no host or no valid port
+int primary_port(const string &addr) {
+  size_t colon = addr.rfind(':');
+  if (colon == 0 || colon == string::npos || colon + 1 == addr.length() ||
+      addr.find_first_not_of("0123456789", colon + 1) != string::npos)
+    return 0;
+  return atoi(addr.c_str() + colon + 1);
+}
+
 /// Parse the command-line arguments, and use them to populate the provided args
 /// object.
 ///
@@ -14,7 +30,10 @@ using namespace std;
 /// @param args The struct into which the parsed args should go
 void parse_args(int argc, char **argv, server_arg_t &args) {
   long opt;
-  while ((opt = getopt(argc, argv, "p:f:k:ht:b:i:u:d:r:o:a:")) != -1) {
+  const char *opts =
+      "p:f:k:ht:q:Q:D:NB:U:b:T:C:l:L:P:a:M:S:v:R:H:I:z:c:j:i:u:d:r:o:s:F:G:"
+      "g:m:eV";
+  while ((opt = getopt(argc, argv, opts)) != -1) {
     switch (opt) {
     case 'p':
       args.port = atoi(optarg);
@@ -28,20 +47,144 @@ void parse_args(int argc, char **argv, server_arg_t &args) {
     case 'h':
       args.usage = true;
       break;
+    case 'e':
+      args.reactor = true;
+      break;
     case 't':
+      args.threads = atoi(optarg);
+      args.usage |= args.threads < 1;
+      break;
+    case 'q':
+      args.backlog = atoi(optarg);
+      args.usage |= args.backlog < 1;
+      break;
+    case 'Q':
+      args.queue = atoi(optarg);
+      args.usage |= args.queue < 0;
+      break;
+    case 'D':
+      args.deadline_ms = atoi(optarg);
+      args.usage |= args.deadline_ms < 0;
+      break;
+    case 'N':
+      args.nagle = true;
+      break;
+    case 'B':
+      args.sndbuf_kb = atoi(optarg);
+      args.usage |= args.sndbuf_kb < 0 || args.sndbuf_kb > 1048576;
+      break;
+    case 'U':
+      args.rcvbuf_kb = atoi(optarg);
+      args.usage |= args.rcvbuf_kb < 0 || args.rcvbuf_kb > 1048576;
+      break;
     case 'b':
+      args.buckets = atoi(optarg);
+      args.usage |= args.buckets < 1;
+      break;
+    case 'T':
+      args.ticket_ttl = atoi(optarg);
+      args.usage |= args.ticket_ttl < 0;
+      break;
+    case 'C':
+      args.ticket_cap = atoi(optarg);
+      args.usage |= args.ticket_cap < 1;
+      break;
+    case 'l':
+      args.wal = true;
+      args.wal_sync_ms = atoi(optarg);
+      break;
+    case 'L':
+      args.compact_kb = atoi(optarg);
+      args.usage |= args.compact_kb < 0;
+      break;
+    case 'P':
+      args.compact_secs = atoi(optarg);
+      args.usage |= args.compact_secs < 0;
+      break;
+    case 'a':
+      args.admin = string(optarg);
+      break;
+    case 'M':
+      args.metrics_file = string(optarg);
+      break;
+    case 'S':
+      args.metrics_secs = atoi(optarg);
+      args.usage |= args.metrics_secs < 1;
+      break;
+    case 'v':
+      args.log_level = string(optarg);
+      break;
+    case 'R':
+      args.log_rate = atoi(optarg);
+      args.usage |= args.log_rate < 0;
+      break;
+    case 'H':
+      args.hash_iters = atoi(optarg);
+      args.usage |= args.hash_iters < 0;
+      break;
+    case 'I':
+      args.import_file = string(optarg);
+      break;
+    case 'z':
+      args.zlevel = atoi(optarg);
+      args.usage |= args.zlevel < 0 || args.zlevel > 9;
+      break;
+    case 'c':
+      args.cache_mb = atoi(optarg);
+      args.usage |= args.cache_mb < 0;
+      break;
+    case 'j':
+      args.segments = atoi(optarg);
+      args.usage |= args.segments < 1 || args.segments > (int)SNAP_MAX_SEGMENTS;
+      break;
+    case 'V':
+      args.verify = false;
+      break;
     case 'i':
+      args.quota_secs = atoi(optarg);
+      args.usage |= args.quota_secs <= 0;
+      break;
     case 'u':
+      args.quota_up = strtoull(optarg, nullptr, 10);
+      break;
     case 'd':
+      args.quota_down = strtoull(optarg, nullptr, 10);
+      break;
     case 'r':
+      args.quota_reqs = strtoull(optarg, nullptr, 10);
+      break;
     case 'o':
-    case 'a':
+      args.top_k = atoi(optarg);
+      args.usage |= args.top_k < 0;
+      break;
+    case 's':
+      args.repl_port = atoi(optarg);
+      args.usage |= args.repl_port <= 0;
+      break;
+    case 'F':
+      args.primary = string(optarg);
+      args.usage |= primary_port(args.primary) <= 0;
+      break;
+    case 'G':
+      args.ring = string(optarg);
+      break;
+    case 'g':
+      args.shard = atoi(optarg);
+      break;
+    case 'm':
+      args.reshard_files.push_back(optarg);
       break;
     default:
       args.usage = true;
       return;
     }
   }
+  // NB: a follower's users only come from its primary
+  args.usage |= args.primary != "" && args.import_file != "";
+  // A shard must know its place in the ring
+  int shards = ring_parse(args.ring).size();
+  args.usage |= args.ring != "" && (args.shard < 0 || args.shard >= shards);
+  args.usage |= args.ring == "" && !args.reshard_files.empty();
 }
 
 /// Display a help message to explain how the command-line parameters for this
@@ -53,13 +196,62 @@ void usage(char *progname) {
        << "  -p [int]    Port on which to listen for incoming connections\n"
        << "  -f [string] File for storing all data\n"
        << "  -k [string] Basename of file for storing the server's RSA keys\n"
-       << "  -t [int]    Ignored\n"
-       << "  -b [int]    Ignored\n"
-       << "  -i [int]    Ignored\n"
-       << "  -u [int]    Ignored\n"
-       << "  -d [int]    Ignored\n"
-       << "  -r [int]    Ignored\n"
-       << "  -o [int]    Ignored\n"
-       << "  -a [string] Ignored\n"
+       << "  -t [int]    Number of worker threads\n"
+       << "  -e          Use an event loop; -t threads only do RSA/AES work\n"
+       << "  -q [int]    Most connections that may wait to be accepted\n"
+       << "              (default 128)\n"
+       << "  -Q [int]    Refuse requests (ERR_BUSY) once this many wait for a\n"
+       << "              thread (default 0, to make them wait for room)\n"
+       << "  -D [int]    Refuse requests (ERR_BUSY) that wait this many ms\n"
+       << "              for a thread (default 0, for no limit)\n"
+       << "  -N          Leave Nagle's algorithm on (no TCP_NODELAY)\n"
+       << "  -B [int]    KB of kernel send buffer per connection (default 0,\n"
+       << "              for the kernel's default)\n"
+       << "  -U [int]    KB of kernel receive buffer per connection (default\n"
+       << "              0, for the kernel's default)\n"
+       << "  -b [int]    Number of buckets in the auth table\n"
+       << "  -T [int]    Lifetime of session tickets, in seconds (0 disables)\n"
+       << "  -C [int]    Most session tickets that may be valid at once\n"
+       << "  -l [int]    Use a write-ahead log, with fsync before each reply\n"
+       << "              (0), every N ms (N > 0), or never (-1)\n"
+       << "  -L [int]    Compact the log once it reaches N KB (0 for never)\n"
+       << "  -P [int]    Compact the log every N seconds (0 for never)\n"
+       << "  -a [string] Name of the admin user, who may read metrics (MET)\n"
+       << "  -M [file]   Dump metrics to this file every -S seconds\n"
+       << "  -S [int]    Seconds between metrics dumps (default 10)\n"
+       << "  -v [string] Log level: debug, info, warn, or error (default\n"
+       << "              info)\n"
+       << "  -R [int]    Most log messages per second (default 1000, 0 for no\n"
+       << "              limit)\n"
+       << "  -H [int]    PBKDF2 iterations for new passwords (default 4096, 0\n"
+       << "              for unsalted MD5)\n"
+       << "  -I [file]   Register the users in this file (name:password per\n"
+       << "              line) at startup\n"
+       << "  -z [int]    zlib level (1-9) at which to compress stored content\n"
+       << "              (default 0, for uncompressed)\n"
+       << "  -c [int]    MB of GET responses to cache (default 32; 0 for no\n"
+       << "              cache)\n"
+       << "  -j [int]    Segments in which to write the data file, each saved\n"
+       << "              and loaded by its own thread (default 1)\n"
+       << "  -V          Only check the sizes of the data file's segments at\n"
+       << "              startup, not their checksums, which read all of them\n"
+       << "  -i [int]    Quota interval, in seconds (default 60)\n"
+       << "  -u [int]    Bytes each user may upload per interval (0 for\n"
+       << "              no limit, the default)\n"
+       << "  -d [int]    Bytes each user may download per interval (0 for\n"
+       << "              no limit, the default)\n"
+       << "  -r [int]    Requests each user may make per interval (0 for\n"
+       << "              no limit, the default)\n"
+       << "  -o [int]    Report this many of the hottest GET and SET keys in\n"
+       << "              the metrics (default 0, for none)\n"
+       << "  -s [int]    Stream every change to followers that connect to\n"
+       << "              this port\n"
+       << "  -F [string] Follow the primary at host:port (its -s port), and\n"
+       << "              serve only GET and ALL\n"
+       << "  -G [string] Be a shard of the servers host:port,host:port,...,\n"
+       << "              keeping only the content of the users it owns\n"
+       << "  -g [int]    With -G, the index of this server in the list\n"
+       << "  -m [file]   With -G, take the users this shard owns from an old\n"
+       << "              shard's data file (may repeat; in use by no server)\n"
        << "  -h          Print help (this message)\n";
 }
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <vector>
 
 /// arg_t is used to store the command-line arguments of the program
 struct server_arg_t {
@@ -13,10 +15,129 @@ struct server_arg_t {
   /// The file holding the AES key
   std::string keyfile;
 
+  /// The number of worker threads that serve connections
+  int threads = 1;
+
+  /// Serve connections from an epoll event loop, with the worker threads used
+  /// only for RSA/AES work?
+  bool reactor = false;
+
+  /// The most connections that the kernel may hold before they are accepted
+  int backlog = 128;
+
+  /// The most requests that may wait for a worker thread before new ones are
+  /// refused with RES_ERR_BUSY (0 to make new ones wait for room instead)
+  int queue = 0;
+
+  /// The most milliseconds that a request may wait for a worker thread before
+  /// it is refused with RES_ERR_BUSY (0 for no limit)
+  int deadline_ms = 0;
+
+  /// Leave Nagle's algorithm on, instead of setting TCP_NODELAY?
+  bool nagle = false;
+
+  /// The sizes of each connection's kernel send and receive buffers, in KB (0
+  /// for the kernel's defaults)
+  int sndbuf_kb = 0, rcvbuf_kb = 0;
+
+  /// The number of buckets in the server's auth table
+  int buckets = 16;
+
+  /// The number of seconds for which a session ticket is valid (0 disables
+  /// tickets)
+  int ticket_ttl = 300;
+
+  /// The most session tickets that may be valid at once
+  int ticket_cap = 4096;
+
+  /// Make changes durable through a write-ahead log, instead of on SAV?
+  bool wal = false;
+
+  /// The log's fsync policy: 0 to sync before each reply (group commit), N > 0
+  /// to sync every N milliseconds, or < 0 to never sync
+  int wal_sync_ms = 0;
+
+  /// Compact the log once it reaches this many KB (0 for never)
+  int compact_kb = 0;
+
+  /// Compact a non-empty log every this many seconds (0 for never)
+  int compact_secs = 0;
+
+  /// The only user who may read the server's metrics ("" for nobody)
+  std::string admin = "";
+
+  /// The file to which metrics are dumped periodically ("" for none)
+  std::string metrics_file = "";
+
+  /// The number of seconds between metrics dumps
+  int metrics_secs = 10;
+
+  /// The lowest level of message to log: debug, info, warn, or error
+  std::string log_level = "info";
+
+  /// The most log messages to write per second (0 for no limit)
+  int log_rate = 1000;
+
+  /// The number of PBKDF2 iterations for new passwords (0 for unsalted MD5)
+  int hash_iters = 4096;
+
+  /// A file of users to register at startup, one name:password per line (""
+  /// for none)
+  std::string import_file = "";
+
+  /// The zlib level at which to compress users' content (0 to store it as it
+  /// is)
+  int zlevel = 0;
+
+  /// The most MB of GET responses to cache (0 for no cache)
+  int cache_mb = 32;
+
+  /// The number of segments in which to write the data file, each by its own
+  /// thread (1 for a single snapshot)
+  int segments = 1;
+
+  /// True to check the checksums of the data file's segments at startup,
+  /// which reads all of their content
+  bool verify = true;
+
+  /// The length of the quota interval, in seconds
+  int quota_secs = 60;
+
+  /// The most requests, bytes uploaded, and bytes downloaded per user per
+  /// quota interval (0 for no limit)
+  uint64_t quota_reqs = 0, quota_up = 0, quota_down = 0;
+
+  /// The number of hottest GET and SET keys to report with the metrics (0 to
+  /// not track them)
+  int top_k = 0;
+
+  /// The port on which to stream changes to followers (0 for none)
+  int repl_port = 0;
+
+  /// The primary to follow, as host:port of its replication port ("" to not
+  /// follow one)
+  std::string primary = "";
+
+  /// The servers of a sharded deployment, as host:port,host:port,... (""
+  /// when not sharded), and the index of this server among them
+  std::string ring = "";
+  int shard = -1;
+
+  /// The data files of the old shards, from which to take this shard's users
+  /// when the ring has changed
+  std::vector<std::string> reshard_files;
+
   /// Display a usage message?
   bool usage = false;
 };
 
+/// Find the port in a host:port address
+///
+/// @param addr The address
+///
+/// @returns The port, or 0 if the address has no host or no valid port
+int primary_port(const std::string &addr);
+
 /// Parse the command-line arguments, and use them to populate the provided args
 /// object.
 ///
@@ -0,0 +1,462 @@
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <vector>
+
+#include "../common/protocol.h"
+
+#include "server_authtable.h"
+#include "server_snapshot.h"
+
+using namespace std;
+
+/// The number of slots in a shard when it is first used
+static const size_t INITIAL_SLOTS = 16;
+
+/// slot_t is one user in a shard.  Everything but the content is inline, so
+/// that an auth check reads the slot and nothing else.  The hash comes first,
+/// so that it shares a cache line with the start of the name.
+struct slot_t {
+  /// The hashed password
+  char hash[AUTH_HASH_MAX];
+
+  /// The user's content, or nullptr if there is none
+  user_content_t *content;
+
+  /// The lengths of the hash and the name
+  uint8_t hlen;
+  uint8_t ulen;
+
+  /// The name, which is not NUL-terminated
+  char user[LEN_UNAME];
+};
+
+static_assert(LEN_UNAME <= UINT8_MAX && AUTH_HASH_MAX <= UINT8_MAX,
+              "slot_t's lengths must fit in a byte");
+
+/// shard_t is one stripe of the table: a lock, and the slots it protects.
+/// Probing scans fps, a dense array of 32-bit fingerprints (0 for an empty
+/// slot), so that a miss usually stays within one cache line, and slots are
+/// only read when their fingerprint matches.  The hashes of the names are also
+/// kept in order, so that a page of a listing can start where the last one
+/// stopped without looking at the rest of the shard.
+struct shard_t {
+  /// A reader/writer lock for this shard
+  shared_mutex lock;
+
+  /// The fingerprint of each slot, or 0 if the slot is empty
+  vector<uint32_t> fps;
+
+  /// The slots themselves
+  vector<slot_t> slots;
+
+  /// The distinct hashes of the names in the slots, in order
+  set<uint64_t> order;
+
+  /// The number of slots in use
+  size_t used = 0;
+};
+
+/// Internal is the class that stores all the members of an AuthTable object
+struct AuthTable::Internal {
+  /// The number of shards in the table
+  size_t nshards;
+
+  /// The shards themselves.  NB: shared_mutex is not movable, so we can't use
+  ///     a std::vector here
+  unique_ptr<shard_t[]> shards;
+
+  /// Construct the shards
+  ///
+  /// @param n The number of shards
+  Internal(size_t n) : nshards(n == 0 ? 1 : n), shards(new shard_t[nshards]) {}
+
+  /// Hash a name, with 64-bit FNV-1a
+  ///
+  /// @param user The name
+  ///
+  /// @returns The hash of the name
+  static uint64_t hash_of(string_view user) {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : user) {
+      h ^= c;
+      h *= 1099511628211ULL;
+    }
+    return h;
+  }
+
+  /// Find the shard that holds a name
+  ///
+  /// @param h The hash of the name
+  ///
+  /// @returns A reference to the shard for that name
+  shard_t &shard_for(uint64_t h) { return shards[h % nshards]; }
+
+  /// Compute the fingerprint of a name, which is never 0
+  ///
+  /// @param h The hash of the name
+  ///
+  /// @returns The fingerprint
+  static uint32_t fp_of(uint64_t h) { return (uint32_t)(h >> 32) | 1; }
+
+  /// Find the slot for a name in a shard.  The caller must hold the shard's
+  /// lock, and the shard must have at least one empty slot.
+  ///
+  /// @param s    The shard
+  /// @param h    The hash of the name
+  /// @param user The name
+  ///
+  /// @returns The index of the name's slot, or of the empty slot where it
+  ///          would go
+  static size_t probe(const shard_t &s, uint64_t h, string_view user) {
+    size_t mask = s.fps.size() - 1;
+    uint32_t fp = fp_of(h);
+    // NB: the low bits of h choose the shard, so use the middle bits here
+    for (size_t i = (h >> 16) & mask;; i = (i + 1) & mask) {
+      if (s.fps[i] == 0)
+        return i;
+      if (s.fps[i] == fp && s.slots[i].ulen == user.length() &&
+          memcmp(s.slots[i].user, user.data(), user.length()) == 0)
+        return i;
+    }
+  }
+
+  /// Find a name in a shard.  The caller must hold the shard's lock.
+  ///
+  /// @param s    The shard
+  /// @param h    The hash of the name
+  /// @param user The name
+  ///
+  /// @returns The name's slot, or nullptr if it isn't in the shard
+  static slot_t *find(shard_t &s, uint64_t h, string_view user) {
+    if (s.used == 0)
+      return nullptr;
+    size_t i = probe(s, h, user);
+    return s.fps[i] == 0 ? nullptr : &s.slots[i];
+  }
+
+  /// Double the size of a shard once it is 80% full, so that probes stay
+  /// short.  The caller must hold the shard's lock for writing.
+  ///
+  /// @param s The shard
+  static void reserve_one(shard_t &s) {
+    if (!s.fps.empty() && (s.used + 1) * 5 <= s.fps.size() * 4)
+      return;
+    size_t size = s.fps.empty() ? INITIAL_SLOTS : s.fps.size() * 2;
+    shard_t bigger;
+    bigger.fps.assign(size, 0);
+    bigger.slots.resize(size);
+    for (size_t i = 0; i < s.fps.size(); ++i) {
+      if (s.fps[i] == 0)
+        continue;
+      string_view user(s.slots[i].user, s.slots[i].ulen);
+      size_t j = probe(bigger, hash_of(user), user);
+      bigger.fps[j] = s.fps[i];
+      bigger.slots[j] = s.slots[i];
+    }
+    s.fps.swap(bigger.fps);
+    s.slots.swap(bigger.slots);
+  }
+
+  /// Fill an empty slot.  The caller must hold the shard's lock for writing.
+  ///
+  /// @param s    The shard
+  /// @param i    The index of the empty slot
+  /// @param h    The hash of the name
+  /// @param user The name
+  /// @param hash The hashed password
+  static void fill(shard_t &s, size_t i, uint64_t h, string_view user,
+                   string_view hash) {
+    slot_t &slot = s.slots[i];
+    set_hash(slot, hash);
+    slot.content = nullptr;
+    slot.ulen = user.length();
+    memcpy(slot.user, user.data(), user.length());
+    s.fps[i] = fp_of(h);
+    s.order.insert(h);
+    ++s.used;
+  }
+
+  /// Store a hash in a slot
+  ///
+  /// @param slot The slot
+  /// @param hash The hashed password
+  static void set_hash(slot_t &slot, string_view hash) {
+    memcpy(slot.hash, hash.data(), hash.length());
+    slot.hlen = hash.length();
+  }
+
+  /// Check that a name and hash fit in a slot
+  ///
+  /// @param user The name
+  /// @param hash The hashed password
+  ///
+  /// @returns true if they fit
+  static bool valid(string_view user, string_view hash) {
+    return user.length() <= (size_t)LEN_UNAME && hash.length() > 0 &&
+           hash.length() <= AUTH_HASH_MAX;
+  }
+
+  /// Delete all the content in a shard, and empty it.  The caller must hold
+  /// the shard's lock for writing.
+  ///
+  /// @param s The shard
+  static void empty(shard_t &s) {
+    for (size_t i = 0; i < s.fps.size(); ++i)
+      if (s.fps[i] != 0)
+        delete s.slots[i].content;
+    vector<uint32_t>().swap(s.fps);
+    vector<slot_t>().swap(s.slots);
+    s.order.clear();
+    s.used = 0;
+  }
+
+  /// Apply a function to every entry in a shard.  The caller must hold the
+  /// shard's lock.
+  ///
+  /// @param s The shard
+  /// @param f The function to apply to each entry
+  static void visit(shard_t &s, const reader_t &f) {
+    for (size_t i = 0; i < s.fps.size(); ++i) {
+      if (s.fps[i] == 0)
+        continue;
+      const slot_t &slot = s.slots[i];
+      f(string_view(slot.user, slot.ulen),
+        string_view(slot.hash, slot.hlen), slot.content);
+    }
+  }
+
+  /// Apply a function to every entry in a shard whose name has a given hash.
+  /// The caller must hold the shard's lock.
+  ///
+  /// @param s The shard
+  /// @param h The hash of the names
+  /// @param f The function to apply to each entry
+  ///
+  /// @returns The number of entries visited
+  static size_t visit_hash(shard_t &s, uint64_t h, const reader_t &f) {
+    size_t mask = s.fps.size() - 1, n = 0;
+    uint32_t fp = fp_of(h);
+    // NB: every name with this hash is in the run of slots that starts where
+    //     probe() starts, and the fingerprint rules out almost every other one
+    for (size_t i = (h >> 16) & mask; s.fps[i] != 0; i = (i + 1) & mask) {
+      const slot_t &slot = s.slots[i];
+      string_view user(slot.user, slot.ulen);
+      if (s.fps[i] != fp || hash_of(user) != h)
+        continue;
+      f(user, string_view(slot.hash, slot.hlen), slot.content);
+      ++n;
+    }
+    return n;
+  }
+};
+
+/// Construct an empty table
+///
+/// @param shards The number of shards (and hence locks) to use
+AuthTable::AuthTable(size_t shards) : fields(new Internal(shards)) {}
+
+/// Destroy the table and all of the content it owns
+AuthTable::~AuthTable() {
+  for (size_t i = 0; i < fields->nshards; ++i)
+    Internal::empty(fields->shards[i]);
+}
+
+/// Add a user with no content, if the name is not already in use
+///
+/// @param user       The user's name, at most LEN_UNAME bytes
+/// @param hash       The user's hashed password, at most AUTH_HASH_MAX bytes
+/// @param on_success Code to run if the user is added.  It runs while the
+///                   shard is still locked.  If it returns false, the user is
+///                   removed again before the shard is unlocked, so no one
+///                   else ever sees it.
+///
+/// @returns false if the user exists, the name or hash is invalid, or
+///          on_success returned false
+bool AuthTable::insert(string_view user, string_view hash,
+                       function<bool()> on_success) {
+  if (!Internal::valid(user, hash))
+    return false;
+  uint64_t h = Internal::hash_of(user);
+  shard_t &s = fields->shard_for(h);
+  unique_lock<shared_mutex> g(s.lock);
+  if (Internal::find(s, h, user))
+    return false;
+  Internal::reserve_one(s);
+  size_t i = Internal::probe(s, h, user);
+  Internal::fill(s, i, h, user, hash);
+  if (on_success())
+    return true;
+  // NB: the slot was empty until now, and nothing is ever removed, so no
+  //     other name's probe passes through it, and it can just be emptied
+  s.fps[i] = 0;
+  --s.used;
+  if (Internal::visit_hash(s, h, [](string_view, string_view,
+                                    const user_content_t *) {}) == 0)
+    s.order.erase(h);
+  return false;
+}
+
+/// Add a user, or replace everything about an existing user
+///
+/// @param user       The user's name, at most LEN_UNAME bytes
+/// @param hash       The user's hashed password, at most AUTH_HASH_MAX bytes
+/// @param content    The user's content, or nullptr for none
+/// @param on_success Code to run once the entry is in place.  It runs while the
+///                   shard is still locked.
+///
+/// @returns false if the name or hash is invalid
+bool AuthTable::upsert(string_view user, string_view hash,
+                       unique_ptr<user_content_t> content,
+                       function<void()> on_success) {
+  if (!Internal::valid(user, hash))
+    return false;
+  uint64_t h = Internal::hash_of(user);
+  shard_t &s = fields->shard_for(h);
+  unique_ptr<user_content_t> old;
+  unique_lock<shared_mutex> g(s.lock);
+  slot_t *slot = Internal::find(s, h, user);
+  if (!slot) {
+    Internal::reserve_one(s);
+    size_t i = Internal::probe(s, h, user);
+    Internal::fill(s, i, h, user, hash);
+    slot = &s.slots[i];
+  }
+  Internal::set_hash(*slot, hash);
+  old.reset(slot->content);
+  slot->content = content.release();
+  on_success();
+  g.unlock();
+  return true;
+}
+
+/// Find a user's hashed password
+///
+/// @param user The user's name
+/// @param hash Receives a copy of the user's hashed password
+///
+/// @returns true if the user exists
+bool AuthTable::get_hash(string_view user, string &hash) {
+  uint64_t h = Internal::hash_of(user);
+  shard_t &s = fields->shard_for(h);
+  shared_lock<shared_mutex> g(s.lock);
+  slot_t *slot = Internal::find(s, h, user);
+  if (!slot)
+    return false;
+  hash.assign(slot->hash, slot->hlen);
+  return true;
+}
+
+/// Apply a function to a user's hashed password and content, while the
+/// user's shard is write-locked.  The function may replace the content.
+///
+/// @param user The user's name
+/// @param f    The function to apply
+///
+/// @returns true if the user exists and the function was applied
+bool AuthTable::do_with(
+    string_view user,
+    function<void(string_view, unique_ptr<user_content_t> &)> f) {
+  uint64_t h = Internal::hash_of(user);
+  shard_t &s = fields->shard_for(h);
+  unique_lock<shared_mutex> g(s.lock);
+  slot_t *slot = Internal::find(s, h, user);
+  if (!slot)
+    return false;
+  unique_ptr<user_content_t> content(slot->content);
+  f(string_view(slot->hash, slot->hlen), content);
+  slot->content = content.release();
+  return true;
+}
+
+/// Apply a function to a user's entry, while the user's shard is read-locked,
+/// so other readers of the same shard are not blocked
+///
+/// @param user The user's name
+/// @param f    The function to apply
+///
+/// @returns true if the user exists and the function was applied
+bool AuthTable::do_with_readonly(string_view user, reader_t f) {
+  uint64_t h = Internal::hash_of(user);
+  shard_t &s = fields->shard_for(h);
+  shared_lock<shared_mutex> g(s.lock);
+  slot_t *slot = Internal::find(s, h, user);
+  if (!slot)
+    return false;
+  f(string_view(slot->user, slot->ulen),
+    string_view(slot->hash, slot->hlen), slot->content);
+  return true;
+}
+
+/// Apply a function to every entry in the table, read-locking one shard at a
+/// time
+///
+/// @param f The function to apply to each entry
+void AuthTable::do_all_readonly(reader_t f) {
+  for (size_t i = 0; i < fields->nshards; ++i)
+    do_shard_readonly(i, f);
+}
+
+/// Apply a function to every entry in one shard, while it is read-locked
+///
+/// @param shard The index of the shard to visit
+/// @param f     The function to apply to each entry
+void AuthTable::do_shard_readonly(size_t shard, reader_t f) {
+  shard_t &s = fields->shards[shard];
+  shared_lock<shared_mutex> g(s.lock);
+  Internal::visit(s, f);
+}
+
+/// Apply a function to the next page of entries in one shard, while it is
+/// read-locked.  Entries are visited in the order of the hashes of their names,
+/// which does not change as the shard grows, so a listing that continues from
+/// where the last page stopped sees every entry that exists throughout exactly
+/// once.
+///
+/// @param shard The index of the shard to visit
+/// @param from  The lowest name hash to visit (0 for the first page)
+/// @param max   The number of entries to visit.  A page also includes every
+///              entry whose name hash equals that of its last entry.
+/// @param f     The function to apply to each entry
+///
+/// @returns The value of from for the next page, or 0 if this page reached the
+///          end of the shard
+uint64_t AuthTable::do_page_readonly(size_t shard, uint64_t from, size_t max,
+                                     reader_t f) {
+  shard_t &s = fields->shards[shard];
+  shared_lock<shared_mutex> g(s.lock);
+  size_t n = 0;
+  auto it = s.order.lower_bound(from);
+  while (it != s.order.end() && (n == 0 || n < max))
+    n += Internal::visit_hash(s, *it++, f);
+  return it == s.order.end() ? 0 : *it;
+}
+
+/// Remove every user from the table, one shard at a time
+void AuthTable::clear() {
+  for (size_t i = 0; i < fields->nshards; ++i) {
+    shard_t &s = fields->shards[i];
+    unique_lock<shared_mutex> g(s.lock);
+    Internal::empty(s);
+  }
+}
+
+/// Count the users in the table, one shard at a time
+///
+/// @returns The number of users that were seen
+size_t AuthTable::size() {
+  size_t res = 0;
+  for (size_t i = 0; i < fields->nshards; ++i) {
+    shard_t &s = fields->shards[i];
+    shared_lock<shared_mutex> g(s.lock);
+    res += s.used;
+  }
+  return res;
+}
+
+/// Report the number of shards in the table
+///
+/// @returns The number of shards
+size_t AuthTable::num_shards() { return fields->nshards; }
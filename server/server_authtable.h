@@ -0,0 +1,176 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string_view>
+
+#include "../common/vec.h"
+
+class MappedSnapshot;
+
+/// The longest hashed password that the auth table can hold
+const size_t AUTH_HASH_MAX = 40;
+
+/// user_content_t is a user's content.  It lives outside of the auth table, so
+/// that the table's slots stay small, and a user who has no content has none.
+struct user_content_t {
+  /// The user's content, unless it is still in a mapped snapshot
+  vec content;
+
+  /// The snapshot that holds the user's content, if the content hasn't changed
+  /// since the snapshot was loaded.  Holding a reference keeps the content
+  /// mapped.
+  std::shared_ptr<MappedSnapshot> snap;
+
+  /// The user's content within snap
+  bytes_t mapped;
+
+  /// The length of the user's content, if data() is its zlib compression, or
+  /// 0 if data() is the content itself
+  uint32_t zsize = 0;
+
+  /// Find the user's content, wherever it lives
+  ///
+  /// @returns A view of the user's content, which is compressed if zsize > 0
+  bytes_t data() const {
+    return snap ? mapped : bytes_t{content.data(), content.size()};
+  }
+};
+
+/// AuthTable maps user names to hashed passwords and content.  It is split
+/// into shards, each with its own reader/writer lock, and each shard is a
+/// single open-addressing array of fixed-size slots: the name and the hash are
+/// stored inline, and the content is a pointer.  An auth check hashes the
+/// name, probes a dense array of 32-bit fingerprints, and compares the name and
+/// the password hash in the one slot whose fingerprint matches, so it touches
+/// two or three cache lines instead of following pointers to a node, a key,
+/// and a hash string.  (The table only stores hashes: server_passhash.h makes
+/// and checks them.)  A user costs one slot, plus some slack for the load
+/// factor, and a node in its shard's ordered set of name hashes, which lets a
+/// page of ALL start from a cursor in O(log n) time.
+///
+/// Users are never removed, except all at once by clear(), so probing needs no
+/// tombstones.
+class AuthTable {
+  /// Internal is the class that stores all the members of an AuthTable object.
+  /// To avoid pulling too much into the .h file, we are using the PIMPL
+  /// pattern (https://www.geeksforgeeks.org/pimpl-idiom-in-c-with-examples/)
+  struct Internal;
+
+  /// A reference to the internal fields of the AuthTable object
+  std::unique_ptr<Internal> fields;
+
+public:
+  /// The type of the functions that read an entry: they receive the user's
+  /// name, hashed password, and content (nullptr if there is none)
+  typedef std::function<void(std::string_view, std::string_view,
+                             const user_content_t *)>
+      reader_t;
+
+  /// Construct an empty table
+  ///
+  /// @param shards The number of shards (and hence locks) to use
+  AuthTable(size_t shards);
+
+  /// Destroy the table and all of the content it owns
+  ~AuthTable();
+
+  /// Add a user with no content, if the name is not already in use
+  ///
+  /// @param user       The user's name, at most LEN_UNAME bytes
+  /// @param hash       The user's hashed password, at most AUTH_HASH_MAX bytes
+  /// @param on_success Code to run if the user is added.  It runs while the
+  ///                   shard is still locked.  If it returns false, the user
+  ///                   is removed again before the shard is unlocked, so no
+  ///                   one else ever sees it.
+  ///
+  /// @returns false if the user exists, the name or hash is invalid, or
+  ///          on_success returned false
+  bool insert(std::string_view user, std::string_view hash,
+              std::function<bool()> on_success = [] { return true; });
+
+  /// Add a user, or replace everything about an existing user
+  ///
+  /// @param user       The user's name, at most LEN_UNAME bytes
+  /// @param hash       The user's hashed password, at most AUTH_HASH_MAX bytes
+  /// @param content    The user's content, or nullptr for none
+  /// @param on_success Code to run once the entry is in place.  It runs while
+  ///                   the shard is still locked.
+  ///
+  /// @returns false if the name or hash is invalid
+  bool upsert(std::string_view user, std::string_view hash,
+              std::unique_ptr<user_content_t> content,
+              std::function<void()> on_success = [] {});
+
+  /// Find a user's hashed password
+  ///
+  /// @param user The user's name
+  /// @param hash Receives a copy of the user's hashed password
+  ///
+  /// @returns true if the user exists
+  bool get_hash(std::string_view user, std::string &hash);
+
+  /// Apply a function to a user's hashed password and content, while the
+  /// user's shard is write-locked.  The function may replace the content.
+  ///
+  /// @param user The user's name
+  /// @param f    The function to apply
+  ///
+  /// @returns true if the user exists and the function was applied
+  bool do_with(std::string_view user,
+               std::function<void(std::string_view,
+                                  std::unique_ptr<user_content_t> &)>
+                   f);
+
+  /// Apply a function to a user's entry, while the user's shard is
+  /// read-locked, so other readers of the same shard are not blocked
+  ///
+  /// @param user The user's name
+  /// @param f    The function to apply
+  ///
+  /// @returns true if the user exists and the function was applied
+  bool do_with_readonly(std::string_view user, reader_t f);
+
+  /// Apply a function to every entry in the table, read-locking one shard at
+  /// a time
+  ///
+  /// @param f The function to apply to each entry
+  void do_all_readonly(reader_t f);
+
+  /// Apply a function to every entry in one shard, while it is read-locked
+  ///
+  /// @param shard The index of the shard to visit
+  /// @param f     The function to apply to each entry
+  void do_shard_readonly(size_t shard, reader_t f);
+
+  /// Apply a function to the next page of entries in one shard, while it is
+  /// read-locked.  Entries are visited in the order of the hashes of their
+  /// names, which does not change as the shard grows, so a listing that
+  /// continues from where the last page stopped sees every entry that exists
+  /// throughout exactly once.
+  ///
+  /// @param shard The index of the shard to visit
+  /// @param from  The lowest name hash to visit (0 for the first page)
+  /// @param max   The number of entries to visit.  A page also includes every
+  ///              entry whose name hash equals that of its last entry.
+  /// @param f     The function to apply to each entry
+  ///
+  /// @returns The value of from for the next page, or 0 if this page reached
+  ///          the end of the shard
+  uint64_t do_page_readonly(size_t shard, uint64_t from, size_t max,
+                            reader_t f);
+
+  /// Remove every user from the table, one shard at a time
+  void clear();
+
+  /// Count the users in the table, one shard at a time
+  ///
+  /// @returns The number of users that were seen
+  size_t size();
+
+  /// Report the number of shards in the table
+  ///
+  /// @returns The number of shards
+  size_t num_shards();
+};
@@ -1,107 +1,474 @@
+#include <cstring>
+#include <functional>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
 
+#include "../common/bufpool.h"
+#include "../common/compress.h"
 #include "../common/crypto.h"
 #include "../common/net.h"
 #include "../common/protocol.h"
 #include "../common/vec.h"
 
 #include "server_commands.h"
+#include "server_mapreduce.h"
+#include "server_metrics.h"
+#include "server_parsing.h"
+#include "server_passhash.h"
+#include "server_replication.h"
 #include "server_storage.h"
+#include "server_topk.h"
 
 using namespace std;
 
+/// all_query_t is a parsed ALL request that holds a query (see protocol.h)
+struct all_query_t {
+  /// The user, password, and query
+  req_view_t v;
+
+  /// The number of names per page
+  size_t page;
+
+  /// The query's flags
+  int flags;
+
+  /// The position of the first page ("" for the start of the list)
+  string cursor;
+};
+
+/// Parse an ALL request that holds a query
+///
+/// @param req The unencrypted contents of the request
+/// @param q   The structure that receives the query
+///
+/// @returns false if the request is malformed, or the page size is invalid
+static bool parse_all_query(const vec &req, all_query_t &q) {
+  const size_t fixed = 2 * sizeof(int);
+  if (!parse_request(req, fixed + LEN_ALL_CURSOR, q.v) ||
+      (q.v.arg.size != fixed && q.v.arg.size != fixed + LEN_ALL_CURSOR))
+    return false;
+  int page;
+  memcpy(&page, q.v.arg.data, sizeof(int));
+  memcpy(&q.flags, q.v.arg.data + sizeof(int), sizeof(int));
+  if (page < 1 || page > ALL_PAGE_MAX)
+    return false;
+  q.page = page;
+  q.cursor.assign((const char *)q.v.arg.data + fixed, q.v.arg.size - fixed);
+  return true;
+}
+
+/// Produce one page of the response to an ALL query, and advance its cursor
+///
+/// @param storage The Storage object, which contains the auth table
+/// @param q       The query, whose cursor is advanced to the next page
+/// @param creds   The connection's checked credentials, or nullptr
+/// @param page    The vector that receives the unencrypted page (or error)
+///
+/// @returns false if the page is an error
+static bool next_page(Storage &storage, all_query_t &q, cred_cache_t *creds,
+                      vec &page) {
+  auto [err, list] =
+      storage.get_users_page(q.v.user, q.v.pass, q.cursor, q.page, creds);
+  if (err) {
+    page = list;
+    return false;
+  }
+  page = vec_from_string(RES_OK);
+  vec_append(page, (int)q.cursor.length());
+  vec_append(page, q.cursor);
+  vec_append(page, (int)list.size());
+  vec_append(page, list);
+  return true;
+}
+
 /// Respond to an ALL command by generating a list of all the usernames in the
-/// Auth table and returning them, one per line.
+/// Auth table and returning them, one per line.  If the request holds a query,
+/// the response is one page of the list, or every page in turn if the query
+/// asks for a stream.
 ///
-/// @param sd      The socket onto which the result should be written
 /// @param storage The Storage object, which contains the auth table
-/// @param ctx     The AES encryption context
 /// @param req     The unencrypted contents of the request
+/// @param res     The unencrypted response, which the caller will encrypt and
+///                send
+/// @param creds   The connection's checked credentials, or nullptr
 ///
 /// @returns false, to indicate that the server shouldn't stop
-bool server_cmd_all(int sd, Storage &storage, EVP_CIPHER_CTX *ctx,
-                    const vec &req) {
-  cerr << "server_cmd_all is not implemented\n";
+bool server_cmd_all(Storage &storage, const vec &req, vec &res,
+                    cred_cache_t *creds) {
+  req_view_t v;
+  if (parse_request(req, -1, v)) {
+    auto [err, list] = storage.get_all_users(v.user, v.pass, creds);
+    if (err) {
+      res = list;
+      return false;
+    }
+    res = vec_from_string(RES_OK);
+    vec_append(res, (int)list.size());
+    vec_append(res, list);
+    return false;
+  }
+  all_query_t q;
+  if (!parse_all_query(req, q)) {
+    res = vec_from_string(RES_ERR_MSG_FMT);
+    return false;
+  }
+  if (!(q.flags & ALL_FLAG_STREAM)) {
+    next_page(storage, q, creds, res);
+    return false;
+  }
+  res.clear();
+  server_cmd_all_stream(storage, req, creds, [&](const vec &page) {
+    vec_append(res, page);
+    return true;
+  });
   return false;
 }
 
-/// Respond to a SET command by putting the provided data into the Auth table
+/// Respond to an ALL query one page at a time, by passing each unencrypted page
+/// to a function as soon as it has been listed, so that a caller can send it
+/// before the next page is listed.  An error is passed as the only page.
+///
+/// @param storage The Storage object, which contains the auth table
+/// @param req     The unencrypted contents of the request, which must hold a
+///                query that asks for a stream
+/// @param creds   The connection's checked credentials, or nullptr
+/// @param emit    The function that receives each page.  It returns false to
+///                stop the listing.
+void server_cmd_all_stream(Storage &storage, const vec &req,
+                           cred_cache_t *creds,
+                           function<bool(const vec &)> emit) {
+  all_query_t q;
+  if (!parse_all_query(req, q)) {
+    emit(vec_from_string(RES_ERR_MSG_FMT));
+    return;
+  }
+  // NB: each page authenticates again, which creds makes cheap
+  cred_cache_t local;
+  if (creds == nullptr)
+    creds = &local;
+  vec page;
+  do {
+    if (!next_page(storage, q, creds, page)) {
+      emit(page);
+      return;
+    }
+  } while (emit(page) && !q.cursor.empty());
+}
+
+/// Determine if an ALL request holds a query that asks for a stream
+///
+/// @param req The unencrypted contents of the request
+///
+/// @returns true if the query is well-formed and has ALL_FLAG_STREAM set
+bool all_is_stream(const vec &req) {
+  all_query_t q;
+  return parse_all_query(req, q) && (q.flags & ALL_FLAG_STREAM);
+}
+
+/// Respond to a MET command by reporting the server's metrics, if the user is
+/// the admin user
 ///
-/// @param sd      The socket onto which the result should be written
 /// @param storage The Storage object, which contains the auth table
-/// @param ctx     The AES encryption context
 /// @param req     The unencrypted contents of the request
+/// @param res     The unencrypted response, which the caller will encrypt and
+///                send
+/// @param creds   The connection's checked credentials, or nullptr
 ///
 /// @returns false, to indicate that the server shouldn't stop
-bool server_cmd_set(int sd, Storage &storage, EVP_CIPHER_CTX *ctx,
-                    const vec &req) {
-  cerr << "server_cmd_set is not implemented\n";
+bool server_cmd_met(Storage &storage, const vec &req, vec &res,
+                    cred_cache_t *creds) {
+  req_view_t v;
+  if (!parse_request(req, -1, v)) {
+    res = vec_from_string(RES_ERR_MSG_FMT);
+    return false;
+  }
+  if (!storage.auth(v.user, v.pass, creds) ||
+      !metrics_is_admin(string(v.user))) {
+    res = vec_from_string(RES_ERR_LOGIN);
+    return false;
+  }
+  string report = metrics_report();
+  res = vec_from_string(RES_OK);
+  vec_append(res, (int)report.length());
+  vec_append(res, report);
   return false;
 }
 
-/// Respond to a GET command by getting the data for a user
+/// Respond to a SOF command by registering a shared object, if the user is the
+/// admin user
 ///
-/// @param sd      The socket onto which the result should be written
 /// @param storage The Storage object, which contains the auth table
-/// @param ctx     The AES encryption context
 /// @param req     The unencrypted contents of the request
+/// @param res     The unencrypted response, which the caller will encrypt and
+///                send
+/// @param creds   The connection's checked credentials, or nullptr
 ///
 /// @returns false, to indicate that the server shouldn't stop
-bool server_cmd_get(int sd, Storage &storage, EVP_CIPHER_CTX *ctx,
-                    const vec &req) {
-  cerr << "server_cmd_get is not implemented\n";
+bool server_cmd_sof(Storage &storage, const vec &req, vec &res,
+                    cred_cache_t *creds) {
+  req_view_t v;
+  // NB: the extra field is len(@s).@s.len(@b).@b
+  if (!parse_request(req, 2 * sizeof(int) + LEN_UNAME + LEN_CONTENT, v)) {
+    res = vec_from_string(RES_ERR_MSG_FMT);
+    return false;
+  }
+  int nlen = -1, blen = -1;
+  if (v.arg.size >= sizeof(int))
+    memcpy(&nlen, v.arg.data, sizeof(int));
+  if (nlen <= 0 || nlen > LEN_UNAME || v.arg.size < 2 * sizeof(int) + nlen) {
+    res = vec_from_string(RES_ERR_MSG_FMT);
+    return false;
+  }
+  string_view name((const char *)v.arg.data + sizeof(int), nlen);
+  const unsigned char *b = v.arg.data + sizeof(int) + nlen;
+  memcpy(&blen, b, sizeof(int));
+  if (blen <= 0 || v.arg.size != 2 * sizeof(int) + nlen + blen) {
+    res = vec_from_string(RES_ERR_MSG_FMT);
+    return false;
+  }
+  if (!storage.auth(v.user, v.pass, creds) ||
+      !metrics_is_admin(string(v.user))) {
+    res = vec_from_string(RES_ERR_LOGIN);
+    return false;
+  }
+  bool ok = mr_register(name, {b + sizeof(int), (size_t)blen});
+  res = vec_from_string(ok ? RES_OK : RES_ERR_SO);
+  return false;
+}
+
+/// Respond to a FUN command by running a registered shared object over every
+/// user, if the user is the admin user
+///
+/// @param storage The Storage object, which contains the auth table
+/// @param req     The unencrypted contents of the request
+/// @param res     The unencrypted response, which the caller will encrypt and
+///                send
+/// @param creds   The connection's checked credentials, or nullptr
+///
+/// @returns false, to indicate that the server shouldn't stop
+bool server_cmd_fun(Storage &storage, const vec &req, vec &res,
+                    cred_cache_t *creds) {
+  req_view_t v;
+  if (!parse_request(req, LEN_UNAME, v) || v.arg.size == 0) {
+    res = vec_from_string(RES_ERR_MSG_FMT);
+    return false;
+  }
+  if (!storage.auth(v.user, v.pass, creds) ||
+      !metrics_is_admin(string(v.user))) {
+    res = vec_from_string(RES_ERR_LOGIN);
+    return false;
+  }
+  auto [err, result] =
+      mr_run(storage, string_view((const char *)v.arg.data, v.arg.size));
+  if (err) {
+    res = result;
+    return false;
+  }
+  res = vec_from_string(RES_OK);
+  vec_append(res, (int)result.size());
+  vec_append(res, result);
+  return false;
+}
+
+/// Respond to a SET command by putting the provided data into the Auth table.
+/// The data may be a packed content field.
+///
+/// @param storage The Storage object, which contains the auth table
+/// @param req     The unencrypted contents of the request
+/// @param res     The unencrypted response, which the caller will encrypt and
+///                send
+/// @param creds   The connection's checked credentials, or nullptr
+///
+/// @returns false, to indicate that the server shouldn't stop
+bool server_cmd_set(Storage &storage, const vec &req, vec &res,
+                    cred_cache_t *creds) {
+  req_view_t v;
+  // NB: a packed field is one int longer than the content, if it didn't shrink
+  if (!parse_request(req, LEN_CONTENT + sizeof(int), v, true) ||
+      (!(v.flags & CONTENT_FLAG_PACKED) && v.arg.size > (size_t)LEN_CONTENT)) {
+    res = vec_from_string(RES_ERR_MSG_FMT);
+    return false;
+  }
+  // A follower only changes when its primary does
+  if (repl_is_follower()) {
+    res = vec_from_string(RES_ERR_READONLY);
+    return false;
+  }
+  if (!(v.flags & CONTENT_FLAG_PACKED)) {
+    res = storage.set_user_data(v.user, v.pass, v.arg, creds);
+    if (res == vec_from_string(RES_OK))
+      topk_hit(TOPK_SET, v.user);
+    return false;
+  }
+  size_t size;
+  bytes_t data;
+  if (!split_packed(v.arg, size, data)) {
+    res = vec_from_string(RES_ERR_MSG_FMT);
+    return false;
+  }
+  res = storage.set_packed_data(v.user, v.pass, data, size, creds);
+  if (res == vec_from_string(RES_OK))
+    topk_hit(TOPK_SET, v.user);
+  return false;
+}
+
+/// Respond to a GET command by getting the data for a user, as a packed
+/// content field if the request asks for one
+///
+/// @param storage The Storage object, which contains the auth table
+/// @param req     The unencrypted contents of the request
+/// @param res     The unencrypted response, which the caller will encrypt and
+///                send
+/// @param creds   The connection's checked credentials, or nullptr
+///
+/// @returns false, to indicate that the server shouldn't stop
+bool server_cmd_get(Storage &storage, const vec &req, vec &res,
+                    cred_cache_t *creds) {
+  req_view_t v;
+  if (!parse_request(req, LEN_UNAME, v, true)) {
+    res = vec_from_string(RES_ERR_MSG_FMT);
+    return false;
+  }
+  string_view who((const char *)v.arg.data, v.arg.size);
+  if (!(v.flags & CONTENT_FLAG_PACKED)) {
+    // NB: the whole response may come from the response cache
+    bool err;
+    tie(err, res) = storage.get_user_response(v.user, v.pass, who, creds);
+    if (!err)
+      topk_hit(TOPK_GET, who);
+    return false;
+  }
+  auto [err, content] = storage.get_packed_data(v.user, v.pass, who, creds);
+  if (err) {
+    res = content;
+    return false;
+  }
+  topk_hit(TOPK_GET, who);
+  // NB: the response comes from the pool too, and the caller gives it back
+  res = pool_take(RES_OK.length() + sizeof(int) + content.size());
+  vec_append(res, RES_OK);
+  vec_append(res, (int)content.size());
+  vec_append(res, content);
+  pool_give(content);
   return false;
 }
 
 /// Respond to a REG command by trying to add a new user
 ///
-/// @param sd      The socket onto which the result should be written
 /// @param storage The Storage object, which contains the auth table
-/// @param ctx     The AES encryption context
 /// @param req     The unencrypted contents of the request
+/// @param res     The unencrypted response, which the caller will encrypt and
+///                send
+/// @param creds   The connection's checked credentials, or nullptr
 ///
 /// @returns false, to indicate that the server shouldn't stop
-bool server_cmd_reg(int sd, Storage &storage, EVP_CIPHER_CTX *ctx,
-                    const vec &req) {
-  cerr << "server_cmd_reg is not implemented\n";
+bool server_cmd_reg(Storage &storage, const vec &req, vec &res,
+                    cred_cache_t *creds) {
+  req_view_t v;
+  if (!parse_request(req, -1, v)) {
+    res = vec_from_string(RES_ERR_MSG_FMT);
+    return false;
+  }
+  if (repl_is_follower()) {
+    res = vec_from_string(RES_ERR_READONLY);
+    return false;
+  }
+  res = storage.add_user(v.user, v.pass);
+  // A session's next request as the new user needn't hash the password again
+  if (creds && res == vec_from_string(RES_OK))
+    creds->add(v.user, v.pass);
   return false;
 }
 
+/// Respond to a run of REG commands by trying to add each new user.  The
+/// passwords are hashed in parallel, but the users are added in order, so the
+/// result is the same as running each REG in turn.
+///
+/// @param storage The Storage object, which contains the auth table
+/// @param reqs    The unencrypted contents of each request
+/// @param res     The vector that receives the unencrypted response to each
+///                request
+/// @param creds   The connection's checked credentials, or nullptr
+void server_cmd_reg_batch(Storage &storage, const vector<vec> &reqs,
+                          vector<vec> &res, cred_cache_t *creds) {
+  res.assign(reqs.size(), vec());
+  vector<pair<string_view, string_view>> users;
+  vector<size_t> which;
+  for (size_t i = 0; i < reqs.size(); ++i) {
+    req_view_t v;
+    if (!parse_request(reqs[i], -1, v)) {
+      res[i] = vec_from_string(RES_ERR_MSG_FMT);
+      continue;
+    }
+    if (repl_is_follower()) {
+      res[i] = vec_from_string(RES_ERR_READONLY);
+      continue;
+    }
+    users.push_back({v.user, v.pass});
+    which.push_back(i);
+  }
+  vector<vec> added = storage.add_users(users);
+  const vec ok = vec_from_string(RES_OK);
+  for (size_t i = 0; i < users.size(); ++i) {
+    if (creds && added[i] == ok)
+      creds->add(users[i].first, users[i].second);
+    res[which[i]] = move(added[i]);
+  }
+}
+
 /// In response to a request for a key, do a reliable send of the contents of
 /// the pubfile
 ///
 /// @param sd The socket on which to write the pubfile
 /// @param pubfile A vector consisting of pubfile contents
-void server_cmd_key(int sd, const vec &pubfile) {
-  cerr << "server_cmd_key is not implemented\n";
-}
+void server_cmd_key(int sd, const vec &pubfile) { send_reliably(sd, pubfile); }
 
 /// Respond to a BYE command by returning false, but only if the user
 /// authenticates
 ///
-/// @param sd      The socket onto which the result should be written
 /// @param storage The Storage object, which contains the auth table
-/// @param ctx     The AES encryption context
 /// @param req     The unencrypted contents of the request
+/// @param res     The unencrypted response, which the caller will encrypt and
+///                send
+/// @param creds   The connection's checked credentials, or nullptr
 ///
 /// @returns true, to indicate that the server should stop, or false on an error
-bool server_cmd_bye(int sd, Storage &storage, EVP_CIPHER_CTX *ctx,
-                    const vec &req) {
-  cerr << "server_cmd_bye is not implemented\n";
-  return false;
+bool server_cmd_bye(Storage &storage, const vec &req, vec &res,
+                    cred_cache_t *creds) {
+  req_view_t v;
+  if (!parse_request(req, -1, v)) {
+    res = vec_from_string(RES_ERR_MSG_FMT);
+    return false;
+  }
+  bool ok = storage.auth(v.user, v.pass, creds);
+  res = vec_from_string(ok ? RES_OK : RES_ERR_LOGIN);
+  return ok;
 }
 
 /// Respond to a SAV command by persisting the file, but only if the user
 /// authenticates
 ///
-/// @param sd      The socket onto which the result should be written
 /// @param storage The Storage object, which contains the auth table
-/// @param ctx     The AES encryption context
 /// @param req     The unencrypted contents of the request
+/// @param res     The unencrypted response, which the caller will encrypt and
+///                send
+/// @param creds   The connection's checked credentials, or nullptr
 ///
 /// @returns false, to indicate that the server shouldn't stop
-bool server_cmd_sav(int sd, Storage &storage, EVP_CIPHER_CTX *ctx,
-                    const vec &req) {
-  cerr << "server_cmd_sav is not implemented\n";
+bool server_cmd_sav(Storage &storage, const vec &req, vec &res,
+                    cred_cache_t *creds) {
+  req_view_t v;
+  if (!parse_request(req, -1, v)) {
+    res = vec_from_string(RES_ERR_MSG_FMT);
+    return false;
+  }
+  if (!storage.auth(v.user, v.pass, creds)) {
+    res = vec_from_string(RES_ERR_LOGIN);
+    return false;
+  }
+  storage.persist();
+  res = vec_from_string(RES_OK);
   return false;
 }
@@ -1,53 +1,136 @@
 #pragma once
 
+#include <functional>
+#include <vector>
+
 #include "../common/crypto.h"
 
 #include "server_storage.h"
 
 /// Respond to an ALL command by generating a list of all the usernames in the
-/// Auth table and returning them, one per line.
+/// Auth table and returning them, one per line.  If the request holds a query,
+/// the response is one page of the list, or every page in turn if the query
+/// asks for a stream.
+///
+/// @param storage The Storage object, which contains the auth table
+/// @param req     The unencrypted contents of the request
+/// @param res     The unencrypted response, which the caller will encrypt and
+///                send
+/// @param creds   The connection's checked credentials, or nullptr
+///
+/// @returns false, to indicate that the server shouldn't stop
+bool server_cmd_all(Storage &storage, const vec &req, vec &res,
+                    cred_cache_t *creds);
+
+/// Respond to an ALL query one page at a time, by passing each unencrypted page
+/// to a function as soon as it has been listed, so that a caller can send it
+/// before the next page is listed.  An error is passed as the only page.
+///
+/// @param storage The Storage object, which contains the auth table
+/// @param req     The unencrypted contents of the request, which must hold a
+///                query that asks for a stream
+/// @param creds   The connection's checked credentials, or nullptr
+/// @param emit    The function that receives each page.  It returns false to
+///                stop the listing.
+void server_cmd_all_stream(Storage &storage, const vec &req,
+                           cred_cache_t *creds,
+                           std::function<bool(const vec &)> emit);
+
+/// Determine if an ALL request holds a query that asks for a stream
+///
+/// @param req The unencrypted contents of the request
+///
+/// @returns true if the query is well-formed and has ALL_FLAG_STREAM set
+bool all_is_stream(const vec &req);
+
+/// Respond to a MET command by reporting the server's metrics, if the user is
+/// the admin user
+///
+/// @param storage The Storage object, which contains the auth table
+/// @param req     The unencrypted contents of the request
+/// @param res     The unencrypted response, which the caller will encrypt and
+///                send
+/// @param creds   The connection's checked credentials, or nullptr
+///
+/// @returns false, to indicate that the server shouldn't stop
+bool server_cmd_met(Storage &storage, const vec &req, vec &res,
+                    cred_cache_t *creds);
+
+/// Respond to a SOF command by registering a shared object, if the user is the
+/// admin user
+///
+/// @param storage The Storage object, which contains the auth table
+/// @param req     The unencrypted contents of the request
+/// @param res     The unencrypted response, which the caller will encrypt and
+///                send
+/// @param creds   The connection's checked credentials, or nullptr
+///
+/// @returns false, to indicate that the server shouldn't stop
+bool server_cmd_sof(Storage &storage, const vec &req, vec &res,
+                    cred_cache_t *creds);
+
+/// Respond to a FUN command by running a registered shared object over every
+/// user, if the user is the admin user
 ///
-/// @param sd      The socket onto which the result should be written
 /// @param storage The Storage object, which contains the auth table
-/// @param ctx     The AES encryption context
 /// @param req     The unencrypted contents of the request
+/// @param res     The unencrypted response, which the caller will encrypt and
+///                send
+/// @param creds   The connection's checked credentials, or nullptr
 ///
 /// @returns false, to indicate that the server shouldn't stop
-bool server_cmd_all(int sd, Storage &storage, EVP_CIPHER_CTX *ctx,
-                    const vec &req);
+bool server_cmd_fun(Storage &storage, const vec &req, vec &res,
+                    cred_cache_t *creds);
 
-/// Respond to a SET command by putting the provided data into the Auth table
+/// Respond to a SET command by putting the provided data into the Auth table.
+/// The data may be a packed content field.
 ///
-/// @param sd      The socket onto which the result should be written
 /// @param storage The Storage object, which contains the auth table
-/// @param ctx     The AES encryption context
 /// @param req     The unencrypted contents of the request
+/// @param res     The unencrypted response, which the caller will encrypt and
+///                send
+/// @param creds   The connection's checked credentials, or nullptr
 ///
 /// @returns false, to indicate that the server shouldn't stop
-bool server_cmd_set(int sd, Storage &storage, EVP_CIPHER_CTX *ctx,
-                    const vec &req);
+bool server_cmd_set(Storage &storage, const vec &req, vec &res,
+                    cred_cache_t *creds);
 
-/// Respond to a GET command by getting the data for a user
+/// Respond to a GET command by getting the data for a user, as a packed
+/// content field if the request asks for one
 ///
-/// @param sd      The socket onto which the result should be written
 /// @param storage The Storage object, which contains the auth table
-/// @param ctx     The AES encryption context
 /// @param req     The unencrypted contents of the request
+/// @param res     The unencrypted response, which the caller will encrypt and
+///                send
+/// @param creds   The connection's checked credentials, or nullptr
 ///
 /// @returns false, to indicate that the server shouldn't stop
-bool server_cmd_get(int sd, Storage &storage, EVP_CIPHER_CTX *ctx,
-                    const vec &req);
+bool server_cmd_get(Storage &storage, const vec &req, vec &res,
+                    cred_cache_t *creds);
 
 /// Respond to a REG command by trying to add a new user
 ///
-/// @param sd      The socket onto which the result should be written
 /// @param storage The Storage object, which contains the auth table
-/// @param ctx     The AES encryption context
 /// @param req     The unencrypted contents of the request
+/// @param res     The unencrypted response, which the caller will encrypt and
+///                send
+/// @param creds   The connection's checked credentials, or nullptr
 ///
 /// @returns false, to indicate that the server shouldn't stop
-bool server_cmd_reg(int sd, Storage &storage, EVP_CIPHER_CTX *ctx,
-                    const vec &req);
+bool server_cmd_reg(Storage &storage, const vec &req, vec &res,
+                    cred_cache_t *creds);
+
+/// Respond to a run of REG commands by trying to add each new user.  The
+/// passwords are hashed in parallel, but the users are added in order, so the
+/// result is the same as running each REG in turn.
+///
+/// @param storage The Storage object, which contains the auth table
+/// @param reqs    The unencrypted contents of each request
+/// @param res     The vector that receives the unencrypted response to each
+///                request
+/// @param creds   The connection's checked credentials, or nullptr
+void server_cmd_reg_batch(Storage &storage, const std::vector<vec> &reqs,
+                          std::vector<vec> &res, cred_cache_t *creds);
 
 /// In response to a request for a key, do a reliable send of the contents of
 /// the pubfile
@@ -59,23 +142,25 @@ void server_cmd_key(int sd, const vec &pubfile);
 /// Respond to a BYE command by returning false, but only if the user
 /// authenticates
 ///
-/// @param sd      The socket onto which the result should be written
 /// @param storage The Storage object, which contains the auth table
-/// @param ctx     The AES encryption context
 /// @param req     The unencrypted contents of the request
+/// @param res     The unencrypted response, which the caller will encrypt and
+///                send
+/// @param creds   The connection's checked credentials, or nullptr
 ///
 /// @returns true, to indicate that the server should stop, or false on an error
-bool server_cmd_bye(int sd, Storage &storage, EVP_CIPHER_CTX *ctx,
-                    const vec &req);
+bool server_cmd_bye(Storage &storage, const vec &req, vec &res,
+                    cred_cache_t *creds);
 
 /// Respond to a SAV command by persisting the file, but only if the user
 /// authenticates
 ///
-/// @param sd      The socket onto which the result should be written
 /// @param storage The Storage object, which contains the auth table
-/// @param ctx     The AES encryption context
 /// @param req     The unencrypted contents of the request
+/// @param res     The unencrypted response, which the caller will encrypt and
+///                send
+/// @param creds   The connection's checked credentials, or nullptr
 ///
 /// @returns false, to indicate that the server shouldn't stop
-bool server_cmd_sav(int sd, Storage &storage, EVP_CIPHER_CTX *ctx,
-                    const vec &req);
+bool server_cmd_sav(Storage &storage, const vec &req, vec &res,
+                    cred_cache_t *creds);
@@ -0,0 +1,215 @@
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "../common/contextmanager.h"
+#include "../common/err.h"
+#include "../common/log.h"
+#include "../common/mapreduce.h"
+#include "../common/pool.h"
+#include "../common/protocol.h"
+
+#include "server_mapreduce.h"
+
+using namespace std;
+
+/// The number of tasks per compute thread that may wait in the pool's queue.
+/// Beyond that, a run is mapped by fewer threads, rather than blocking.
+const size_t MR_QUEUE_PER_THREAD = 4;
+
+/// so_t is one loaded shared object.  It is unloaded when the last run that
+/// uses it lets go of it.
+struct so_t {
+  /// The handle from dlopen()
+  void *handle = nullptr;
+
+  /// The object's functions
+  map_func map = nullptr;
+  reduce_func reduce = nullptr;
+
+  /// Unload the object
+  ~so_t() {
+    if (handle != nullptr)
+      dlclose(handle);
+  }
+};
+
+/// run_t is the shared state of one call to mr_run().  Helpers that start
+/// after the run is done only touch this, never the caller's stack, so the
+/// caller need not wait for them.
+struct run_t {
+  /// The shared object, and the storage whose shards are mapped
+  shared_ptr<so_t> so;
+  Storage *storage;
+
+  /// The results of map(), one vector per shard
+  vector<vector<vec>> results;
+
+  /// The index of the next shard to map
+  atomic<size_t> next{0};
+
+  /// The number of shards that have been mapped, and a lock and condition
+  /// variable for waiting until that is all of them
+  size_t done = 0;
+  mutex lock;
+  condition_variable cv;
+};
+
+/// The prefix of the temporary files for shared objects
+static string so_prefix;
+
+/// The number of compute threads, and the threads themselves
+static size_t mr_threads = 0;
+static unique_ptr<thread_pool> mappers;
+
+/// The registered shared objects, and a lock to protect them
+static mutex registry_lock;
+static unordered_map<string, shared_ptr<so_t>> registry;
+
+/// Configure map/reduce, and start the compute threads
+///
+/// @param prefix  The prefix of the temporary files for shared objects
+/// @param threads The number of threads that help to map shards
+void mr_init(const string &prefix, size_t threads) {
+  so_prefix = prefix;
+  mr_threads = threads;
+  if (threads > 0)
+    mappers.reset(new thread_pool(threads, threads * MR_QUEUE_PER_THREAD));
+}
+
+/// Stop the compute threads, and unload every shared object that isn't in
+/// use.  Runs are mapped by the calling thread alone after this.
+void mr_stop() {
+  if (mappers) {
+    mappers->await_shutdown();
+    mappers.reset();
+    mr_threads = 0;
+  }
+  lock_guard<mutex> g(registry_lock);
+  registry.clear();
+}
+
+/// Write a shared object to a fresh temporary file, and load it.  The file is
+/// removed before this returns, since the loaded object doesn't need it.
+///
+/// NB: dlopen() returns the same handle for a path that is already loaded, so
+///     every object gets a file of its own.
+///
+/// @param so The bytes of the shared object
+///
+/// @returns The loaded object, or nullptr on error
+static shared_ptr<so_t> load_so(bytes_t so) {
+  // NB: dlopen() searches the library path for a name without a '/'
+  string path = so_prefix + ".so.XXXXXX";
+  if (path.find('/') == string::npos)
+    path = "./" + path;
+  int fd = mkstemp(path.data());
+  if (fd < 0) {
+    sys_error(errno, "Error creating shared object file:");
+    return nullptr;
+  }
+  ContextManager rm([&]() { unlink(path.c_str()); });
+  {
+    ContextManager cfd([&]() { close(fd); });
+    for (size_t off = 0; off < so.size;) {
+      ssize_t n = write(fd, so.data + off, so.size - off);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0) {
+        sys_error(errno, "Error writing shared object file:");
+        return nullptr;
+      }
+      off += n;
+    }
+  }
+  auto res = make_shared<so_t>();
+  res->handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (res->handle == nullptr) {
+    log_msg(LOG_WARN, string("Error loading shared object: ") + dlerror());
+    return nullptr;
+  }
+  res->map = (map_func)dlsym(res->handle, "map");
+  res->reduce = (reduce_func)dlsym(res->handle, "reduce");
+  if (res->map == nullptr || res->reduce == nullptr) {
+    log_msg(LOG_WARN, "Shared object lacks map() or reduce()");
+    return nullptr;
+  }
+  return res;
+}
+
+/// Register a shared object, replacing any earlier one with the same name
+///
+/// @param name The name under which to register it
+/// @param so   The bytes of the shared object
+///
+/// @returns false if the object can't be loaded, or lacks map() or reduce()
+bool mr_register(string_view name, bytes_t so) {
+  auto loaded = load_so(so);
+  if (!loaded)
+    return false;
+  lock_guard<mutex> g(registry_lock);
+  registry[string(name)] = loaded;
+  return true;
+}
+
+/// Map shards from a run until there are none left
+///
+/// @param r The run
+static void map_some(run_t &r) {
+  size_t i;
+  while ((i = r.next.fetch_add(1)) < r.results.size()) {
+    auto &out = r.results[i];
+    r.storage->map_shard(i, [&](string_view user, bytes_t content) {
+      out.push_back(r.so->map(user, content));
+    });
+    lock_guard<mutex> g(r.lock);
+    if (++r.done == r.results.size())
+      r.cv.notify_all();
+  }
+}
+
+/// Run a registered shared object over every user
+///
+/// @param storage The Storage object whose users should be mapped
+/// @param name    The name of the shared object
+///
+/// @returns {false, result of reduce()}, or {true, error message} if there is
+///          no shared object with that name
+pair<bool, vec> mr_run(Storage &storage, string_view name) {
+  auto r = make_shared<run_t>();
+  {
+    lock_guard<mutex> g(registry_lock);
+    auto it = registry.find(string(name));
+    if (it == registry.end())
+      return {true, vec_from_string(RES_ERR_SO)};
+    r->so = it->second;
+  }
+  r->storage = &storage;
+  r->results.resize(storage.num_shards());
+  // The calling thread maps too, so it needs one fewer helper than shards
+  size_t helpers = (mappers && !r->results.empty())
+                       ? min(r->results.size() - 1, mr_threads)
+                       : 0;
+  for (size_t i = 0; i < helpers; ++i) {
+    if (mappers->queue_depth() >= mr_threads * MR_QUEUE_PER_THREAD ||
+        !mappers->submit([r]() { map_some(*r); }))
+      break;
+  }
+  map_some(*r);
+  {
+    unique_lock<mutex> g(r->lock);
+    r->cv.wait(g, [&]() { return r->done == r->results.size(); });
+  }
+  vector<vec> all;
+  for (auto &shard : r->results)
+    for (auto &v : shard)
+      all.push_back(move(v));
+  return {false, r->so->reduce(all)};
+}
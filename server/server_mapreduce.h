@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "../common/vec.h"
+
+#include "server_storage.h"
+
+/// The admin can register shared objects that provide map() and reduce() (see
+/// common/mapreduce.h), and then run them over every user's content, so that
+/// aggregate questions don't need a GET per user.  A run maps the auth table's
+/// shards in parallel: the calling thread and a pool of compute threads each
+/// claim the next unvisited shard, and map() every user in it while the shard
+/// is read-locked.  Then reduce() runs on the calling thread.
+///
+/// A registered object is written to a private temporary file, loaded with
+/// dlopen(), and the file is removed at once.  Registering a name again
+/// replaces the object, but runs that have already started keep using the old
+/// one.  Registrations live only in memory.
+
+/// Configure map/reduce, and start the compute threads
+///
+/// @param prefix  The prefix of the temporary files for shared objects
+/// @param threads The number of threads that help to map shards
+void mr_init(const std::string &prefix, size_t threads);
+
+/// Stop the compute threads, and unload every shared object that isn't in
+/// use.  Runs are mapped by the calling thread alone after this.
+void mr_stop();
+
+/// Register a shared object, replacing any earlier one with the same name
+///
+/// @param name The name under which to register it
+/// @param so   The bytes of the shared object
+///
+/// @returns false if the object can't be loaded, or lacks map() or reduce()
+bool mr_register(std::string_view name, bytes_t so);
+
+/// Run a registered shared object over every user
+///
+/// @param storage The Storage object whose users should be mapped
+/// @param name    The name of the shared object
+///
+/// @returns {false, result of reduce()}, or {true, error message} if there is
+///          no shared object with that name
+std::pair<bool, vec> mr_run(Storage &storage, std::string_view name);
@@ -0,0 +1,252 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "../common/err.h"
+#include "../common/file.h"
+#include "../common/histogram.h"
+
+#include "server_metrics.h"
+
+using namespace std;
+
+/// The names of the counters, in the order of counter_t
+static const char *const COUNTER_NAMES[NCOUNTERS] = {
+    "connections",   "bytes_in",        "bytes_out",    "auth_failures",
+    "quota_rejects", "shed_queue_full", "shed_deadline"};
+
+/// The names of the histograms, in the order of latency_t
+static const char *const LATENCY_NAMES[NLATENCIES] = {
+    "cmd_REG", "cmd_BYE", "cmd_SAV", "cmd_SET", "cmd_GET", "cmd_ALL",
+    "cmd_MET", "cmd_SOF", "cmd_FUN", "rsa",     "aes"};
+
+/// lat_block_t is one thread's atomic version of a histogram
+struct lat_block_t {
+  /// The count in each bucket
+  atomic<uint64_t> buckets[histogram::HIST_BUCKETS];
+
+  /// The sum and largest of the values
+  atomic<uint64_t> sum, max;
+};
+
+/// thread_block_t holds one thread's metrics.  Only that thread writes them,
+/// so updates are a relaxed load and store, rather than a read-modify-write.
+struct thread_block_t {
+  /// The counters
+  atomic<uint64_t> counters[NCOUNTERS];
+
+  /// The histograms
+  lat_block_t lat[NLATENCIES];
+
+  /// Zero every metric.  NB: atomics are not zeroed by default.
+  thread_block_t() {
+    for (auto &c : counters)
+      c.store(0, memory_order_relaxed);
+    for (auto &l : lat) {
+      for (auto &b : l.buckets)
+        b.store(0, memory_order_relaxed);
+      l.sum.store(0, memory_order_relaxed);
+      l.max.store(0, memory_order_relaxed);
+    }
+  }
+};
+
+/// Add to an atomic that only the calling thread writes
+///
+/// @param a The atomic
+/// @param n The amount to add
+static void bump(atomic<uint64_t> &a, uint64_t n) {
+  a.store(a.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+/// The global state of the metrics.  Blocks are never freed, so the counts of
+/// threads that have exited are still reported.
+static struct {
+  /// A lock to protect everything below.  It is only taken when a thread
+  /// first records a metric, and when a report is made.
+  mutex lock;
+
+  /// Every thread's block
+  vector<unique_ptr<thread_block_t>> blocks;
+
+  /// The gauges, with their names
+  vector<pair<string, function<uint64_t()>>> gauges;
+
+  /// The sections
+  vector<function<string()>> sections;
+
+  /// The admin user
+  string admin;
+
+  /// When the server started
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  /// The dump thread, and what it needs to know to stop
+  thread dumper;
+  bool stopping = false;
+  condition_variable cv;
+} metrics;
+
+/// Find the calling thread's block, creating it on first use
+///
+/// @returns The calling thread's block
+static thread_block_t &my_block() {
+  static thread_local thread_block_t *mine = nullptr;
+  if (mine == nullptr) {
+    auto b = make_unique<thread_block_t>();
+    mine = b.get();
+    lock_guard<mutex> g(metrics.lock);
+    metrics.blocks.push_back(move(b));
+  }
+  return *mine;
+}
+
+/// Add to one of the calling thread's counters
+///
+/// @param c The counter
+/// @param n The amount to add
+void metric_add(counter_t c, uint64_t n) { bump(my_block().counters[c], n); }
+
+/// Record one latency in the calling thread's histogram
+///
+/// @param l  The histogram
+/// @param ns The latency, in nanoseconds
+void metric_time(latency_t l, uint64_t ns) {
+  lat_block_t &b = my_block().lat[l];
+  bump(b.buckets[histogram::bucket_of(ns)], 1);
+  bump(b.sum, ns);
+  if (ns > b.max.load(memory_order_relaxed))
+    b.max.store(ns, memory_order_relaxed);
+}
+
+/// Add a gauge: a value that is computed at report time, such as a queue depth
+///
+/// @param name The name to report it under
+/// @param f    The function that computes its current value
+void metric_gauge(const string &name, function<uint64_t()> f) {
+  lock_guard<mutex> g(metrics.lock);
+  metrics.gauges.emplace_back(name, f);
+}
+
+/// Add a section: lines of text that are computed at report time, for metrics
+/// that aren't a single number
+///
+/// @param f The function that computes the lines, each ending in "\n"
+void metric_section(function<string()> f) {
+  lock_guard<mutex> g(metrics.lock);
+  metrics.sections.push_back(f);
+}
+
+/// Name the user who may read the metrics with REQ_MET
+///
+/// @param user The admin user's name, or "" to disable REQ_MET
+void metrics_set_admin(const string &user) {
+  lock_guard<mutex> g(metrics.lock);
+  metrics.admin = user;
+}
+
+/// Check if a user is the admin user
+///
+/// @param user The user's name
+///
+/// @returns true if an admin has been named and it is user
+bool metrics_is_admin(const string &user) {
+  lock_guard<mutex> g(metrics.lock);
+  return metrics.admin != "" && metrics.admin == user;
+}
+
+/// Produce a report of every counter, histogram, gauge and section
+///
+/// @returns The text of the report
+string metrics_report() {
+  uint64_t counters[NCOUNTERS] = {0};
+  vector<histogram> lats(NLATENCIES);
+  vector<pair<string, function<uint64_t()>>> gauges;
+  vector<function<string()>> sections;
+  {
+    lock_guard<mutex> g(metrics.lock);
+    vector<uint64_t> buckets(histogram::HIST_BUCKETS);
+    for (auto &b : metrics.blocks) {
+      for (int c = 0; c < NCOUNTERS; ++c)
+        counters[c] += b->counters[c].load(memory_order_relaxed);
+      for (int l = 0; l < NLATENCIES; ++l) {
+        for (int i = 0; i < histogram::HIST_BUCKETS; ++i)
+          buckets[i] = b->lat[l].buckets[i].load(memory_order_relaxed);
+        lats[l].merge(buckets.data(), b->lat[l].sum.load(memory_order_relaxed),
+                      b->lat[l].max.load(memory_order_relaxed));
+      }
+    }
+    gauges = metrics.gauges;
+    sections = metrics.sections;
+  }
+
+  // NB: gauges and sections run without the lock, since they may take locks of
+  //     their own
+  ostringstream out;
+  out << fixed << setprecision(1);
+  out << "uptime_s "
+      << chrono::duration_cast<chrono::seconds>(chrono::steady_clock::now() -
+                                                metrics.start)
+             .count()
+      << "\n";
+  for (int c = 0; c < NCOUNTERS; ++c)
+    out << COUNTER_NAMES[c] << " " << counters[c] << "\n";
+  for (auto &g : gauges)
+    out << g.first << " " << g.second() << "\n";
+  for (int l = 0; l < NLATENCIES; ++l) {
+    const histogram &h = lats[l];
+    out << LATENCY_NAMES[l] << " count=" << h.count()
+        << " mean_us=" << h.mean() / 1e3
+        << " p50_us=" << h.percentile(50) / 1e3
+        << " p99_us=" << h.percentile(99) / 1e3
+        << " p999_us=" << h.percentile(99.9) / 1e3
+        << " max_us=" << h.max() / 1e3 << "\n";
+  }
+  for (auto &s : sections)
+    out << s();
+  return out.str();
+}
+
+/// Start a thread that writes the report to a file (through file.tmp, so that
+/// readers never see a partial report) every few seconds
+///
+/// @param file The name of the file
+/// @param secs The number of seconds between dumps
+void metrics_start_dump(const string &file, int secs) {
+  metrics.dumper = thread([file, secs]() {
+    string tmp = file + ".tmp";
+    unique_lock<mutex> l(metrics.lock);
+    while (true) {
+      bool last = metrics.cv.wait_for(l, chrono::seconds(secs),
+                                      [] { return metrics.stopping; });
+      l.unlock();
+      string report = metrics_report();
+      if (write_file(tmp, report.data(), report.size()) &&
+          rename(tmp.c_str(), file.c_str()) != 0)
+        sys_error(errno, "Error renaming metrics file:");
+      l.lock();
+      if (last)
+        return;
+    }
+  });
+}
+
+/// Stop the dump thread, after it writes one last report
+void metrics_stop_dump() {
+  {
+    lock_guard<mutex> g(metrics.lock);
+    metrics.stopping = true;
+    metrics.cv.notify_all();
+  }
+  if (metrics.dumper.joinable())
+    metrics.dumper.join();
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+/// The server's metrics are counters and latency histograms that every thread
+/// updates without locks.  Each thread has its own block of relaxed atomics,
+/// which only it writes, so an update costs about as much as a plain add.  A
+/// report sums every thread's block, and then adds the gauges.
+///
+/// The report is plain text, with one "name value" line per counter or gauge,
+/// and one line per histogram, giving its count and latencies in microseconds
+/// (latencies are recorded in nanoseconds, so that short ones aren't lost).
+/// It is available to the admin user through REQ_MET, and can be dumped to a
+/// file every few seconds.
+
+/// The counters that the server keeps
+enum counter_t {
+  CNT_CONNECTIONS,   // connections accepted
+  CNT_BYTES_IN,      // bytes received from clients
+  CNT_BYTES_OUT,     // bytes sent to clients
+  CNT_AUTH_FAILURES, // requests that failed with RES_ERR_LOGIN
+  CNT_QUOTA_REJECTS, // requests refused for going over a quota
+  CNT_SHED_FULL,     // connections refused because the queue was full
+  CNT_SHED_LATE,     // requests refused for waiting past their deadline
+  NCOUNTERS
+};
+
+/// The latencies that the server measures.  The first few are the command
+/// handlers, in the same order as the commands that dispatch_command() knows.
+enum latency_t {
+  LAT_REG,
+  LAT_BYE,
+  LAT_SAV,
+  LAT_SET,
+  LAT_GET,
+  LAT_ALL,
+  LAT_MET,
+  LAT_SOF,
+  LAT_FUN,
+  LAT_RSA, // RSA decryption of an rblock
+  LAT_AES, // AES work for one request (or session frame)
+  NLATENCIES
+};
+
+/// Add to one of the calling thread's counters
+///
+/// @param c The counter
+/// @param n The amount to add
+void metric_add(counter_t c, uint64_t n = 1);
+
+/// Record one latency in the calling thread's histogram
+///
+/// @param l  The histogram
+/// @param ns The latency, in nanoseconds
+void metric_time(latency_t l, uint64_t ns);
+
+/// metric_timer_t records the time from its construction to its destruction
+/// in one of the calling thread's histograms
+struct metric_timer_t {
+  /// The histogram
+  const latency_t lat;
+
+  /// When the timer started
+  const std::chrono::steady_clock::time_point start;
+
+  /// Start a timer
+  ///
+  /// @param l The histogram that should receive the time
+  metric_timer_t(latency_t l)
+      : lat(l), start(std::chrono::steady_clock::now()) {}
+
+  /// Stop the timer and record its time
+  ~metric_timer_t() {
+    metric_time(lat, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - start)
+                         .count());
+  }
+};
+
+/// Add a gauge: a value that is computed at report time, such as a queue depth
+///
+/// @param name The name to report it under
+/// @param f    The function that computes its current value
+void metric_gauge(const std::string &name, std::function<uint64_t()> f);
+
+/// Add a section: lines of text that are computed at report time, for metrics
+/// that aren't a single number
+///
+/// @param f The function that computes the lines, each ending in "\n"
+void metric_section(std::function<std::string()> f);
+
+/// Name the user who may read the metrics with REQ_MET
+///
+/// @param user The admin user's name, or "" to disable REQ_MET
+void metrics_set_admin(const std::string &user);
+
+/// Check if a user is the admin user
+///
+/// @param user The user's name
+///
+/// @returns true if an admin has been named and it is user
+bool metrics_is_admin(const std::string &user);
+
+/// Produce a report of every counter, histogram, gauge and section
+///
+/// @returns The text of the report
+std::string metrics_report();
+
+/// Start a thread that writes the report to a file (through file.tmp, so that
+/// readers never see a partial report) every few seconds
+///
+/// @param file The name of the file
+/// @param secs The number of seconds between dumps
+void metrics_start_dump(const std::string &file, int secs);
+
+/// Stop the dump thread, after it writes one last report
+void metrics_stop_dump();
@@ -1,30 +1,750 @@
+#include <chrono>
 #include <cstring>
 #include <iostream>
 #include <openssl/rsa.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <vector>
 
+#include "../common/bufpool.h"
 #include "../common/contextmanager.h"
 #include "../common/crypto.h"
 #include "../common/net.h"
 #include "../common/protocol.h"
+#include "../common/session.h"
 #include "../common/vec.h"
 
+#include "server_admission.h"
 #include "server_commands.h"
+#include "server_metrics.h"
 #include "server_parsing.h"
+#include "server_passhash.h"
+#include "server_quotas.h"
 #include "server_storage.h"
+#include "server_tickets.h"
 
 using namespace std;
 
+/// The most frames of a session that are run as one batch
+const size_t SESSION_BATCH_MAX = 16;
+
+/// aes_meter_t records the AES time of one request (or frame) in LAT_AES.  Only
+/// the time spent in AES counts, not the I/O or the command in between.
+struct aes_meter_t {
+  /// The calling thread's AES time when the meter started
+  const uint64_t start = aes_thread_ns();
+
+  /// Record the AES time since the meter started
+  ~aes_meter_t() { metric_time(LAT_AES, aes_thread_ns() - start); }
+};
+
+/// Find the next len().bytes field of a request, without copying it.  The
+/// field must not be longer than max bytes.
+///
+/// @param req The decrypted request body
+/// @param pos The position of the field's length; advanced past the field
+/// @param max The maximum valid length of the field
+/// @param out The view that receives the field
+///
+/// @returns false if the request is too short or the length is invalid
+static bool view_field(const vec &req, size_t &pos, int max, bytes_t &out) {
+  int len;
+  if (req.size() - pos < sizeof(int))
+    return false;
+  memcpy(&len, req.data() + pos, sizeof(int));
+  pos += sizeof(int);
+  if (len < 0 || len > max || req.size() - pos < (size_t)len)
+    return false;
+  out.data = req.data() + pos;
+  out.size = len;
+  pos += len;
+  return true;
+}
+
+/// Find the name of the user (@u) who made a request, without checking the rest
+/// of the body
+///
+/// @param req  The decrypted request body
+/// @param user Receives a view of the name
+///
+/// @returns false if the body does not start with a valid name
+static bool peek_user(const vec &req, string_view &user) {
+  size_t pos = 0;
+  bytes_t u;
+  if (!view_field(req, pos, LEN_UNAME, u) || u.size == 0)
+    return false;
+  user = string_view((const char *)u.data, u.size);
+  return true;
+}
+
+/// Determine if a command's response counts against the download quota
+///
+/// @param cmd The command
+///
+/// @returns true for the commands that fetch data
+static bool is_download(const string &cmd) {
+  return cmd == REQ_GET || cmd == REQ_ALL || cmd == REQ_MET ||
+         cmd == REQ_FUN;
+}
+
+/// Parse a decrypted request body into views of its fields.  Each length is
+/// checked against the buffer and against LEN_UNAME, LEN_PASS, or max_arg, and
+/// the fields must account for every byte of the body.
+///
+/// @param req     The decrypted request body
+/// @param max_arg The largest valid length of the extra field, or -1 if the
+///                request has no extra field
+/// @param view    The structure that receives the views
+/// @param flags   Accept a 4-byte set of flags after the extra field?
+///
+/// @returns false if the body is malformed, or if @u or @p is empty
+bool parse_request(const vec &req, int max_arg, req_view_t &view,
+                   bool flags) {
+  size_t pos = 0;
+  bytes_t user, pass;
+  if (!view_field(req, pos, LEN_UNAME, user) || user.size == 0 ||
+      !view_field(req, pos, LEN_PASS, pass) || pass.size == 0)
+    return false;
+  view.user = string_view((const char *)user.data, user.size);
+  view.pass = string_view((const char *)pass.data, pass.size);
+  view.arg = bytes_t();
+  view.flags = 0;
+  if (max_arg >= 0 && !view_field(req, pos, max_arg, view.arg))
+    return false;
+  if (flags && req.size() - pos == sizeof(int)) {
+    memcpy(&view.flags, req.data() + pos, sizeof(int));
+    pos += sizeof(int);
+  }
+  return pos == req.size();
+}
+
+/// Determine if a LEN_RKBLOCK-byte block is an unencrypted KEY request
+///
+/// @param block The first LEN_RKBLOCK bytes of a request
+///
+/// @returns true if the block is pad0(REQ_KEY), false otherwise
+bool is_kblock(const vec &block) {
+  if (block.size() != LEN_RKBLOCK ||
+      memcmp(block.data(), REQ_KEY.c_str(), REQ_KEY.length()) != 0)
+    return false;
+  for (size_t i = REQ_KEY.length(); i < block.size(); ++i)
+    if (block[i] != '\0')
+      return false;
+  return true;
+}
+
+/// Use the server's private key to decrypt an rblock, and then split it into
+/// its fields.  This is the most expensive step in serving a request.
+///
+/// @param pri    The private key used by the server
+/// @param rblock The LEN_RKBLOCK bytes of the encrypted rblock
+/// @param hdr    The structure that receives the decrypted fields
+///
+/// @returns false if the rblock could not be decrypted or is malformed
+bool decrypt_rblock(RSA *pri, const vec &rblock, rblock_t &hdr) {
+  // The rblock is cmd.aeskey.len(@ablock), where cmd is 3 bytes
+  const size_t cmd_len = REQ_KEY.length();
+  const size_t key_len = AES_KEYSIZE + AES_IVSIZE;
+  vec dec(RSA_size(pri));
+  int len;
+  {
+    metric_timer_t t(LAT_RSA);
+    len = RSA_private_decrypt(rblock.size(), rblock.data(), dec.data(), pri,
+                              RSA_PKCS1_OAEP_PADDING);
+  }
+  if (len < (int)(cmd_len + key_len + sizeof(int)))
+    return false;
+  hdr.cmd = string(dec.begin(), dec.begin() + cmd_len);
+  hdr.aeskey = vec(dec.begin() + cmd_len, dec.begin() + cmd_len + key_len);
+  memcpy(&hdr.alen, dec.data() + cmd_len + key_len, sizeof(int));
+  hdr.flags = 0;
+  if (len >= (int)(cmd_len + key_len + 2 * sizeof(int)))
+    memcpy(&hdr.flags, dec.data() + cmd_len + key_len + sizeof(int),
+           sizeof(int));
+  // NB: an ablock holds at most a user, a password, and a content, each with a
+  //     length, plus one block of AES padding
+  const int max_alen = LEN_UNAME + LEN_PASS + LEN_CONTENT + 3 * sizeof(int) +
+                       EVP_MAX_BLOCK_LENGTH;
+  return hdr.alen >= 0 && hdr.alen <= max_alen;
+}
+
+/// Determine if a LEN_RKBLOCK-byte block is an unencrypted REQ_RSM header
+///
+/// @param block The first LEN_RKBLOCK bytes of a request
+///
+/// @returns true if the block is pad0("RSM".@t.len(@e)), false otherwise
+bool is_rsm_block(const vec &block) {
+  const size_t hdr_len = REQ_RSM.length() + LEN_TICKET + sizeof(int);
+  if (block.size() != LEN_RKBLOCK ||
+      memcmp(block.data(), REQ_RSM.c_str(), REQ_RSM.length()) != 0)
+    return false;
+  for (size_t i = hdr_len; i < block.size(); ++i)
+    if (block[i] != '\0')
+      return false;
+  return true;
+}
+
+/// Redeem the ticket in a REQ_RSM header, and fill in the fields of the
+/// request as though they came from an rblock.  This costs one AES decryption,
+/// instead of an RSA decryption.
+///
+/// @param tickets The server's ticket cache
+/// @param block   The LEN_RKBLOCK bytes of the header
+/// @param hdr     The structure that receives the fields
+///
+/// @returns false if the ticket can't be redeemed or the header is malformed
+bool parse_rsm_block(TicketCache &tickets, const vec &block, rblock_t &hdr) {
+  const unsigned char *ticket = block.data() + REQ_RSM.length();
+  int len;
+  memcpy(&len, ticket + LEN_TICKET, sizeof(int));
+  if (len <= 0 || len > LEN_FRAME_MAX || !tickets.redeem(ticket, hdr.aeskey))
+    return false;
+  hdr.cmd = REQ_RSM;
+  hdr.alen = AES_IVSIZE + len;
+  hdr.flags = 0;
+  return true;
+}
+
+/// Run one decrypted command by dispatching it to the right handler.  The time
+/// of each command is recorded, as is every RES_ERR_LOGIN.
+///
+/// @param storage The Storage object with which clients interact
+/// @param cmd     The command (e.g., REQ_REG)
+/// @param req     The unencrypted body of the request
+/// @param res     The vector that receives the unencrypted response
+/// @param creds   The connection's checked credentials, or nullptr
+///
+/// @returns true if the server should halt once the response is sent
+bool dispatch_command(Storage &storage, const string &cmd, const vec &req,
+                      vec &res, cred_cache_t *creds) {
+  // NB: the order must match latency_t
+  vector<string> cmds = {REQ_REG, REQ_BYE, REQ_SAV, REQ_SET, REQ_GET,
+                         REQ_ALL, REQ_MET, REQ_SOF, REQ_FUN};
+  decltype(server_cmd_reg) *funcs[] = {
+      server_cmd_reg, server_cmd_bye, server_cmd_sav,
+      server_cmd_set, server_cmd_get, server_cmd_all,
+      server_cmd_met, server_cmd_sof, server_cmd_fun};
+  for (size_t i = 0; i < cmds.size(); ++i) {
+    if (cmd != cmds[i])
+      continue;
+    // NB: REG isn't metered, since its user doesn't exist yet
+    string_view user;
+    bool metered = cmd != REQ_REG && quota_enabled() && peek_user(req, user);
+    if (metered) {
+      string err = quota_admit(user, req.size());
+      if (!err.empty()) {
+        metric_add(CNT_QUOTA_REJECTS);
+        res = vec_from_string(err);
+        return false;
+      }
+    }
+    bool stop;
+    {
+      metric_timer_t t((latency_t)i);
+      stop = funcs[i](storage, req, res, creds);
+    }
+    if (res == vec_from_string(RES_ERR_LOGIN)) {
+      metric_add(CNT_AUTH_FAILURES);
+    } else if (metered) {
+      uint64_t down = is_download(cmd) ? res.size() : 0;
+      if (down > 0 && !quota_can_download(user, down)) {
+        metric_add(CNT_QUOTA_REJECTS);
+        pool_give(res);
+        res = vec_from_string(RES_ERR_QUOTA_DOWN);
+        down = 0;
+      }
+      quota_charge(user, req.size(), down);
+    }
+    return stop;
+  }
+  res = vec_from_string(RES_ERR_INV_CMD);
+  return false;
+}
+
+/// Produce the bytes that precede the encrypted response to a one-shot request
+/// (len(@t).@t), if its rblock asked for a ticket.  Only a successful request
+/// earns a ticket.
+///
+/// @param tickets The server's ticket cache
+/// @param hdr     The decrypted rblock
+/// @param ok      false if the response must not earn a ticket
+/// @param res     The unencrypted response (or its first page)
+/// @param prefix  The vector that receives the bytes, or is cleared if the
+///                rblock did not ask for a ticket
+static void ticket_prefix(TicketCache &tickets, const rblock_t &hdr, bool ok,
+                          const vec &res, vec &prefix) {
+  prefix.clear();
+  if (!(hdr.flags & RBLOCK_FLAG_TICKET))
+    return;
+  vec ticket;
+  if (ok && res.size() >= RES_OK.length() &&
+      memcmp(res.data(), RES_OK.c_str(), RES_OK.length()) == 0)
+    ticket = tickets.issue(hdr.aeskey);
+  vec_append(prefix, (int)ticket.size());
+  vec_append(prefix, ticket);
+}
+
+/// Run a one-shot request whose ablock has already been decrypted.  If the
+/// rblock asked for a ticket, then the bytes that must precede the encrypted
+/// response (len(@t).@t) are produced too.
+///
+/// @param storage The Storage object with which clients interact
+/// @param tickets The server's ticket cache
+/// @param hdr     The decrypted rblock
+/// @param req     The decrypted ablock
+/// @param res     The vector that receives the unencrypted response
+/// @param prefix  The vector that receives the unencrypted bytes that precede
+///                the encrypted response.  It is empty unless the rblock asked
+///                for a ticket.
+///
+/// @returns true if the server should halt once the response is sent
+static bool run_request(Storage &storage, TicketCache &tickets,
+                        const rblock_t &hdr, const vec &req, vec &res,
+                        vec &prefix) {
+  bool stop = dispatch_command(storage, hdr.cmd, req, res);
+  ticket_prefix(tickets, hdr, !stop, res, prefix);
+  return stop;
+}
+
+/// Given a decrypted rblock and the (still encrypted) ablock of a request,
+/// decrypt the ablock, dispatch to the right command handler, and produce the
+/// exact bytes that should be sent back to the client.  This does no I/O, so
+/// it can be used by both the blocking and the event-driven servers.  If the
+/// rblock asked for a ticket, the response is prefixed with len(@t).@t.
+///
+/// @param storage  The Storage object with which clients interact
+/// @param tickets  The server's ticket cache
+/// @param hdr      The decrypted rblock
+/// @param ablock   The encrypted ablock
+/// @param response The vector that receives the bytes of the response
+///
+/// @returns true if the server should halt once the response is sent
+bool execute_request(Storage &storage, TicketCache &tickets,
+                     const rblock_t &hdr, const vec &ablock, vec &response) {
+  aes_meter_t aes;
+  // Decrypt the ablock.  If we can't, the error is sent unencrypted.
+  EVP_CIPHER_CTX *ctx = create_aes_context(hdr.aeskey, false);
+  if (ctx == nullptr) {
+    response = vec_from_string(RES_ERR_CRYPTO);
+    return false;
+  }
+  ContextManager cm([&]() { reclaim_aes_context(ctx); });
+  vec req = aes_crypt_msg(ctx, ablock);
+  if (req.empty()) {
+    response = vec_from_string(RES_ERR_CRYPTO);
+    return false;
+  }
+
+  vec res;
+  bool stop = run_request(storage, tickets, hdr, req, res, response);
+
+  // Encrypt the response with the client's key
+  if (!reset_aes_context(ctx, hdr.aeskey, true)) {
+    response = vec_from_string(RES_ERR_CRYPTO);
+    return false;
+  }
+  vec enc = aes_crypt_msg(ctx, res);
+  pool_give(res);
+  vec_append(response, enc);
+  return stop;
+}
+
+/// Serve a one-shot ALL query that asks for a stream, by encrypting and sending
+/// each page as soon as it has been listed.  The pages form one CBC stream, so
+/// the client sees the same bytes as if they had been encrypted all at once,
+/// but neither the list nor its ciphertext is ever held in full.
+///
+/// @param sd      The socket on which communication with the client takes place
+/// @param storage The Storage object with which clients interact
+/// @param tickets The server's ticket cache
+/// @param hdr     The decrypted rblock
+/// @param req     The decrypted ablock
+/// @param ctx     The request's AES context, ready to encrypt
+static void stream_all(int sd, Storage &storage, TicketCache &tickets,
+                       const rblock_t &hdr, const vec &req,
+                       EVP_CIPHER_CTX *ctx) {
+  metric_timer_t t(LAT_ALL);
+  bool first = true, sent = true;
+  size_t len = 0;
+  auto send_page = [&](const vec &page) {
+    if (first) {
+      first = false;
+      vec prefix;
+      ticket_prefix(tickets, hdr, true, page, prefix);
+      if (!prefix.empty() && !send_reliably(sd, prefix))
+        return sent = false;
+      metric_add(CNT_BYTES_OUT, prefix.size());
+    }
+    len += page.size();
+    return sent = send_encrypt_part(sd, ctx, page.data(), page.size());
+  };
+  // NB: quotas work as in dispatch_command(), except that the listing stops
+  //     at the first page that doesn't fit in the download quota
+  string_view user;
+  bool metered = quota_enabled() && peek_user(req, user);
+  string err = metered ? quota_admit(user, req.size()) : "";
+  if (!err.empty()) {
+    metric_add(CNT_QUOTA_REJECTS);
+    send_page(vec_from_string(err));
+  } else {
+    server_cmd_all_stream(storage, req, nullptr, [&](const vec &page) {
+      if (first && page == vec_from_string(RES_ERR_LOGIN)) {
+        metric_add(CNT_AUTH_FAILURES);
+        metered = false;
+      }
+      uint64_t up = first ? req.size() : 0;
+      if (metered && !quota_can_download(user, page.size())) {
+        metric_add(CNT_QUOTA_REJECTS);
+        quota_charge(user, up, 0, first);
+        if (first)
+          send_page(vec_from_string(RES_ERR_QUOTA_DOWN));
+        return false;
+      }
+      if (metered)
+        quota_charge(user, up, page.size(), first);
+      return send_page(page);
+    });
+  }
+  if (sent)
+    send_encrypt_final(sd, ctx);
+  metric_add(CNT_BYTES_OUT, len + AES_IVSIZE - len % AES_IVSIZE);
+}
+
+/// Serve a one-shot request on a blocking socket, by decrypting its ablock as
+/// it arrives, and encrypting the response as it is sent.  Unlike
+/// execute_request(), neither the encrypted ablock nor the encrypted response
+/// is ever held in memory, which matters for large SET and GET payloads.
+///
+/// @param sd      The socket on which communication with the client takes place
+/// @param storage The Storage object with which clients interact
+/// @param tickets The server's ticket cache
+/// @param hdr     The decrypted rblock
+/// @param arena   The connection's buffers
+///
+/// @returns true if the server should halt immediately, false otherwise
+static bool stream_request(int sd, Storage &storage, TicketCache &tickets,
+                           const rblock_t &hdr, buf_arena &arena) {
+  aes_meter_t aes;
+  EVP_CIPHER_CTX *ctx = create_aes_context(hdr.aeskey, false);
+  if (ctx == nullptr) {
+    send_reliably(sd, RES_ERR_CRYPTO);
+    return false;
+  }
+  ContextManager cm([&]() { reclaim_aes_context(ctx); });
+  // NB: with room for the padding, so that recv_decrypt() never reallocates
+  vec &req = arena.get(hdr.alen + EVP_MAX_BLOCK_LENGTH);
+  int got = recv_decrypt(sd, ctx, hdr.alen, req);
+  if (got <= 0) {
+    send_reliably(sd, got == 0 ? RES_ERR_XMIT : RES_ERR_CRYPTO);
+    // NB: the rest of an undecryptable ablock is never read
+    if (got < 0)
+      admission_linger(sd);
+    return false;
+  }
+  metric_add(CNT_BYTES_IN, hdr.alen);
+
+  if (hdr.cmd == REQ_ALL && all_is_stream(req)) {
+    if (!reset_aes_context(ctx, hdr.aeskey, true)) {
+      send_reliably(sd, RES_ERR_CRYPTO);
+      return false;
+    }
+    stream_all(sd, storage, tickets, hdr, req, ctx);
+    return false;
+  }
+
+  vec res, prefix;
+  bool stop = run_request(storage, tickets, hdr, req, res, prefix);
+
+  if (!reset_aes_context(ctx, hdr.aeskey, true)) {
+    send_reliably(sd, RES_ERR_CRYPTO);
+    return false;
+  }
+  // NB: CBC pads the response to a whole number of cipher blocks, which are
+  //     as long as the IV
+  metric_add(CNT_BYTES_OUT, prefix.size() + res.size() + AES_IVSIZE -
+                                res.size() % AES_IVSIZE);
+  send_encrypt(sd, ctx, res.data(), res.size(), prefix);
+  pool_give(res);
+  return stop;
+}
+
+/// Handle the handshake (REQ_SES) that opens a session.  The response is
+/// always a frame, so that the client can read it without waiting for EOF.
+///
+/// @param hdr      The decrypted rblock, which holds the session's AES key
+/// @param ablock   The encrypted ablock
+/// @param response The vector that receives the bytes of the response
+///
+/// @returns true if the session is open and frames may follow, false if the
+///          connection should be closed once the response is sent
+bool start_session(const rblock_t &hdr, const vec &ablock, vec &response) {
+  aes_meter_t aes;
+  EVP_CIPHER_CTX *ctx = create_aes_context(hdr.aeskey, false);
+  if (ctx == nullptr) {
+    response = seal_frame(hdr.aeskey, vec_from_string(RES_ERR_CRYPTO));
+    return false;
+  }
+  ContextManager cm([&]() { reclaim_aes_context(ctx); });
+  vec req = aes_crypt_msg(ctx, ablock);
+  if (req.empty()) {
+    response = seal_frame(hdr.aeskey, vec_from_string(RES_ERR_CRYPTO));
+    return false;
+  }
+  int version;
+  if (req.size() != sizeof(int) ||
+      (memcpy(&version, req.data(), sizeof(int)), version < 1)) {
+    response = seal_frame(hdr.aeskey, vec_from_string(RES_ERR_MSG_FMT));
+    return false;
+  }
+  vec res = vec_from_string(RES_OK);
+  vec_append(res, version < SESSION_VERSION ? version : SESSION_VERSION);
+  response = seal_frame(hdr.aeskey, res);
+  return !response.empty();
+}
+
+/// Decrypt one request frame of a session, run it, and produce the response
+/// frame.  This does no I/O.
+///
+/// @param storage  The Storage object with which clients interact
+/// @param key      The session's AES key
+/// @param frame    The @iv.@e part of the frame
+/// @param response The vector that receives the bytes of the response frame.
+///                 It is left empty if the frame could not be decrypted, in
+///                 which case the session must end.
+/// @param creds    The connection's checked credentials, or nullptr
+///
+/// @returns true if the server should halt once the response is sent
+bool execute_frame(Storage &storage, const vec &key, const vec &frame,
+                   vec &response, cred_cache_t *creds) {
+  vector<vec> responses;
+  bool stop = execute_frames(storage, key, {&frame}, responses, creds);
+  response.clear();
+  if (!responses.empty())
+    response.swap(responses[0]);
+  return stop;
+}
+
+/// Split a decrypted session message into its command and its body
+///
+/// @param msg The message, which is cmd.@b
+/// @param cmd Receives the command
+/// @param req Receives the body
+///
+/// @returns false if the message is too short to hold a command
+static bool split_message(const vec &msg, string &cmd, vec &req) {
+  // The message is cmd.@b, where cmd is as long as every other command
+  const size_t cmd_len = REQ_KEY.length();
+  if (msg.size() < cmd_len)
+    return false;
+  cmd.assign(msg.begin(), msg.begin() + cmd_len);
+  req.assign(msg.begin() + cmd_len, msg.end());
+  return true;
+}
+
+/// Decrypt several request frames of a session, which arrived back to back,
+/// run them in order, and produce their response frames.  A run of REGs is
+/// registered as one batch, so that their passwords are hashed in parallel.
+/// This does no I/O.
+///
+/// @param storage   The Storage object with which clients interact
+/// @param key       The session's AES key
+/// @param frames    The @iv.@e part of each frame
+/// @param responses The vector that receives the bytes of each response
+///                  frame.  It is shorter than frames if a frame could not be
+///                  decrypted (in which case the session must end), or if a
+///                  frame halted the server (in which case no later frame is
+///                  run).
+/// @param creds     The connection's checked credentials, or nullptr
+///
+/// @returns true if the server should halt once the responses are sent
+bool execute_frames(Storage &storage, const vec &key,
+                    const vector<const vec *> &frames, vector<vec> &responses,
+                    cred_cache_t *creds) {
+  aes_meter_t aes;
+  responses.clear();
+  // NB: only the frames before the first one that can't be decrypted are run
+  size_t n = frames.size();
+  vector<string> cmds(n);
+  vector<vec> reqs(n), res(n);
+  vector<bool> valid(n);
+  for (size_t i = 0; i < n; ++i) {
+    vec msg;
+    if (!open_frame(key, frames[i]->data(), frames[i]->size(), msg)) {
+      n = i;
+      break;
+    }
+    valid[i] = split_message(msg, cmds[i], reqs[i]);
+  }
+
+  bool stop = false;
+  size_t ran = 0;
+  while (ran < n && !stop) {
+    size_t end = ran;
+    while (end < n && valid[end] && cmds[end] == REQ_REG)
+      ++end;
+    if (end - ran > 1) {
+      metric_timer_t t(LAT_REG);
+      vector<vec> batch(reqs.begin() + ran, reqs.begin() + end), out;
+      server_cmd_reg_batch(storage, batch, out, creds);
+      for (size_t i = ran; i < end; ++i)
+        res[i].swap(out[i - ran]);
+      ran = end;
+      continue;
+    }
+    if (valid[ran])
+      stop = dispatch_command(storage, cmds[ran], reqs[ran], res[ran], creds);
+    else
+      res[ran] = vec_from_string(RES_ERR_MSG_FMT);
+    ++ran;
+  }
+  for (size_t i = 0; i < ran; ++i) {
+    responses.push_back(seal_frame(key, res[i]));
+    pool_give(res[i]);
+  }
+  return stop;
+}
+
+/// Check if all of the next frame of a session has already arrived, so that
+/// reading it won't block
+///
+/// @param sd The socket on which communication with the client takes place
+///
+/// @returns true if the next frame can be read right away
+static bool frame_waiting(int sd) {
+  int avail, len;
+  if (ioctl(sd, FIONREAD, &avail) < 0 || avail < (int)sizeof(int))
+    return false;
+  if (recv(sd, &len, sizeof(int), MSG_PEEK | MSG_DONTWAIT) != sizeof(int))
+    return false;
+  return len > 0 && len <= LEN_FRAME_MAX &&
+         avail >= (int)sizeof(int) + AES_IVSIZE + len;
+}
+
+/// Serve the frames of a session on a blocking socket, until the client
+/// closes the connection or something goes wrong.  When a client sends frames
+/// without waiting for each response, the frames that have already arrived
+/// are run as one batch (see execute_frames()).
+///
+/// @param sd      The socket on which communication with the client takes place
+/// @param storage The Storage object with which clients interact
+/// @param key     The session's AES key
+/// @param arena   The connection's buffers, which are reused for each batch
+///
+/// @returns true if the server should halt immediately, false otherwise
+static bool serve_session(int sd, Storage &storage, const vec &key,
+                          buf_arena &arena) {
+  cred_cache_t creds;
+  while (true) {
+    arena.reset();
+    vector<const vec *> frames;
+    do {
+      // Read the length, then the @iv.@e of the next frame
+      vec lenbuf(sizeof(int));
+      if (reliable_get_to_eof_or_n(sd, lenbuf.begin(), sizeof(int)) !=
+          sizeof(int))
+        return false;
+      int len;
+      memcpy(&len, lenbuf.data(), sizeof(int));
+      if (len <= 0 || len > LEN_FRAME_MAX)
+        return false;
+      vec &frame = arena.get(AES_IVSIZE + len);
+      frame.resize(AES_IVSIZE + len);
+      if (reliable_get_to_eof_or_n(sd, frame.begin(), frame.size()) !=
+          (int)frame.size())
+        return false;
+      metric_add(CNT_BYTES_IN, sizeof(int) + frame.size());
+      frames.push_back(&frame);
+    } while (frames.size() < SESSION_BATCH_MAX && frame_waiting(sd));
+
+    vector<vec> responses;
+    bool stop = execute_frames(storage, key, frames, responses, &creds);
+    vec out;
+    for (auto &r : responses)
+      vec_append(out, r);
+    metric_add(CNT_BYTES_OUT, out.size());
+    if (out.empty() || !send_reliably(sd, out))
+      return false;
+    if (stop)
+      return true;
+    if (responses.size() < frames.size())
+      return false;
+  }
+}
+
 /// When a new client connection is accepted, this code will run to figure out
 /// what the client is requesting, and to dispatch to the right function for
 /// satisfying the request.
 ///
-/// @param sd      The socket on which communication with the client takes place
-/// @param pri     The private key used by the server
-/// @param pub     The public key file contents, to send to the client
-/// @param storage The Storage object with which clients interact
+/// @param sd       The socket on which communication with the client takes
+///                 place
+/// @param pri      The private key used by the server
+/// @param pub      The public key file contents, to send to the client
+/// @param storage  The Storage object with which clients interact
+/// @param tickets  The server's ticket cache
+/// @param accepted The time at which the connection was accepted
 ///
 /// @returns true if the server should halt immediately, false otherwise
-bool serve_client(int sd, RSA *pri, const vec &pub, Storage &storage) {
-  cerr << "serve_client is not implemented\n";
-  return false;
+bool serve_client(int sd, RSA *pri, const vec &pub, Storage &storage,
+                  TicketCache &tickets,
+                  chrono::steady_clock::time_point accepted) {
+  // Every request starts with a fixed-size rblock or kblock.  The larger
+  // buffers come from the connection's arena.
+  metric_add(CNT_CONNECTIONS);
+  buf_arena arena;
+  vec rblock(LEN_RKBLOCK);
+  if (reliable_get_to_eof_or_n(sd, rblock.begin(), LEN_RKBLOCK) !=
+      LEN_RKBLOCK) {
+    send_reliably(sd, RES_ERR_XMIT);
+    return false;
+  }
+  metric_add(CNT_BYTES_IN, LEN_RKBLOCK);
+  if (is_kblock(rblock)) {
+    server_cmd_key(sd, pub);
+    return false;
+  }
+  // Don't spend RSA or AES on a request that waited too long for a worker
+  if (admission_late(accepted)) {
+    admission_send_busy(sd);
+    return false;
+  }
+  // A ticket replaces the RSA step.  If we don't recognize it, the client
+  // must fall back to a regular request.
+  rblock_t hdr;
+  if (is_rsm_block(rblock)) {
+    if (!parse_rsm_block(tickets, rblock, hdr)) {
+      send_reliably(sd, RES_ERR_TICKET);
+      return false;
+    }
+  } else if (!decrypt_rblock(pri, rblock, hdr)) {
+    send_reliably(sd, RES_ERR_CRYPTO);
+    return false;
+  }
+
+  // A regular request's ablock gets decrypted as it arrives
+  if (hdr.cmd != REQ_SES && hdr.cmd != REQ_RSM)
+    return stream_request(sd, storage, tickets, hdr, arena);
+
+  // Now that we know its length, get the ablock
+  vec &ablock = arena.get(hdr.alen);
+  ablock.resize(hdr.alen);
+  if (reliable_get_to_eof_or_n(sd, ablock.begin(), hdr.alen) != hdr.alen) {
+    send_reliably(sd, RES_ERR_XMIT);
+    return false;
+  }
+  metric_add(CNT_BYTES_IN, hdr.alen);
+  vec response;
+  if (hdr.cmd == REQ_SES) {
+    bool open = start_session(hdr, ablock, response);
+    metric_add(CNT_BYTES_OUT, response.size());
+    if (!send_reliably(sd, response) || !open)
+      return false;
+    return serve_session(sd, storage, hdr.aeskey, arena);
+  }
+  bool stop = execute_frame(storage, hdr.aeskey, ablock, response);
+  if (response.empty())
+    response = vec_from_string(RES_ERR_CRYPTO);
+  metric_add(CNT_BYTES_OUT, response.size());
+  send_reliably(sd, response);
+  return stop;
 }
@@ -1,15 +1,190 @@
 #pragma once
 
+#include <chrono>
+#include <openssl/rsa.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../common/vec.h"
+
 #include "server_storage.h"
+#include "server_tickets.h"
+
+/// rblock_t holds the fields of a request's rblock, after it has been
+/// decrypted with the server's private key
+struct rblock_t {
+  /// The command that the client is requesting (e.g., REQ_REG)
+  std::string cmd;
+
+  /// The AES key (and iv) that the client used for the @ablock, and that the
+  /// server must use for the response
+  vec aeskey;
+
+  /// The length of the encrypted @ablock that follows the rblock.  For
+  /// REQ_RSM, this is the length of @iv.@e.
+  int alen = 0;
+
+  /// The optional flags (e.g., RBLOCK_FLAG_TICKET) that follow len(@ablock)
+  int flags = 0;
+};
+
+/// req_view_t holds non-owning views of the fields of a decrypted request body,
+/// which has the form len(@u).@u.len(@p).@p, optionally followed by one more
+/// field, len(@x).@x, and for some commands a 4-byte set of flags.  Every view
+/// points into the decrypted buffer, so nothing is copied until a field is
+/// actually stored.
+struct req_view_t {
+  /// The name of the user doing the request (@u)
+  std::string_view user;
+
+  /// The password of the user doing the request (@p)
+  std::string_view pass;
+
+  /// The request's extra field (@x), e.g., the content of a SET or the name
+  /// in a GET
+  bytes_t arg;
+
+  /// The request's flags, or 0 if it has none
+  int flags = 0;
+};
+
+/// Parse a decrypted request body into views of its fields.  Each length is
+/// checked against the buffer and against LEN_UNAME, LEN_PASS, or max_arg, and
+/// the fields must account for every byte of the body.
+///
+/// @param req     The decrypted request body
+/// @param max_arg The largest valid length of the extra field, or -1 if the
+///                request has no extra field
+/// @param view    The structure that receives the views
+/// @param flags   Accept a 4-byte set of flags after the extra field?
+///
+/// @returns false if the body is malformed, or if @u or @p is empty
+bool parse_request(const vec &req, int max_arg, req_view_t &view,
+                   bool flags = false);
+
+/// Determine if a LEN_RKBLOCK-byte block is an unencrypted KEY request
+///
+/// @param block The first LEN_RKBLOCK bytes of a request
+///
+/// @returns true if the block is pad0(REQ_KEY), false otherwise
+bool is_kblock(const vec &block);
+
+/// Use the server's private key to decrypt an rblock, and then split it into
+/// its fields.  This is the most expensive step in serving a request.
+///
+/// @param pri    The private key used by the server
+/// @param rblock The LEN_RKBLOCK bytes of the encrypted rblock
+/// @param hdr    The structure that receives the decrypted fields
+///
+/// @returns false if the rblock could not be decrypted or is malformed
+bool decrypt_rblock(RSA *pri, const vec &rblock, rblock_t &hdr);
+
+/// Determine if a LEN_RKBLOCK-byte block is an unencrypted REQ_RSM header
+///
+/// @param block The first LEN_RKBLOCK bytes of a request
+///
+/// @returns true if the block is pad0("RSM".@t.len(@e)), false otherwise
+bool is_rsm_block(const vec &block);
+
+/// Redeem the ticket in a REQ_RSM header, and fill in the fields of the
+/// request as though they came from an rblock.  This costs one AES decryption,
+/// instead of an RSA decryption.
+///
+/// @param tickets The server's ticket cache
+/// @param block   The LEN_RKBLOCK bytes of the header
+/// @param hdr     The structure that receives the fields
+///
+/// @returns false if the ticket can't be redeemed or the header is malformed
+bool parse_rsm_block(TicketCache &tickets, const vec &block, rblock_t &hdr);
+
+/// Given a decrypted rblock and the (still encrypted) ablock of a request,
+/// decrypt the ablock, dispatch to the right command handler, and produce the
+/// exact bytes that should be sent back to the client.  This does no I/O, so
+/// it can be used by both the blocking and the event-driven servers.  If the
+/// rblock asked for a ticket, the response is prefixed with len(@t).@t.
+///
+/// @param storage  The Storage object with which clients interact
+/// @param tickets  The server's ticket cache
+/// @param hdr      The decrypted rblock
+/// @param ablock   The encrypted ablock
+/// @param response The vector that receives the bytes of the response
+///
+/// @returns true if the server should halt once the response is sent
+bool execute_request(Storage &storage, TicketCache &tickets,
+                     const rblock_t &hdr, const vec &ablock, vec &response);
+
+/// Run one decrypted command by dispatching it to the right handler
+///
+/// @param storage The Storage object with which clients interact
+/// @param cmd     The command (e.g., REQ_REG)
+/// @param req     The unencrypted body of the request
+/// @param res     The vector that receives the unencrypted response
+/// @param creds   The connection's checked credentials, or nullptr
+///
+/// @returns true if the server should halt once the response is sent
+bool dispatch_command(Storage &storage, const std::string &cmd, const vec &req,
+                      vec &res, cred_cache_t *creds = nullptr);
+
+/// Handle the handshake (REQ_SES) that opens a session.  The response is
+/// always a frame, so that the client can read it without waiting for EOF.
+///
+/// @param hdr      The decrypted rblock, which holds the session's AES key
+/// @param ablock   The encrypted ablock
+/// @param response The vector that receives the bytes of the response
+///
+/// @returns true if the session is open and frames may follow, false if the
+///          connection should be closed once the response is sent
+bool start_session(const rblock_t &hdr, const vec &ablock, vec &response);
+
+/// Decrypt one request frame of a session, run it, and produce the response
+/// frame.  This does no I/O.
+///
+/// @param storage  The Storage object with which clients interact
+/// @param key      The session's AES key
+/// @param frame    The @iv.@e part of the frame
+/// @param response The vector that receives the bytes of the response frame.
+///                 It is left empty if the frame could not be decrypted, in
+///                 which case the session must end.
+/// @param creds    The connection's checked credentials, or nullptr
+///
+/// @returns true if the server should halt once the response is sent
+bool execute_frame(Storage &storage, const vec &key, const vec &frame,
+                   vec &response, cred_cache_t *creds = nullptr);
+
+/// Decrypt several request frames of a session, which arrived back to back,
+/// run them in order, and produce their response frames.  A run of REGs is
+/// registered as one batch, so that their passwords are hashed in parallel.
+/// This does no I/O.
+///
+/// @param storage   The Storage object with which clients interact
+/// @param key       The session's AES key
+/// @param frames    The @iv.@e part of each frame
+/// @param responses The vector that receives the bytes of each response
+///                  frame.  It is shorter than frames if a frame could not be
+///                  decrypted (in which case the session must end), or if a
+///                  frame halted the server (in which case no later frame is
+///                  run).
+/// @param creds     The connection's checked credentials, or nullptr
+///
+/// @returns true if the server should halt once the responses are sent
+bool execute_frames(Storage &storage, const vec &key,
+                    const std::vector<const vec *> &frames,
+                    std::vector<vec> &responses, cred_cache_t *creds);
 
 /// When a new client connection is accepted, this code will run to figure out
 /// what the client is requesting, and to dispatch to the right function for
 /// satisfying the request.
 ///
-/// @param sd      The socket on which communication with the client takes place
-/// @param pri     The private key used by the server
-/// @param pub     The public key file contents, to send to the client
-/// @param storage The Storage object with which clients interact
+/// @param sd       The socket on which communication with the client takes
+///                 place
+/// @param pri      The private key used by the server
+/// @param pub      The public key file contents, to send to the client
+/// @param storage  The Storage object with which clients interact
+/// @param tickets  The server's ticket cache
+/// @param accepted The time at which the connection was accepted
 ///
 /// @returns true if the server should halt immediately, false otherwise
-bool serve_client(int sd, RSA *pri, const vec &pub, Storage &storage);
+bool serve_client(int sd, RSA *pri, const vec &pub, Storage &storage,
+                  TicketCache &tickets,
+                  std::chrono::steady_clock::time_point accepted);
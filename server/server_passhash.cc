@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/md5.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+
+#include "../common/log.h"
+#include "../common/pool.h"
+
+#include "server_passhash.h"
+
+using namespace std;
+
+/// The most entries that a cred_cache_t holds
+const size_t CRED_CACHE_MAX = 8;
+
+/// The number of tasks per hashing thread that may wait in the pool's queue.
+/// Beyond that, a batch is hashed by fewer threads, rather than blocking.
+const size_t HASH_QUEUE_PER_THREAD = 4;
+
+/// The number of PBKDF2 iterations for new hashes (0 for MD5)
+static int hash_iters = 0;
+
+/// The number of hashing threads, and the threads themselves
+static size_t hash_threads = 0;
+static unique_ptr<thread_pool> hashers;
+
+/// batch_t is the shared state of one call to pass_hash_batch().  Helpers that
+/// start after the batch is done only touch this, never the caller's stack,
+/// so the caller need not wait for them.
+struct batch_t {
+  /// The passwords and their hashes
+  vector<string> passes, hashes;
+
+  /// The index of the next password to hash
+  atomic<size_t> next{0};
+
+  /// The number of passwords that have been hashed, and a lock and condition
+  /// variable for waiting until that is all of them
+  size_t done = 0;
+  mutex lock;
+  condition_variable cv;
+};
+
+/// Derive a salted hash from a password and a salt
+///
+/// @param pass  The password
+/// @param salt  The salt, PASS_SALT_LEN bytes
+/// @param iters The number of iterations
+/// @param out   Receives PASS_KEY_LEN bytes
+///
+/// @returns false on error
+static bool derive(string_view pass, const unsigned char *salt, uint32_t iters,
+                   unsigned char *out) {
+  return PKCS5_PBKDF2_HMAC(pass.data(), pass.length(), salt, PASS_SALT_LEN,
+                           iters, EVP_sha256(), PASS_KEY_LEN, out) == 1;
+}
+
+/// Compute the legacy (MD5) hash of a password
+///
+/// @param pass The password to hash
+///
+/// @returns A string holding the MD5 digest of the password
+static string legacy_hash(string_view pass) {
+  unsigned char digest[MD5_DIGEST_LENGTH];
+  MD5((const unsigned char *)pass.data(), pass.length(), digest);
+  return string((char *)digest, MD5_DIGEST_LENGTH);
+}
+
+/// Configure password hashing, and start the hashing threads
+///
+/// @param iters   The number of PBKDF2 iterations for new hashes (0 for MD5)
+/// @param threads The number of threads that hash batches of passwords
+void pass_hash_init(int iters, size_t threads) {
+  hash_iters = iters;
+  hash_threads = threads;
+  if (threads > 0)
+    hashers.reset(new thread_pool(threads, threads * HASH_QUEUE_PER_THREAD));
+}
+
+/// Stop the hashing threads.  Batches are hashed by the calling thread alone
+/// after this.
+void pass_hash_stop() {
+  if (!hashers)
+    return;
+  hashers->await_shutdown();
+  hashers.reset();
+  hash_threads = 0;
+}
+
+/// Hash a password, with a fresh salt
+///
+/// @param pass The password to hash
+///
+/// @returns The hash, in the format described in server_passhash.h, or "" on
+///          error
+string pass_hash(string_view pass) {
+  if (hash_iters == 0)
+    return legacy_hash(pass);
+  unsigned char out[PASS_HASH_LEN];
+  uint32_t iters = hash_iters;
+  memcpy(out, &iters, sizeof(iters));
+  unsigned char *salt = out + sizeof(iters);
+  if (!RAND_bytes(salt, PASS_SALT_LEN) ||
+      !derive(pass, salt, iters, salt + PASS_SALT_LEN)) {
+    log_msg(LOG_ERROR, "Error hashing password");
+    return "";
+  }
+  return string((char *)out, PASS_HASH_LEN);
+}
+
+/// Hash passwords from a batch until there are none left
+///
+/// @param b The batch
+static void hash_some(batch_t &b) {
+  size_t i;
+  while ((i = b.next.fetch_add(1)) < b.passes.size()) {
+    b.hashes[i] = pass_hash(b.passes[i]);
+    lock_guard<mutex> g(b.lock);
+    if (++b.done == b.passes.size())
+      b.cv.notify_all();
+  }
+}
+
+/// Hash a batch of passwords, each with a fresh salt, in parallel.  The calling
+/// thread takes part, so this makes progress even if the hashing threads are
+/// busy with other batches.
+///
+/// @param passes The passwords to hash
+///
+/// @returns The hashes, in the same order as the passwords
+vector<string> pass_hash_batch(const vector<string_view> &passes) {
+  if (passes.empty())
+    return {};
+  auto b = make_shared<batch_t>();
+  b->passes.assign(passes.begin(), passes.end());
+  b->hashes.resize(passes.size());
+  // NB: MD5 is too cheap to be worth handing off
+  size_t helpers = hash_iters == 0 || !hashers ? 0 : passes.size() - 1;
+  helpers = min(helpers, hash_threads);
+  for (size_t i = 0; i < helpers; ++i) {
+    if (hashers->queue_depth() >= hash_threads * HASH_QUEUE_PER_THREAD ||
+        !hashers->submit([b]() { hash_some(*b); }))
+      break;
+  }
+  hash_some(*b);
+  unique_lock<mutex> g(b->lock);
+  b->cv.wait(g, [&]() { return b->done == b->passes.size(); });
+  return move(b->hashes);
+}
+
+/// Check a password against a stored hash, in either format
+///
+/// @param hash The stored hash
+/// @param pass The password to check
+///
+/// @returns true if the password matches
+bool pass_check(string_view hash, string_view pass) {
+  if (hash.length() == PASS_LEGACY_LEN) {
+    string digest = legacy_hash(pass);
+    return CRYPTO_memcmp(digest.data(), hash.data(), PASS_LEGACY_LEN) == 0;
+  }
+  if (hash.length() != PASS_HASH_LEN)
+    return false;
+  uint32_t iters;
+  memcpy(&iters, hash.data(), sizeof(iters));
+  auto salt = (const unsigned char *)hash.data() + sizeof(iters);
+  unsigned char key[PASS_KEY_LEN];
+  return iters > 0 && derive(pass, salt, iters, key) &&
+         CRYPTO_memcmp(key, salt + PASS_SALT_LEN, PASS_KEY_LEN) == 0;
+}
+
+/// Compute the digest that a cred_cache_t keeps for a password
+///
+/// @param pass The password
+///
+/// @returns The SHA-256 digest of the password
+static string cache_digest(string_view pass) {
+  unsigned char digest[SHA256_DIGEST_LENGTH];
+  SHA256((const unsigned char *)pass.data(), pass.length(), digest);
+  return string((char *)digest, SHA256_DIGEST_LENGTH);
+}
+
+/// Check if a user's password has already been checked on this connection
+///
+/// @param user The name of the user
+/// @param pass The password
+///
+/// @returns true if the credentials were checked before, and matched
+bool cred_cache_t::check(string_view user, string_view pass) const {
+  for (auto &e : entries) {
+    if (e.user != user)
+      continue;
+    string digest = cache_digest(pass);
+    return CRYPTO_memcmp(digest.data(), e.digest.data(), digest.length()) == 0;
+  }
+  return false;
+}
+
+/// Remember a user's credentials, once they have been checked
+///
+/// @param user The name of the user
+/// @param pass The password
+void cred_cache_t::add(string_view user, string_view pass) {
+  for (auto &e : entries) {
+    if (e.user == user) {
+      e.digest = cache_digest(pass);
+      return;
+    }
+  }
+  if (entries.size() == CRED_CACHE_MAX)
+    entries.erase(entries.begin());
+  entries.push_back({string(user), cache_digest(pass)});
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Passwords are stored as salted, iterated hashes: PBKDF2-HMAC-SHA256, with a
+/// random salt per user.  A stored hash is PASS_HASH_LEN bytes:
+///
+///  - a 4-byte binary write of the number of iterations
+///  - the PASS_SALT_LEN bytes of the salt
+///  - the PASS_KEY_LEN bytes of the derived key
+///
+/// The iterations are part of the hash, so changing the server's setting only
+/// affects users who register afterwards.  A stored hash that is
+/// PASS_LEGACY_LEN bytes long is an unsalted MD5 digest, from before salted
+/// hashes were introduced.  Those can still be checked, and are also what new
+/// users get if the server is configured with 0 iterations.
+///
+/// A salted hash is deliberately expensive, so the hashes of a batch of
+/// passwords (a bulk import, or a run of REGs in a session) are computed in
+/// parallel, by a pool of hashing threads.
+
+/// The length of a salt
+const size_t PASS_SALT_LEN = 16;
+
+/// The length of a derived key
+const size_t PASS_KEY_LEN = 16;
+
+/// The length of a salted hash
+const size_t PASS_HASH_LEN = 4 + PASS_SALT_LEN + PASS_KEY_LEN;
+
+/// The length of a legacy (MD5) hash
+const size_t PASS_LEGACY_LEN = 16;
+
+/// Configure password hashing, and start the hashing threads
+///
+/// @param iters   The number of PBKDF2 iterations for new hashes (0 for MD5)
+/// @param threads The number of threads that hash batches of passwords
+void pass_hash_init(int iters, size_t threads);
+
+/// Stop the hashing threads.  Batches are hashed by the calling thread alone
+/// after this.
+void pass_hash_stop();
+
+/// Hash a password, with a fresh salt
+///
+/// @param pass The password to hash
+///
+/// @returns The hash, in the format described above, or "" on error
+std::string pass_hash(std::string_view pass);
+
+/// Hash a batch of passwords, each with a fresh salt, in parallel.  The calling
+/// thread takes part, so this makes progress even if the hashing threads are
+/// busy with other batches.
+///
+/// @param passes The passwords to hash
+///
+/// @returns The hashes, in the same order as the passwords
+std::vector<std::string>
+pass_hash_batch(const std::vector<std::string_view> &passes);
+
+/// Check a password against a stored hash, in either format
+///
+/// @param hash The stored hash
+/// @param pass The password to check
+///
+/// @returns true if the password matches
+bool pass_check(std::string_view hash, std::string_view pass);
+
+/// cred_cache_t remembers the credentials that have already been checked on
+/// one connection, so that a session that sends many requests as the same
+/// user only pays for a salted hash once.  It holds a fast digest of each
+/// password, not the password itself.
+///
+/// Entries never need to be invalidated: users are never removed and their
+/// passwords never change while the server runs.  A cache belongs to one
+/// connection, so it needs no lock.
+class cred_cache_t {
+  /// entry_t is one user whose password has been checked
+  struct entry_t {
+    /// The name of the user
+    std::string user;
+
+    /// The SHA-256 digest of the user's password
+    std::string digest;
+  };
+
+  /// The entries, least recently added first
+  std::vector<entry_t> entries;
+
+public:
+  /// Check if a user's password has already been checked on this connection
+  ///
+  /// @param user The name of the user
+  /// @param pass The password
+  ///
+  /// @returns true if the credentials were checked before, and matched
+  bool check(std::string_view user, std::string_view pass) const;
+
+  /// Remember a user's credentials, once they have been checked
+  ///
+  /// @param user The name of the user
+  /// @param pass The password
+  void add(std::string_view user, std::string_view pass);
+};
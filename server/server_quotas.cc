@@ -0,0 +1,202 @@
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+#include "../common/protocol.h"
+
+#include "server_quotas.h"
+
+using namespace std;
+
+/// The number of shards in the usage table
+const size_t QUOTA_SHARDS = 64;
+
+/// window_t is one sliding-window counter
+struct window_t {
+  /// The index of the interval that cur counts
+  atomic<uint64_t> epoch{0};
+
+  /// The totals for the current and the previous interval
+  atomic<uint64_t> cur{0}, prev{0};
+};
+
+/// usage_t is one user's counters, one per quota
+struct usage_t {
+  window_t w[NQUOTAS];
+};
+
+/// shard_t is one stripe of the usage table
+struct shard_t {
+  /// A reader/writer lock, which is only taken for writing to add a user
+  shared_mutex lock;
+
+  /// The users in this shard.  NB: usage_t holds atomics, so it can't move
+  unordered_map<string, unique_ptr<usage_t>> users;
+};
+
+/// The length of the sliding interval, in milliseconds
+static uint64_t interval_ms = 0;
+
+/// The limits, indexed by quota_t (0 for no limit)
+static uint64_t limits[NQUOTAS] = {0, 0, 0};
+
+/// The usage table
+static shard_t shards[QUOTA_SHARDS];
+
+/// Configure the quotas.  Until this is called, there are no limits.
+///
+/// @param interval_secs The length of the sliding interval, in seconds
+/// @param reqs          The most requests per interval (0 for no limit)
+/// @param up            The most bytes uploaded per interval (0 for no limit)
+/// @param down          The most bytes downloaded per interval (0 for no limit)
+void quota_init(int interval_secs, uint64_t reqs, uint64_t up, uint64_t down) {
+  interval_ms = interval_secs > 0 ? (uint64_t)interval_secs * 1000 : 0;
+  limits[QUOTA_REQ] = reqs;
+  limits[QUOTA_UP] = up;
+  limits[QUOTA_DOWN] = down;
+}
+
+/// Check if any quota is configured
+///
+/// @returns true if at least one limit is set
+bool quota_enabled() {
+  return interval_ms > 0 &&
+         (limits[QUOTA_REQ] || limits[QUOTA_UP] || limits[QUOTA_DOWN]);
+}
+
+/// Report the current time
+///
+/// @returns Milliseconds since an arbitrary, fixed point
+static uint64_t now_ms() {
+  using namespace chrono;
+  return duration_cast<milliseconds>(steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/// Find the shard that holds a user
+///
+/// @param user The name of the user
+///
+/// @returns A reference to the shard
+static shard_t &shard_for(string_view user) {
+  return shards[hash<string_view>()(user) % QUOTA_SHARDS];
+}
+
+/// Find a user's counters
+///
+/// @param user   The name of the user
+/// @param create Add the user if they have no counters yet?
+///
+/// @returns The user's counters, or nullptr if they have none and create is
+///          false
+static usage_t *find(string_view user, bool create) {
+  shard_t &s = shard_for(user);
+  {
+    shared_lock<shared_mutex> g(s.lock);
+    auto i = s.users.find(string(user));
+    if (i != s.users.end())
+      return i->second.get();
+  }
+  if (!create)
+    return nullptr;
+  unique_lock<shared_mutex> g(s.lock);
+  auto &u = s.users[string(user)];
+  if (!u)
+    u.reset(new usage_t);
+  // NB: usage_t never moves or goes away, so the pointer outlives the lock
+  return u.get();
+}
+
+/// Move a counter into the interval that holds now, if it isn't there yet
+///
+/// @param w   The counter
+/// @param now The current time, in milliseconds
+static void roll(window_t &w, uint64_t now) {
+  uint64_t epoch = now / interval_ms, old = w.epoch.load();
+  if (old >= epoch || !w.epoch.compare_exchange_strong(old, epoch))
+    return;
+  // NB: only the thread that moved the epoch gets here
+  uint64_t last = w.cur.exchange(0);
+  w.prev.store(epoch == old + 1 ? last : 0);
+}
+
+/// Estimate a counter's total over the sliding interval that ends now
+///
+/// @param w   The counter
+/// @param now The current time, in milliseconds
+///
+/// @returns The estimated total
+static uint64_t total(window_t &w, uint64_t now) {
+  roll(w, now);
+  uint64_t left = interval_ms - now % interval_ms;
+  return w.cur.load() + w.prev.load() * left / interval_ms;
+}
+
+/// Check if adding to one of a user's counters would go over its limit
+///
+/// @param u   The user's counters, or nullptr
+/// @param q   The quota
+/// @param n   The amount to add
+/// @param now The current time, in milliseconds
+///
+/// @returns true if the amount fits
+static bool fits(usage_t *u, quota_t q, uint64_t n, uint64_t now) {
+  if (limits[q] == 0)
+    return true;
+  uint64_t used = u ? total(u->w[q], now) : 0;
+  return used + n <= limits[q];
+}
+
+/// Check if a user may make a request, before doing any of its work
+///
+/// @param user The name of the user
+/// @param up   The number of bytes that the request uploads
+///
+/// @returns "" if the request may proceed, or the error code to send
+string quota_admit(string_view user, uint64_t up) {
+  if (!quota_enabled())
+    return "";
+  usage_t *u = find(user, false);
+  uint64_t now = now_ms();
+  if (!fits(u, QUOTA_REQ, 1, now))
+    return RES_ERR_QUOTA_REQ;
+  if (!fits(u, QUOTA_UP, up, now))
+    return RES_ERR_QUOTA_UP;
+  return "";
+}
+
+/// Check if a user may download some bytes
+///
+/// @param user The name of the user
+/// @param down The number of bytes
+///
+/// @returns true if the download fits in the user's quota
+bool quota_can_download(string_view user, uint64_t down) {
+  if (!quota_enabled())
+    return true;
+  return fits(find(user, false), QUOTA_DOWN, down, now_ms());
+}
+
+/// Count an authenticated request against a user's quotas
+///
+/// @param user    The name of the user
+/// @param up      The number of bytes that the request uploaded
+/// @param down    The number of bytes that the response downloads
+/// @param request Count the request itself?  (false for the later parts of a
+///                response that is charged as it is sent)
+void quota_charge(string_view user, uint64_t up, uint64_t down, bool request) {
+  if (!quota_enabled())
+    return;
+  usage_t *u = find(user, true);
+  uint64_t now = now_ms();
+  uint64_t n[NQUOTAS] = {request ? 1u : 0u, up, down};
+  for (int q = 0; q < NQUOTAS; ++q) {
+    roll(u->w[q], now);
+    u->w[q].cur.fetch_add(n[q]);
+  }
+}
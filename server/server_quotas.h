@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/// The server can limit what each user does in a sliding interval: how many
+/// requests they make, how many bytes they upload (decrypted request bodies),
+/// and how many bytes they download (decrypted GET, ALL, MET, and FUN
+/// responses).
+///
+/// Each limit is tracked with a sliding-window counter: the total for the
+/// current interval, plus the previous interval's total scaled by how much of
+/// it is still inside the window.  The counters are atomics, in a table that
+/// is split into shards, each with a reader/writer lock that is only taken for
+/// writing when a user is first counted.  So a check never waits, except for
+/// other users' first requests in the same shard.  Intervals roll lazily, on a
+/// user's next request, and a roll that races with a charge may misplace that
+/// charge in the previous interval, so the limits are approximate.
+///
+/// Users are only counted once they have authenticated, but a user who is over
+/// a limit is refused before their password is checked.
+
+/// quota_t names the three limits
+enum quota_t {
+  QUOTA_REQ,  // requests
+  QUOTA_UP,   // bytes uploaded
+  QUOTA_DOWN, // bytes downloaded
+  NQUOTAS
+};
+
+/// Configure the quotas.  Until this is called, there are no limits.
+///
+/// @param interval_secs The length of the sliding interval, in seconds
+/// @param reqs          The most requests per interval (0 for no limit)
+/// @param up            The most bytes uploaded per interval (0 for no limit)
+/// @param down          The most bytes downloaded per interval (0 for no
+///                      limit)
+void quota_init(int interval_secs, uint64_t reqs, uint64_t up, uint64_t down);
+
+/// Check if any quota is configured
+///
+/// @returns true if at least one limit is set
+bool quota_enabled();
+
+/// Check if a user may make a request, before doing any of its work
+///
+/// @param user The name of the user
+/// @param up   The number of bytes that the request uploads
+///
+/// @returns "" if the request may proceed, or the error code to send
+std::string quota_admit(std::string_view user, uint64_t up);
+
+/// Check if a user may download some bytes
+///
+/// @param user The name of the user
+/// @param down The number of bytes
+///
+/// @returns true if the download fits in the user's quota
+bool quota_can_download(std::string_view user, uint64_t down);
+
+/// Count an authenticated request against a user's quotas
+///
+/// @param user    The name of the user
+/// @param up      The number of bytes that the request uploaded
+/// @param down    The number of bytes that the response downloads
+/// @param request Count the request itself?  (false for the later parts of a
+///                response that is charged as it is sent)
+void quota_charge(std::string_view user, uint64_t up, uint64_t down,
+                  bool request = true);
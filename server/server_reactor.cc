@@ -0,0 +1,445 @@
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <iostream>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+
+#include "../common/bufpool.h"
+#include "../common/crypto.h"
+#include "../common/err.h"
+#include "../common/net.h"
+#include "../common/pool.h"
+#include "../common/protocol.h"
+#include "../common/vec.h"
+
+#include "server_admission.h"
+#include "server_metrics.h"
+#include "server_parsing.h"
+#include "server_passhash.h"
+#include "server_reactor.h"
+#include "server_storage.h"
+#include "server_tickets.h"
+
+using namespace std;
+
+/// The most events to fetch from epoll in one call
+const int MAX_EVENTS = 256;
+
+/// connection_t tracks the progress of one client connection through the
+/// stages of a request.  Every connection is registered with EPOLLONESHOT, so
+/// exactly one thread (the event loop or a compute thread) touches it at a
+/// time.
+struct connection_t {
+  /// The stages that a connection passes through
+  enum stage_t {
+    READ_RBLOCK, // Waiting for the rest of the rblock/kblock
+    READ_ABLOCK, // Waiting for the rest of the ablock
+    READ_FLEN,   // In a session, waiting for the length of the next frame
+    READ_FRAME,  // In a session, waiting for the rest of the frame
+    COMPUTE,     // Owned by a compute thread
+    WRITE,       // Writing the response
+  };
+
+  /// The socket for this connection
+  int sd;
+
+  /// The current stage of the request
+  stage_t stage = READ_RBLOCK;
+
+  /// The block that is being read, and the number of its bytes that have
+  /// arrived so far
+  vec block = vec(LEN_RKBLOCK);
+  size_t have = 0;
+
+  /// The decrypted rblock
+  rblock_t hdr;
+
+  /// The response, and the number of its bytes that have been sent so far
+  vec out;
+  size_t sent = 0;
+
+  /// True if the server should halt once the response has been sent
+  bool stop = false;
+
+  /// True once a REQ_SES handshake has succeeded, so that the connection stays
+  /// open for frames after each response
+  bool session = false;
+
+  /// The credentials that have been checked on this connection
+  cred_cache_t creds;
+
+  /// The time at which the request was handed to the compute pool
+  chrono::steady_clock::time_point queued;
+
+  /// True if the request was refused with RES_ERR_BUSY, before all of it was
+  /// read
+  bool refused = false;
+
+  /// Refuse the request with RES_ERR_BUSY
+  void refuse() {
+    out = vec_from_string(RES_ERR_BUSY);
+    refused = true;
+    stage = WRITE;
+  }
+
+  /// Construct a connection for a newly accepted socket
+  ///
+  /// @param _sd The connection's socket
+  connection_t(int _sd) : sd(_sd) {}
+
+  /// Give the connection's buffers back to the pool
+  ~connection_t() {
+    pool_give(block);
+    pool_give(out);
+  }
+
+  /// Start reading a new block, into a buffer from the pool
+  ///
+  /// @param n The size of the block
+  void next_block(size_t n) {
+    pool_give(block);
+    block = pool_take(n);
+    block.resize(n);
+    have = 0;
+  }
+};
+
+/// Re-register a connection with epoll, so that the event loop will hear about
+/// it the next time its socket is readable (or writable)
+///
+/// @param ep    The epoll descriptor
+/// @param c     The connection
+/// @param write true to wait for writability, false for readability
+static void rearm(int ep, connection_t *c, bool write) {
+  epoll_event ev = {0};
+  ev.events = (write ? EPOLLOUT : EPOLLIN) | EPOLLONESHOT;
+  ev.data.ptr = c;
+  if (epoll_ctl(ep, EPOLL_CTL_MOD, c->sd, &ev) < 0)
+    sys_error(errno, "Error in epoll_ctl(MOD):");
+}
+
+/// Read as many bytes of the current block as are available, without blocking
+///
+/// @param c The connection to read from
+///
+/// @returns 1 if the block is complete, 0 if the socket ran dry first, and -1
+///          on EOF or error
+static int read_some(connection_t *c) {
+  while (c->have < c->block.size()) {
+    int got = recv(c->sd, c->block.data() + c->have, c->block.size() - c->have,
+                   0);
+    if (got > 0) {
+      c->have += got;
+      metric_add(CNT_BYTES_IN, got);
+    } else if (got == 0)
+      return -1;
+    else if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return 0;
+    else if (errno != EINTR) {
+      sys_error(errno, "Error in recv():");
+      return -1;
+    }
+  }
+  return 1;
+}
+
+/// Write as many bytes of the response as the socket will take, without
+/// blocking
+///
+/// @param c The connection to write to
+///
+/// @returns 1 if the response is fully sent, 0 if the socket filled up first,
+///          and -1 on error
+static int write_some(connection_t *c) {
+  while (c->sent < c->out.size()) {
+    int sent = send(c->sd, c->out.data() + c->sent, c->out.size() - c->sent,
+                    MSG_NOSIGNAL);
+    if (sent > 0) {
+      c->sent += sent;
+      metric_add(CNT_BYTES_OUT, sent);
+    }
+    else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return 0;
+    else if (sent < 0 && errno == EINTR)
+      continue;
+    else {
+      sys_error(errno, "Error in send():");
+      return -1;
+    }
+  }
+  return 1;
+}
+
+/// Run a complete request (or, in a session, a complete frame) on a compute
+/// thread, and then hand the connection back to the event loop to write the
+/// response
+///
+/// @param ep      The epoll descriptor
+/// @param c       The connection
+/// @param storage The Storage object with which clients interact
+/// @param tickets The server's ticket cache
+static void compute_execute(int ep, connection_t *c, Storage &storage,
+                            TicketCache &tickets) {
+  if (c->session) {
+    c->stop =
+        execute_frame(storage, c->hdr.aeskey, c->block, c->out, &c->creds);
+  } else if (c->hdr.cmd == REQ_SES) {
+    c->session = start_session(c->hdr, c->block, c->out);
+  } else if (c->hdr.cmd == REQ_RSM && admission_late(c->queued)) {
+    c->refuse();
+  } else if (c->hdr.cmd == REQ_RSM) {
+    c->stop = execute_frame(storage, c->hdr.aeskey, c->block, c->out);
+    if (c->out.empty())
+      c->out = vec_from_string(RES_ERR_CRYPTO);
+  } else {
+    c->stop = execute_request(storage, tickets, c->hdr, c->block, c->out);
+  }
+  pool_give(c->block);
+  c->stage = connection_t::WRITE;
+  rearm(ep, c, true);
+}
+
+/// Decrypt an rblock on a compute thread.  If the ablock is empty, go straight
+/// on to execute the request.  Otherwise, hand the connection back to the
+/// event loop to read the ablock.
+///
+/// @param ep      The epoll descriptor
+/// @param c       The connection
+/// @param pri     The private key used by the server
+/// @param storage The Storage object with which clients interact
+/// @param tickets The server's ticket cache
+static void compute_rblock(int ep, connection_t *c, RSA *pri, Storage &storage,
+                           TicketCache &tickets) {
+  // Don't spend RSA on a request that waited too long for a compute thread
+  if (admission_late(c->queued)) {
+    c->refuse();
+    rearm(ep, c, true);
+    return;
+  }
+  if (!decrypt_rblock(pri, c->block, c->hdr)) {
+    c->out = vec_from_string(RES_ERR_CRYPTO);
+    c->stage = connection_t::WRITE;
+    rearm(ep, c, true);
+    return;
+  }
+  c->next_block(c->hdr.alen);
+  if (c->hdr.alen == 0) {
+    compute_execute(ep, c, storage, tickets);
+    return;
+  }
+  c->stage = connection_t::READ_ABLOCK;
+  rearm(ep, c, false);
+}
+
+/// Hand a connection to the compute pool.  A new request (i.e., one that has
+/// not yet used the pool) is refused with RES_ERR_BUSY instead, if the pool's
+/// queue is full and admission control asks for that.
+///
+/// @param ep      The epoll descriptor
+/// @param c       The connection
+/// @param compute The pool of threads that does the RSA/AES work
+/// @param fresh   true if the connection holds a new request
+/// @param task    The work to do on a compute thread
+///
+/// @returns false if the pool has been shut down
+static bool hand_off(int ep, connection_t *c, thread_pool &compute, bool fresh,
+                     function<void()> task) {
+  c->stage = connection_t::COMPUTE;
+  if (!fresh)
+    return compute.submit(task);
+  c->queued = chrono::steady_clock::now();
+  if (!admission_refuses())
+    return compute.submit(task);
+  if (compute.try_submit(task))
+    return true;
+  if (!compute.check_active())
+    return false;
+  admission_count_full();
+  c->refuse();
+  rearm(ep, c, true);
+  return true;
+}
+
+/// Advance a connection through as many stages as possible, in response to an
+/// event.  This runs on the event loop thread.
+///
+/// @param ep      The epoll descriptor
+/// @param c       The connection
+/// @param compute The pool of threads that does the RSA/AES work
+/// @param pri     The private key used by the server
+/// @param pub     The public key file contents, to send to the client
+/// @param storage The Storage object with which clients interact
+/// @param tickets The server's ticket cache
+///
+/// @returns false if the connection is finished and should be closed
+static bool advance(int ep, connection_t *c, thread_pool &compute, RSA *pri,
+                    const vec &pub, Storage &storage, TicketCache &tickets) {
+  while (true) {
+    if (c->stage == connection_t::WRITE) {
+      int res = write_some(c);
+      if (res == 0)
+        rearm(ep, c, true);
+      if (res != 1)
+        return res == 0;
+      // A one-shot request ends with its response.  A session keeps going,
+      // unless the frame couldn't be decrypted or the server is stopping.
+      if (c->refused)
+        admission_linger(c->sd);
+      if (!c->session || c->stop || c->out.empty())
+        return false;
+      pool_give(c->out);
+      c->sent = 0;
+      c->next_block(sizeof(int));
+      c->stage = connection_t::READ_FLEN;
+      continue;
+    }
+
+    // Every other stage is reading a block
+    int res = read_some(c);
+    if (res < 0)
+      return false;
+    if (res == 0) {
+      rearm(ep, c, false);
+      return true;
+    }
+    if (c->stage == connection_t::READ_RBLOCK && is_kblock(c->block)) {
+      c->out = pub;
+      c->stage = connection_t::WRITE;
+    } else if (c->stage == connection_t::READ_RBLOCK &&
+               is_rsm_block(c->block)) {
+      // Redeeming a ticket is cheap enough to do right here
+      if (!parse_rsm_block(tickets, c->block, c->hdr)) {
+        c->out = vec_from_string(RES_ERR_TICKET);
+        c->stage = connection_t::WRITE;
+        continue;
+      }
+      c->next_block(c->hdr.alen);
+      c->stage = connection_t::READ_ABLOCK;
+    } else if (c->stage == connection_t::READ_RBLOCK) {
+      return hand_off(ep, c, compute, true, [ep, c, pri, &storage, &tickets]() {
+        compute_rblock(ep, c, pri, storage, tickets);
+      });
+    } else if (c->stage == connection_t::READ_FLEN) {
+      int len;
+      memcpy(&len, c->block.data(), sizeof(int));
+      if (len <= 0 || len > LEN_FRAME_MAX)
+        return false;
+      c->next_block(AES_IVSIZE + len);
+      c->stage = connection_t::READ_FRAME;
+    } else {
+      // A redeemed ticket hasn't used the pool yet, but a session frame, or
+      // the ablock of a request whose rblock was decrypted, has
+      bool fresh = !c->session && c->hdr.cmd == REQ_RSM;
+      return hand_off(ep, c, compute, fresh, [ep, c, &storage, &tickets]() {
+        compute_execute(ep, c, storage, tickets);
+      });
+    }
+  }
+}
+
+/// Accept every pending connection on the (non-blocking) listening socket, and
+/// register each one with epoll
+///
+/// @param sd    The listening socket
+/// @param ep    The epoll descriptor
+/// @param conns The set of all open connections
+static void accept_all(int sd, int ep, unordered_set<connection_t *> &conns) {
+  while (true) {
+    int connSd = accept4(sd, nullptr, nullptr, SOCK_NONBLOCK);
+    if (connSd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        sys_error(errno, "Error accepting request from client: ");
+      return;
+    }
+    net_tune(connSd);
+    metric_add(CNT_CONNECTIONS);
+    connection_t *c = new connection_t(connSd);
+    epoll_event ev = {0};
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = c;
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, connSd, &ev) < 0) {
+      sys_error(errno, "Error in epoll_ctl(ADD):");
+      close(connSd);
+      delete c;
+      continue;
+    }
+    conns.insert(c);
+  }
+}
+
+/// Serve clients from a single event-loop thread, instead of dedicating a
+/// thread to each connection.  All sockets are non-blocking and registered
+/// with epoll.  The loop reads each request's fixed-size rblock and its
+/// variable-size ablock incrementally, as bytes arrive, so a client that
+/// trickles its request in over a slow link costs only a small buffer.
+///
+/// Once a block is complete, the expensive work (RSA decryption of the rblock,
+/// then AES decryption, execution, and encryption of the request) is handed to
+/// the compute pool.  When the response is ready, the loop writes it back,
+/// again without blocking.
+///
+/// @param sd      The listening socket
+/// @param compute The pool of threads that does the RSA/AES work
+/// @param pri     The private key used by the server
+/// @param pub     The public key file contents, to send to the client
+/// @param storage The Storage object with which clients interact
+/// @param tickets The server's ticket cache
+void serve_reactor(int sd, thread_pool &compute, RSA *pri, const vec &pub,
+                   Storage &storage, TicketCache &tickets) {
+  int ep = epoll_create1(0);
+  if (ep < 0) {
+    sys_error(errno, "Error in epoll_create1():");
+    return;
+  }
+  fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) | O_NONBLOCK);
+  // NB: the listening socket is the only one that isn't one-shot, and its
+  //     event has a null ptr
+  epoll_event lev = {0};
+  lev.events = EPOLLIN;
+  lev.data.ptr = nullptr;
+  if (epoll_ctl(ep, EPOLL_CTL_ADD, sd, &lev) < 0) {
+    sys_error(errno, "Error in epoll_ctl(ADD):");
+    close(ep);
+    return;
+  }
+
+  unordered_set<connection_t *> conns;
+  vector<epoll_event> events(MAX_EVENTS);
+  bool done = false;
+  while (!done) {
+    int n = epoll_wait(ep, events.data(), events.size(), -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      sys_error(errno, "Error in epoll_wait():");
+      break;
+    }
+    for (int i = 0; i < n; ++i) {
+      connection_t *c = (connection_t *)events[i].data.ptr;
+      if (c == nullptr) {
+        accept_all(sd, ep, conns);
+      } else if (!advance(ep, c, compute, pri, pub, storage, tickets)) {
+        // A BYE takes effect once its response has been fully sent
+        done |= c->stop && c->sent == c->out.size();
+        close(c->sd);
+        conns.erase(c);
+        delete c;
+      }
+    }
+  }
+
+  // Compute threads may still hold connections, so wait for them before
+  // reclaiming anything
+  compute.await_shutdown();
+  for (auto c : conns) {
+    close(c->sd);
+    delete c;
+  }
+  close(ep);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <openssl/rsa.h>
+
+#include "../common/pool.h"
+#include "../common/vec.h"
+
+#include "server_storage.h"
+#include "server_tickets.h"
+
+/// Serve clients from a single event-loop thread, instead of dedicating a
+/// thread to each connection.  All sockets are non-blocking and registered
+/// with epoll.  The loop reads each request's fixed-size rblock and its
+/// variable-size ablock incrementally, as bytes arrive, so a client that
+/// trickles its request in over a slow link costs only a small buffer.
+///
+/// Once a block is complete, the expensive work (RSA decryption of the rblock,
+/// then AES decryption, execution, and encryption of the request) is handed to
+/// the compute pool.  When the response is ready, the loop writes it back,
+/// again without blocking.
+///
+/// @param sd      The listening socket
+/// @param compute The pool of threads that does the RSA/AES work
+/// @param pri     The private key used by the server
+/// @param pub     The public key file contents, to send to the client
+/// @param storage The Storage object with which clients interact
+/// @param tickets The server's ticket cache
+void serve_reactor(int sd, thread_pool &compute, RSA *pri, const vec &pub,
+                   Storage &storage, TicketCache &tickets);
@@ -0,0 +1,431 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <openssl/rsa.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "../common/crypto.h"
+#include "../common/err.h"
+#include "../common/log.h"
+#include "../common/net.h"
+#include "../common/protocol.h"
+#include "../common/session.h"
+#include "../common/vec.h"
+
+#include "server_replication.h"
+
+using namespace std;
+
+/// The most bytes of records to put in one frame, unless a single record is
+/// larger
+const size_t REPL_BATCH_BYTES = 1 << 20;
+
+/// The most bytes of records that may wait for a follower before it is
+/// disconnected
+const size_t REPL_MAX_LAG_BYTES = 64 << 20;
+
+/// The largest frame that a follower accepts: a full batch, plus one more
+/// record of the largest size
+const int REPL_FRAME_MAX = REPL_BATCH_BYTES + LEN_CONTENT + 4096;
+
+/// The longest wait between a follower's attempts to reach its primary
+const int REPL_RETRY_MAX_SECS = 16;
+
+/// follower_t is the primary's view of one connected follower
+struct follower_t {
+  /// The follower's socket, and the stream's AES key
+  int sd = -1;
+  vec key;
+
+  /// A lock and condition variable to protect and signal everything below
+  mutex lock;
+  condition_variable cv;
+
+  /// The records that are waiting to be sent, and their total size
+  deque<vec> queue;
+  size_t bytes = 0;
+
+  /// Does the follower receive changes yet?  Only once it has agreed on a
+  /// key, and is about to receive every entry.
+  bool live = false;
+
+  /// Has the follower been disconnected?
+  bool closed = false;
+
+  /// Has the sending thread finished?
+  atomic<bool> done{false};
+
+  /// The thread that sends to the follower
+  thread sender;
+};
+
+/// The RSA key that the primary and followers share
+static RSA *repl_key = nullptr;
+
+/// The Storage object that is being replicated
+static Storage *repl_storage = nullptr;
+
+/// The primary's listening socket, and the thread that accepts followers
+static int listen_sd = -1;
+static thread acceptor;
+
+/// The connected followers, and a lock to protect them
+static mutex followers_lock;
+static list<shared_ptr<follower_t>> followers;
+
+/// The follower's primary, the thread that follows it, and its current socket
+static string primary_host;
+static int primary_port = 0;
+static thread follower;
+static int primary_sd = -1;
+
+/// A lock and condition variable to protect and signal primary_sd and
+/// stopping
+static mutex follow_lock;
+static condition_variable follow_cv;
+
+/// True once replication should stop
+static atomic<bool> stopping{false};
+
+/// The replication counters (see repl_stats_t)
+static atomic<uint64_t> sent{0}, applied{0};
+
+/// Agree on the AES key for a stream: send a fresh key, encrypted with the
+/// public half of the shared RSA key, and receive the other side's.  The
+/// stream's key is the xor of the two.
+///
+/// @param sd The socket of the stream
+///
+/// @returns The stream's key, or an empty vector on error
+static vec agree_key(int sd) {
+  vec mine = create_aes_key();
+  vec enc(RSA_size(repl_key)), theirs(RSA_size(repl_key));
+  if (RSA_public_encrypt(mine.size(), mine.data(), enc.data(), repl_key,
+                         RSA_PKCS1_OAEP_PADDING) != (int)enc.size()) {
+    log_msg(LOG_ERROR, "Error in RSA_public_encrypt()");
+    return {};
+  }
+  if (!send_reliably(sd, enc) ||
+      reliable_get_to_eof_or_n(sd, enc.begin(), enc.size()) !=
+          (int)enc.size())
+    return {};
+  int len = RSA_private_decrypt(enc.size(), enc.data(), theirs.data(),
+                                repl_key, RSA_PKCS1_OAEP_PADDING);
+  if (len != (int)mine.size()) {
+    log_msg(LOG_WARN, "Replication peer does not share our key");
+    return {};
+  }
+  for (size_t i = 0; i < mine.size(); ++i)
+    mine[i] ^= theirs[i];
+  return mine;
+}
+
+/// Queue a record for a follower.  The follower's lock must be held.
+///
+/// @param f   The follower
+/// @param rec The record
+static void enqueue(follower_t &f, const vec &rec) {
+  f.queue.push_back(rec);
+  f.bytes += rec.size();
+  f.cv.notify_all();
+}
+
+/// Hand a change to every live follower.  This runs while the changed user's
+/// shard is locked (see Storage::replicate_to()), so it never blocks on a
+/// follower's socket.
+///
+/// @param rec The record that describes the change
+static void publish(const vec &rec) {
+  lock_guard<mutex> g(followers_lock);
+  for (auto &f : followers) {
+    lock_guard<mutex> h(f->lock);
+    if (!f->live || f->closed)
+      continue;
+    if (f->bytes + rec.size() > REPL_MAX_LAG_BYTES) {
+      log_msg(LOG_WARN, "Disconnecting a follower that fell too far behind");
+      f->closed = true;
+      f->cv.notify_all();
+      shutdown(f->sd, SHUT_RDWR);
+      continue;
+    }
+    enqueue(*f, rec);
+  }
+}
+
+/// Send a follower the records in its queue, a batch per frame
+///
+/// @param f    The follower
+/// @param wait Wait for more records once the queue is empty?  If so, this
+///             only returns once the follower is disconnected.
+///
+/// @returns false if the follower was disconnected or the stream failed
+static bool send_queue(follower_t &f, bool wait) {
+  while (true) {
+    vec frame;
+    size_t n = 0;
+    {
+      unique_lock<mutex> g(f.lock);
+      if (wait)
+        f.cv.wait(g, [&]() { return f.closed || !f.queue.empty(); });
+      if (f.closed)
+        return false;
+      if (f.queue.empty())
+        return true;
+      while (!f.queue.empty() && frame.size() < REPL_BATCH_BYTES) {
+        vec_append(frame, (int)f.queue.front().size());
+        vec_append(frame, f.queue.front());
+        f.bytes -= f.queue.front().size();
+        f.queue.pop_front();
+        ++n;
+      }
+    }
+    if (!send_frame(f.sd, f.key, frame))
+      return false;
+    sent += n;
+  }
+}
+
+/// The body of a follower's sending thread: agree on a key, send every entry
+/// one shard at a time, and then stream changes until the follower is
+/// disconnected
+///
+/// NB: the follower goes live before each shard is read, so a change is
+///     either in the shard's entries or queued after them (or both, which is
+///     harmless, since the follower applies them in order)
+///
+/// @param f The follower
+static void serve_follower(follower_t &f) {
+  f.key = agree_key(f.sd);
+  if (!f.key.empty()) {
+    {
+      lock_guard<mutex> g(f.lock);
+      f.live = !f.closed;
+    }
+    log_msg(LOG_INFO, "Follower connected; sending every entry");
+    bool ok = true;
+    for (size_t i = 0; ok && i < repl_storage->num_shards(); ++i) {
+      repl_storage->dump_shard(i, [&](const vec &rec) {
+        lock_guard<mutex> g(f.lock);
+        enqueue(f, rec);
+      });
+      ok = send_queue(f, false);
+    }
+    if (ok)
+      send_queue(f, true);
+    log_msg(LOG_INFO, "Follower disconnected");
+  }
+  lock_guard<mutex> g(f.lock);
+  f.closed = true;
+  f.done = true;
+}
+
+/// Wait for a follower's sending thread, and close its socket
+///
+/// @param f The follower
+static void reap(follower_t &f) {
+  f.sender.join();
+  close(f.sd);
+}
+
+/// The body of the primary's accepting thread: start a sending thread for
+/// each follower that connects, until replication stops
+static void accept_followers() {
+  while (true) {
+    sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int sd = accept(listen_sd, (sockaddr *)&addr, &len);
+    if (sd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      // NB: repl_stop() shuts the socket down to end the loop
+      if (!stopping)
+        sys_error(errno, "Error accepting follower:");
+      return;
+    }
+    net_tune(sd);
+    auto f = make_shared<follower_t>();
+    f->sd = sd;
+    lock_guard<mutex> g(followers_lock);
+    for (auto i = followers.begin(); i != followers.end();) {
+      if ((*i)->done) {
+        reap(**i);
+        i = followers.erase(i);
+      } else {
+        ++i;
+      }
+    }
+    followers.push_back(f);
+    f->sender = thread([f]() { serve_follower(*f); });
+  }
+}
+
+/// Start streaming changes to any follower that connects to a port.  This
+/// must be called before any requests are served.
+///
+/// @param port    The port on which to listen for followers
+/// @param key     The RSA key that the primary and followers share
+/// @param storage The Storage object whose changes should be streamed
+///
+/// @returns false if the port can't be opened
+bool repl_serve(int port, RSA *key, Storage &storage) {
+  listen_sd = create_server_socket(port);
+  if (listen_sd < 0)
+    return false;
+  repl_key = key;
+  repl_storage = &storage;
+  storage.replicate_to(publish);
+  acceptor = thread(accept_followers);
+  return true;
+}
+
+/// Split a frame from the primary into its records
+///
+/// @param msg  The decrypted frame
+/// @param recs Receives the records
+///
+/// @returns false if the frame is malformed
+static bool split_records(const vec &msg, vector<vec> &recs) {
+  size_t pos = 0;
+  while (pos < msg.size()) {
+    int len;
+    if (pos + sizeof(int) > msg.size())
+      return false;
+    memcpy(&len, msg.data() + pos, sizeof(int));
+    pos += sizeof(int);
+    if (len <= 0 || pos + len > msg.size())
+      return false;
+    recs.emplace_back(msg.begin() + pos, msg.begin() + pos + len);
+    pos += len;
+  }
+  return true;
+}
+
+/// Apply every batch from the primary, until the stream ends
+///
+/// @param sd The socket of the stream
+///
+/// @returns true if at least one batch was applied
+static bool apply_stream(int sd) {
+  vec key = agree_key(sd);
+  if (key.empty())
+    return false;
+  log_msg(LOG_INFO, "Following " + primary_host + ":" +
+                        to_string(primary_port));
+  bool any = false;
+  vec msg;
+  while (recv_frame(sd, key, REPL_FRAME_MAX, msg) == 1) {
+    vector<vec> recs;
+    if (!split_records(msg, recs) || !repl_storage->apply_records(recs)) {
+      log_msg(LOG_ERROR, "Invalid records from the primary");
+      break;
+    }
+    applied += recs.size();
+    any = true;
+  }
+  log_msg(LOG_WARN, "Lost the primary; reconnecting");
+  return any;
+}
+
+/// The body of the following thread: connect to the primary and apply its
+/// stream, backing off between attempts, until replication stops
+static void follow_primary() {
+  int delay = 1;
+  while (true) {
+    int sd = connect_to_server(primary_host, primary_port);
+    if (sd >= 0) {
+      {
+        lock_guard<mutex> g(follow_lock);
+        if (stopping) {
+          close(sd);
+          return;
+        }
+        primary_sd = sd;
+      }
+      if (apply_stream(sd))
+        delay = 1;
+      lock_guard<mutex> g(follow_lock);
+      primary_sd = -1;
+      close(sd);
+    }
+    unique_lock<mutex> g(follow_lock);
+    follow_cv.wait_for(g, chrono::seconds(delay),
+                       [&]() { return stopping.load(); });
+    if (stopping)
+      return;
+    delay = min(delay * 2, REPL_RETRY_MAX_SECS);
+  }
+}
+
+/// Start following a primary, in the background
+///
+/// @param host    The IP or hostname of the primary
+/// @param port    The primary's replication port
+/// @param key     The RSA key that the primary and followers share
+/// @param storage The Storage object to which changes should be applied
+void repl_follow(const string &host, int port, RSA *key, Storage &storage) {
+  primary_host = host;
+  primary_port = port;
+  repl_key = key;
+  repl_storage = &storage;
+  follower = thread(follow_primary);
+}
+
+/// Check if this server is a follower, and must not accept changes
+///
+/// @returns true if repl_follow() has been called
+bool repl_is_follower() { return primary_port != 0; }
+
+/// Stop replication: disconnect every follower, and stop following
+void repl_stop() {
+  {
+    lock_guard<mutex> g(follow_lock);
+    stopping = true;
+    if (primary_sd >= 0)
+      shutdown(primary_sd, SHUT_RDWR);
+    follow_cv.notify_all();
+  }
+  if (follower.joinable())
+    follower.join();
+  if (listen_sd < 0)
+    return;
+  shutdown(listen_sd, SHUT_RDWR);
+  acceptor.join();
+  close(listen_sd);
+  listen_sd = -1;
+  lock_guard<mutex> g(followers_lock);
+  for (auto &f : followers) {
+    {
+      lock_guard<mutex> h(f->lock);
+      f->closed = true;
+      f->cv.notify_all();
+      shutdown(f->sd, SHUT_RDWR);
+    }
+    reap(*f);
+  }
+  followers.clear();
+}
+
+/// Report on replication
+///
+/// @returns The replication counters
+repl_stats_t repl_stats() {
+  repl_stats_t res{0, sent, applied, 0};
+  lock_guard<mutex> g(followers_lock);
+  for (auto &f : followers) {
+    lock_guard<mutex> h(f->lock);
+    res.followers += f->live && !f->closed;
+    res.queued_bytes += f->bytes;
+  }
+  return res;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <openssl/rsa.h>
+#include <string>
+
+#include "server_storage.h"
+
+/// A server can keep hot standbys up to date by streaming every change to
+/// them.  The primary listens on a replication port.  A follower connects to
+/// it, and the two agree on an AES key: each sends a fresh key, encrypted
+/// with the public half of the RSA key that they share, and the stream's key
+/// is the xor of the two.  So only a server that holds the private key can
+/// either follow or lead.  (A standby needs that key anyway, so that clients
+/// can trust it once it takes over.)
+///
+/// The primary then sends every user's entry, one shard at a time, followed
+/// by every later change as it happens.  Each change is the record that the
+/// write-ahead log would hold (see server_storage.h), so the same records
+/// drive the log and the followers.  Records are sent as session frames (see
+/// common/session.h), each of which holds a batch of len(@r).@r records: all
+/// the records that queued up while the previous frame was being sent, up to
+/// REPL_BATCH_BYTES.  Replication is asynchronous: a change is acknowledged to
+/// the client before any follower has it.  A follower that falls so far
+/// behind that its queue would exceed REPL_MAX_LAG_BYTES is disconnected.
+///
+/// A follower applies each batch to its own auth table (and its own log, if
+/// it has one), and serves GET and ALL, but refuses REG and SET with
+/// RES_ERR_READONLY.  If the stream breaks, it reconnects, backing off up to
+/// REPL_RETRY_MAX_SECS between tries, and gets every entry again.  Since users
+/// are never removed, applying the entries over what it already has leaves it
+/// with exactly the primary's table.  A follower may also listen for followers
+/// of its own.
+
+/// repl_stats_t reports on replication
+struct repl_stats_t {
+  /// The number of followers that are being streamed to
+  uint64_t followers;
+
+  /// The number of records sent to followers, and applied from a primary
+  uint64_t sent, applied;
+
+  /// The number of bytes of records waiting to be sent to followers
+  uint64_t queued_bytes;
+};
+
+/// Start streaming changes to any follower that connects to a port.  This
+/// must be called before any requests are served.
+///
+/// @param port    The port on which to listen for followers
+/// @param key     The RSA key that the primary and followers share
+/// @param storage The Storage object whose changes should be streamed
+///
+/// @returns false if the port can't be opened
+bool repl_serve(int port, RSA *key, Storage &storage);
+
+/// Start following a primary, in the background
+///
+/// @param host    The IP or hostname of the primary
+/// @param port    The primary's replication port
+/// @param key     The RSA key that the primary and followers share
+/// @param storage The Storage object to which changes should be applied
+void repl_follow(const std::string &host, int port, RSA *key,
+                 Storage &storage);
+
+/// Check if this server is a follower, and must not accept changes
+///
+/// @returns true if repl_follow() has been called
+bool repl_is_follower();
+
+/// Stop replication: disconnect every follower, and stop following
+void repl_stop();
+
+/// Report on replication
+///
+/// @returns The replication counters
+repl_stats_t repl_stats();
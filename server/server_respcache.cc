@@ -0,0 +1,189 @@
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "../common/vec.h"
+
+#include "server_respcache.h"
+
+using namespace std;
+
+/// The number of shards in a response cache
+const size_t RESP_CACHE_SHARDS = 16;
+
+/// The largest response that is cached, as a fraction of the capacity, so that
+/// one huge profile can't flush every other one
+const size_t RESP_CACHE_MAX_SHARE = 4;
+
+/// Each shard holds its responses in a list, with the most recently used at
+/// the front, and an index from name to list position
+typedef list<pair<string, shared_ptr<const vec>>> resp_lru_t;
+
+/// resp_shard_t is one shard of a response cache
+struct resp_shard_t {
+  /// A lock to protect everything below
+  mutex lock;
+
+  /// The responses, in LRU order
+  resp_lru_t lru;
+
+  /// The position of each response in lru
+  unordered_map<string, resp_lru_t::iterator> index;
+
+  /// The number of invalidations in this shard
+  uint64_t generation = 0;
+};
+
+/// Internal is the class that stores all the members of a ResponseCache object.
+/// To avoid pulling too much into the .h file, we are using the PIMPL pattern
+/// (https://www.geeksforgeeks.org/pimpl-idiom-in-c-with-examples/)
+struct ResponseCache::Internal {
+  /// The most bytes of responses to hold
+  const size_t capacity;
+
+  /// The shards
+  resp_shard_t shards[RESP_CACHE_SHARDS];
+
+  /// The counters (see resp_cache_stats_t)
+  atomic<uint64_t> hits{0}, misses{0}, bytes{0}, entries{0};
+
+  /// Construct the Internal object
+  ///
+  /// @param _capacity The most bytes of responses to hold
+  Internal(size_t _capacity) : capacity(_capacity) {}
+
+  /// Find the shard that holds a user's response
+  ///
+  /// @param who The name of the user
+  ///
+  /// @returns The shard
+  resp_shard_t &shard_of(string_view who) {
+    return shards[hash<string_view>()(who) % RESP_CACHE_SHARDS];
+  }
+
+  /// Count the bytes that a cached response costs
+  ///
+  /// @param who The name of the user
+  /// @param res The response
+  ///
+  /// @returns The number of bytes
+  static size_t cost(string_view who, const vec &res) {
+    return who.size() + res.size();
+  }
+
+  /// Remove a response from a shard, which must be locked
+  ///
+  /// @param s The shard
+  /// @param i The response's position in the shard's index
+  void evict(resp_shard_t &s,
+             unordered_map<string, resp_lru_t::iterator>::iterator i) {
+    bytes -= cost(i->first, *i->second->second);
+    --entries;
+    s.lru.erase(i->second);
+    s.index.erase(i);
+  }
+};
+
+/// Construct an empty cache
+///
+/// @param capacity The most bytes of responses to hold (0 to hold none)
+ResponseCache::ResponseCache(size_t capacity)
+    : fields(new Internal(capacity)) {}
+
+/// Destructor for the response cache
+///
+/// NB: The compiler doesn't know that it can create the default destructor in
+///     the .h file, because PIMPL prevents it from knowing the size of
+///     ResponseCache::Internal.  Now that we have reified
+///     ResponseCache::Internal, the compiler can make a destructor for us.
+ResponseCache::~ResponseCache() = default;
+
+/// Find the response for a user's content
+///
+/// @param who The name of the user whose content was fetched
+///
+/// @returns The response, or nullptr if it isn't cached
+shared_ptr<const vec> ResponseCache::get(string_view who) {
+  if (fields->capacity == 0)
+    return nullptr;
+  resp_shard_t &s = fields->shard_of(who);
+  lock_guard<mutex> g(s.lock);
+  auto i = s.index.find(string(who));
+  if (i == s.index.end()) {
+    ++fields->misses;
+    return nullptr;
+  }
+  ++fields->hits;
+  s.lru.splice(s.lru.begin(), s.lru, i->second);
+  return i->second->second;
+}
+
+/// Take the generation of a user's shard, before reading the content from
+/// which a response will be built
+///
+/// @param who The name of the user whose content will be fetched
+///
+/// @returns The stamp to pass to put()
+uint64_t ResponseCache::stamp(string_view who) {
+  if (fields->capacity == 0)
+    return 0;
+  resp_shard_t &s = fields->shard_of(who);
+  lock_guard<mutex> g(s.lock);
+  return s.generation;
+}
+
+/// Add the response for a user's content, if nothing has been invalidated in
+/// its shard since the stamp was taken, and it fits
+///
+/// @param who   The name of the user whose content was fetched
+/// @param stamp The result of stamp(), from before the content was read
+/// @param res   The response
+void ResponseCache::put(string_view who, uint64_t stamp, const vec &res) {
+  size_t cost = Internal::cost(who, res);
+  if (cost > fields->capacity / RESP_CACHE_MAX_SHARE)
+    return;
+  // NB: copy before taking the lock
+  auto copy = make_shared<const vec>(res);
+  resp_shard_t &s = fields->shard_of(who);
+  lock_guard<mutex> g(s.lock);
+  if (s.generation != stamp)
+    return;
+  string key(who);
+  auto i = s.index.find(key);
+  if (i != s.index.end())
+    fields->evict(s, i);
+  while (fields->bytes + cost > fields->capacity && !s.lru.empty())
+    fields->evict(s, s.index.find(s.lru.back().first));
+  if (fields->bytes + cost > fields->capacity)
+    return;
+  s.lru.emplace_front(key, copy);
+  s.index[key] = s.lru.begin();
+  fields->bytes += cost;
+  ++fields->entries;
+}
+
+/// Forget the response for a user's content, after the content has changed
+///
+/// @param who The name of the user whose content changed
+void ResponseCache::invalidate(string_view who) {
+  if (fields->capacity == 0)
+    return;
+  resp_shard_t &s = fields->shard_of(who);
+  lock_guard<mutex> g(s.lock);
+  ++s.generation;
+  auto i = s.index.find(string(who));
+  if (i != s.index.end())
+    fields->evict(s, i);
+}
+
+/// Report on the cache
+///
+/// @returns The cache's counters
+resp_cache_stats_t ResponseCache::stats() {
+  return {fields->hits, fields->misses, fields->bytes, fields->entries};
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+#include "../common/vec.h"
+
+/// resp_cache_stats_t reports how well the response cache is working
+struct resp_cache_stats_t {
+  /// The number of lookups that found a response
+  uint64_t hits;
+
+  /// The number of lookups that didn't
+  uint64_t misses;
+
+  /// The number of bytes of responses held in the cache, and the number of
+  /// responses
+  uint64_t bytes, entries;
+};
+
+/// ResponseCache holds the unencrypted responses to recent GETs, by the name of
+/// the user whose content was fetched, so that a hot profile is not copied out
+/// of the auth table (and decompressed) for every GET.  It is split into shards
+/// by name, each with its own lock and LRU list.  The shards share one budget:
+/// adding a response evicts the least recently used responses of its shard
+/// until the cache fits, and the response isn't added if they aren't enough.
+///
+/// A response must never outlive a change to the content it was built from.
+/// Writers change the table first and then call invalidate(), which bumps the
+/// shard's generation.  Readers take the generation with stamp() before they
+/// read the table, and put() drops a response whose stamp is older than the
+/// shard's generation, since the content may have changed under it.
+class ResponseCache {
+  /// Internal is the class that stores all the members of a ResponseCache
+  /// object.  To avoid pulling too much into the .h file, we are using the
+  /// PIMPL pattern (https://www.geeksforgeeks.org/pimpl-idiom-in-c-with-examples/)
+  struct Internal;
+
+  /// A reference to the internal fields of the ResponseCache object
+  std::unique_ptr<Internal> fields;
+
+public:
+  /// Construct an empty cache
+  ///
+  /// @param capacity The most bytes of responses to hold (0 to hold none)
+  ResponseCache(size_t capacity);
+
+  /// Destructor for the response cache
+  ~ResponseCache();
+
+  /// Find the response for a user's content
+  ///
+  /// @param who The name of the user whose content was fetched
+  ///
+  /// @returns The response, or nullptr if it isn't cached
+  std::shared_ptr<const vec> get(std::string_view who);
+
+  /// Take the generation of a user's shard, before reading the content from
+  /// which a response will be built
+  ///
+  /// @param who The name of the user whose content will be fetched
+  ///
+  /// @returns The stamp to pass to put()
+  uint64_t stamp(std::string_view who);
+
+  /// Add the response for a user's content, if nothing has been invalidated in
+  /// its shard since the stamp was taken, and it fits
+  ///
+  /// @param who   The name of the user whose content was fetched
+  /// @param stamp The result of stamp(), from before the content was read
+  /// @param res   The response
+  void put(std::string_view who, uint64_t stamp, const vec &res);
+
+  /// Forget the response for a user's content, after the content has changed
+  ///
+  /// @param who The name of the user whose content changed
+  void invalidate(std::string_view who);
+
+  /// Report on the cache
+  ///
+  /// @returns The cache's counters
+  resp_cache_stats_t stats();
+};
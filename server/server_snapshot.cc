@@ -0,0 +1,443 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#include <zlib.h>
+
+#include "../common/contextmanager.h"
+#include "../common/err.h"
+#include "../common/file.h"
+#include "../common/log.h"
+#include "../common/protocol.h"
+#include "../common/vec.h"
+
+#include "server_snapshot.h"
+
+using namespace std;
+
+/// The magic 8-byte constant at the start of every indexed snapshot
+const string SNAP_MAGIC = "AUTHIDX3";
+
+/// The magic 8-byte constant at the start of every segmented snapshot's
+/// manifest
+const string SEGS_MAGIC = "AUTHSEGS";
+
+/// The size of the fixed part of an index record: two 4-byte lengths, then the
+/// content length and offset
+const size_t SNAP_ENTRY = 2 * sizeof(uint32_t) + 2 * sizeof(uint64_t);
+
+/// snap_header_t is the start of a snapshot's header.  The rest of the header
+/// is zeros.
+struct snap_header_t {
+  /// The magic constant, SNAP_MAGIC
+  char magic[8];
+
+  /// The number of entries
+  uint64_t count;
+
+  /// The offset of the index
+  uint64_t index;
+
+  /// The offset of the end of the index
+  uint64_t end;
+};
+
+/// Round an offset up to the next multiple of 8, where an index record may
+/// begin
+///
+/// @param off The offset
+///
+/// @returns The rounded offset
+static uint64_t entry_align(uint64_t off) {
+  return (off + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+}
+
+/// Internal is the class that stores all the members of a SnapshotWriter
+/// object.  To avoid pulling too much into the .h file, we are using the PIMPL
+/// pattern (https://www.geeksforgeeks.org/pimpl-idiom-in-c-with-examples/)
+struct SnapshotWriter::Internal {
+  /// The file being written, or nullptr
+  FILE *f = nullptr;
+
+  /// The number of bytes written so far
+  uint64_t pos = 0;
+
+  /// The number of entries written so far
+  uint64_t count = 0;
+
+  /// The index records of the entries written so far
+  vec index;
+
+  /// The CRC-32 of everything after the header, and then (once the header is
+  /// written) of the whole file
+  uLong crc = crc32(0, nullptr, 0);
+
+  /// Write bytes to the file
+  ///
+  /// @param data The bytes to write
+  /// @param len  The number of bytes
+  ///
+  /// @returns false on error
+  bool put(const void *data, size_t len) {
+    if (fwrite(data, 1, len, f) != len) {
+      sys_error(errno, "Error writing snapshot:");
+      return false;
+    }
+    // NB: the header isn't known until finish(), so it is summed last.  Empty
+    //     content may have no buffer, and crc32_z() restarts on a null one.
+    if (pos >= SNAP_HEADER && len > 0)
+      crc = crc32_z(crc, (const Bytef *)data, len);
+    pos += len;
+    return true;
+  }
+
+  /// Write zeros until the position is a multiple of align
+  ///
+  /// @param align The alignment to reach
+  ///
+  /// @returns false on error
+  bool pad(size_t align) {
+    static const unsigned char zeros[SNAP_ALIGN] = {0};
+    size_t n = (align - pos % align) % align;
+    return n == 0 || put(zeros, n);
+  }
+};
+
+/// Construct a writer.  No file is created until open() is called.
+SnapshotWriter::SnapshotWriter() : fields(new Internal()) {}
+
+/// Destructor for the writer.  If finish() was not called, the file is left
+/// incomplete, and will not be recognized as a snapshot.
+SnapshotWriter::~SnapshotWriter() {
+  if (fields->f != nullptr)
+    fclose(fields->f);
+}
+
+/// Create (or truncate) the snapshot file
+///
+/// @param path The name of the file
+///
+/// @returns false on error
+bool SnapshotWriter::open(const string &path) {
+  fields->f = fopen(path.c_str(), "wb");
+  if (fields->f == nullptr) {
+    sys_error(errno, "Error opening snapshot:");
+    return false;
+  }
+  // NB: the header is written as zeros, and filled in by finish(), so a file
+  //     that was never finished has no magic
+  unsigned char header[SNAP_HEADER] = {0};
+  return fields->put(header, SNAP_HEADER);
+}
+
+/// Append one entry to the snapshot
+///
+/// @param user    The name of the user
+/// @param hash    The hashed password
+/// @param content The user's content
+/// @param zsize   The length of the content, if content is its zlib
+///                compression, or 0
+///
+/// @returns false on error
+bool SnapshotWriter::add(string_view user, string_view hash, bytes_t content,
+                         uint32_t zsize) {
+  // NB: empty content takes no space, so it needs no padding
+  if (content.size > 0 && !fields->pad(SNAP_ALIGN))
+    return false;
+  uint64_t coff = fields->pos;
+  if (!fields->put(content.data, content.size))
+    return false;
+  uint32_t lens[2] = {(uint32_t)user.size(), (uint32_t)hash.size()};
+  uint64_t blob[2] = {content.size | (uint64_t)zsize << 32, coff};
+  vec &index = fields->index;
+  index.insert(index.end(), (const unsigned char *)lens,
+               (const unsigned char *)lens + sizeof(lens));
+  index.insert(index.end(), (const unsigned char *)blob,
+               (const unsigned char *)blob + sizeof(blob));
+  index.insert(index.end(), user.begin(), user.end());
+  index.insert(index.end(), hash.begin(), hash.end());
+  index.resize(entry_align(index.size()), 0);
+  ++fields->count;
+  return true;
+}
+
+/// Write the index and the header, and force the file to disk
+///
+/// @returns false on error
+bool SnapshotWriter::finish() {
+  ContextManager closer([&]() {
+    fclose(fields->f);
+    fields->f = nullptr;
+  });
+  snap_header_t h;
+  memcpy(h.magic, SNAP_MAGIC.data(), sizeof(h.magic));
+  h.count = fields->count;
+  if (!fields->pad(sizeof(uint64_t)))
+    return false;
+  h.index = fields->pos;
+  if (!fields->put(fields->index.data(), fields->index.size()))
+    return false;
+  h.end = fields->pos;
+  unsigned char header[SNAP_HEADER] = {0};
+  memcpy(header, &h, sizeof(h));
+  if (fseek(fields->f, 0, SEEK_SET) != 0 ||
+      fwrite(header, SNAP_HEADER, 1, fields->f) != 1 ||
+      fflush(fields->f) != 0 || fsync(fileno(fields->f)) != 0) {
+    sys_error(errno, "Error writing snapshot:");
+    return false;
+  }
+  fields->crc = crc32_combine(crc32(0, header, SNAP_HEADER), fields->crc,
+                              fields->pos - SNAP_HEADER);
+  return true;
+}
+
+/// Report the size of the file
+///
+/// @returns The number of bytes written so far
+size_t SnapshotWriter::size() { return fields->pos; }
+
+/// Report the checksum of the file, once finish() has succeeded
+///
+/// @returns The CRC-32 of every byte of the file
+uint32_t SnapshotWriter::checksum() { return fields->crc; }
+
+/// Internal is the class that stores all the members of a MappedSnapshot
+/// object.  To avoid pulling too much into the .h file, we are using the PIMPL
+/// pattern (https://www.geeksforgeeks.org/pimpl-idiom-in-c-with-examples/)
+struct MappedSnapshot::Internal {
+  /// The start of the mapping, or nullptr
+  const unsigned char *base = nullptr;
+
+  /// The size of the mapping
+  size_t size = 0;
+
+  /// The header, which is at the start of the mapping
+  snap_header_t header;
+};
+
+/// Construct an empty view.  No file is mapped until open() is called.
+MappedSnapshot::MappedSnapshot() : fields(new Internal()) {}
+
+/// Destructor for the view.  This unmaps the file.
+MappedSnapshot::~MappedSnapshot() {
+  if (fields->base != nullptr)
+    munmap((void *)fields->base, fields->size);
+}
+
+/// Check if a file begins like an indexed snapshot
+///
+/// @param path The name of the file
+///
+/// @returns true if the file starts with the AUTHIDX3 magic
+bool MappedSnapshot::is_snapshot(const string &path) {
+  FILE *f = fopen(path.c_str(), "rb");
+  if (f == nullptr)
+    return false;
+  ContextManager closer([&]() { fclose(f); });
+  char magic[8];
+  return fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+         memcmp(magic, SNAP_MAGIC.data(), sizeof(magic)) == 0;
+}
+
+/// Map a snapshot file, and check that its header is valid
+///
+/// @param path The name of the file
+///
+/// @returns false on error, or if the file is not a valid snapshot
+bool MappedSnapshot::open(const string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    sys_error(errno, "Error opening snapshot:");
+    return false;
+  }
+  // NB: the mapping stays valid after the descriptor is closed, and even
+  //     after a newer snapshot is renamed over this one
+  ContextManager closer([&]() { close(fd); });
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    sys_error(errno, "Error in fstat():");
+    return false;
+  }
+  if ((size_t)st.st_size < SNAP_HEADER) {
+    log_msg(LOG_ERROR, "Truncated snapshot: " + path);
+    return false;
+  }
+  void *base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (base == MAP_FAILED) {
+    sys_error(errno, "Error in mmap():");
+    return false;
+  }
+  fields->base = (const unsigned char *)base;
+  fields->size = st.st_size;
+
+  snap_header_t &h = fields->header;
+  memcpy(&h, fields->base, sizeof(h));
+  bool ok = memcmp(h.magic, SNAP_MAGIC.data(), sizeof(h.magic)) == 0 &&
+            h.index >= SNAP_HEADER && h.index % sizeof(uint64_t) == 0 &&
+            h.index <= h.end && h.end <= fields->size;
+  if (!ok)
+    log_msg(LOG_ERROR, "Invalid snapshot header in " + path);
+  return ok;
+}
+
+/// Visit every entry of the snapshot, in index order.  Only the index is
+/// read: each entry's content is a view of the mapping.
+///
+/// @param f The function to run on each entry.  If it returns false, the
+///          traversal stops.
+///
+/// @returns false if an entry is invalid or f() returned false
+bool MappedSnapshot::for_each(function<bool(const snap_entry_t &)> f) {
+  const snap_header_t &h = fields->header;
+  uint64_t seen = 0;
+  for (uint64_t off = h.index; off < h.end;) {
+    // The record must lie within the index, and its content between the
+    // header and the index
+    uint32_t lens[2];
+    uint64_t blob[2];
+    if (off + SNAP_ENTRY > h.end) {
+      log_msg(LOG_ERROR, "Truncated snapshot index");
+      return false;
+    }
+    memcpy(lens, fields->base + off, sizeof(lens));
+    memcpy(blob, fields->base + off + sizeof(lens), sizeof(blob));
+    uint64_t names = off + SNAP_ENTRY;
+    uint64_t clen = blob[0] & UINT32_MAX, zsize = blob[0] >> 32;
+    if (lens[0] > LEN_UNAME || lens[1] > h.end - names ||
+        lens[0] > h.end - names - lens[1] || clen > LEN_CONTENT ||
+        zsize > LEN_CONTENT || (zsize && !clen) || blob[1] < SNAP_HEADER ||
+        blob[1] > h.index || clen > h.index - blob[1]) {
+      log_msg(LOG_ERROR, "Invalid entry in snapshot");
+      return false;
+    }
+    snap_entry_t e;
+    e.user = string_view((const char *)fields->base + names, lens[0]);
+    e.hash = string_view((const char *)fields->base + names + lens[0], lens[1]);
+    e.content = bytes_t{fields->base + blob[1], clen};
+    e.zsize = zsize;
+    ++seen;
+    if (!f(e))
+      return false;
+    off = entry_align(names + lens[0] + lens[1]);
+  }
+  if (seen != h.count) {
+    log_msg(LOG_ERROR, "Snapshot index does not match its header");
+    return false;
+  }
+  return true;
+}
+
+/// Report the size of the mapped file
+///
+/// @returns The number of bytes in the mapping
+size_t MappedSnapshot::size() { return fields->size; }
+
+/// Compute the checksum of the mapped file.  This reads every page of it.
+///
+/// @returns The CRC-32 of every byte of the file
+uint32_t MappedSnapshot::checksum() {
+  return crc32_z(crc32(0, nullptr, 0), fields->base, fields->size);
+}
+
+/// Find the file that holds one segment of a segmented snapshot
+///
+/// @param path The name of the snapshot's main file
+/// @param gen  The generation of the segments
+/// @param i    The index of the segment
+///
+/// @returns The name of the segment's file
+string snap_segment_path(const string &path, uint64_t gen, size_t i) {
+  return path + ".seg" + to_string(gen) + "." + to_string(i);
+}
+
+/// Check if a file begins like the manifest of a segmented snapshot
+///
+/// @param path The name of the file
+///
+/// @returns true if the file starts with the AUTHSEGS magic
+bool snap_is_manifest(const string &path) {
+  FILE *f = fopen(path.c_str(), "rb");
+  if (f == nullptr)
+    return false;
+  ContextManager closer([&]() { fclose(f); });
+  char magic[8];
+  return fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+         memcmp(magic, SEGS_MAGIC.data(), sizeof(magic)) == 0;
+}
+
+/// Create (or truncate) a manifest file, and force it to disk
+///
+/// @param path     The name of the file
+/// @param manifest The generation and segments to record
+///
+/// @returns false on error
+bool snap_write_manifest(const string &path, const snap_manifest_t &manifest) {
+  vec buf(SEGS_MAGIC.begin(), SEGS_MAGIC.end());
+  auto put = [&](uint64_t v) {
+    auto b = (const unsigned char *)&v;
+    buf.insert(buf.end(), b, b + sizeof(v));
+  };
+  put(manifest.gen);
+  put(manifest.segments.size());
+  for (auto &s : manifest.segments) {
+    put(s.size);
+    put(s.crc);
+  }
+  put(crc32_z(crc32(0, nullptr, 0), buf.data(), buf.size()));
+  FILE *f = fopen(path.c_str(), "wb");
+  if (f == nullptr) {
+    sys_error(errno, "Error opening manifest:");
+    return false;
+  }
+  ContextManager closer([&]() { fclose(f); });
+  if (fwrite(buf.data(), 1, buf.size(), f) != buf.size() || fflush(f) != 0 ||
+      fsync(fileno(f)) != 0) {
+    sys_error(errno, "Error writing manifest:");
+    return false;
+  }
+  return true;
+}
+
+/// Read a manifest file, and check that it is valid
+///
+/// @param path     The name of the file
+/// @param manifest Receives the generation and segments
+///
+/// @returns false on error, or if the file is not a valid manifest
+bool snap_read_manifest(const string &path, snap_manifest_t &manifest) {
+  vec buf = load_entire_file(path);
+  size_t pos = SEGS_MAGIC.size();
+  auto get = [&](uint64_t &v) {
+    if (pos + sizeof(v) > buf.size())
+      return false;
+    memcpy(&v, buf.data() + pos, sizeof(v));
+    pos += sizeof(v);
+    return true;
+  };
+  uint64_t n = 0, sum;
+  bool ok = buf.size() >= pos &&
+            memcmp(buf.data(), SEGS_MAGIC.data(), pos) == 0 &&
+            get(manifest.gen) && get(n) && n > 0 && n <= SNAP_MAX_SEGMENTS;
+  manifest.segments.clear();
+  for (uint64_t i = 0; ok && i < n; ++i) {
+    snap_segment_t s;
+    uint64_t crc = 0;
+    ok = get(s.size) && get(crc) && crc <= UINT32_MAX;
+    s.crc = crc;
+    manifest.segments.push_back(s);
+  }
+  // NB: the final checksum covers everything before it
+  size_t body = pos;
+  ok = ok && get(sum) && pos == buf.size() &&
+       sum == crc32_z(crc32(0, nullptr, 0), buf.data(), body);
+  if (!ok)
+    log_msg(LOG_ERROR, "Invalid manifest in " + path);
+  return ok;
+}
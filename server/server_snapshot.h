@@ -0,0 +1,229 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../common/vec.h"
+
+/// The indexed snapshot format lets the server start without reading every
+/// user's content.  All integers are 8 bytes unless noted, and a file is laid
+/// out as:
+///
+///  - A SNAP_HEADER-byte header: the magic 8-byte constant AUTHIDX3, the
+///    number of entries, and the offsets of the start and the end of the
+///    index, followed by zeros
+///  - The content of each user, each at a multiple of SNAP_ALIGN bytes
+///  - The index, which holds one record per user.  Each begins at a multiple
+///    of 8 bytes, with a 4-byte length of the username, a 4-byte length of
+///    pass_hash, the length of the content, and the offset of the content,
+///    followed by the bytes of the username and of pass_hash.  If the content
+///    is compressed, the high 32 bits of its length hold the length of the
+///    content once it is inflated.
+///
+/// The index is contiguous, so loading a snapshot only reads the header and
+/// the index, and each user's content is left on disk until it is used.  The
+/// index comes last because a snapshot is written in a single pass, and its
+/// size isn't known until every entry has been added.  A snapshot is never
+/// modified once it is written.
+///
+/// A segmented snapshot splits the entries among several indexed snapshots, so
+/// that each can be written and loaded by its own thread.  The main file
+/// is then a manifest, laid out as:
+///
+///  - The magic 8-byte constant AUTHSEGS, the generation of the segments, and
+///    the number of segments
+///  - For each segment, its size and the CRC-32 of all of its bytes
+///  - The CRC-32 of everything before it
+///
+/// Segment i of generation g of main file f is the snapshot f.seg<g>.<i> (see
+/// snap_segment_path()).  A new generation is written next to the current
+/// one, and only replaces it when its manifest is renamed over the main file,
+/// so a crash leaves either every old segment or every new one in use.
+
+/// The size of a snapshot's header
+const size_t SNAP_HEADER = 64;
+
+/// The alignment of content in a snapshot
+const size_t SNAP_ALIGN = 64;
+
+/// The most segments that a segmented snapshot may have
+const size_t SNAP_MAX_SEGMENTS = 256;
+
+/// snap_entry_t is one user's entry in a snapshot.  Its fields point into the
+/// snapshot's mapping, and are only valid while the mapping is.
+struct snap_entry_t {
+  /// The name of the user
+  std::string_view user;
+
+  /// The hashed password
+  std::string_view hash;
+
+  /// The user's content
+  bytes_t content;
+
+  /// The length of the content, if content is its zlib compression, or 0
+  uint32_t zsize;
+};
+
+/// snap_segment_t describes one segment of a segmented snapshot
+struct snap_segment_t {
+  /// The size of the segment's file
+  uint64_t size = 0;
+
+  /// The CRC-32 of the segment's file
+  uint32_t crc = 0;
+};
+
+/// snap_manifest_t is the content of a segmented snapshot's main file
+struct snap_manifest_t {
+  /// The generation of the segments, which names their files
+  uint64_t gen = 0;
+
+  /// The segments
+  std::vector<snap_segment_t> segments;
+};
+
+/// SnapshotWriter produces an indexed snapshot file, one entry at a time.  The
+/// content goes to the file as it is added, and the index is kept in memory
+/// until finish().
+class SnapshotWriter {
+  /// Internal is the class that stores all the members of a SnapshotWriter
+  /// object.  To avoid pulling too much into the .h file, we are using the
+  /// PIMPL pattern (https://www.geeksforgeeks.org/pimpl-idiom-in-c-with-examples/)
+  struct Internal;
+
+  /// A reference to the internal fields of the SnapshotWriter object
+  std::unique_ptr<Internal> fields;
+
+public:
+  /// Construct a writer.  No file is created until open() is called.
+  SnapshotWriter();
+
+  /// Destructor for the writer.  If finish() was not called, the file is left
+  /// incomplete, and will not be recognized as a snapshot.
+  ~SnapshotWriter();
+
+  /// Create (or truncate) the snapshot file
+  ///
+  /// @param path The name of the file
+  ///
+  /// @returns false on error
+  bool open(const std::string &path);
+
+  /// Append one entry to the snapshot
+  ///
+  /// @param user    The name of the user
+  /// @param hash    The hashed password
+  /// @param content The user's content
+  /// @param zsize   The length of the content, if content is its zlib
+  ///                compression, or 0
+  ///
+  /// @returns false on error
+  bool add(std::string_view user, std::string_view hash, bytes_t content,
+           uint32_t zsize = 0);
+
+  /// Write the index and the header, and force the file to disk
+  ///
+  /// @returns false on error
+  bool finish();
+
+  /// Report the size of the file
+  ///
+  /// @returns The number of bytes written so far
+  size_t size();
+
+  /// Report the checksum of the file, once finish() has succeeded
+  ///
+  /// @returns The CRC-32 of every byte of the file
+  uint32_t checksum();
+};
+
+/// MappedSnapshot is a read-only, memory-mapped view of an indexed snapshot.
+/// Opening it only touches the header, and visiting its entries only touches
+/// the index.  Content pages are not read from disk until they are used.
+class MappedSnapshot {
+  /// Internal is the class that stores all the members of a MappedSnapshot
+  /// object.  To avoid pulling too much into the .h file, we are using the
+  /// PIMPL pattern (https://www.geeksforgeeks.org/pimpl-idiom-in-c-with-examples/)
+  struct Internal;
+
+  /// A reference to the internal fields of the MappedSnapshot object
+  std::unique_ptr<Internal> fields;
+
+public:
+  /// Construct an empty view.  No file is mapped until open() is called.
+  MappedSnapshot();
+
+  /// Destructor for the view.  This unmaps the file.
+  ~MappedSnapshot();
+
+  /// Check if a file begins like an indexed snapshot
+  ///
+  /// @param path The name of the file
+  ///
+  /// @returns true if the file starts with the AUTHIDX3 magic
+  static bool is_snapshot(const std::string &path);
+
+  /// Map a snapshot file, and check that its header is valid
+  ///
+  /// @param path The name of the file
+  ///
+  /// @returns false on error, or if the file is not a valid snapshot
+  bool open(const std::string &path);
+
+  /// Visit every entry of the snapshot, in index order
+  ///
+  /// @param f The function to run on each entry.  If it returns false, the
+  ///          traversal stops.
+  ///
+  /// @returns false if an entry is invalid or f() returned false
+  bool for_each(std::function<bool(const snap_entry_t &)> f);
+
+  /// Report the size of the mapped file
+  ///
+  /// @returns The number of bytes in the mapping
+  size_t size();
+
+  /// Compute the checksum of the mapped file.  This reads every page of it.
+  ///
+  /// @returns The CRC-32 of every byte of the file
+  uint32_t checksum();
+};
+
+/// Find the file that holds one segment of a segmented snapshot
+///
+/// @param path The name of the snapshot's main file
+/// @param gen  The generation of the segments
+/// @param i    The index of the segment
+///
+/// @returns The name of the segment's file
+std::string snap_segment_path(const std::string &path, uint64_t gen,
+                              size_t i);
+
+/// Check if a file begins like the manifest of a segmented snapshot
+///
+/// @param path The name of the file
+///
+/// @returns true if the file starts with the AUTHSEGS magic
+bool snap_is_manifest(const std::string &path);
+
+/// Create (or truncate) a manifest file, and force it to disk
+///
+/// @param path     The name of the file
+/// @param manifest The generation and segments to record
+///
+/// @returns false on error
+bool snap_write_manifest(const std::string &path,
+                         const snap_manifest_t &manifest);
+
+/// Read a manifest file, and check that it is valid
+///
+/// @param path     The name of the file
+/// @param manifest Receives the generation and segments
+///
+/// @returns false on error, or if the file is not a valid manifest
+bool snap_read_manifest(const std::string &path, snap_manifest_t &manifest);
@@ -1,14 +1,33 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <functional>
 #include <iostream>
-#include <openssl/md5.h>
-#include <unordered_map>
+#include <mutex>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
 #include <utility>
+#include <vector>
 
+#include "../common/bufpool.h"
+#include "../common/compress.h"
 #include "../common/contextmanager.h"
 #include "../common/err.h"
+#include "../common/file.h"
+#include "../common/log.h"
 #include "../common/protocol.h"
 #include "../common/vec.h"
 
+#include "server_authtable.h"
+#include "server_passhash.h"
+#include "server_snapshot.h"
 #include "server_storage.h"
+#include "server_wal.h"
 
 using namespace std;
 
@@ -16,17 +35,9 @@ using namespace std;
 /// Storage object.  Organizing the fields as an Internal is part of the PIMPL
 /// pattern.
 struct Storage::Internal {
-  /// AuthTableEntry represents one user stored in the authentication table
-  struct AuthTableEntry {
-    /// The name of the user; max 64 characters
-    string username;
-
-    /// The hashed password.  Note that the password is a max of 128 chars
-    string pass_hash;
-
-    /// The user's content
-    vec content;
-  };
+  static_assert(PASS_HASH_LEN <= AUTH_HASH_MAX &&
+                    PASS_LEGACY_LEN <= AUTH_HASH_MAX,
+                "the auth table must hold every kind of hashed password");
 
   /// A unique 8-byte code to use as a prefix each time an AuthTable Entry is
   /// written to disk.
@@ -35,27 +46,568 @@ struct Storage::Internal {
   ///     compatibility later on.
   inline static const string AUTHENTRY = "AUTHAUTH";
 
-  /// The map of authentication information, indexed by username
-  unordered_map<string, AuthTableEntry> auth_table;
+  /// The prefix of an entry whose content is compressed
+  inline static const string PACKENTRY = "AUTHPACK";
+
+  /// The map of authentication information, indexed by username.  Each shard
+  /// of the map has its own lock, so requests for different users rarely
+  /// contend.
+  AuthTable auth_table;
 
   /// filename is the name of the file from which the Storage object was loaded,
   /// and to which we persist the Storage object every time it changes
   string filename = "";
 
-  /// Construct the Storage::Internal object by setting the filename
+  /// A lock to keep two persist() or compact() calls from writing
+  /// filename.tmp at once.  Note that it does not block any of the other
+  /// operations on auth_table.
+  mutex persist_lock;
+
+  /// The configuration of the log and of compaction
+  const log_opts_t opts;
+
+  /// The zlib level at which to compress content, or 0 to store it as it is
+  const int zlevel;
+
+  /// The number of segments in which to write the main file (1 for a single
+  /// indexed snapshot)
+  const size_t segments;
+
+  /// True if load() checks the checksum of each segment, as well as its size.
+  /// This reads every page of each segment.
+  const bool verify;
+
+  /// The manifest that filename holds, if it is a segmented snapshot.  If it
+  /// isn't, this has no segments.
+  snap_manifest_t manifest;
+
+  /// The cache of GET responses
+  ResponseCache responses;
+
+  /// The write-ahead log, or nullptr if Storage isn't in log mode
+  unique_ptr<WriteAheadLog> wal;
+
+  /// The function that hands each change to followers, if any (see
+  /// replicate_to())
+  function<void(const vec &)> feed;
+
+  /// The compaction thread, if any compaction trigger is configured
+  thread compactor;
+
+  /// True when the compaction thread should exit
+  bool stopping = false;
+
+  /// A lock and condition variable for waking the compaction thread
+  mutex compact_lock;
+  condition_variable compact_cv;
+
+  /// The compaction counters (see compaction_stats_t)
+  atomic<uint64_t> runs{0}, last_ms{0}, total_ms{0}, reclaimed{0};
+
+  /// Construct the Storage::Internal object by setting the filename and the
+  /// number of buckets in the auth table
+  ///
+  /// @param fname   The name of the file that should be used to load/store the
+  ///                data
+  /// @param buckets The number of buckets in the auth table
+  /// @param log     The configuration of the write-ahead log
+  /// @param zlevel  The zlib level at which to compress content (0 to store
+  ///                it as it is)
+  /// @param cache   The most bytes of GET responses to cache (0 for none)
+  /// @param segs    The number of segments in which to write the main file
+  /// @param verify  True to check the checksum of each segment at load()
+  Internal(const string &fname, size_t buckets, const log_opts_t &log,
+           int zlevel, size_t cache, size_t segs, bool verify)
+      : auth_table(buckets), filename(fname), opts(log), zlevel(zlevel),
+        segments(segs), verify(verify), responses(cache),
+        wal(log.enabled ? new WriteAheadLog(fname + ".log", log.sync_ms)
+                        : nullptr) {}
+
+  /// Report the size of a file
+  ///
+  /// @param name The name of the file
+  ///
+  /// @returns The number of bytes in the file, or 0 if it doesn't exist
+  static size_t file_size(const string &name) {
+    struct stat st;
+    return stat(name.c_str(), &st) == 0 ? st.st_size : 0;
+  }
+
+  /// Report the size of the main file, including its segments
+  ///
+  /// @returns The number of bytes
+  size_t snapshot_size() {
+    size_t res = file_size(filename);
+    for (auto &s : manifest.segments)
+      res += s.size;
+    return res;
+  }
+
+  /// Write some of the buckets to an indexed snapshot.  Entries are written
+  /// one bucket at a time, so that requests for users in other buckets are
+  /// never blocked, and so that the whole table never has to be held in
+  /// memory twice.
+  ///
+  /// @param path   The name of the file to write
+  /// @param first  The first bucket to write
+  /// @param stride The distance between the buckets to write
+  /// @param seg    Receives the size and checksum of the file
+  ///
+  /// @returns false on error
+  bool write_buckets(const string &path, size_t first, size_t stride,
+                     snap_segment_t &seg) {
+    SnapshotWriter w;
+    if (!w.open(path))
+      return false;
+    // NB: each bucket is only read-locked while its entries are copied into
+    //     the writer's stdio buffer, so GETs on it can continue
+    bool ok = true;
+    for (size_t i = first; ok && i < auth_table.num_shards(); i += stride)
+      auth_table.do_shard_readonly(
+          i, [&](string_view user, string_view hash, const user_content_t *c) {
+            ok = ok && (c ? w.add(user, hash, c->data(), c->zsize)
+                          : w.add(user, hash, bytes_t()));
+          });
+    if (!ok || !w.finish())
+      return false;
+    seg.size = w.size();
+    seg.crc = w.checksum();
+    return true;
+  }
+
+  /// Remove the segment files of a manifest
+  ///
+  /// @param m The manifest
+  void remove_segments(const snap_manifest_t &m) {
+    for (size_t i = 0; i < m.segments.size(); ++i) {
+      string seg = snap_segment_path(filename, m.gen, i);
+      if (unlink(seg.c_str()) != 0 && errno != ENOENT)
+        sys_error(errno, "Error removing snapshot segment:");
+    }
+  }
+
+  /// Write the next generation of segments, one per thread, each holding
+  /// every segments'th bucket.  Once all of them are on disk, write their
+  /// manifest to filename.tmp and rename it over filename.
+  ///
+  /// @returns false on error, in which case filename is unchanged
+  bool write_segments() {
+    snap_manifest_t next;
+    next.gen = manifest.gen + 1;
+    next.segments.resize(min(segments, auth_table.num_shards()));
+    size_t n = next.segments.size();
+    // NB: not vector<bool>, whose elements can't be set from many threads
+    vector<char> ok(n, false);
+    vector<thread> writers;
+    for (size_t i = 0; i < n; ++i)
+      writers.emplace_back([&, i]() {
+        ok[i] = write_buckets(snap_segment_path(filename, next.gen, i), i, n,
+                              next.segments[i]);
+      });
+    for (auto &w : writers)
+      w.join();
+    string tmp = filename + ".tmp";
+    if (find(ok.begin(), ok.end(), false) != ok.end() ||
+        !snap_write_manifest(tmp, next)) {
+      remove_segments(next);
+      return false;
+    }
+    if (rename(tmp.c_str(), filename.c_str()) != 0) {
+      sys_error(errno, "Error renaming persisted data file:");
+      remove_segments(next);
+      return false;
+    }
+    remove_segments(manifest);
+    manifest = next;
+    return true;
+  }
+
+  /// Write every entry to filename.tmp as an indexed snapshot, fsync it, and
+  /// rename it over filename, or write a segmented snapshot if there is more
+  /// than one segment.  The caller must hold persist_lock.
+  ///
+  /// @param bytes Receives the size of the new file, including its segments
+  ///
+  /// @returns false on error, in which case filename is unchanged
+  bool write_snapshot(size_t &bytes) {
+    if (segments > 1) {
+      if (!write_segments())
+        return false;
+      bytes = snapshot_size();
+      return true;
+    }
+    string tmp = filename + ".tmp";
+    snap_segment_t seg;
+    if (!write_buckets(tmp, 0, 1, seg)) {
+      // NB: don't leave a partial file to take up the space the log needs
+      unlink(tmp.c_str());
+      return false;
+    }
+    bytes = seg.size;
+    if (rename(tmp.c_str(), filename.c_str()) != 0) {
+      sys_error(errno, "Error renaming persisted data file:");
+      return false;
+    }
+    // NB: the segments that filename used to name are no longer needed
+    remove_segments(manifest);
+    manifest = snap_manifest_t();
+    return true;
+  }
+
+  /// Load the entries of an indexed snapshot.  Content is not copied: each
+  /// entry refers to the mapping, so it is paged in on first use.
+  ///
+  /// @param path The name of the snapshot
+  /// @param seg  The size and checksum that the snapshot must have, or
+  ///             nullptr to skip the check.  The checksum is only checked if
+  ///             verify is set.
+  ///
+  /// @returns false if the snapshot is invalid
+  bool load_snapshot(const string &path, const snap_segment_t *seg = nullptr) {
+    auto snap = make_shared<MappedSnapshot>();
+    if (!snap->open(path))
+      return false;
+    if (seg && snap->size() != seg->size) {
+      log_msg(LOG_ERROR, "Size mismatch in " + path);
+      return false;
+    }
+    if (seg && verify && snap->checksum() != seg->crc) {
+      log_msg(LOG_ERROR, "Checksum mismatch in " + path);
+      return false;
+    }
+    return snap->for_each([&](const snap_entry_t &s) {
+      unique_ptr<user_content_t> c;
+      if (s.content.size > 0) {
+        c.reset(new user_content_t);
+        c->snap = snap;
+        c->mapped = s.content;
+        c->zsize = s.zsize;
+      }
+      if (!auth_table.upsert(s.user, s.hash, move(c))) {
+        log_msg(LOG_ERROR, "Invalid entry in " + path);
+        return false;
+      }
+      return true;
+    });
+  }
+
+  /// Load the segments of a segmented snapshot, one per thread, straight into
+  /// the auth table
   ///
-  /// @param fname The name of the file that should be used to load/store the
-  ///              data
-  Internal(const string &fname) : filename(fname) {}
+  /// @returns false if the manifest or any segment is invalid
+  bool load_segments() {
+    snap_manifest_t m;
+    if (!snap_read_manifest(filename, m))
+      return false;
+    size_t n = m.segments.size();
+    // NB: not vector<bool>, whose elements can't be set from many threads
+    vector<char> ok(n, false);
+    vector<thread> loaders;
+    for (size_t i = 0; i < n; ++i)
+      loaders.emplace_back([&, i]() {
+        ok[i] = load_snapshot(snap_segment_path(filename, m.gen, i),
+                              &m.segments[i]);
+      });
+    for (auto &l : loaders)
+      l.join();
+    if (find(ok.begin(), ok.end(), false) != ok.end())
+      return false;
+    manifest = m;
+    return true;
+  }
+
+  /// Load the entries of a file in the legacy format, which has no index, so
+  /// every entry (and its content) must be read and copied
+  ///
+  /// @returns false if the file is invalid
+  bool load_legacy() {
+    vec buf = load_entire_file(filename);
+    // NB: load_entire_file() can't distinguish an empty file from an error,
+    //     but an empty file just means there were no users when we last
+    //     persisted
+    size_t pos = 0;
+    while (pos < buf.size())
+      if (!parse_entry(buf, pos, filename))
+        return false;
+    return true;
+  }
+
+  /// Fold the log into a new snapshot: swap in a fresh log, write a snapshot
+  /// that covers everything in the old one, then delete the old one.  Requests
+  /// keep running throughout, and are only blocked while the log is swapped.
+  /// An old log that an earlier, failed compaction left behind is folded in
+  /// before the log is swapped.
+  ///
+  /// @returns false on error
+  bool compact() {
+    lock_guard<mutex> g(persist_lock);
+    auto start = chrono::steady_clock::now();
+    string old = filename + ".log.old";
+    // NB: a compaction that failed after its rotation leaves the old log
+    //     behind.  Its records are in auth_table, but in no snapshot, and the
+    //     rotation below would rename the current log over it.  So fold it in
+    //     first, and don't rotate until it is gone.
+    if (file_exists(old)) {
+      size_t folded;
+      if (!write_snapshot(folded))
+        return false;
+      if (unlink(old.c_str()) != 0) {
+        sys_error(errno, "Error removing old log:");
+        return false;
+      }
+    }
+    size_t before = snapshot_size() + wal->size();
+    // NB: every record in the old log was applied to auth_table before it was
+    //     appended, so the snapshot is guaranteed to include it.  Records that
+    //     go to the new log may also be in the snapshot, which is harmless:
+    //     replaying an entry that is already present just replaces it.
+    if (!wal->rotate(old))
+      return false;
+    size_t after;
+    if (!write_snapshot(after))
+      return false;
+    if (unlink(old.c_str()) != 0)
+      sys_error(errno, "Error removing old log:");
+    uint64_t ms = chrono::duration_cast<chrono::milliseconds>(
+                      chrono::steady_clock::now() - start)
+                      .count();
+    last_ms = ms;
+    total_ms += ms;
+    reclaimed += before > after ? before - after : 0;
+    ++runs;
+    return true;
+  }
+
+  /// The body of the compaction thread: check the triggers once a second, and
+  /// compact when one of them fires, until told to stop
+  void compact_loop() {
+    auto last = chrono::steady_clock::now();
+    unique_lock<mutex> l(compact_lock);
+    while (!stopping) {
+      compact_cv.wait_for(l, chrono::seconds(1));
+      if (stopping)
+        break;
+      size_t bytes = wal->size();
+      auto now = chrono::steady_clock::now();
+      bool due = (opts.compact_bytes > 0 && bytes >= opts.compact_bytes) ||
+                 (opts.compact_secs > 0 && bytes > 0 &&
+                  now - last >= chrono::seconds(opts.compact_secs));
+      if (!due)
+        continue;
+      l.unlock();
+      compact();
+      l.lock();
+      last = chrono::steady_clock::now();
+    }
+  }
+
+  /// Record one change, which is already in auth_table: append it to the log,
+  /// and hand it to followers.  The caller must hold the lock on the user's
+  /// shard, so that the log and the followers see the same order of changes
+  /// to each user as the table.
+  ///
+  /// @param rec The user's complete entry
+  /// @param lsn Receives the record's sequence number in the log, or 0 if
+  ///            there is no log
+  ///
+  /// @returns false if the record could not be appended to the log, in which
+  ///          case followers don't get it either, and the caller must undo
+  ///          the change before it releases the lock
+  bool record(const vec &rec, uint64_t &lsn) {
+    lsn = 0;
+    if (wal && !wal->append(rec, lsn))
+      return false;
+    if (feed)
+      feed(rec);
+    return true;
+  }
+
+  /// Replay one log file into auth_table
+  ///
+  /// @param log The name of the log file
+  ///
+  /// @returns false if the log holds a record that isn't a valid entry
+  bool replay(const string &log) {
+    // Every log record is a complete entry that is newer than the main file
+    return WriteAheadLog::replay(log, [&](const vec &rec) {
+      size_t pos = 0;
+      return parse_entry(rec, pos, log) && pos == rec.size();
+    });
+  }
+
+  /// Add a user whose password has already been hashed.  In log mode, the
+  /// new entry is appended to the log, and is durable before this returns.
+  ///
+  /// @param user The user name to register
+  /// @param hash The user's hashed password
+  ///
+  /// @returns A vector with the result message: RES_OK, RES_ERR_USER_EXISTS,
+  ///          or RES_ERR_SERVER if the password couldn't be hashed or the
+  ///          new entry couldn't be logged
+  vec add_hashed(string_view user, const string &hash) {
+    if (hash.empty())
+      return vec_from_string(RES_ERR_SERVER);
+    if (!wal && !feed)
+      return vec_from_string(auth_table.insert(user, hash)
+                                 ? RES_OK
+                                 : RES_ERR_USER_EXISTS);
+
+    // NB: record under the shard lock, so that the log has the same order of
+    //     changes to each user as the table.  Wait for the sync after the
+    //     lock is released.
+    vec rec = make_entry(user, hash, bytes_t());
+    uint64_t lsn = 0;
+    bool logged = true;
+    bool added = auth_table.insert(user, hash, [&]() {
+      logged = record(rec, lsn);
+      return logged;
+    });
+    if (!logged)
+      return vec_from_string(RES_ERR_SERVER);
+    if (!added)
+      return vec_from_string(RES_ERR_USER_EXISTS);
+    if (!logged || (lsn != 0 && !wal->commit(lsn)))
+      return vec_from_string(RES_ERR_SERVER);
+    return vec_from_string(RES_OK);
+  }
+
+  /// Serialize the entry for a user, in the on-disk format described in
+  /// server_storage.h, straight from its fields
+  ///
+  /// @param user    The name of the user
+  /// @param hash    The user's hashed password
+  /// @param content The user's content
+  /// @param zsize   The length of the content, if it is compressed, or 0
+  ///
+  /// @returns A vector holding the entry
+  static vec make_entry(string_view user, const string &hash, bytes_t content,
+                        size_t zsize = 0) {
+    vec out;
+    out.reserve(AUTHENTRY.length() + 4 * sizeof(int) + user.length() +
+                hash.length() + content.size);
+    vec_append(out, zsize > 0 ? PACKENTRY : AUTHENTRY);
+    vec_append(out, (int)user.length());
+    out.insert(out.end(), user.begin(), user.end());
+    vec_append(out, (int)hash.length());
+    vec_append(out, hash);
+    if (zsize > 0)
+      vec_append(out, (int)zsize);
+    vec_append(out, (int)content.size);
+    out.insert(out.end(), content.data, content.data + content.size);
+    return out;
+  }
+
+  /// Parse one entry, in the on-disk format described in server_storage.h,
+  /// and add it to auth_table, replacing any entry for the same user
+  ///
+  /// @param buf        The buffer being parsed
+  /// @param pos        The position of the entry's AUTHENTRY; advanced past
+  ///                   the entry
+  /// @param src        The name of the file being parsed, for error messages
+  /// @param on_success Code to run with the user's name once the entry is in
+  ///                   place, if any.  It runs while the shard is still
+  ///                   locked.
+  ///
+  /// @returns false if the buffer does not hold a valid entry at pos
+  bool parse_entry(const vec &buf, size_t &pos, const string &src,
+                   function<void(string_view)> on_success = nullptr) {
+    // NB: both prefixes are the same length
+    bool packed = pos + PACKENTRY.length() <= buf.size() &&
+                  memcmp(buf.data() + pos, PACKENTRY.c_str(),
+                         PACKENTRY.length()) == 0;
+    if (!packed && (pos + AUTHENTRY.length() > buf.size() ||
+                    memcmp(buf.data() + pos, AUTHENTRY.c_str(),
+                           AUTHENTRY.length()) != 0)) {
+      log_msg(LOG_ERROR, "Invalid entry in " + src);
+      return false;
+    }
+    pos += AUTHENTRY.length();
+    vec name, hash, content;
+    int zsize = 0;
+    if (!read_field(buf, pos, name, LEN_UNAME) ||
+        !read_field(buf, pos, hash, AUTH_HASH_MAX) ||
+        (packed && !read_int(buf, pos, zsize)) ||
+        !read_field(buf, pos, content, LEN_CONTENT)) {
+      log_msg(LOG_ERROR, "Truncated entry in " + src);
+      return false;
+    }
+    if (packed && (zsize <= 0 || zsize > LEN_CONTENT || content.empty())) {
+      log_msg(LOG_ERROR, "Invalid entry in " + src);
+      return false;
+    }
+    unique_ptr<user_content_t> c;
+    if (!content.empty()) {
+      c.reset(new user_content_t);
+      c->content.swap(content);
+      c->zsize = zsize;
+    }
+    string_view user((char *)name.data(), name.size());
+    if (!auth_table.upsert(user, string_view((char *)hash.data(), hash.size()),
+                           move(c), [&]() {
+                             if (on_success)
+                               on_success(user);
+                           })) {
+      log_msg(LOG_ERROR, "Invalid entry in " + src);
+      return false;
+    }
+    return true;
+  }
+
+  /// Read a 4-byte integer from a buffer
+  ///
+  /// @param buf The buffer being parsed
+  /// @param pos The position of the integer; advanced past it
+  /// @param out Receives the integer
+  ///
+  /// @returns false if the buffer is too short
+  static bool read_int(const vec &buf, size_t &pos, int &out) {
+    if (pos + sizeof(int) > buf.size())
+      return false;
+    memcpy(&out, buf.data() + pos, sizeof(int));
+    pos += sizeof(int);
+    return true;
+  }
+
+  /// Read a 4-byte length, followed by that many bytes, from a buffer.
+  ///
+  /// @param buf The buffer being parsed
+  /// @param pos The position of the length field; advanced past the bytes
+  /// @param out The vector that receives the bytes
+  /// @param max The largest length that is considered valid
+  ///
+  /// @returns false if the buffer is too short or the length is invalid
+  static bool read_field(const vec &buf, size_t &pos, vec &out, int max) {
+    int len;
+    if (pos + sizeof(int) > buf.size())
+      return false;
+    memcpy(&len, buf.data() + pos, sizeof(int));
+    pos += sizeof(int);
+    if (len < 0 || len > max || pos + len > buf.size())
+      return false;
+    out.assign(buf.begin() + pos, buf.begin() + pos + len);
+    pos += len;
+    return true;
+  }
 };
 
 /// Construct an empty object and specify the file from which it should be
 /// loaded.  To avoid exceptions and errors in the constructor, the act of
 /// loading data is separate from construction.
 ///
-/// @param fname The name of the file that should be used to load/store the
-///              data
-Storage::Storage(const string &fname) : fields(new Internal(fname)) {}
+/// @param fname   The name of the file that should be used to load/store the
+///                data
+/// @param buckets The number of buckets in the auth table
+/// @param log     The configuration of the write-ahead log
+/// @param zlevel  The zlib level at which to compress content (0 to store it
+///                as it is)
+/// @param cache   The most bytes of GET responses to cache (0 for none)
+/// @param segs    The number of segments in which to write the main file (1
+///                for a single indexed snapshot)
+/// @param verify  True to check the checksum of each segment at load(), as
+///                well as its size.  This reads all of the content.
+Storage::Storage(const string &fname, size_t buckets, const log_opts_t &log,
+                 int zlevel, size_t cache, size_t segs, bool verify)
+    : fields(new Internal(fname, buckets, log, zlevel, cache, segs, verify)) {}
 
 /// Destructor for the storage object.
 ///
@@ -65,16 +617,55 @@ Storage::Storage(const string &fname) : fields(new Internal(fname)) {}
 ///     compiler can make a destructor for us.
 Storage::~Storage() = default;
 
-/// Populate the Storage object by loading an auth_table from this.filename.
-/// Note that load() begins by clearing the auth_table, so that when the call
-/// is complete, exactly and only the contents of the file are in the
-/// auth_table.
+/// Populate the Storage object by loading an auth_table from this.filename,
+/// and then replaying this.filename.log.old and this.filename.log.  Note that
+/// load() begins by clearing the auth_table, so that when the call is
+/// complete, exactly and only the contents of the files are in the auth_table.
+/// In log mode, this also opens the log for appending, and starts the
+/// compaction thread.
 ///
 /// @returns false if any error is encountered in the file, and true
 ///          otherwise.  Note that a non-existent file is not an error.
 bool Storage::load() {
-  cerr << "load is not implemented\n";
-  return false;
+  fields->auth_table.clear();
+  if (!file_exists(fields->filename)) {
+    cerr << "File not found: " << fields->filename << endl;
+  } else {
+    // NB: a file in the legacy format is rewritten as a snapshot the next
+    //     time Storage is persisted or compacted
+    bool ok;
+    if (MappedSnapshot::is_snapshot(fields->filename))
+      ok = fields->load_snapshot(fields->filename);
+    else if (snap_is_manifest(fields->filename))
+      ok = fields->load_segments();
+    else
+      ok = fields->load_legacy();
+    if (!ok)
+      return false;
+    cerr << "Loaded: " << fields->filename << endl;
+  }
+
+  // A compaction that was interrupted leaves an old log, which is older than
+  // the current log.  Fold it into the main file right away, since the next
+  // compaction would otherwise rename the current log over it.
+  string old = fields->filename + ".log.old";
+  if (!fields->replay(old) || !fields->replay(fields->filename + ".log"))
+    return false;
+  if (file_exists(old)) {
+    lock_guard<mutex> g(fields->persist_lock);
+    size_t bytes;
+    if (!fields->write_snapshot(bytes))
+      return false;
+    if (unlink(old.c_str()) != 0)
+      sys_error(errno, "Error removing old log:");
+  }
+  if (!fields->wal)
+    return true;
+  if (!fields->wal->open())
+    return false;
+  if (fields->opts.compact_bytes > 0 || fields->opts.compact_secs > 0)
+    fields->compactor = thread([&]() { fields->compact_loop(); });
+  return true;
 }
 
 /// Create a new entry in the Auth table.  If the user_name already exists, we
@@ -84,10 +675,31 @@ bool Storage::load() {
 /// @param user_name The user name to register
 /// @param pass      The password to associate with that user name
 ///
-/// @returns False if the username already exists, true otherwise
-bool Storage::add_user(const string &user_name, const string &pass) {
-  cerr << "add_user is not implemented\n";
-  return false;
+/// @returns A vector with the result message: RES_OK, RES_ERR_USER_EXISTS if
+///          the username already exists, or RES_ERR_SERVER if the new entry
+///          couldn't be made durable
+vec Storage::add_user(string_view user_name, string_view pass) {
+  return fields->add_hashed(user_name, pass_hash(pass));
+}
+
+/// Create many new entries in the Auth table, as if by add_user().  The
+/// passwords are hashed in parallel, before any entry is added, and the
+/// entries are then added in order.
+///
+/// @param users The user names to register, and their passwords
+///
+/// @returns For each user, the result message of add_user().  A username that
+///          appeared earlier in the batch already exists.
+vector<vec>
+Storage::add_users(const vector<pair<string_view, string_view>> &users) {
+  vector<string_view> passes;
+  for (auto &u : users)
+    passes.push_back(u.second);
+  vector<string> hashes = pass_hash_batch(passes);
+  vector<vec> res;
+  for (size_t i = 0; i < users.size(); ++i)
+    res.push_back(fields->add_hashed(users[i].first, hashes[i]));
+  return res;
 }
 
 /// Set the data bytes for a user, but do so if and only if the password
@@ -96,30 +708,263 @@ bool Storage::add_user(const string &user_name, const string &pass) {
 /// @param user_name The name of the user whose content is being set
 /// @param pass      The password for the user, used to authenticate
 /// @param content   The data to set for this user
+/// @param creds     The connection's checked credentials, or nullptr
 ///
 /// @returns A pair with a bool to indicate error, and a vector indicating the
 ///          message (possibly an error message) that is the result of the
 ///          attempt
-vec Storage::set_user_data(const string &user_name, const string &pass,
-                           const vec &content) {
-  cerr << "set_user_data is not implemented\n";
-  return vec_from_string(RES_ERR_XMIT);
+vec Storage::set_user_data(string_view user_name, string_view pass,
+                           const vec &content, cred_cache_t *creds) {
+  return set_user_data(user_name, pass,
+                       bytes_t{content.data(), content.size()}, creds);
+}
+
+/// Set the data bytes for a user, but do so if and only if the password
+/// matches.  The content is a view into the request, and it is copied exactly
+/// once, into the user's entry.
+///
+/// @param user_name The name of the user whose content is being set
+/// @param pass      The password for the user, used to authenticate
+/// @param content   A view of the data to set for this user
+/// @param creds     The connection's checked credentials, or nullptr
+///
+/// @returns A vector indicating the message (possibly an error message) that
+///          is the result of the attempt
+vec Storage::set_user_data(string_view user_name, string_view pass,
+                           bytes_t content, cred_cache_t *creds) {
+  return set_packed_data(user_name, pass, content, content.size, creds);
+}
+
+/// Set the data bytes for a user from a packed content field (see
+/// CONTENT_FLAG_PACKED), but do so if and only if the password matches.  If the
+/// data is compressed, and Storage compresses content too, then it is stored as
+/// it is, once it has been checked.
+///
+/// @param user_name The name of the user whose content is being set
+/// @param pass      The password for the user, used to authenticate
+/// @param data      A view of the content, or of its zlib compression
+/// @param size      The length of the content
+/// @param creds     The connection's checked credentials, or nullptr
+///
+/// @returns A vector indicating the message (possibly an error message) that
+///          is the result of the attempt
+vec Storage::set_packed_data(string_view user_name, string_view pass,
+                             bytes_t data, size_t size, cred_cache_t *creds) {
+  // NB: the password is checked before taking the lock, since a salted hash
+  //     is too slow to compute while holding it.  A user's hash never
+  //     changes, so the check can't go stale.
+  if (!auth(user_name, pass, creds))
+    return vec_from_string(RES_ERR_LOGIN);
+
+  // NB: build the stored form of the content in a pooled buffer before taking
+  //     the lock, and swap it in under the lock.  The old content goes back to
+  //     the pool (and the reference to the snapshot that held it is dropped)
+  //     after the lock is released.  A user with no content has no
+  //     user_content_t.
+  unique_ptr<user_content_t> next;
+  if (size > 0) {
+    next.reset(new user_content_t);
+    vec &c = next->content;
+    if (data.size != size) {
+      // Compressed data is always checked, so that every GET can inflate it
+      c = pool_take(size);
+      if (!zlib_inflate(data, size, c)) {
+        pool_give(c);
+        return vec_from_string(RES_ERR_MSG_FMT);
+      }
+      if (fields->zlevel > 0) {
+        c.assign(data.data, data.data + data.size);
+        next->zsize = size;
+      }
+    } else {
+      c = pool_take(size);
+      if (fields->zlevel > 0 && zlib_deflate(data, fields->zlevel, c))
+        next->zsize = size;
+      else
+        c.assign(data.data, data.data + data.size);
+    }
+  }
+  vec rec;
+  string hash;
+  if ((fields->wal || fields->feed) &&
+      fields->auth_table.get_hash(user_name, hash))
+    rec = next ? Internal::make_entry(user_name, hash, next->data(),
+                                      next->zsize)
+               : Internal::make_entry(user_name, hash, bytes_t());
+  bool found = false, logged = true;
+  uint64_t lsn = 0;
+  fields->auth_table.do_with(
+      user_name, [&](string_view, unique_ptr<user_content_t> &c) {
+        found = true;
+        c.swap(next);
+        // NB: record under the shard lock, so that the log has the same
+        //     order of changes to each user as the table.  A user who was
+        //     added after the hash was looked up has no record, since an
+        //     empty record would not replay.  A change that can't be logged
+        //     is undone before anyone can read it.
+        if (!rec.empty())
+          logged = fields->record(rec, lsn);
+        if (!logged)
+          c.swap(next);
+      });
+  // NB: invalidate after the table has changed, so that a GET that read the
+  //     old content can't cache it afterwards
+  if (found)
+    fields->responses.invalidate(user_name);
+  if (next)
+    pool_give(next->content);
+  next.reset();
+  if (!found)
+    return vec_from_string(RES_ERR_LOGIN);
+  if (!logged || (lsn != 0 && !fields->wal->commit(lsn)))
+    return vec_from_string(RES_ERR_SERVER);
+  return vec_from_string(RES_OK);
+}
+
+/// Copy a user's content out of the auth table, decompressing it if it is
+/// stored compressed
+///
+/// @param table The auth table
+/// @param who   The name of the user whose content is being fetched
+///
+/// @returns A pair with a bool to indicate error, and a vector from the pool
+///          with the content or an error message.  Note that "no data" is an
+///          error
+static pair<bool, vec> read_content(AuthTable &table, string_view who) {
+  vec res;
+  size_t zsize = 0;
+  bool found = table.do_with_readonly(
+      who, [&](string_view, string_view, const user_content_t *c) {
+        if (!c)
+          return;
+        bytes_t b = c->data();
+        res = pool_take(b.size);
+        res.assign(b.data, b.data + b.size);
+        zsize = c->zsize;
+      });
+  if (!found)
+    return {true, vec_from_string(RES_ERR_NO_USER)};
+  if (res.empty())
+    return {true, vec_from_string(RES_ERR_NO_DATA)};
+  if (zsize == 0)
+    return {false, move(res)};
+  // NB: inflate outside the lock, from the copy
+  vec raw = pool_take(zsize);
+  bool ok = zlib_inflate(bytes_t{res.data(), res.size()}, zsize, raw);
+  pool_give(res);
+  if (!ok) {
+    log_msg(LOG_ERROR, "Compressed content is damaged for " + string(who));
+    pool_give(raw);
+    return {true, vec_from_string(RES_ERR_NO_DATA)};
+  }
+  return {false, move(raw)};
 }
 
 /// Return a copy of the user data for a user, but do so only if the password
-/// matches
+/// matches.  The copy is in a buffer from the pool, which the caller may
+/// pool_give() back once it is done with it.
 ///
 /// @param user_name The name of the user who made the request
 /// @param pass      The password for the user, used to authenticate
 /// @param who       The name of the user whose content is being fetched
+/// @param creds     The connection's checked credentials, or nullptr
 ///
 /// @returns A pair with a bool to indicate error, and a vector indicating the
 ///          data (possibly an error message) that is the result of the
 ///          attempt.  Note that "no data" is an error
-pair<bool, vec> Storage::get_user_data(const string &user_name,
-                                       const string &pass, const string &who) {
-  cerr << "get_user_data is not implemented\n";
-  return {true, vec_from_string(RES_ERR_XMIT)};
+pair<bool, vec> Storage::get_user_data(string_view user_name,
+                                       string_view pass, string_view who,
+                                       cred_cache_t *creds) {
+  if (!auth(user_name, pass, creds))
+    return {true, vec_from_string(RES_ERR_LOGIN)};
+  return read_content(fields->auth_table, who);
+}
+
+/// Return the whole response to a GET of a user's content, "OK".len(@c).@c, but
+/// do so only if the password matches.  Hot responses are served from the
+/// response cache, and the content is only read from the auth table on a miss.
+/// The response is in a buffer from the pool, which the caller may pool_give()
+/// back once it is done with it.
+///
+/// @param user_name The name of the user who made the request
+/// @param pass      The password for the user, used to authenticate
+/// @param who       The name of the user whose content is being fetched
+/// @param creds     The connection's checked credentials, or nullptr
+///
+/// @returns A pair with a bool to indicate error, and a vector indicating the
+///          response (possibly an error message) that is the result of the
+///          attempt.  Note that "no data" is an error
+pair<bool, vec> Storage::get_user_response(string_view user_name,
+                                           string_view pass, string_view who,
+                                           cred_cache_t *creds) {
+  if (!auth(user_name, pass, creds))
+    return {true, vec_from_string(RES_ERR_LOGIN)};
+  ResponseCache &cache = fields->responses;
+  if (auto hit = cache.get(who)) {
+    vec res = pool_take(hit->size());
+    res.assign(hit->begin(), hit->end());
+    return {false, move(res)};
+  }
+  uint64_t stamp = cache.stamp(who);
+  auto [err, content] = read_content(fields->auth_table, who);
+  if (err)
+    return {true, content};
+  vec res = pool_take(RES_OK.length() + sizeof(int) + content.size());
+  vec_append(res, RES_OK);
+  vec_append(res, (int)content.size());
+  vec_append(res, content);
+  pool_give(content);
+  cache.put(who, stamp, res);
+  return {false, move(res)};
+}
+
+/// Return a user's content as a packed content field (see
+/// CONTENT_FLAG_PACKED), but do so only if the password matches.  Content that
+/// is stored compressed is not decompressed.
+///
+/// @param user_name The name of the user who made the request
+/// @param pass      The password for the user, used to authenticate
+/// @param who       The name of the user whose content is being fetched
+/// @param creds     The connection's checked credentials, or nullptr
+///
+/// @returns A pair with a bool to indicate error, and a vector indicating the
+///          packed field (possibly an error message) that is the result of the
+///          attempt.  Note that "no data" is an error
+pair<bool, vec> Storage::get_packed_data(string_view user_name,
+                                         string_view pass, string_view who,
+                                         cred_cache_t *creds) {
+  if (!auth(user_name, pass, creds))
+    return {true, vec_from_string(RES_ERR_LOGIN)};
+  vec res;
+  bool raw = false;
+  bool found = fields->auth_table.do_with_readonly(
+      who, [&](string_view, string_view, const user_content_t *c) {
+        if (!c)
+          return;
+        bytes_t b = c->data();
+        res = pool_take(sizeof(int) + b.size);
+        vec_append(res, c->zsize > 0 ? (int)c->zsize : (int)b.size);
+        res.insert(res.end(), b.data, b.data + b.size);
+        raw = c->zsize == 0;
+      });
+  if (!found)
+    return {true, vec_from_string(RES_ERR_NO_USER)};
+  if (res.empty())
+    return {true, vec_from_string(RES_ERR_NO_DATA)};
+  // NB: if Storage compresses content, raw content didn't shrink enough to be
+  //     worth trying again.  Otherwise, compress it for the wire, quickly.
+  if (!raw || fields->zlevel > 0)
+    return {false, move(res)};
+  bytes_t b{res.data() + sizeof(int), res.size() - sizeof(int)};
+  vec packed = pool_take(b.size);
+  if (!zlib_deflate(b, COMPRESS_FAST, packed)) {
+    pool_give(packed);
+    return {false, move(res)};
+  }
+  res.resize(sizeof(int));
+  vec_append(res, packed);
+  pool_give(packed);
+  return {false, move(res)};
 }
 
 /// Return a newline-delimited string containing all of the usernames in the
@@ -127,23 +972,257 @@ pair<bool, vec> Storage::get_user_data(const string &user_name,
 ///
 /// @param user_name The name of the user who made the request
 /// @param pass      The password for the user, used to authenticate
+/// @param creds     The connection's checked credentials, or nullptr
+///
+/// @returns A vector with the data, or a vector with an error message
+pair<bool, vec> Storage::get_all_users(string_view user_name,
+                                       string_view pass,
+                                       cred_cache_t *creds) {
+  if (!auth(user_name, pass, creds))
+    return {true, vec_from_string(RES_ERR_LOGIN)};
+  vec res;
+  fields->auth_table.do_all_readonly(
+      [&](string_view name, string_view, const user_content_t *) {
+        if (!res.empty())
+          res.push_back('\n');
+        res.insert(res.end(), name.begin(), name.end());
+      });
+  return {false, res};
+}
+
+/// Return a newline-delimited string containing the next page of usernames in
+/// the auth table.  Only one shard is locked at a time, for at most one page,
+/// so a listing of a large table never stalls writers for long.
+///
+/// @param user_name The name of the user who made the request
+/// @param pass      The password for the user, used to authenticate
+/// @param cursor    The position at which to start ("" for the first page),
+///                  which receives the position of the next page ("" once
+///                  every name has been listed)
+/// @param max       The number of names to list
+/// @param creds     The connection's checked credentials, or nullptr
 ///
 /// @returns A vector with the data, or a vector with an error message
-pair<bool, vec> Storage::get_all_users(const string &user_name,
-                                       const string &pass) {
-  cerr << "get_all_users is not implemented\n";
-  return {true, vec_from_string(RES_ERR_XMIT)};
+pair<bool, vec> Storage::get_users_page(string_view user_name,
+                                        string_view pass, string &cursor,
+                                        size_t max, cred_cache_t *creds) {
+  if (!auth(user_name, pass, creds))
+    return {true, vec_from_string(RES_ERR_LOGIN)};
+  // The cursor is a shard index and the lowest name hash left in that shard
+  AuthTable &table = fields->auth_table;
+  uint32_t shard = 0;
+  uint64_t from = 0;
+  if (!cursor.empty()) {
+    if (cursor.length() != (size_t)LEN_ALL_CURSOR)
+      return {true, vec_from_string(RES_ERR_MSG_FMT)};
+    memcpy(&shard, cursor.data(), sizeof(shard));
+    memcpy(&from, cursor.data() + sizeof(shard), sizeof(from));
+    if (shard >= table.num_shards())
+      return {true, vec_from_string(RES_ERR_MSG_FMT)};
+  }
+  vec res;
+  size_t count = 0;
+  while (shard < table.num_shards() && count < max) {
+    from = table.do_page_readonly(
+        shard, from, max - count,
+        [&](string_view name, string_view, const user_content_t *) {
+          if (!res.empty())
+            res.push_back('\n');
+          res.insert(res.end(), name.begin(), name.end());
+          ++count;
+        });
+    if (from == 0)
+      ++shard;
+  }
+  cursor.clear();
+  if (shard < table.num_shards()) {
+    cursor.resize(LEN_ALL_CURSOR);
+    memcpy(cursor.data(), &shard, sizeof(shard));
+    memcpy(cursor.data() + sizeof(shard), &from, sizeof(from));
+  }
+  return {false, res};
+}
+
+/// Report the number of shards in the auth table, each of which map_shard() can
+/// visit on its own
+///
+/// @returns The number of shards
+size_t Storage::num_shards() { return fields->auth_table.num_shards(); }
+
+/// Apply a function to every user in one shard of the auth table, while the
+/// shard is read-locked.  The function sees compressed content decompressed.
+///
+/// @param shard The index of the shard to visit
+/// @param f     The function, which receives each user's name and content
+///              (empty if the user has none)
+void Storage::map_shard(size_t shard, function<void(string_view, bytes_t)> f) {
+  vec raw;
+  fields->auth_table.do_shard_readonly(
+      shard, [&](string_view name, string_view, const user_content_t *c) {
+        bytes_t data = c ? c->data() : bytes_t{};
+        if (c && c->zsize > 0) {
+          if (!zlib_inflate(data, c->zsize, raw)) {
+            log_msg(LOG_ERROR,
+                    "Compressed content is damaged for " + string(name));
+            raw.clear();
+          }
+          data = {raw.data(), raw.size()};
+        }
+        f(name, data);
+      });
+}
+
+/// Apply a function to the complete entry of every user in one shard of the
+/// auth table, in the format of a log record, while the shard is read-locked
+///
+/// @param shard The index of the shard to visit
+/// @param f     The function, which receives each entry
+void Storage::dump_shard(size_t shard, function<void(const vec &)> f) {
+  fields->auth_table.do_shard_readonly(
+      shard, [&](string_view name, string_view hash, const user_content_t *c) {
+        f(c ? Internal::make_entry(name, string(hash), c->data(), c->zsize)
+            : Internal::make_entry(name, string(hash), bytes_t()));
+      });
 }
 
-/// Authenticate a user
+/// Hand every later change to a function, as the log record that describes
+/// it.  The function runs while the changed user's shard is locked, so it
+/// sees each user's changes in order, and must not block.  This must be
+/// called before any requests are served.
+///
+/// @param f The function, which receives each record
+void Storage::replicate_to(function<void(const vec &)> f) { fields->feed = f; }
+
+/// Apply records from another server's log (or from dump_shard()), each of
+/// which replaces the entry for its user.  In log mode, the records are
+/// appended to this server's own log, and are durable before this returns.
+///
+/// @param recs The records
+///
+/// @returns false if a record isn't a valid entry, in which case the records
+///          before it have been applied, or if the records couldn't be made
+///          durable in this server's log
+bool Storage::apply_records(const vector<vec> &recs) {
+  uint64_t lsn = 0;
+  bool ok = true, logged = true;
+  for (auto &rec : recs) {
+    size_t pos = 0;
+    string who;
+    ok = fields->parse_entry(rec, pos, "replication stream",
+                             [&](string_view user) {
+                               who = user;
+                               uint64_t at;
+                               logged = fields->record(rec, at) && logged;
+                               lsn = max(lsn, at);
+                             }) &&
+         pos == rec.size();
+    if (!who.empty())
+      fields->responses.invalidate(who);
+    if (!ok)
+      break;
+  }
+  if (lsn != 0 && !fields->wal->commit(lsn))
+    logged = false;
+  if (!logged)
+    log_msg(LOG_ERROR, "Could not log the records from the primary");
+  return ok && logged;
+}
+
+/// Move this server's share of a sharded deployment into it, after the ring
+/// of shards has changed.  Each old shard's data file (and its logs) is loaded
+/// as usual.  Only the users that this shard owns are moved in, with their
+/// content.  Any shard may have to authenticate any user, so the credentials
+/// of other users are added too, but only if this shard doesn't have them
+/// yet.  Then the content of the users that it no longer owns is dropped.  The
+/// moves go straight into the auth table, so none of them are logged or sent
+/// to followers: the result is made durable by writing a new main file.
+///
+/// @param files The data files of the old shards (copies, if those shards
+///              are also being resharded)
+/// @param owns  A function that tells if this shard owns a user
+///
+/// @returns false if a file can't be loaded, or the result can't be saved
+bool Storage::reshard(const vector<string> &files,
+                      function<bool(string_view)> owns) {
+  AuthTable &table = fields->auth_table;
+  size_t taken = 0, dropped = 0;
+  string known;
+  for (auto &file : files) {
+    Storage old(file, table.num_shards());
+    if (!old.load())
+      return false;
+    AuthTable &from = old.fields->auth_table;
+    for (size_t i = 0; i < from.num_shards(); ++i)
+      from.do_shard_readonly(
+          i, [&](string_view user, string_view hash, const user_content_t *c) {
+            if (owns(user) && c) {
+              // NB: the old table's content may be in its mapping, which goes
+              //     away with it, so it is copied
+              unique_ptr<user_content_t> copy(new user_content_t);
+              bytes_t b = c->data();
+              copy->content.assign(b.data, b.data + b.size);
+              copy->zsize = c->zsize;
+              table.upsert(user, hash, move(copy));
+              ++taken;
+              return;
+            }
+            // NB: a GET goes to the shard that owns the content, which must
+            //     authenticate the requester.  REG goes to every shard, so
+            //     this shard usually knows the user already.
+            if (!table.get_hash(user, known))
+              table.insert(user, hash);
+          });
+  }
+  for (size_t i = 0; i < table.num_shards(); ++i) {
+    vector<string> gone;
+    table.do_shard_readonly(
+        i, [&](string_view user, string_view, const user_content_t *c) {
+          if (c && !owns(user))
+            gone.emplace_back(user);
+        });
+    for (auto &user : gone)
+      table.do_with(user, [](string_view, unique_ptr<user_content_t> &c) {
+        c.reset();
+      });
+    dropped += gone.size();
+  }
+  // NB: a shard whose ring hasn't changed has nothing to save
+  if (files.empty() && dropped == 0)
+    return true;
+  log_msg(LOG_INFO, "Resharded: took the content of " + to_string(taken) +
+                        " users, and dropped the content of " +
+                        to_string(dropped));
+  if (fields->wal)
+    return fields->compact();
+  lock_guard<mutex> g(fields->persist_lock);
+  size_t bytes;
+  if (!fields->write_snapshot(bytes))
+    return false;
+  string log = fields->filename + ".log";
+  if (file_exists(log) && unlink(log.c_str()) != 0)
+    sys_error(errno, "Error removing log:");
+  return true;
+}
+
+/// Authenticate a user.  The hash is checked without holding any lock.  If
+/// the connection has already checked these credentials, they are not hashed
+/// again.
 ///
 /// @param user_name The name of the user who made the request
 /// @param pass      The password for the user, used to authenticate
+/// @param creds     The connection's checked credentials, or nullptr
 ///
 /// @returns True if the user and password are valid, false otherwise
-bool Storage::auth(const string &user_name, const string &pass) {
-  cerr << "auth is not implemented\n";
-  return false;
+bool Storage::auth(string_view user_name, string_view pass,
+                   cred_cache_t *creds) {
+  if (creds && creds->check(user_name, pass))
+    return true;
+  string hash;
+  if (!fields->auth_table.get_hash(user_name, hash) || !pass_check(hash, pass))
+    return false;
+  if (creds)
+    creds->add(user_name, pass);
+  return true;
 }
 
 /// Write the entire Storage object (right now just the Auth table) to the
@@ -151,11 +1230,62 @@ bool Storage::auth(const string &user_name, const string &pass) {
 /// persisted in two steps.  First, it must be written to a temporary file
 /// (this.filename.tmp).  Then the temporary file can be renamed to replace
 /// the older version of the Storage object.
-void Storage::persist() { cerr << "persist is not implemented\n"; }
+///
+/// In log mode, every change is already in the log, so this only forces the
+/// log to disk.
+void Storage::persist() {
+  if (fields->wal) {
+    fields->wal->sync();
+    return;
+  }
+  lock_guard<mutex> g(fields->persist_lock);
+  size_t bytes;
+  if (!fields->write_snapshot(bytes))
+    return;
+  string log = fields->filename + ".log";
+  if (file_exists(log) && unlink(log.c_str()) != 0)
+    sys_error(errno, "Error removing log:");
+}
 
-/// Shut down the storage when the server stops.
+/// In log mode, fold the log into a new main file, without blocking requests
+/// for more than the moment it takes to swap log files
+///
+/// @returns false if Storage isn't in log mode, or on error
+bool Storage::compact() { return fields->wal && fields->compact(); }
+
+/// Report on the compactions that have run so far
+///
+/// @returns The compaction counters
+compaction_stats_t Storage::compaction_stats() {
+  compaction_stats_t res;
+  res.runs = fields->runs;
+  res.last_ms = fields->last_ms;
+  res.total_ms = fields->total_ms;
+  res.bytes_reclaimed = fields->reclaimed;
+  return res;
+}
+
+/// Report on the cache of GET responses
+///
+/// @returns The cache's counters
+resp_cache_stats_t Storage::response_cache_stats() {
+  return fields->responses.stats();
+}
+
+/// Shut down the storage when the server stops.  In log mode, this stops the
+/// compaction thread, and syncs and closes the log.
 ///
 /// NB: this is only called when all threads have stopped accessing the
-///     Storage object.  As a result, there's nothing left to do, so it's a
-///     no-op.
-void Storage::shutdown() {}
+///     Storage object.
+void Storage::shutdown() {
+  if (!fields->wal)
+    return;
+  {
+    lock_guard<mutex> g(fields->compact_lock);
+    fields->stopping = true;
+    fields->compact_cv.notify_all();
+  }
+  if (fields->compactor.joinable())
+    fields->compactor.join();
+  fields->wal->close();
+}
@@ -1,24 +1,78 @@
 #pragma once
 
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <utility>
+#include <vector>
 
 #include "../common/vec.h"
 
+#include "server_respcache.h"
+
+class cred_cache_t;
+
+/// log_opts_t configures Storage's write-ahead log, and the background thread
+/// that compacts it
+struct log_opts_t {
+  /// Use a write-ahead log?
+  bool enabled = false;
+
+  /// The log's fsync policy (see WriteAheadLog)
+  int sync_ms = 0;
+
+  /// Compact once the log holds at least this many bytes (0 for never)
+  size_t compact_bytes = 0;
+
+  /// Compact a non-empty log once this many seconds have passed since the
+  /// last compaction (0 for never)
+  int compact_secs = 0;
+};
+
+/// compaction_stats_t reports on the compactions that Storage has run
+struct compaction_stats_t {
+  /// The number of compactions that have finished
+  uint64_t runs = 0;
+
+  /// The duration of the most recent compaction, and of all compactions
+  uint64_t last_ms = 0, total_ms = 0;
+
+  /// The total number of bytes of log and old main file that compaction has
+  /// freed, net of the size of the new main files
+  uint64_t bytes_reclaimed = 0;
+};
+
 /// Storage is the main data type managed by the server.  For the time being, it
-/// wraps a std::unordered_map that serves as an authentication table.  The
-/// authentication table holds user names and hashed passwords, as well as a
-/// single content object per user.
+/// wraps an AuthTable that serves as an authentication table.  The
+/// authentication table holds user names and hashed passwords (see
+/// server_passhash.h), as well as a single content object per user.
 ///
 /// The public interface of Storage provides functions that correspond 1:1 with
 /// the data requests that a client can make.  In that manner, the server
 /// command handlers need only parse a request, send its parts to the Storage
 /// object, and then format and return the result.
 ///
-/// Storage is a persistent object.  For the time being, persistence is
-/// achieved by writing the entire object to disk in response to SAV
-/// messages. We use a relatively simple binary wire format:
+/// Storage is a persistent object.  By default, persistence is achieved by
+/// writing the entire object to disk in response to SAV messages.  The file is
+/// an indexed snapshot (see server_snapshot.h), which load() maps into memory
+/// instead of reading, so that startup time does not depend on the amount of
+/// content.  Each user's content stays in the mapping until it is first
+/// changed.
+///
+/// With more than one segment, the main file is a segmented snapshot instead
+/// (see server_snapshot.h).  Each segment holds every segs'th bucket of the
+/// auth table, so the users are split by the hash of their names.  Each
+/// segment is written by its own thread, and mapped back by its own thread
+/// straight into the auth table, once its size and checksum are checked.
+/// (Checking the checksum reads all of the content, so it can be turned off
+/// when startup time matters more than catching a corrupt segment.)
+/// load() accepts either kind of main file, whatever the number of segments,
+/// and the next persist converts it.
+///
+/// load() also accepts files in the legacy format, which are converted on the
+/// next persist.  The legacy format is also the format of log records:
 ///
 ///  - Each autnetication table entry begins with the magic 8-byte constant
 ///    AUTHAUTH
@@ -29,7 +83,43 @@
 ///  - Then a binary write of num_bytes
 ///  - Finally, if num_bytes > 0, a binary write of the bytes field
 ///
-/// This is repeated for each entry in the Auth table.
+/// This is repeated for each entry in the Auth table.  An entry whose content
+/// is compressed begins with AUTHPACK instead, and has a 4-byte binary write of
+/// the length of the content just before num_bytes, so that the bytes field is
+/// the zlib compression of the content.
+///
+/// Storage can keep each user's content compressed with zlib, in memory, in
+/// the main file, and in the log, if it shrinks enough to be worth it.  Only
+/// GET and SET ever see it decompressed, and a client that asks for packed
+/// content (see CONTENT_FLAG_PACKED) gets the compressed bytes as they are.
+/// The whole responses to recent GETs are kept in a ResponseCache, so a hot
+/// profile is neither copied out of the table nor decompressed again until
+/// set_user_data() changes it.
+///
+/// Storage can also use a write-ahead log (filename.log), so that changes are
+/// durable without rewriting the whole file.  Every successful add_user() and
+/// set_user_data() appends one record to the log, holding the user's complete
+/// entry in the format above.  load() replays the log after reading the main
+/// file, so a later record for a user replaces an earlier one.  In log mode, a
+/// SAV only forces the log to disk.
+///
+/// To keep the log from growing forever, a background thread compacts it.  It
+/// renames filename.log to filename.log.old (new records go to a fresh
+/// filename.log), writes a new main file through filename.tmp, one bucket at a
+/// time, and then removes filename.log.old.  A crash at any point leaves files
+/// that load() can replay: main file, then filename.log.old, then
+/// filename.log.
+///
+/// The records that go to the log can also go to followers (see
+/// server_replication.h), which apply them with apply_records().  Records are
+/// built whenever there is a log or a follower feed, and are handed to both
+/// while the user's shard is locked, so every copy sees the same order of
+/// changes to each user.
+///
+/// In a sharded deployment (see common/ring.h), every shard registers every
+/// user, but only holds the content of the users that the ring gives it.
+/// reshard() rebuilds a shard from the old shards' files when the ring
+/// changes.
 class Storage {
   /// Internal is the class that stores all the members of a Storage object.  To
   /// avoid pulling too much into the .h file, we are using the PIMPL pattern
@@ -43,15 +133,31 @@ public:
   /// Construct an empty object and specify the file from which it should be
   /// loaded.  To avoid exceptions and errors in the constructor, the act of
   /// loading data is separate from construction.
-  Storage(const std::string &fname);
+  ///
+  /// @param fname   The name of the file that should be used to load/store the
+  ///                data
+  /// @param buckets The number of buckets in the auth table
+  /// @param log     The configuration of the write-ahead log
+  /// @param zlevel  The zlib level at which to compress content (0 to store it
+  ///                as it is)
+  /// @param cache   The most bytes of GET responses to cache (0 for none)
+  /// @param segs    The number of segments in which to write the main file (1
+  ///                for a single indexed snapshot)
+  /// @param verify  True to check the checksum of each segment at load(), as
+  ///                well as its size.  This reads all of the content.
+  Storage(const std::string &fname, size_t buckets,
+          const log_opts_t &log = log_opts_t(), int zlevel = 0,
+          size_t cache = 0, size_t segs = 1, bool verify = true);
 
   /// Destructor for the storage object.
   ~Storage();
 
-  /// Populate the Storage object by loading an auth_table from this.filename.
-  /// Note that load() begins by clearing the auth_table, so that when the call
-  /// is complete, exactly and only the contents of the file are in the
-  /// auth_table.
+  /// Populate the Storage object by loading an auth_table from this.filename,
+  /// and then replaying this.filename.log.old and this.filename.log.  Note
+  /// that load() begins by clearing the auth_table, so that when the call is
+  /// complete, exactly and only the contents of the files are in the
+  /// auth_table.  In log mode, this also opens the log for appending, and
+  /// starts the compaction thread.
   ///
   /// @returns false if any error is encountered in the file, and true
   ///          otherwise.  Note that a non-existent file is not an error.
@@ -64,8 +170,21 @@ public:
   /// @param user_name The user name to register
   /// @param pass      The password to associate with that user name
   ///
-  /// @returns False if the username already exists, true otherwise
-  bool add_user(const std::string &user_name, const std::string &pass);
+  /// @returns A vector with the result message: RES_OK, RES_ERR_USER_EXISTS if
+  ///          the username already exists, or RES_ERR_SERVER if the new entry
+  ///          couldn't be made durable
+  vec add_user(std::string_view user_name, std::string_view pass);
+
+  /// Create many new entries in the Auth table, as if by add_user().  The
+  /// passwords are hashed in parallel, before any entry is added, and the
+  /// entries are then added in order.
+  ///
+  /// @param users The user names to register, and their passwords
+  ///
+  /// @returns For each user, the result message of add_user().  A username
+  ///          that appeared earlier in the batch already exists.
+  std::vector<vec> add_users(
+      const std::vector<std::pair<std::string_view, std::string_view>> &users);
 
   /// Set the data bytes for a user, but do so if and only if the password
   /// matches
@@ -73,56 +192,231 @@ public:
   /// @param user_name The name of the user whose content is being set
   /// @param pass      The password for the user, used to authenticate
   /// @param content   The data to set for this user
+  /// @param creds     The connection's checked credentials, or nullptr
   ///
   /// @returns A pair with a bool to indicate error, and a vector indicating the
   ///          message (possibly an error message) that is the result of the
   ///          attempt
-  vec set_user_data(const std::string &user_name, const std::string &pass,
-                    const vec &content);
+  vec set_user_data(std::string_view user_name, std::string_view pass,
+                    const vec &content, cred_cache_t *creds = nullptr);
+
+  /// Set the data bytes for a user, but do so if and only if the password
+  /// matches.  The content is a view into the request, and it is copied
+  /// exactly once, into the user's entry.
+  ///
+  /// @param user_name The name of the user whose content is being set
+  /// @param pass      The password for the user, used to authenticate
+  /// @param content   A view of the data to set for this user
+  /// @param creds     The connection's checked credentials, or nullptr
+  ///
+  /// @returns A vector indicating the message (possibly an error message)
+  ///          that is the result of the attempt
+  vec set_user_data(std::string_view user_name, std::string_view pass,
+                    bytes_t content, cred_cache_t *creds = nullptr);
+
+  /// Set the data bytes for a user from a packed content field (see
+  /// CONTENT_FLAG_PACKED), but do so if and only if the password matches.  If
+  /// the data is compressed, and Storage compresses content too, then it is
+  /// stored as it is, once it has been checked.
+  ///
+  /// @param user_name The name of the user whose content is being set
+  /// @param pass      The password for the user, used to authenticate
+  /// @param data      A view of the content, or of its zlib compression
+  /// @param size      The length of the content
+  /// @param creds     The connection's checked credentials, or nullptr
+  ///
+  /// @returns A vector indicating the message (possibly an error message)
+  ///          that is the result of the attempt
+  vec set_packed_data(std::string_view user_name, std::string_view pass,
+                      bytes_t data, size_t size,
+                      cred_cache_t *creds = nullptr);
 
   /// Return a copy of the user data for a user, but do so only if the password
-  /// matches
+  /// matches.  The copy is in a buffer from the pool, which the caller may
+  /// pool_give() back once it is done with it.
   ///
   /// @param user_name The name of the user who made the request
   /// @param pass      The password for the user, used to authenticate
   /// @param who       The name of the user whose content is being fetched
+  /// @param creds     The connection's checked credentials, or nullptr
   ///
   /// @returns A pair with a bool to indicate error, and a vector indicating the
   ///          data (possibly an error message) that is the result of the
   ///          attempt.  Note that "no data" is an error
-  std::pair<bool, vec> get_user_data(const std::string &user_name,
-                                     const std::string &pass,
-                                     const std::string &who);
+  std::pair<bool, vec> get_user_data(std::string_view user_name,
+                                     std::string_view pass,
+                                     std::string_view who,
+                                     cred_cache_t *creds = nullptr);
+
+  /// Return the whole response to a GET of a user's content, "OK".len(@c).@c,
+  /// but do so only if the password matches.  Hot responses are served from
+  /// the response cache, and the content is only read from the auth table on
+  /// a miss.  The response is in a buffer from the pool, which the caller may
+  /// pool_give() back once it is done with it.
+  ///
+  /// @param user_name The name of the user who made the request
+  /// @param pass      The password for the user, used to authenticate
+  /// @param who       The name of the user whose content is being fetched
+  /// @param creds     The connection's checked credentials, or nullptr
+  ///
+  /// @returns A pair with a bool to indicate error, and a vector indicating the
+  ///          response (possibly an error message) that is the result of the
+  ///          attempt.  Note that "no data" is an error
+  std::pair<bool, vec> get_user_response(std::string_view user_name,
+                                         std::string_view pass,
+                                         std::string_view who,
+                                         cred_cache_t *creds = nullptr);
+
+  /// Return a user's content as a packed content field (see
+  /// CONTENT_FLAG_PACKED), but do so only if the password matches.  Content
+  /// that is stored compressed is not decompressed.
+  ///
+  /// @param user_name The name of the user who made the request
+  /// @param pass      The password for the user, used to authenticate
+  /// @param who       The name of the user whose content is being fetched
+  /// @param creds     The connection's checked credentials, or nullptr
+  ///
+  /// @returns A pair with a bool to indicate error, and a vector indicating the
+  ///          packed field (possibly an error message) that is the result of
+  ///          the attempt.  Note that "no data" is an error
+  std::pair<bool, vec> get_packed_data(std::string_view user_name,
+                                       std::string_view pass,
+                                       std::string_view who,
+                                       cred_cache_t *creds = nullptr);
 
   /// Return a newline-delimited string containing all of the usernames in the
   /// auth table
   ///
   /// @param user_name The name of the user who made the request
   /// @param pass      The password for the user, used to authenticate
+  /// @param creds     The connection's checked credentials, or nullptr
   ///
   /// @returns A vector with the data, or a vector with an error message
-  std::pair<bool, vec> get_all_users(const std::string &user_name,
-                                     const std::string &pass);
+  std::pair<bool, vec> get_all_users(std::string_view user_name,
+                                     std::string_view pass,
+                                     cred_cache_t *creds = nullptr);
+
+  /// Return a newline-delimited string containing the next page of usernames
+  /// in the auth table.  Only one shard is locked at a time, for at most one
+  /// page, so a listing of a large table never stalls writers for long.
+  ///
+  /// @param user_name The name of the user who made the request
+  /// @param pass      The password for the user, used to authenticate
+  /// @param cursor    The position at which to start ("" for the first page),
+  ///                  which receives the position of the next page ("" once
+  ///                  every name has been listed)
+  /// @param max       The number of names to list
+  /// @param creds     The connection's checked credentials, or nullptr
+  ///
+  /// @returns A vector with the data, or a vector with an error message
+  std::pair<bool, vec> get_users_page(std::string_view user_name,
+                                      std::string_view pass,
+                                      std::string &cursor, size_t max,
+                                      cred_cache_t *creds = nullptr);
+
+  /// Report the number of shards in the auth table, each of which map_shard()
+  /// can visit on its own
+  ///
+  /// @returns The number of shards
+  size_t num_shards();
 
-  /// Authenticate a user
+  /// Apply a function to every user in one shard of the auth table, while the
+  /// shard is read-locked.  The function sees compressed content decompressed.
+  ///
+  /// @param shard The index of the shard to visit
+  /// @param f     The function, which receives each user's name and content
+  ///              (empty if the user has none)
+  void map_shard(size_t shard,
+                 std::function<void(std::string_view, bytes_t)> f);
+
+  /// Apply a function to the complete entry of every user in one shard of the
+  /// auth table, in the format of a log record, while the shard is
+  /// read-locked
+  ///
+  /// @param shard The index of the shard to visit
+  /// @param f     The function, which receives each entry
+  void dump_shard(size_t shard, std::function<void(const vec &)> f);
+
+  /// Hand every later change to a function, as the log record that describes
+  /// it.  The function runs while the changed user's shard is locked, so it
+  /// sees each user's changes in order, and must not block.  This must be
+  /// called before any requests are served.
+  ///
+  /// @param f The function, which receives each record
+  void replicate_to(std::function<void(const vec &)> f);
+
+  /// Apply records from another server's log (or from dump_shard()), each of
+  /// which replaces the entry for its user.  In log mode, the records are
+  /// appended to this server's own log, and are durable before this returns.
+  ///
+  /// @param recs The records
+  ///
+  /// @returns false if a record isn't a valid entry, in which case the records
+  ///          before it have been applied, or if the records couldn't be made
+  ///          durable in this server's log
+  bool apply_records(const std::vector<vec> &recs);
+
+  /// Move this server's share of a sharded deployment into it, after the ring
+  /// of shards has changed.  Each old shard's data file (and its logs) is
+  /// loaded as usual.  Only the users that this shard owns are moved in, with
+  /// their content.  Any shard may have to authenticate any user, so the
+  /// credentials of other users are added too, but only if this shard doesn't
+  /// have them yet.  Then the content of the users that it no longer owns is
+  /// dropped.  The moves go straight into the auth table, so none of them are
+  /// logged or sent to followers: the result is made durable by writing a new
+  /// main file.
+  ///
+  /// @param files The data files of the old shards (copies, if those shards
+  ///              are also being resharded)
+  /// @param owns  A function that tells if this shard owns a user
+  ///
+  /// @returns false if a file can't be loaded, or the result can't be saved
+  bool reshard(const std::vector<std::string> &files,
+               std::function<bool(std::string_view)> owns);
+
+  /// Authenticate a user.  The hash is checked without holding any lock.  If
+  /// the connection has already checked these credentials, they are not
+  /// hashed again.
   ///
   /// @param user_name The name of the user who made the request
   /// @param pass      The password for the user, used to authenticate
+  /// @param creds     The connection's checked credentials, or nullptr
   ///
   /// @returns True if the user and password are valid, false otherwise
-  bool auth(const std::string &user_name, const std::string &pass);
+  bool auth(std::string_view user_name, std::string_view pass,
+            cred_cache_t *creds = nullptr);
 
   /// Write the entire Storage object (right now just the Auth table) to the
   /// file specified by this.filename.  To ensure durability, Storage must be
   /// persisted in two steps.  First, it must be written to a temporary file
   /// (this.filename.tmp).  Then the temporary file can be renamed to replace
-  /// the older version of the Storage object.
+  /// the older version of the Storage object.  Once that is done, any log
+  /// left over from an earlier run in log mode is redundant, so it is removed.
+  ///
+  /// In log mode, every change is already in the log, so this only forces the
+  /// log to disk.
   void persist();
 
-  /// Shut down the storage when the server stops.
+  /// In log mode, fold the log into a new main file, without blocking
+  /// requests for more than the moment it takes to swap log files
+  ///
+  /// @returns false if Storage isn't in log mode, or on error
+  bool compact();
+
+  /// Report on the compactions that have run so far
+  ///
+  /// @returns The compaction counters
+  compaction_stats_t compaction_stats();
+
+  /// Report on the cache of GET responses
+  ///
+  /// @returns The cache's counters
+  resp_cache_stats_t response_cache_stats();
+
+  /// Shut down the storage when the server stops.  In log mode, this stops
+  /// the compaction thread, and syncs and closes the log.
   ///
   /// NB: this is only called when all threads have stopped accessing the
-  ///     Storage object.  As a result, there's nothing left to do, so it's a
-  ///     no-op.
+  ///     Storage object.
   void shutdown();
 };
@@ -0,0 +1,183 @@
+#include <cstring>
+#include <ctime>
+#include <list>
+#include <mutex>
+#include <openssl/rand.h>
+#include <string>
+#include <unordered_map>
+
+#include "../common/contextmanager.h"
+#include "../common/crypto.h"
+#include "../common/log.h"
+#include "../common/protocol.h"
+#include "../common/vec.h"
+
+#include "server_tickets.h"
+
+using namespace std;
+
+/// The number of random bytes that identify a ticket's cache entry
+const int LEN_TICKET_ID = 16;
+
+/// The unencrypted content of a ticket: @id.@expires, where @expires is an
+/// 8-byte time_t.  After AES encryption, this pads out to exactly two blocks,
+/// so that @iv.enc(@id.@expires) is LEN_TICKET bytes.
+const int LEN_TICKET_PLAIN = LEN_TICKET_ID + sizeof(int64_t);
+
+/// entry_t is the server-side state of one ticket
+struct entry_t {
+  /// The AES key (and iv) that the ticket stands for
+  vec aeskey;
+
+  /// The time at which the ticket stops being valid
+  time_t expires;
+};
+
+/// The cache holds each ticket's id and entry in a list, with the most
+/// recently used at the front.  An index from id to list position makes every
+/// operation O(1).
+typedef list<pair<string, entry_t>> lru_t;
+
+/// Internal is the class that stores all the members of a TicketCache object.
+/// To avoid pulling too much into the .h file, we are using the PIMPL pattern
+/// (https://www.geeksforgeeks.org/pimpl-idiom-in-c-with-examples/)
+struct TicketCache::Internal {
+  /// The most tickets that may be valid at once
+  const size_t capacity;
+
+  /// The number of seconds for which a ticket is valid
+  const int ttl;
+
+  /// The server's secret key for encrypting tickets.  It is never saved, so
+  /// restarting the server invalidates every ticket.
+  vec key;
+
+  /// The entries, in LRU order
+  lru_t lru;
+
+  /// The position of each entry in lru
+  unordered_map<string, lru_t::iterator> index;
+
+  /// A lock to protect lru and index.  Every critical section is a handful of
+  /// pointer updates, so one lock is enough.
+  mutex lock;
+
+  /// Construct the Internal object
+  ///
+  /// @param _capacity The most tickets that may be valid at once
+  /// @param _ttl      The number of seconds for which a ticket is valid
+  Internal(size_t _capacity, int _ttl)
+      : capacity(_capacity), ttl(_ttl), key(create_aes_key()) {}
+
+  /// Make a key/iv vector for encrypting or decrypting a ticket
+  ///
+  /// @param iv A pointer to the AES_IVSIZE bytes of the ticket's iv
+  ///
+  /// @returns A key/iv vector suitable for create_aes_context()
+  vec ticket_key(const unsigned char *iv) {
+    vec res(AES_KEYSIZE + AES_IVSIZE);
+    memcpy(res.data(), key.data(), AES_KEYSIZE);
+    memcpy(res.data() + AES_KEYSIZE, iv, AES_IVSIZE);
+    return res;
+  }
+};
+
+/// Construct a ticket cache, with a fresh random key for encrypting tickets
+///
+/// @param capacity The most tickets that may be valid at once
+/// @param ttl      The number of seconds for which a ticket is valid.  A value
+///                 of 0 means that tickets are never issued.
+TicketCache::TicketCache(size_t capacity, int ttl)
+    : fields(new Internal(capacity, ttl)) {}
+
+/// Destructor for the ticket cache
+TicketCache::~TicketCache() {}
+
+/// Check if tickets are enabled
+///
+/// @returns true if issue() will produce tickets
+bool TicketCache::enabled() {
+  return fields->ttl > 0 && fields->capacity > 0 && !fields->key.empty();
+}
+
+/// Create a ticket that is bound to an AES key
+///
+/// @param aeskey The AES key (and iv) that the client used
+///
+/// @returns The LEN_TICKET bytes of the ticket, or an empty vector if tickets
+///          are disabled or there was an error
+vec TicketCache::issue(const vec &aeskey) {
+  if (!enabled())
+    return {};
+  unsigned char iv[AES_IVSIZE];
+  vec plain(LEN_TICKET_PLAIN);
+  if (!RAND_bytes(iv, AES_IVSIZE) || !RAND_bytes(plain.data(), LEN_TICKET_ID)) {
+    log_msg(LOG_ERROR, "Error in RAND_bytes()");
+    return {};
+  }
+  int64_t expires = time(nullptr) + fields->ttl;
+  memcpy(plain.data() + LEN_TICKET_ID, &expires, sizeof(expires));
+
+  EVP_CIPHER_CTX *ctx = create_aes_context(fields->ticket_key(iv), true);
+  if (ctx == nullptr)
+    return {};
+  ContextManager cm([&]() { reclaim_aes_context(ctx); });
+  vec enc = aes_crypt_msg(ctx, plain);
+  if (enc.size() + AES_IVSIZE != LEN_TICKET)
+    return {};
+
+  // Add the entry, and evict from the back until we're within capacity
+  string id(plain.begin(), plain.begin() + LEN_TICKET_ID);
+  {
+    lock_guard<mutex> g(fields->lock);
+    fields->lru.emplace_front(id, entry_t{aeskey, (time_t)expires});
+    fields->index[id] = fields->lru.begin();
+    while (fields->lru.size() > fields->capacity) {
+      fields->index.erase(fields->lru.back().first);
+      fields->lru.pop_back();
+    }
+  }
+
+  vec ticket(iv, iv + AES_IVSIZE);
+  vec_append(ticket, enc);
+  return ticket;
+}
+
+/// Recover the AES key that a ticket is bound to
+///
+/// @param ticket A pointer to the LEN_TICKET bytes of a ticket
+/// @param aeskey The vector that receives the AES key
+///
+/// @returns false if the ticket is invalid, expired, or has been evicted
+bool TicketCache::redeem(const unsigned char *ticket, vec &aeskey) {
+  if (!enabled())
+    return false;
+  EVP_CIPHER_CTX *ctx = create_aes_context(fields->ticket_key(ticket), false);
+  if (ctx == nullptr)
+    return false;
+  ContextManager cm([&]() { reclaim_aes_context(ctx); });
+  vec plain = aes_crypt_msg(
+      ctx, vec(ticket + AES_IVSIZE, ticket + LEN_TICKET));
+  if (plain.size() != LEN_TICKET_PLAIN)
+    return false;
+  int64_t expires;
+  memcpy(&expires, plain.data() + LEN_TICKET_ID, sizeof(expires));
+  time_t now = time(nullptr);
+  if (expires < now)
+    return false;
+
+  // The entry must still be cached.  Using it makes it the most recent.
+  string id(plain.begin(), plain.begin() + LEN_TICKET_ID);
+  lock_guard<mutex> g(fields->lock);
+  auto i = fields->index.find(id);
+  if (i == fields->index.end())
+    return false;
+  if (i->second->second.expires < now) {
+    fields->lru.erase(i->second);
+    fields->index.erase(i);
+    return false;
+  }
+  fields->lru.splice(fields->lru.begin(), fields->lru, i->second);
+  aeskey = i->second->second.aeskey;
+  return true;
+}
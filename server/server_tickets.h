@@ -0,0 +1,58 @@
+#pragma once
+
+#include <memory>
+
+#include "../common/vec.h"
+
+/// TicketCache lets a client that has recently completed an RSA-protected
+/// request skip the RSA step on later requests.  After a successful request,
+/// the server issues a ticket: an opaque, server-encrypted block that names an
+/// entry in this cache.  The entry holds the AES key from the original request.
+/// Until the ticket's lifetime ends, the client can present it in place of an
+/// rblock (see REQ_RSM), and the server recovers the AES key by decrypting the
+/// ticket and looking it up, which is far cheaper than RSA_private_decrypt().
+///
+/// The cache is bounded.  When it is full, issuing a new ticket evicts the
+/// least recently used one, so a client must always be ready to fall back to a
+/// regular RSA request.
+class TicketCache {
+  /// Internal is the class that stores all the members of a TicketCache
+  /// object.  To avoid pulling too much into the .h file, we are using the
+  /// PIMPL pattern (https://www.geeksforgeeks.org/pimpl-idiom-in-c-with-examples/)
+  struct Internal;
+
+  /// A reference to the internal fields of the TicketCache object
+  std::unique_ptr<Internal> fields;
+
+public:
+  /// Construct a ticket cache, with a fresh random key for encrypting tickets
+  ///
+  /// @param capacity The most tickets that may be valid at once
+  /// @param ttl      The number of seconds for which a ticket is valid.  A
+  ///                 value of 0 means that tickets are never issued.
+  TicketCache(size_t capacity, int ttl);
+
+  /// Destructor for the ticket cache
+  ~TicketCache();
+
+  /// Check if tickets are enabled
+  ///
+  /// @returns true if issue() will produce tickets
+  bool enabled();
+
+  /// Create a ticket that is bound to an AES key
+  ///
+  /// @param aeskey The AES key (and iv) that the client used
+  ///
+  /// @returns The LEN_TICKET bytes of the ticket, or an empty vector if
+  ///          tickets are disabled or there was an error
+  vec issue(const vec &aeskey);
+
+  /// Recover the AES key that a ticket is bound to
+  ///
+  /// @param ticket A pointer to the LEN_TICKET bytes of a ticket
+  /// @param aeskey The vector that receives the AES key
+  ///
+  /// @returns false if the ticket is invalid, expired, or has been evicted
+  bool redeem(const unsigned char *ticket, vec &aeskey);
+};
@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "server_topk.h"
+
+using namespace std;
+
+/// The shape of each sketch: TOPK_DEPTH rows of TOPK_WIDTH counters
+const size_t TOPK_DEPTH = 4;
+const size_t TOPK_WIDTH = 4096;
+
+/// The number of candidates kept per key that is reported.  The slack lets a
+/// key that is climbing survive a few hits on a colder key.
+const size_t TOPK_SLACK = 4;
+
+/// The names of the kinds of key, in the order of topk_t
+static const char *const TOPK_NAMES[NTOPK] = {"top_get", "top_set"};
+
+/// tracker_t is the sketch and the candidates for one kind of key
+struct tracker_t {
+  /// The sketch.  NB: trackers are static, so the counters start at zero.
+  atomic<uint32_t> counts[TOPK_DEPTH][TOPK_WIDTH];
+
+  /// The count that a key must beat to become a candidate, once there are
+  /// enough candidates
+  atomic<uint32_t> floor;
+
+  /// A lock to protect the candidates
+  mutex lock;
+
+  /// The candidates, with their counts when they were last updated
+  vector<pair<string, uint32_t>> cands;
+};
+
+/// The number of keys of each kind to report, and of candidates to keep
+static size_t top_k = 0, cap = 0;
+
+/// The trackers, indexed by topk_t
+static tracker_t trackers[NTOPK];
+
+/// Configure tracking.  Until this is called, nothing is tracked.
+///
+/// @param k The number of keys of each kind to report (0 to track nothing)
+void topk_init(size_t k) {
+  top_k = k;
+  cap = k * TOPK_SLACK;
+  for (auto &t : trackers)
+    t.cands.reserve(cap);
+}
+
+/// Find the counter for a key in one row of a sketch.  The rows' hashes are
+/// derived from one hash of the key, as h1 + row * h2.
+///
+/// @param h   The hash of the key
+/// @param row The row
+///
+/// @returns The index of the key's counter within the row
+static size_t column(size_t h, size_t row) {
+  uint32_t h1 = h, h2 = (uint64_t)h >> 32 | 1;
+  return (h1 + row * h2) % TOPK_WIDTH;
+}
+
+/// Estimate a key's count from a sketch
+///
+/// @param t   The tracker
+/// @param key The key
+///
+/// @returns The smallest of the key's counters
+static uint32_t estimate(const tracker_t &t, string_view key) {
+  size_t h = hash<string_view>()(key);
+  uint32_t est = UINT32_MAX;
+  for (size_t r = 0; r < TOPK_DEPTH; ++r)
+    est = min(est, t.counts[r][column(h, r)].load(memory_order_relaxed));
+  return est;
+}
+
+/// Order candidates by their counts
+///
+/// @param a The first candidate
+/// @param b The second candidate
+///
+/// @returns true if a's count is lower than b's
+static bool by_count(const pair<string, uint32_t> &a,
+                     const pair<string, uint32_t> &b) {
+  return a.second < b.second;
+}
+
+/// Count one hit on a key
+///
+/// @param which The kind of key
+/// @param key   The key (a user name)
+void topk_hit(topk_t which, string_view key) {
+  if (top_k == 0)
+    return;
+  tracker_t &t = trackers[which];
+  size_t h = hash<string_view>()(key);
+  uint32_t est = UINT32_MAX;
+  for (size_t r = 0; r < TOPK_DEPTH; ++r)
+    est = min(est, t.counts[r][column(h, r)].fetch_add(
+                       1, memory_order_relaxed) + 1);
+  if (est <= t.floor.load(memory_order_relaxed))
+    return;
+
+  unique_lock<mutex> g(t.lock, try_to_lock);
+  if (!g.owns_lock())
+    return;
+  auto it = find_if(t.cands.begin(), t.cands.end(),
+                    [&](auto &c) { return c.first == key; });
+  if (it != t.cands.end()) {
+    it->second = est;
+  } else if (t.cands.size() < cap) {
+    t.cands.emplace_back(string(key), est);
+  } else {
+    auto low = min_element(t.cands.begin(), t.cands.end(), by_count);
+    low->first = string(key);
+    low->second = est;
+  }
+  if (t.cands.size() == cap) {
+    auto low = min_element(t.cands.begin(), t.cands.end(), by_count);
+    t.floor.store(low->second, memory_order_relaxed);
+  }
+}
+
+/// Produce a report of the hottest keys of each kind
+///
+/// @returns One "top_get name count" or "top_set name count" line per key,
+///          hottest first
+string topk_report() {
+  ostringstream out;
+  for (int i = 0; i < NTOPK; ++i) {
+    tracker_t &t = trackers[i];
+    vector<pair<string, uint32_t>> cands;
+    {
+      lock_guard<mutex> g(t.lock);
+      cands = t.cands;
+    }
+    // NB: a candidate's own count may be stale, so ask the sketch again
+    for (auto &c : cands)
+      c.second = estimate(t, c.first);
+    sort(cands.begin(), cands.end(), [](auto &a, auto &b) {
+      return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+    for (size_t j = 0; j < min(top_k, cands.size()); ++j)
+      out << TOPK_NAMES[i] << " " << cands[j].first << " " << cands[j].second
+          << "\n";
+  }
+  return out.str();
+}
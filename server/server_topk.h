@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+/// The server can track its hottest keys: the users whose content is read
+/// most by GET, and the users who write their content most with SET.  Each
+/// kind of key has a count-min sketch, a fixed grid of relaxed atomic counters
+/// that every hit bumps in one counter per row, without locks.  A key's count
+/// is the smallest of its counters, which may be too high (because of
+/// collisions) but is never too low.  Any key whose count reaches the smallest
+/// count among a small, fixed set of candidates replaces that candidate.  The
+/// candidates' lock is only ever tried, never waited for, so a hit that loses
+/// the race just leaves the candidates as they were.
+///
+/// Counts are since the server started.  The top keys are reported with the
+/// metrics, as "top_get name count" and "top_set name count" lines.
+
+/// topk_t names the kinds of key that are tracked
+enum topk_t {
+  TOPK_GET, // users whose content is read
+  TOPK_SET, // users who write their content
+  NTOPK
+};
+
+/// Configure tracking.  Until this is called, nothing is tracked.
+///
+/// @param k The number of keys of each kind to report (0 to track nothing)
+void topk_init(size_t k);
+
+/// Count one hit on a key
+///
+/// @param which The kind of key
+/// @param key   The key (a user name)
+void topk_hit(topk_t which, std::string_view key);
+
+/// Produce a report of the hottest keys of each kind
+///
+/// @returns One "top_get name count" or "top_set name count" line per key,
+///          hottest first
+std::string topk_report();
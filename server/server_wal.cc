@@ -0,0 +1,298 @@
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "../common/err.h"
+#include "../common/file.h"
+#include "../common/log.h"
+#include "../common/vec.h"
+
+#include "server_wal.h"
+
+using namespace std;
+
+/// Internal is the class that stores all the members of a WriteAheadLog
+/// object.  To avoid pulling too much into the .h file, we are using the PIMPL
+/// pattern (https://www.geeksforgeeks.org/pimpl-idiom-in-c-with-examples/)
+struct WriteAheadLog::Internal {
+  /// The name of the log file
+  const string path;
+
+  /// The fsync policy
+  const int sync_ms;
+
+  /// The log file's descriptor, or -1 if it isn't open
+  int fd = -1;
+
+  /// The sequence number of the last record written, and of the last record
+  /// known to be on disk
+  uint64_t written = 0, synced = 0;
+
+  /// The number of bytes in the log file
+  size_t bytes = 0;
+
+  /// True while some thread is running fdatasync()
+  bool syncing = false;
+
+  /// True when the background sync thread should exit
+  bool stopping = false;
+
+  /// A lock to protect all of the fields above.  Note that it is not held
+  /// during fdatasync(), so appends can continue while a sync runs.
+  mutex lock;
+
+  /// For waking threads that are waiting on a sync (or for a stop)
+  condition_variable cv;
+
+  /// The background sync thread, if sync_ms > 0
+  thread syncer;
+
+  /// Construct the Internal object
+  ///
+  /// @param _path    The name of the log file
+  /// @param _sync_ms The fsync policy
+  Internal(const string &_path, int _sync_ms)
+      : path(_path), sync_ms(_sync_ms) {}
+
+  /// Make sure that every record up to lsn is on disk.  If another thread is
+  /// already syncing, wait for it, since its sync may cover lsn too.
+  ///
+  /// @param l   A lock on this->lock, which must be held on entry
+  /// @param lsn The sequence number that must be durable
+  ///
+  /// @returns false if fdatasync() failed
+  bool sync_to(unique_lock<mutex> &l, uint64_t lsn) {
+    bool ok = true;
+    while (synced < lsn && fd >= 0) {
+      if (syncing) {
+        cv.wait(l);
+        continue;
+      }
+      syncing = true;
+      uint64_t target = written;
+      int sd = fd;
+      l.unlock();
+      ok = fdatasync(sd) == 0;
+      if (!ok)
+        sys_error(errno, "Error in fdatasync():");
+      l.lock();
+      syncing = false;
+      if (ok && target > synced)
+        synced = target;
+      cv.notify_all();
+      if (!ok)
+        break;
+    }
+    return ok;
+  }
+
+  /// The body of the background sync thread: sync every sync_ms milliseconds
+  /// until told to stop
+  void sync_loop() {
+    unique_lock<mutex> l(lock);
+    while (!stopping) {
+      cv.wait_for(l, chrono::milliseconds(sync_ms));
+      if (written > synced)
+        sync_to(l, written);
+    }
+  }
+};
+
+/// Construct a log object.  No file is opened until open() is called.
+///
+/// @param path    The name of the log file
+/// @param sync_ms The fsync policy (see server_wal.h)
+WriteAheadLog::WriteAheadLog(const string &path, int sync_ms)
+    : fields(new Internal(path, sync_ms)) {}
+
+/// Destructor for the log.  This closes the log, if it is still open.
+WriteAheadLog::~WriteAheadLog() { close(); }
+
+/// Read every intact record in a log file, in order.  Reading stops at the
+/// first record that is truncated or whose checksum doesn't match, and the
+/// file is truncated there, so that new records aren't appended after
+/// garbage.  A missing file is treated as an empty log.
+///
+/// @param path  The name of the log file
+/// @param apply A function to run on the body (@r) of each record.  If it
+///              returns false, replay stops.
+///
+/// @returns false if apply() rejected a record, true otherwise
+bool WriteAheadLog::replay(const string &path,
+                           function<bool(const vec &)> apply) {
+  if (!file_exists(path))
+    return true;
+  vec buf = load_entire_file(path);
+  size_t pos = 0;
+  while (buf.size() - pos >= 2 * sizeof(int)) {
+    int len;
+    memcpy(&len, buf.data() + pos, sizeof(int));
+    if (len < 0 || buf.size() - pos - 2 * sizeof(int) < (size_t)len)
+      break;
+    const unsigned char *body = buf.data() + pos + sizeof(int);
+    uint32_t crc;
+    memcpy(&crc, body + len, sizeof(crc));
+    if (crc != crc32(0, body, len))
+      break;
+    if (!apply(vec(body, body + len)))
+      return false;
+    pos += 2 * sizeof(int) + len;
+  }
+  if (pos != buf.size()) {
+    log_msg(LOG_WARN, "Discarding " + to_string(buf.size() - pos) +
+                          " damaged bytes at the end of " + path);
+    if (truncate(path.c_str(), pos) != 0)
+      sys_error(errno, "Error truncating log:");
+  }
+  return true;
+}
+
+/// Open (or create) the log file for appending, and start the background sync
+/// thread if the policy needs one
+///
+/// @returns false on error
+bool WriteAheadLog::open() {
+  fields->fd =
+      ::open(fields->path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fields->fd < 0) {
+    sys_error(errno, "Error opening log:");
+    return false;
+  }
+  struct stat st;
+  fields->bytes = fstat(fields->fd, &st) == 0 ? st.st_size : 0;
+  if (fields->sync_ms > 0)
+    fields->syncer = thread([&]() { fields->sync_loop(); });
+  return true;
+}
+
+/// Append one record to the log.  The record is written (but not necessarily
+/// synced) before this returns, so callers that need records to appear in a
+/// particular order should hold a lock around append().
+///
+/// @param rec The body of the record
+/// @param lsn Receives the record's sequence number, for use with commit()
+///
+/// @returns false on error, in which case the record is not in the log
+bool WriteAheadLog::append(const vec &rec, uint64_t &lsn) {
+  vec frame;
+  frame.reserve(2 * sizeof(int) + rec.size());
+  vec_append(frame, (int)rec.size());
+  vec_append(frame, rec);
+  uint32_t crc = crc32(0, rec.data(), rec.size());
+  frame.insert(frame.end(), (unsigned char *)&crc,
+               (unsigned char *)&crc + sizeof(crc));
+
+  lock_guard<mutex> g(fields->lock);
+  if (fields->fd < 0)
+    return false;
+  // NB: O_APPEND makes each write() land at the end, but a write can still be
+  //     short, so loop until the whole frame is out
+  for (size_t done = 0; done < frame.size();) {
+    ssize_t w = write(fields->fd, frame.data() + done, frame.size() - done);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w < 0) {
+      sys_error(errno, "Error appending to log:");
+      // NB: cut off a partial frame, so that replay doesn't stop at it and
+      //     drop every record that is appended after it
+      if (done > 0 && ftruncate(fields->fd, fields->bytes) != 0)
+        sys_error(errno, "Error truncating log:");
+      return false;
+    }
+    done += w;
+  }
+  fields->bytes += frame.size();
+  lsn = ++fields->written;
+  return true;
+}
+
+/// Wait until a record is as durable as the fsync policy requires
+///
+/// @param lsn The sequence number that append() returned
+///
+/// @returns false if the log could not be synced
+bool WriteAheadLog::commit(uint64_t lsn) {
+  if (fields->sync_ms != 0 || lsn == 0)
+    return true;
+  unique_lock<mutex> l(fields->lock);
+  return fields->sync_to(l, lsn);
+}
+
+/// Force every record that has been appended so far to disk, regardless of the
+/// fsync policy
+///
+/// @returns false on error
+bool WriteAheadLog::sync() {
+  unique_lock<mutex> l(fields->lock);
+  return fields->sync_to(l, fields->written);
+}
+
+/// Report the size of the log file
+///
+/// @returns The number of bytes in the log file
+size_t WriteAheadLog::size() {
+  lock_guard<mutex> g(fields->lock);
+  return fields->bytes;
+}
+
+/// Sync the log, move it to another name, and start a new, empty log in its
+/// place.  Appends are blocked only while the file is swapped, not while the
+/// old log is being read or removed.
+///
+/// @param old_path The name to give the old log
+///
+/// @returns false on error, in which case the log is unchanged
+bool WriteAheadLog::rotate(const string &old_path) {
+  unique_lock<mutex> l(fields->lock);
+  if (fields->fd < 0)
+    return false;
+  // NB: sync_to() drops the lock while it syncs, so more records may arrive.
+  //     Keep going until everything in the old file is durable and no other
+  //     thread is using its descriptor.
+  while (fields->synced < fields->written || fields->syncing) {
+    if (fields->syncing)
+      fields->cv.wait(l);
+    else if (!fields->sync_to(l, fields->written))
+      return false;
+  }
+  if (rename(fields->path.c_str(), old_path.c_str()) != 0) {
+    sys_error(errno, "Error renaming log:");
+    return false;
+  }
+  int fd = ::open(fields->path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd < 0) {
+    sys_error(errno, "Error opening log:");
+    if (rename(old_path.c_str(), fields->path.c_str()) != 0)
+      sys_error(errno, "Error restoring log:");
+    return false;
+  }
+  ::close(fields->fd);
+  fields->fd = fd;
+  fields->bytes = 0;
+  return true;
+}
+
+/// Sync and close the log, and stop the background sync thread
+void WriteAheadLog::close() {
+  {
+    unique_lock<mutex> l(fields->lock);
+    if (fields->fd < 0)
+      return;
+    fields->sync_to(l, fields->written);
+    fields->stopping = true;
+    fields->cv.notify_all();
+  }
+  if (fields->syncer.joinable())
+    fields->syncer.join();
+  lock_guard<mutex> g(fields->lock);
+  ::close(fields->fd);
+  fields->fd = -1;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "../common/vec.h"
+
+/// WriteAheadLog is an append-only file of records, which lets Storage make
+/// each change durable without rewriting the whole data file.  Each record is
+/// framed as len(@r).@r.crc32(@r), so that a record that was only partly
+/// written when the server crashed can be detected and discarded.
+///
+/// The log supports three fsync policies:
+///  - sync_ms == 0: commit() does not return until the record is on disk.
+///    Concurrent writers share fsyncs (group commit): one writer syncs
+///    everything that has been written so far, and the rest just wait for it.
+///  - sync_ms > 0: a background thread fsyncs the log every sync_ms
+///    milliseconds, so a crash loses at most that much time's worth of
+///    changes.  commit() returns immediately.
+///  - sync_ms < 0: the log is never explicitly fsynced, except by sync().
+class WriteAheadLog {
+  /// Internal is the class that stores all the members of a WriteAheadLog
+  /// object.  To avoid pulling too much into the .h file, we are using the
+  /// PIMPL pattern (https://www.geeksforgeeks.org/pimpl-idiom-in-c-with-examples/)
+  struct Internal;
+
+  /// A reference to the internal fields of the WriteAheadLog object
+  std::unique_ptr<Internal> fields;
+
+public:
+  /// Construct a log object.  No file is opened until open() is called.
+  ///
+  /// @param path    The name of the log file
+  /// @param sync_ms The fsync policy (see above)
+  WriteAheadLog(const std::string &path, int sync_ms);
+
+  /// Destructor for the log.  This closes the log, if it is still open.
+  ~WriteAheadLog();
+
+  /// Read every intact record in a log file, in order.  Reading stops at the
+  /// first record that is truncated or whose checksum doesn't match, and the
+  /// file is truncated there, so that new records aren't appended after
+  /// garbage.  A missing file is treated as an empty log.
+  ///
+  /// @param path  The name of the log file
+  /// @param apply A function to run on the body (@r) of each record.  If it
+  ///              returns false, replay stops.
+  ///
+  /// @returns false if apply() rejected a record, true otherwise
+  static bool replay(const std::string &path,
+                     std::function<bool(const vec &)> apply);
+
+  /// Open (or create) the log file for appending, and start the background
+  /// sync thread if the policy needs one
+  ///
+  /// @returns false on error
+  bool open();
+
+  /// Append one record to the log.  The record is written (but not
+  /// necessarily synced) before this returns, so callers that need records to
+  /// appear in a particular order should hold a lock around append().
+  ///
+  /// @param rec The body of the record
+  /// @param lsn Receives the record's sequence number, for use with commit()
+  ///
+  /// @returns false on error, in which case the record is not in the log
+  bool append(const vec &rec, uint64_t &lsn);
+
+  /// Wait until a record is as durable as the fsync policy requires
+  ///
+  /// @param lsn The sequence number that append() returned
+  ///
+  /// @returns false if the log could not be synced
+  bool commit(uint64_t lsn);
+
+  /// Force every record that has been appended so far to disk, regardless of
+  /// the fsync policy
+  ///
+  /// @returns false on error
+  bool sync();
+
+  /// Report the size of the log file
+  ///
+  /// @returns The number of bytes in the log file
+  size_t size();
+
+  /// Sync the log, move it to another name, and start a new, empty log in its
+  /// place.  Appends are blocked only while the file is swapped, not while
+  /// the old log is being read or removed.
+  ///
+  /// @param old_path The name to give the old log
+  ///
+  /// @returns false on error, in which case the log is unchanged
+  bool rotate(const std::string &old_path);
+
+  /// Sync and close the log, and stop the background sync thread
+  void close();
+};
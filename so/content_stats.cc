@@ -0,0 +1,53 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../common/mapreduce.h"
+#include "../common/vec.h"
+
+using namespace std;
+
+/// content_stats summarizes the sizes of users' content, to show how map() and
+/// reduce() fit together.  Its result is text, with one "name value" line per
+/// statistic.
+
+extern "C" {
+
+/// Find the size of one user's content
+///
+/// @param user    The user's name
+/// @param content The user's content
+///
+/// @returns The size, as an 8-byte binary value
+vec map(string_view, bytes_t content) {
+  uint64_t size = content.size;
+  vec res(sizeof(size));
+  memcpy(res.data(), &size, sizeof(size));
+  return res;
+}
+
+/// Combine the sizes of every user's content
+///
+/// @param results The results of map()
+///
+/// @returns A report of the number of users, how many have content, and the
+///          total and largest size of their content
+vec reduce(const vector<vec> &results) {
+  uint64_t with = 0, total = 0, largest = 0;
+  for (auto &r : results) {
+    uint64_t size = 0;
+    if (r.size() == sizeof(size))
+      memcpy(&size, r.data(), sizeof(size));
+    with += size > 0;
+    total += size;
+    largest = max(largest, size);
+  }
+  return vec_from_string("users " + to_string(results.size()) + "\n" +
+                         "users_with_content " + to_string(with) + "\n" +
+                         "content_bytes " + to_string(total) + "\n" +
+                         "largest_content_bytes " + to_string(largest) + "\n");
+}
+}
@@ -8,6 +8,7 @@
 
 import subprocess
 import os
+import socket
 import time
 import filecmp
 import sys
@@ -30,8 +31,8 @@ class UserConfig:
 class ServerConfig:
     """An object that encapsulates the server's configuration, and makes it easy to launch a server."""
 
-    def __init__(self, exe, port, keyfile, dirfile, threads = "1", buckets = "16", qinterval = "60", upquot = "1048576", downquot = "1048576", reqquot = "128", top = "4", admin = ""):
-        """Construct a ServerConfig object from an executable, port, keyfile, directory file, thread count, quota interval, u/d/r quotas, and TOP threshold"""
+    def __init__(self, exe, port, keyfile, dirfile, threads = "1", buckets = "16", qinterval = "60", upquot = "1048576", downquot = "1048576", reqquot = "128", top = "4", admin = "", extra = []):
+        """Construct a ServerConfig object from an executable, port, keyfile, directory file, thread count, quota interval, u/d/r quotas, TOP threshold, and any extra flags"""
         self.exe = exe
         self.port = port
         self.keyfile = keyfile
@@ -44,10 +45,11 @@ class ServerConfig:
         self.rqq = reqquot
         self.top = top
         self.admin = admin
+        self.extra = extra
 
     def launchcmd(self):
         """Return, in list form, the parts of a command to start the server"""
-        return [self.exe, "-p", self.port, "-k", self.keyfile, "-f", self.dirfile, "-t", self.threads, "-b", self.buckets, "-i", self.qi, "-u", self.upq, "-d", self.dnq, "-r", self.rqq, "-o", self.top, "-a", self.admin]
+        return [self.exe, "-p", self.port, "-k", self.keyfile, "-f", self.dirfile, "-t", self.threads, "-b", self.buckets, "-i", self.qi, "-u", self.upq, "-d", self.dnq, "-r", self.rqq, "-o", self.top, "-a", self.admin] + self.extra
 
 
 class ClientConfig:
@@ -128,6 +130,10 @@ class ClientConfig:
         """Configure a command for persisting the server"""
         return self.cmd0(user, "SAV")
 
+    def batch(self, user, filename):
+        """Configure a command for running a file of commands over one session"""
+        return [self.exe, "-k", self.keyfile, "-s", self.server, "-p", self.port, "-u", user.name, "-w", user.pwd, "-B", filename]
+
 def delfile(file):
     """delete a file, but only if it exists:"""
     if os.path.exists(file):
@@ -176,6 +182,104 @@ def do_cmd(msg, expect, cmd):
         print("["+red("ERR")+"] '" + str(res_o) + " " + str(res_e)+"'")
     return s
 
+def do_cmds(msg, expect, cmds):
+    """Launch every command in /cmds/ at once, and then check if each one's result equals the expected value"""
+    if verbose:
+        for cmd in cmds:
+            for x in cmd:
+                print(x, end=" ")
+            print("", end="\n")
+    print((msg+" Expect: "+str(len(cmds))+" x '" + expect+"'").ljust(indentation), end="")
+    # A client that has no copy of the server's key fetches it and saves it,
+    # so clients that all start without one race to write it.  When the key
+    # is missing, the first command runs alone, and fetches it for the rest.
+    procs = []
+    if len(cmds) > 0 and "-k" in cmds[0]:
+        keyfile = cmds[0][cmds[0].index("-k") + 1]
+        if not os.path.exists(keyfile):
+            procs.append(subprocess.Popen(cmds[0], stderr=subprocess.PIPE, stdout=subprocess.PIPE))
+            procs[0].wait()
+    procs += [subprocess.Popen(cmd, stderr=subprocess.PIPE, stdout=subprocess.PIPE) for cmd in cmds[len(procs):]]
+    bad = []
+    for s in procs:
+        res_o = s.stdout.readline().rstrip().decode("utf-8")
+        res_e = s.stderr.readline().rstrip().decode("utf-8")
+        s.wait()
+        if res_o != expect and res_e != expect:
+            bad.append(res_o + " " + res_e)
+    if len(bad) == 0:
+        print("["+green("OK")+"]")
+    else:
+        print("["+red("ERR")+"] " + str(len(bad)) + " failed, e.g. '" + bad[0]+"'")
+
+def do_batch(msg, expect, cmd):
+    """Launch the batch command /cmd/, and then check if the results it prints,
+    one per line, equal the list of expected values"""
+    if verbose:
+        for x in cmd:
+            print(x, end=" ")
+        print("", end="\n")
+    print((msg+" Expect: " + " ".join(expect)).ljust(indentation), end="")
+    s = subprocess.run(cmd, stderr=subprocess.PIPE, stdout=subprocess.PIPE)
+    res = s.stdout.decode("utf-8").split()
+    if res == expect:
+        print("["+green("OK")+"]")
+    else:
+        print("["+red("ERR")+"] '" + " ".join(res)+"'")
+
+def check_value(msg, expect, actual):
+    """Check if a value that a script computed equals the expected value"""
+    print((msg+" Expect: '" + str(expect)+"'").ljust(indentation), end="")
+    if actual == expect:
+        print("["+green("OK")+"]")
+    else:
+        print("["+red("ERR")+"] '" + str(actual)+"'")
+
+def kill_server(server):
+    """Kill the server abruptly, as a crash would, and wait for it to exit"""
+    server.pid.kill()
+    server.pid.wait()
+
+def rsa_encrypt(pubfile, data):
+    """Encrypt /data/ with the RSA public key in /pubfile/, as the client does"""
+    s = subprocess.run(["openssl", "pkeyutl", "-encrypt", "-pubin", "-inkey", pubfile, "-pkeyopt", "rsa_padding_mode:oaep"], input=data, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    return s.stdout
+
+def aes_encrypt(key, data, pad = True):
+    """Encrypt /data/ with a 48-byte AES key/iv, as the client does.  Without /pad/, /data/ must be a whole number of blocks, and is encrypted as it is."""
+    cmd = ["openssl", "enc", "-aes-256-cbc", "-K", key[:32].hex(), "-iv", key[32:].hex()]
+    if not pad:
+        cmd.append("-nopad")
+    s = subprocess.run(cmd, input=data, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    return s.stdout
+
+def aes_decrypt(key, data):
+    """Decrypt /data/ with a 48-byte AES key/iv, as the client does, or return b"" if it doesn't decrypt"""
+    cmd = ["openssl", "enc", "-d", "-aes-256-cbc", "-K", key[:32].hex(), "-iv", key[32:].hex()]
+    s = subprocess.run(cmd, input=data, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    return s.stdout if s.returncode == 0 else b""
+
+def raw_request(port, data):
+    """Send raw bytes to the server, end the request, and return the whole response"""
+    s = socket.create_connection(("localhost", int(port)))
+    # NB: the server may answer, and close, before it has read everything
+    try:
+        s.sendall(data)
+        s.shutdown(socket.SHUT_WR)
+    except OSError:
+        pass
+    res = b""
+    while True:
+        try:
+            part = s.recv(4096)
+        except ConnectionResetError:
+            break
+        if not part:
+            break
+        res += part
+    s.close()
+    return res
+
 def await_server(msg, expect, server):
     """Wait for server to terminate"""
     print((msg+" Expect: '" + expect+"'").ljust(indentation), end="")
@@ -185,6 +289,17 @@ def await_server(msg, expect, server):
     else:
         print("["+red("ERR")+"] '" + res+"'")
 
+def await_server_after_errors(msg, expect, server):
+    """Wait for server to terminate, skipping any errors that it reported first"""
+    print((msg+" Expect: '" + expect+"'").ljust(indentation), end="")
+    res = server.stderr.readline().rstrip().decode("utf-8")
+    while res != expect and res != "":
+        res = server.stderr.readline().rstrip().decode("utf-8")
+    if res == expect:
+        print("["+green("OK")+"]")
+    else:
+        print("["+red("ERR")+"] server exited without '" + expect+"'")
+
 def clean_common_files(server, client):
     """ Delete any of the files that we would expect the client or server to have made during an interrupted run of the tests"""
     files = [server.keyfile+".pri", server.keyfile +
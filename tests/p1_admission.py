@@ -0,0 +1,66 @@
+#!/usr/bin/python3
+import subprocess
+import cse303
+
+# Configure constants and users
+cse303.indentation = 80
+cse303.verbose = cse303.check_args_verbose()
+admin = cse303.UserConfig("admin", "admin_is_in_charge")
+users = [cse303.UserConfig("user" + str(i), "password" + str(i)) for i in range(40)]
+metfile = "metrics.txt"
+
+# Create objects with server and client configuration.  The server has one
+# worker, and refuses requests once one is waiting for it.
+server = cse303.ServerConfig("./obj64/server.exe", "9999", "rsa", "company.dir", admin = admin.name, extra = ["-Q", "1"])
+client = cse303.ClientConfig("./obj64/client.exe", "localhost", "9999", "localhost.pub")
+
+# Check if we should use spear's server or client
+cse303.override_exe(server, client)
+
+# Clean up the file system from the last run, kill active servers
+cse303.clean_common_files(server, client)
+cse303.delfile(metfile)
+cse303.killall("server.exe")
+
+def burst(cmds):
+    """Launch every command in /cmds/ at once, and return each one's result"""
+    procs = [subprocess.Popen(cmd, stderr=subprocess.PIPE, stdout=subprocess.PIPE) for cmd in cmds]
+    res = []
+    for s in procs:
+        res_o = s.stdout.readline().rstrip().decode("utf-8")
+        res_e = s.stderr.readline().rstrip().decode("utf-8")
+        s.wait()
+        res.append(res_o if res_o != "" else res_e)
+    return res
+
+server.pid = cse303.do_cmd("Starting server.", "File not found: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmd("Registering new user admin.", "OK", client.reg(admin))
+cse303.do_cmd("Getting the server's key.", "OK", client.reg(users[0]))
+cse303.line()
+
+# A burst of requests saturates the queue, so some of them must be refused
+res = burst([client.reg(u) for u in users[1:]])
+busy = [u for u, r in zip(users[1:], res) if r == "ERR_BUSY"]
+done = [u for u, r in zip(users[1:], res) if r == "OK"]
+cse303.check_value("Checking that each request is served or refused.", len(res), len(busy) + len(done))
+cse303.check_value("Checking that some requests are refused.", True, len(busy) > 0)
+cse303.do_cmd("Getting metrics as admin.", "OK", client.cmd1(admin, "MET", metfile))
+f = open(metfile)
+shed = [x.strip() for x in f.readlines() if x.startswith("shed_queue_full")]
+f.close()
+cse303.delfile(metfile)
+cse303.check_value("Checking the count of refused requests.", ["shed_queue_full " + str(len(busy))], shed)
+cse303.line()
+
+# A refused request has no effect, so only the served ones registered a user
+for u in done:
+    cse303.do_cmd("Registering " + u.name + " again.", "ERR_USER_EXISTS", client.reg(u))
+for u in busy:
+    cse303.do_cmd("Registering " + u.name + " after being refused.", "OK", client.reg(u))
+cse303.line()
+
+# Clean up
+cse303.kill_server(server)
+cse303.clean_common_files(server, client)
@@ -0,0 +1,56 @@
+#!/usr/bin/python3
+import cse303
+
+# Configure constants and users.  There are many more users than the table
+# starts with room for, so its shards must grow while requests are in flight.
+cse303.indentation = 80
+cse303.verbose = cse303.check_args_verbose()
+users = [cse303.UserConfig("user%02d" % i, "password_%02d" % i) for i in range(64)]
+fake = cse303.UserConfig(users[7].name, "not_the_password")
+afile = "server/server_args.h"
+allfile = "allfile"
+
+# Create objects with server and client configuration.  The server has several
+# threads and few buckets.
+server = cse303.ServerConfig("./obj64/server.exe", "9999", "rsa", "company.dir", threads = "4", buckets = "4")
+client = cse303.ClientConfig("./obj64/client.exe", "localhost", "9999", "localhost.pub")
+
+# Check if we should use spear's server or client
+cse303.override_exe(server, client)
+
+# Clean up the file system from the last run, kill active servers
+cse303.clean_common_files(server, client)
+cse303.killall("server.exe")
+
+# Register everyone at once, then make sure every user is in the table
+server.pid = cse303.do_cmd("Starting server.", "File not found: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmds("Registering all users at once.", "OK", [client.reg(u) for u in users])
+cse303.do_cmds("Re-registering all users at once.", "ERR_USER_EXISTS", [client.reg(u) for u in users])
+cse303.do_cmds("Setting every other user's content.", "OK", [client.setC(u, afile) for u in users[::2]])
+cse303.do_cmd("Getting all users.", "OK", client.getA(users[0], allfile))
+cse303.check_file_list(allfile, [u.name for u in users])
+cse303.do_cmd("Attempting access with a bad password.", "ERR_LOGIN", client.getC(fake, users[0].name))
+cse303.do_cmd("Getting content of a user who has none.", "ERR_NO_DATA", client.getC(users[0], users[1].name))
+cse303.do_cmd("Instructing server to persist data.", "OK", client.persist(users[0]))
+cse303.do_cmd("Stopping server.", "OK", client.bye(users[0]))
+cse303.await_server("Waiting for server to shut down.", "Server terminated", server.pid)
+cse303.line()
+
+# Every user, and every user's content, must survive a restart
+server.pid = cse303.do_cmd("Restarting server to check persistence.", "Loaded: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmds("Re-registering all users at once.", "ERR_USER_EXISTS", [client.reg(u) for u in users])
+cse303.do_cmd("Getting all users.", "OK", client.getA(users[63], allfile))
+cse303.check_file_list(allfile, [u.name for u in users])
+cse303.do_cmd("Checking a user's content.", "OK", client.getC(users[63], users[62].name))
+cse303.check_file_result(afile, users[62].name)
+cse303.do_cmd("Attempting access with a bad password.", "ERR_LOGIN", client.getC(fake, users[0].name))
+cse303.do_cmd("Stopping server.", "OK", client.bye(users[0]))
+cse303.await_server("Waiting for server to shut down.", "Server terminated", server.pid)
+cse303.line()
+
+# Clean up
+cse303.clean_common_files(server, client)
@@ -0,0 +1,59 @@
+#!/usr/bin/python3
+import os
+import struct
+import cse303
+
+# Configure constants and users
+cse303.indentation = 80
+cse303.verbose = cse303.check_args_verbose()
+alice = cse303.UserConfig("alice", "alice_is_awesome")
+
+# Create objects with server and client configuration
+server = cse303.ServerConfig("./obj64/server.exe", "9999", "rsa", "company.dir")
+client = cse303.ClientConfig("./obj64/client.exe", "localhost", "9999", "localhost.pub")
+
+# Check if we should use spear's server or client
+cse303.override_exe(server, client)
+
+def reg_request(key, ablock, alen):
+    """Build a REG request whose rblock promises alen bytes of ablock"""
+    content = b"REG" + key + struct.pack("<i", alen)
+    return cse303.rsa_encrypt(server.keyfile + ".pub", content) + ablock
+
+def reg_body(user):
+    """Build the unencrypted ablock of a REG request"""
+    name = user.name.encode()
+    pwd = user.pwd.encode()
+    return struct.pack("<i", len(name)) + name + struct.pack("<i", len(pwd)) + pwd
+
+# Run every check against both kinds of server
+for mode in [[], ["-e"]]:
+    server.extra = mode
+    cse303.clean_common_files(server, client)
+    cse303.killall("server.exe")
+    server.pid = cse303.do_cmd("Starting server.", "File not found: " + server.dirfile, server.launchcmd())
+    cse303.waitfor(2)
+    cse303.line()
+
+    # NB: with no padding, a last plaintext block that ends in 0 can't be
+    #     unpadded, so the ablock decrypts but can't be finished
+    key = os.urandom(48)
+    bad = cse303.aes_encrypt(key, b"\0" * 64, False)
+    res = cse303.raw_request(server.port, reg_request(key, bad, len(bad)))
+    cse303.check_value("Sending an ablock with bad padding.", b"ERR_CRYPTO", res)
+    good = cse303.aes_encrypt(key, reg_body(alice))
+    # NB: an event-loop server just closes a connection that ends early
+    res = cse303.raw_request(server.port, reg_request(key, good[:-8], len(good)))
+    cse303.check_value("Sending a truncated ablock.", b"" if mode else b"ERR_XMIT", res)
+    res = cse303.raw_request(server.port, os.urandom(256) + good)
+    cse303.check_value("Sending a corrupted rblock.", b"ERR_CRYPTO", res)
+    cse303.line()
+
+    # The bad requests must have had no effect
+    cse303.do_cmd("Registering new user alice.", "OK", client.reg(alice))
+    cse303.do_cmd("Stopping server.", "OK", client.bye(alice))
+    cse303.await_server_after_errors("Waiting for server to shut down.", "Server terminated", server.pid)
+    cse303.line()
+
+# Clean up
+cse303.clean_common_files(server, client)
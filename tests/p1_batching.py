@@ -0,0 +1,79 @@
+#!/usr/bin/python3
+import cse303
+
+# Configure constants and users
+cse303.indentation = 80
+cse303.verbose = cse303.check_args_verbose()
+admin = cse303.UserConfig("admin", "admin_is_in_charge")
+alice = cse303.UserConfig("alice", "alice_is_awesome")
+bob = cse303.UserConfig("bob", "bob_is_the_best")
+files = ["f" + str(i) + ".dat" for i in range(3)]
+bigfile = "big.dat"
+batchfile = "batch.txt"
+metfile = "metrics.txt"
+
+# Create objects with server and client configuration.  The server has enough
+# workers to serve several sessions at once, and no bandwidth quotas.
+server = cse303.ServerConfig("./obj64/server.exe", "9999", "rsa", "company.dir", threads = "4", upquot = "0", downquot = "0", admin = admin.name)
+client = cse303.ClientConfig("./obj64/client.exe", "localhost", "9999", "localhost.pub")
+
+# Check if we should use spear's server or client
+cse303.override_exe(server, client)
+
+# Clean up the file system from the last run, kill active servers
+cse303.clean_common_files(server, client)
+cse303.delfile(metfile)
+cse303.killall("server.exe")
+for i, f in enumerate(files):
+    cse303.build_file_as(f, str(i) * (1000 * (i + 1)))
+cse303.build_file(bigfile, 900000)
+
+def metrics(user):
+    """Return the number of connections and of RSA decryptions that the
+    server has seen"""
+    cse303.do_cmd("Getting metrics as admin.", "OK", client.cmd1(user, "MET", metfile))
+    f = open(metfile)
+    lines = [x.split() for x in f.readlines()]
+    f.close()
+    cse303.delfile(metfile)
+    conns = [int(x[1]) for x in lines if x[0] == "connections"][0]
+    rsa = [int(x[1][len("count="):]) for x in lines if x[0] == "rsa"][0]
+    return conns, rsa
+
+server.pid = cse303.do_cmd("Starting server.", "File not found: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmd("Registering new user admin.", "OK", client.reg(admin))
+cse303.do_cmd("Registering new user alice.", "OK", client.reg(alice))
+cse303.line()
+
+# With many commands in flight on one session, they still run, and report
+# their results, in the order of the batch file
+cse303.build_file_as(batchfile, "REG\nSET " + bigfile + "\nGET bob\nGET nobody\n" + "".join("SET " + f + "\nGET bob\n" for f in files))
+expect = ["OK", "OK", "OK", "ERR_NO_USER"] + ["OK", "OK"] * len(files)
+cse303.do_batch("Running a pipelined batch as bob.", expect, client.batch(bob, batchfile) + ["-D", "8"])
+cse303.check_file_result(files[-1], bob.name)
+cse303.build_file_as(batchfile, "SET " + bigfile + "\nGET bob\n")
+cse303.do_batch("Running a pipelined batch with large content.", ["OK", "OK"], client.batch(bob, batchfile) + ["-D", "4"])
+cse303.check_file_result(bigfile, bob.name)
+cse303.line()
+
+# Spread over several sessions, the results are still reported in order, and
+# each session pays for RSA once
+conns, rsa = metrics(admin)
+cse303.build_file_as(batchfile, "GET bob\nGET nobody\nGET alice\nGET bob\nGET bob\nGET nobody\n")
+cse303.do_batch("Running a batch over three sessions.", ["OK", "ERR_NO_USER", "ERR_NO_DATA", "OK", "OK", "ERR_NO_USER"], client.batch(alice, batchfile) + ["-P", "3", "-D", "2"])
+cse303.check_file_result(bigfile, bob.name)
+conns2, rsa2 = metrics(admin)
+cse303.check_value("Checking the connections for the batch.", 3, conns2 - conns - 1)
+cse303.check_value("Checking the RSA handshakes for the batch.", 3, rsa2 - rsa - 1)
+cse303.line()
+
+# Clean up
+cse303.kill_server(server)
+cse303.clean_common_files(server, client)
+cse303.delfile(batchfile)
+cse303.delfile(metfile)
+cse303.delfile(bigfile)
+for f in files:
+    cse303.delfile(f)
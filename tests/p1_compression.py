@@ -0,0 +1,97 @@
+#!/usr/bin/python3
+import cse303
+
+# Configure constants and users
+cse303.indentation = 80
+cse303.verbose = cse303.check_args_verbose()
+alice = cse303.UserConfig("alice", "alice_is_awesome")
+bob = cse303.UserConfig("bob", "bob_is_the_best")
+afile = "alice_content.txt"
+bfile = "bob_content.txt"
+LEN_CONTENT = 1048576
+
+# Create objects with server and client configuration.  The server's quotas
+# leave room for several copies of the largest content.  It compresses content,
+# and keeps a write-ahead log that it syncs before each answer.
+server = cse303.ServerConfig("./obj64/server.exe", "9999", "rsa", "company.dir", upquot = "16777216", downquot = "16777216", extra = ["-z", "6", "-l", "0"])
+client = cse303.ClientConfig("./obj64/client.exe", "localhost", "9999", "localhost.pub")
+logfile = server.dirfile + ".log"
+
+# Check if we should use spear's server or client
+cse303.override_exe(server, client)
+
+# Clean up the file system from the last run, kill active servers
+cse303.clean_common_files(server, client)
+cse303.delfile(logfile)
+cse303.killall("server.exe")
+
+# alice's content is as large as it may be, and shrinks a lot.  bob's content
+# is source code, which shrinks less.
+cse303.build_file(afile, LEN_CONTENT)
+text = b""
+for f in ["server/server_storage.cc", "server/server_commands.cc", "server/server_snapshot.cc"]:
+    text += open(f, "rb").read()
+open(bfile, "wb").write(text)
+
+# Store the content, and read it back from memory
+server.pid = cse303.do_cmd("Starting server.", "File not found: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmd("Registering new user alice.", "OK", client.reg(alice))
+cse303.do_cmd("Setting alice's content.", "OK", client.setC(alice, afile))
+cse303.do_cmd("Registering new user bob.", "OK", client.reg(bob))
+cse303.do_cmd("Setting bob's content.", "OK", client.setC(bob, bfile))
+cse303.do_cmd("Checking alice's content.", "OK", client.getC(bob, alice.name))
+cse303.check_file_result(afile, alice.name)
+cse303.do_cmd("Checking bob's content.", "OK", client.getC(alice, bob.name))
+cse303.check_file_result(bfile, bob.name)
+cse303.check_value("Checking that the log holds compressed content.", True, cse303.get_len(logfile) < len(text))
+cse303.kill_server(server)
+cse303.line()
+
+# The compressed records in the log must replay
+server.pid = cse303.do_cmd("Restarting server after a crash.", "File not found: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmd("Checking alice's content.", "OK", client.getC(bob, alice.name))
+cse303.check_file_result(afile, alice.name)
+cse303.do_cmd("Checking bob's content.", "OK", client.getC(alice, bob.name))
+cse303.check_file_result(bfile, bob.name)
+cse303.do_cmd("Stopping server.", "OK", client.bye(alice))
+cse303.await_server("Waiting for server to shut down.", "Server terminated", server.pid)
+cse303.line()
+
+# Without a log, SAV folds everything into a snapshot, whose compressed
+# entries must load
+server.extra = ["-z", "6"]
+server.pid = cse303.do_cmd("Restarting server without a log.", "File not found: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmd("Instructing server to persist data.", "OK", client.persist(alice))
+cse303.do_cmd("Stopping server.", "OK", client.bye(alice))
+cse303.await_server("Waiting for server to shut down.", "Server terminated", server.pid)
+cse303.line()
+cse303.check_value("Checking that the snapshot holds compressed content.", True, cse303.get_len(server.dirfile) < len(text))
+server.pid = cse303.do_cmd("Restarting server.", "Loaded: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmd("Checking alice's content.", "OK", client.getC(bob, alice.name))
+cse303.check_file_result(afile, alice.name)
+cse303.do_cmd("Checking bob's content.", "OK", client.getC(alice, bob.name))
+cse303.check_file_result(bfile, bob.name)
+
+# A client that sends and receives packed content sees the same bytes
+cse303.do_cmd("Setting bob's content, packed.", "OK", client.setC(bob, afile) + ["-z", "6"])
+cse303.do_cmd("Checking bob's content, packed.", "OK", client.getC(alice, bob.name) + ["-z", "6"])
+cse303.check_file_result(afile, bob.name)
+cse303.do_cmd("Checking bob's content, unpacked.", "OK", client.getC(alice, bob.name))
+cse303.check_file_result(afile, bob.name)
+cse303.do_cmd("Stopping server.", "OK", client.bye(alice))
+cse303.await_server("Waiting for server to shut down.", "Server terminated", server.pid)
+cse303.line()
+
+# Clean up
+cse303.clean_common_files(server, client)
+cse303.delfile(logfile)
+cse303.delfile(afile)
+cse303.delfile(bfile)
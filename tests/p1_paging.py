@@ -0,0 +1,45 @@
+#!/usr/bin/python3
+import cse303
+
+# Configure constants and users.  The users are imported at startup, with
+# unsalted hashes so that registering them is quick.
+cse303.indentation = 80
+cse303.verbose = cse303.check_args_verbose()
+names = ["user%d" % i for i in range(500)]
+alice = cse303.UserConfig("user0", "pw0")
+late = cse303.UserConfig("late_user", "late_pw")
+importfile = "import_users.txt"
+allfile = "allfile"
+
+# Create objects with server and client configuration.  Every page is a
+# request, so there is no request quota.
+server = cse303.ServerConfig("./obj64/server.exe", "9999", "rsa", "company.dir", buckets = "4", reqquot = "0", extra = ["-H", "0", "-I", importfile])
+client = cse303.ClientConfig("./obj64/client.exe", "localhost", "9999", "localhost.pub")
+
+# Check if we should use spear's server or client
+cse303.override_exe(server, client)
+
+# Clean up the file system from the last run, kill active servers
+cse303.clean_common_files(server, client)
+cse303.killall("server.exe")
+cse303.build_file_as(importfile, "".join(n + ":pw" + n[4:] + "\n" for n in names))
+
+# Every page size must list every user exactly once
+server.pid = cse303.do_cmd("Starting server.", "File not found: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmd("Getting all users at once.", "OK", client.getA(alice, allfile))
+cse303.check_file_list(allfile, list(names))
+for page in ["1", "7", "100", "1000"]:
+    cse303.do_cmd("Getting all users, " + page + " per page.", "OK", client.getA(alice, allfile) + ["-2", page])
+    cse303.check_file_list(allfile, list(names))
+cse303.do_cmd("Registering one more user.", "OK", client.reg(late))
+cse303.do_cmd("Getting all users, 13 per page.", "OK", client.getA(alice, allfile) + ["-2", "13"])
+cse303.check_file_list(allfile, names + [late.name])
+cse303.do_cmd("Stopping server.", "OK", client.bye(alice))
+cse303.await_server("Waiting for server to shut down.", "Server terminated", server.pid)
+cse303.line()
+
+# Clean up
+cse303.clean_common_files(server, client)
+cse303.delfile(importfile)
@@ -0,0 +1,66 @@
+#!/usr/bin/python3
+import cse303
+
+# Configure constants and users
+cse303.indentation = 80
+cse303.verbose = cse303.check_args_verbose()
+alice = cse303.UserConfig("alice", "alice_is_awesome")
+bob = cse303.UserConfig("bob", "bob_is_the_best")
+carol = cse303.UserConfig("carol", "carol_rocks")
+smallfile = "small.dat"
+bigfile = "big.dat"
+otherfile = "other.dat"
+
+# Create objects with server and client configuration.  Each user may make 4
+# requests, and upload and download 20000 bytes, per minute.
+server = cse303.ServerConfig("./obj64/server.exe", "9999", "rsa", "company.dir", qinterval = "60", upquot = "20000", downquot = "20000", reqquot = "4")
+client = cse303.ClientConfig("./obj64/client.exe", "localhost", "9999", "localhost.pub")
+
+# Check if we should use spear's server or client
+cse303.override_exe(server, client)
+
+# Clean up the file system from the last run, kill active servers
+cse303.clean_common_files(server, client)
+cse303.killall("server.exe")
+cse303.build_file(smallfile, 1000)
+cse303.build_file(bigfile, 12000)
+cse303.build_file_as(otherfile, "x" * 12000)
+
+server.pid = cse303.do_cmd("Starting server.", "File not found: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmd("Registering new user alice.", "OK", client.reg(alice))
+cse303.do_cmd("Registering new user bob.", "OK", client.reg(bob))
+cse303.do_cmd("Registering new user carol.", "OK", client.reg(carol))
+cse303.line()
+
+# A user's fifth request in the interval is refused, but other users still
+# have their own quotas
+cse303.do_cmd("Setting alice's content.", "OK", client.setC(alice, smallfile))
+cse303.do_cmd("Getting alice's content.", "OK", client.getC(alice, alice.name))
+cse303.do_cmd("Getting alice's content.", "OK", client.getC(alice, alice.name))
+cse303.do_cmd("Getting alice's content.", "OK", client.getC(alice, alice.name))
+cse303.do_cmd("Getting alice's content.", "ERR_QUOTA_REQ", client.getC(alice, alice.name))
+cse303.do_cmd("Getting alice's content as bob.", "OK", client.getC(bob, alice.name))
+cse303.check_file_result(smallfile, alice.name)
+cse303.line()
+
+# An upload that would go over the limit is refused, and has no effect
+cse303.do_cmd("Setting bob's content.", "OK", client.setC(bob, bigfile))
+cse303.do_cmd("Setting bob's content again.", "ERR_QUOTA_UP", client.setC(bob, otherfile))
+cse303.do_cmd("Getting bob's content as carol.", "OK", client.getC(carol, bob.name))
+cse303.check_file_result(bigfile, bob.name)
+cse303.line()
+
+# So is a download that would go over the limit
+cse303.do_cmd("Getting bob's content as carol again.", "ERR_QUOTA_DOWN", client.getC(carol, bob.name))
+cse303.do_cmd("Getting alice's content as carol.", "OK", client.getC(carol, alice.name))
+cse303.check_file_result(smallfile, alice.name)
+cse303.line()
+
+# Clean up
+cse303.kill_server(server)
+cse303.clean_common_files(server, client)
+cse303.delfile(smallfile)
+cse303.delfile(bigfile)
+cse303.delfile(otherfile)
@@ -0,0 +1,70 @@
+#!/usr/bin/python3
+import cse303
+
+# Configure constants and users
+cse303.indentation = 80
+cse303.verbose = cse303.check_args_verbose()
+alice = cse303.UserConfig("alice", "alice_is_awesome")
+bob = cse303.UserConfig("bob", "bob_is_the_best")
+carol = cse303.UserConfig("carol", "carol_rocks")
+afile1 = "server/server_args.h"
+afile2 = "server/server_args.cc"
+allfile = "allfile"
+
+# Create objects with server and client configuration.  The primary streams
+# its changes on port 9998, and the follower keeps them in its own log.
+primary = cse303.ServerConfig("./obj64/server.exe", "9999", "rsa", "company.dir", extra = ["-s", "9998"])
+follower = cse303.ServerConfig("./obj64/server.exe", "9997", "rsa", "follower.dir", extra = ["-F", "localhost:9998", "-l", "0"])
+client = cse303.ClientConfig("./obj64/client.exe", "localhost", "9999", "localhost.pub")
+reader = cse303.ClientConfig("./obj64/client.exe", "localhost", "9997", "localhost.pub")
+followfiles = [follower.dirfile, follower.dirfile + ".log"]
+
+# Check if we should use spear's server or client
+cse303.override_exe(primary, client)
+cse303.override_exe(follower, reader)
+
+# Clean up the file system from the last run, kill active servers
+cse303.clean_common_files(primary, client)
+for f in followfiles:
+    cse303.delfile(f)
+cse303.killall("server.exe")
+
+# Make changes before the follower starts
+primary.pid = cse303.do_cmd("Starting primary.", "File not found: " + primary.dirfile, primary.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmd("Registering new user alice.", "OK", client.reg(alice))
+cse303.do_cmd("Setting alice's content.", "OK", client.setC(alice, afile1))
+cse303.line()
+
+# A new follower first catches up with everything the primary has
+follower.pid = cse303.do_cmd("Starting follower.", "Listening on port " + follower.port + " using (key/data) = (" + follower.keyfile + ", " + follower.dirfile + ")", follower.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmd("Getting alice's content from the follower.", "OK", reader.getC(alice, alice.name))
+cse303.check_file_result(afile1, alice.name)
+cse303.line()
+
+# Then it sees each of the primary's changes as they are made
+cse303.do_cmd("Setting alice's content again.", "OK", client.setC(alice, afile2))
+cse303.do_cmd("Registering new user bob.", "OK", client.reg(bob))
+cse303.waitfor(1)
+cse303.do_cmd("Getting alice's content from the follower.", "OK", reader.getC(alice, alice.name))
+cse303.check_file_result(afile2, alice.name)
+cse303.do_cmd("Getting all users from the follower.", "OK", reader.getA(bob, allfile))
+cse303.check_file_list(allfile, [alice.name, bob.name])
+cse303.line()
+
+# But it refuses to make changes of its own
+cse303.do_cmd("Setting bob's content on the follower.", "ERR_READONLY", reader.setC(bob, afile1))
+cse303.do_cmd("Registering carol on the follower.", "ERR_READONLY", reader.reg(carol))
+cse303.do_cmd("Getting bob's content from the follower.", "ERR_NO_DATA", reader.getC(bob, bob.name))
+cse303.do_cmd("Registering carol on the primary.", "OK", client.reg(carol))
+cse303.line()
+
+# Clean up
+cse303.kill_server(follower)
+cse303.kill_server(primary)
+cse303.clean_common_files(primary, client)
+for f in followfiles:
+    cse303.delfile(f)
@@ -0,0 +1,91 @@
+#!/usr/bin/python3
+import subprocess
+import cse303
+
+# Configure constants and users
+cse303.indentation = 80
+cse303.verbose = cse303.check_args_verbose()
+users = [cse303.UserConfig("user" + str(i), "password" + str(i)) for i in range(8)]
+allfile = "allfile"
+
+# Create objects with server and client configuration.  Users start out split
+# over two shards, and are then moved onto three.
+old = [cse303.ServerConfig("./obj64/server.exe", str(9991 + i), "rsa", "shard" + str(i) + ".dir") for i in range(2)]
+new = [cse303.ServerConfig("./obj64/server.exe", str(9993 + i), "rsa", "reshard" + str(i) + ".dir") for i in range(3)]
+ring2 = ",".join("localhost:" + s.port for s in old)
+ring3 = ",".join("localhost:" + s.port for s in new)
+for i, s in enumerate(old):
+    s.extra = ["-G", ring2, "-g", str(i)]
+for i, s in enumerate(new):
+    s.extra = ["-G", ring3, "-g", str(i)] + [x for o in old for x in ["-m", o.dirfile]]
+client = cse303.ClientConfig("./obj64/client.exe", "localhost", old[0].port, "localhost.pub")
+
+# Check if we should use spear's server or client
+for s in old + new:
+    cse303.override_exe(s, client)
+
+# Clean up the file system from the last run, kill active servers
+cse303.clean_common_files(old[0], client)
+for s in old + new:
+    cse303.delfile(s.dirfile)
+cse303.killall("server.exe")
+
+def contentfile(user):
+    """Return the name of the file with a user's content"""
+    return user.name + ".in"
+
+def owners(shards, user):
+    """Count the shards that have a user's content, by asking each directly"""
+    count = 0
+    for s in shards:
+        cmd = client.getC(user, user.name) + ["-s", "localhost", "-p", s.port]
+        p = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        if p.stdout.decode("utf-8").split("\n")[0].strip() == "OK":
+            count += 1
+    cse303.delfile(user.name + ".file.dat")
+    return count
+
+def check_shards(shards, ring):
+    """Check that each user's content is on exactly one of the shards, and that
+    the client can get it, and every user's name, through the ring"""
+    for u in users:
+        cse303.do_cmd("Getting " + u.name + "'s content.", "OK", client.getC(u, u.name) + ["-R", ring])
+        cse303.check_file_result(contentfile(u), u.name)
+        cse303.check_value("Counting the shards with " + u.name + "'s content.", 1, owners(shards, u))
+    cse303.do_cmd("Getting all users.", "OK", client.getA(users[0], allfile) + ["-R", ring])
+    cse303.check_file_list(allfile, [u.name for u in users])
+
+# Register users on two shards, and give each its own content
+for s in old:
+    s.pid = cse303.do_cmd("Starting shard " + s.port + ".", "File not found: " + s.dirfile, s.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+for u in users:
+    cse303.build_file_as(contentfile(u), u.name * 1000)
+    cse303.do_cmd("Registering new user " + u.name + ".", "OK", client.reg(u) + ["-R", ring2])
+    cse303.do_cmd("Setting " + u.name + "'s content.", "OK", client.setC(u, contentfile(u)) + ["-R", ring2])
+cse303.line()
+check_shards(old, ring2)
+cse303.do_cmd("Persisting shards.", "OK", client.persist(users[0]) + ["-R", ring2])
+cse303.do_cmd("Stopping shards.", "OK", client.bye(users[0]) + ["-R", ring2])
+for s in old:
+    cse303.await_server("Waiting for shard " + s.port + " to shut down.", "Server terminated", s.pid)
+cse303.line()
+
+# After resharding, each user's content is only on the shard that now owns it
+for s in new:
+    s.pid = cse303.do_cmd("Starting shard " + s.port + " from the old shards.", "File not found: " + s.dirfile, s.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+check_shards(new, ring3)
+cse303.do_cmd("Stopping shards.", "OK", client.bye(users[0]) + ["-R", ring3])
+for s in new:
+    cse303.await_server_after_errors("Waiting for shard " + s.port + " to shut down.", "Server terminated", s.pid)
+cse303.line()
+
+# Clean up
+cse303.clean_common_files(old[0], client)
+for s in old + new:
+    cse303.delfile(s.dirfile)
+for u in users:
+    cse303.delfile(contentfile(u))
@@ -0,0 +1,65 @@
+#!/usr/bin/python3
+import cse303
+
+# Configure constants and users
+cse303.indentation = 80
+cse303.verbose = cse303.check_args_verbose()
+admin = cse303.UserConfig("admin", "admin_is_in_charge")
+alice = cse303.UserConfig("alice", "alice_is_awesome")
+bob = cse303.UserConfig("bob", "bob_is_the_best")
+afile1 = "server/server_args.h"
+afile2 = "server/server_args.cc"
+metfile = "metrics.txt"
+
+# Create objects with server and client configuration.  The server caches GET
+# responses, stores content compressed, and reports the cache's use to admin.
+server = cse303.ServerConfig("./obj64/server.exe", "9999", "rsa", "company.dir", admin = admin.name, extra = ["-c", "1", "-z", "6"])
+client = cse303.ClientConfig("./obj64/client.exe", "localhost", "9999", "localhost.pub")
+
+# Check if we should use spear's server or client
+cse303.override_exe(server, client)
+
+# Clean up the file system from the last run, kill active servers
+cse303.clean_common_files(server, client)
+cse303.delfile(metfile)
+cse303.killall("server.exe")
+
+def cache_lines(filename):
+    """Return the hit and miss lines of a metrics report, and delete it"""
+    f = open(filename)
+    lines = [x.strip() for x in f.readlines() if x.startswith("get_cache_hits") or x.startswith("get_cache_misses")]
+    f.close()
+    cse303.delfile(filename)
+    return lines
+
+server.pid = cse303.do_cmd("Starting server.", "File not found: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+for u in [admin, alice, bob]:
+    cse303.do_cmd("Registering new user " + u.name + ".", "OK", client.reg(u))
+cse303.line()
+
+# The first GET fills the cache, and the second is served from it
+cse303.do_cmd("Setting alice's content.", "OK", client.setC(alice, afile1))
+cse303.do_cmd("Getting alice's content as bob.", "OK", client.getC(bob, alice.name))
+cse303.check_file_result(afile1, alice.name)
+cse303.do_cmd("Getting alice's content as bob again.", "OK", client.getC(bob, alice.name))
+cse303.check_file_result(afile1, alice.name)
+cse303.do_cmd("Getting metrics as admin.", "OK", client.cmd1(admin, "MET", metfile))
+cse303.check_value("Checking the cache's use.", ["get_cache_hits 1", "get_cache_misses 1"], cache_lines(metfile))
+cse303.line()
+
+# A SET must invalidate the cached response, so no GET sees the old content
+cse303.do_cmd("Setting alice's content again.", "OK", client.setC(alice, afile2))
+cse303.do_cmd("Getting alice's content as bob.", "OK", client.getC(bob, alice.name))
+cse303.check_file_result(afile2, alice.name)
+cse303.do_cmd("Getting alice's content as bob again.", "OK", client.getC(bob, alice.name))
+cse303.check_file_result(afile2, alice.name)
+cse303.do_cmd("Getting metrics as admin.", "OK", client.cmd1(admin, "MET", metfile))
+cse303.check_value("Checking the cache's use.", ["get_cache_hits 2", "get_cache_misses 2"], cache_lines(metfile))
+cse303.line()
+
+# Clean up
+cse303.kill_server(server)
+cse303.clean_common_files(server, client)
+cse303.delfile(metfile)
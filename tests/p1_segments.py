@@ -0,0 +1,88 @@
+#!/usr/bin/python3
+import glob
+import cse303
+
+# Configure constants and users
+cse303.indentation = 80
+cse303.verbose = cse303.check_args_verbose()
+users = [cse303.UserConfig("user%d" % i, "password_%d" % i) for i in range(8)]
+afile = "server/server_args.h"
+allfile = "allfile"
+
+# Create objects with server and client configuration.  The server writes its
+# data file as four segments.
+server = cse303.ServerConfig("./obj64/server.exe", "9999", "rsa", "company.dir", extra = ["-j", "4"])
+client = cse303.ClientConfig("./obj64/client.exe", "localhost", "9999", "localhost.pub")
+
+# Check if we should use spear's server or client
+cse303.override_exe(server, client)
+
+def clean_segments():
+    """Delete every segment that a run may have left behind"""
+    for f in glob.glob(server.dirfile + ".seg*"):
+        cse303.delfile(f)
+
+# Clean up the file system from the last run, kill active servers
+cse303.clean_common_files(server, client)
+clean_segments()
+cse303.killall("server.exe")
+
+# Persist some users as a segmented snapshot
+server.pid = cse303.do_cmd("Starting server.", "File not found: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmds("Registering all users.", "OK", [client.reg(u) for u in users])
+cse303.do_cmds("Setting every user's content.", "OK", [client.setC(u, afile) for u in users])
+cse303.do_cmd("Instructing server to persist data.", "OK", client.persist(users[0]))
+cse303.do_cmd("Stopping server.", "OK", client.bye(users[0]))
+cse303.await_server("Waiting for server to shut down.", "Server terminated", server.pid)
+cse303.line()
+f = open(server.dirfile, "rb")
+magic = f.read(8)
+f.close()
+segs = sorted(glob.glob(server.dirfile + ".seg*"))
+cse303.check_value("Checking the manifest's magic.", b"AUTHSEGS", magic)
+cse303.check_value("Checking the number of segments.", 4, len(segs))
+cse303.line()
+
+# Every segment is loaded, by its own thread
+server.pid = cse303.do_cmd("Restarting server to load the segments.", "Loaded: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmd("Getting all users.", "OK", client.getA(users[0], allfile))
+cse303.check_file_list(allfile, [u.name for u in users])
+for u in users:
+    cse303.do_cmd("Checking " + u.name + "'s content.", "OK", client.getC(users[0], u.name))
+    cse303.check_file_result(afile, u.name)
+cse303.do_cmd("Stopping server.", "OK", client.bye(users[0]))
+cse303.await_server("Waiting for server to shut down.", "Server terminated", server.pid)
+cse303.line()
+
+# Corrupt the last byte of one segment's content.  The server must refuse to
+# start, unless -V tells it to only check the sizes of the segments.
+f = open(segs[2], "r+b")
+f.seek(-1, 2)
+last = f.read(1)
+f.seek(-1, 2)
+f.write(bytes([last[0] ^ 0xff]))
+f.close()
+server.pid = cse303.do_cmd("Starting server with a corrupt segment.", "Checksum mismatch in " + segs[2], server.launchcmd())
+server.pid.wait()
+cse303.line()
+server.extra = ["-j", "4", "-V"]
+server.pid = cse303.do_cmd("Starting server with -V.", "Loaded: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmd("Stopping server.", "OK", client.bye(users[0]))
+cse303.await_server("Waiting for server to shut down.", "Server terminated", server.pid)
+cse303.line()
+
+# A missing segment means the server must refuse to start
+cse303.delfile(segs[1])
+server.pid = cse303.do_cmd("Starting server with a missing segment.", "Error opening snapshot: No such file or directory", server.launchcmd())
+server.pid.wait()
+cse303.line()
+
+# Clean up
+cse303.clean_common_files(server, client)
+clean_segments()
@@ -0,0 +1,76 @@
+#!/usr/bin/python3
+import cse303
+
+# Configure constants and users
+cse303.indentation = 80
+cse303.verbose = cse303.check_args_verbose()
+admin = cse303.UserConfig("admin", "admin_is_in_charge")
+alice = cse303.UserConfig("alice", "alice_is_awesome")
+bob = cse303.UserConfig("bob", "bob_is_the_best")
+afile = "server/server_args.h"
+allfile = "allfile"
+batchfile = "batch.txt"
+metfile = "metrics.txt"
+
+# Create objects with server and client configuration
+server = cse303.ServerConfig("./obj64/server.exe", "9999", "rsa", "company.dir", admin = admin.name)
+client = cse303.ClientConfig("./obj64/client.exe", "localhost", "9999", "localhost.pub")
+
+# Check if we should use spear's server or client
+cse303.override_exe(server, client)
+
+# Clean up the file system from the last run, kill active servers
+cse303.clean_common_files(server, client)
+cse303.delfile(metfile)
+cse303.killall("server.exe")
+
+def metrics(user):
+    """Return the number of connections and of RSA decryptions that the
+    server has seen"""
+    cse303.do_cmd("Getting metrics as admin.", "OK", client.cmd1(user, "MET", metfile))
+    f = open(metfile)
+    lines = [x.split() for x in f.readlines()]
+    f.close()
+    cse303.delfile(metfile)
+    conns = [int(x[1]) for x in lines if x[0] == "connections"][0]
+    rsa = [int(x[1][len("count="):]) for x in lines if x[0] == "rsa"][0]
+    return conns, rsa
+
+server.pid = cse303.do_cmd("Starting server.", "File not found: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmd("Registering new user admin.", "OK", client.reg(admin))
+cse303.do_cmd("Registering new user alice.", "OK", client.reg(alice))
+cse303.line()
+
+# Every command in a batch is a frame of one session, with one connection and
+# one RSA handshake, and each gets its own result
+conns, rsa = metrics(admin)
+cse303.build_file_as(batchfile, "REG\nSET " + afile + "\nGET bob\nGET alice\nALL " + allfile + "\nGET nobody\nSAV\n")
+cse303.do_batch("Running a batch as bob.", ["OK", "OK", "OK", "ERR_NO_DATA", "OK", "ERR_NO_USER", "OK"], client.batch(bob, batchfile))
+cse303.check_file_result(afile, bob.name)
+cse303.check_file_list(allfile, [admin.name, alice.name, bob.name])
+conns2, rsa2 = metrics(admin)
+cse303.check_value("Checking the connections for the batch.", 1, conns2 - conns - 1)
+cse303.check_value("Checking the RSA handshakes for the batch.", 1, rsa2 - rsa - 1)
+cse303.line()
+
+# A failed command doesn't end the session, but a bad password fails all of
+# them
+cse303.build_file_as(batchfile, "SET " + afile + "\nGET nobody\nGET bob\n")
+cse303.do_batch("Running a batch as alice.", ["OK", "ERR_NO_USER", "OK"], client.batch(alice, batchfile))
+cse303.check_file_result(afile, bob.name)
+cse303.do_batch("Running a batch with the wrong password.", ["ERR_LOGIN", "ERR_LOGIN", "ERR_LOGIN"], client.batch(cse303.UserConfig(alice.name, "wrong"), batchfile))
+cse303.line()
+
+# BYE ends the session and the server
+cse303.build_file_as(batchfile, "GET alice\nBYE\n")
+cse303.do_batch("Running a batch that stops the server.", ["OK", "OK"], client.batch(admin, batchfile))
+cse303.check_file_result(afile, alice.name)
+cse303.await_server("Waiting for server to shut down.", "Server terminated", server.pid)
+cse303.line()
+
+# Clean up
+cse303.clean_common_files(server, client)
+cse303.delfile(batchfile)
+cse303.delfile(metfile)
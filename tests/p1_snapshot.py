@@ -0,0 +1,91 @@
+#!/usr/bin/python3
+import struct
+import cse303
+
+# Configure constants and users
+cse303.indentation = 80
+cse303.verbose = cse303.check_args_verbose()
+alice = cse303.UserConfig("alice", "alice_is_awesome")
+bob = cse303.UserConfig("bob", "bob_is_the_best")
+afile1 = "server/server_args.h"
+afile2 = "server/server_args.cc"
+bfile = "bob_content.txt"
+allfile = "allfile"
+
+# Create objects with server and client configuration
+server = cse303.ServerConfig("./obj64/server.exe", "9999", "rsa", "company.dir")
+client = cse303.ClientConfig("./obj64/client.exe", "localhost", "9999", "localhost.pub")
+
+# Check if we should use spear's server or client
+cse303.override_exe(server, client)
+
+# Clean up the file system from the last run, kill active servers
+cse303.clean_common_files(server, client)
+cse303.delfile(bfile)
+cse303.killall("server.exe")
+
+# Persist two users, one of whom has content that spans many pages
+cse303.build_file(bfile, 500000)
+server.pid = cse303.do_cmd("Starting server.", "File not found: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmd("Registering new user alice.", "OK", client.reg(alice))
+cse303.do_cmd("Setting alice's content.", "OK", client.setC(alice, afile1))
+cse303.do_cmd("Registering new user bob.", "OK", client.reg(bob))
+cse303.do_cmd("Setting bob's content.", "OK", client.setC(bob, bfile))
+cse303.do_cmd("Instructing server to persist data.", "OK", client.persist(alice))
+cse303.do_cmd("Stopping server.", "OK", client.bye(alice))
+cse303.await_server("Waiting for server to shut down.", "Server terminated", server.pid)
+cse303.line()
+f = open(server.dirfile, "rb")
+header = f.read(32)
+f.close()
+index, end = struct.unpack("<QQ", header[16:32])
+cse303.check_value("Checking the snapshot's magic.", b"AUTHIDX3", header[0:8])
+cse303.check_value("Checking the snapshot's entry count.", 2, struct.unpack("<Q", header[8:16])[0])
+cse303.check_value("Checking that the index follows the content.", True, index > 500000 and end == cse303.get_len(server.dirfile))
+cse303.check_value("Checking that the index is small.", True, end - index < 256)
+cse303.line()
+
+# The snapshot is mapped, rather than read.  Loading only reads its index, and
+# content is paged in on use.
+server.pid = cse303.do_cmd("Restarting server to load the snapshot.", "Loaded: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmd("Re-registering alice.", "ERR_USER_EXISTS", client.reg(alice))
+cse303.do_cmd("Getting all users.", "OK", client.getA(alice, allfile))
+cse303.check_file_list(allfile, [alice.name, bob.name])
+cse303.do_cmd("Checking bob's content.", "OK", client.getC(alice, bob.name))
+cse303.check_file_result(bfile, bob.name)
+cse303.do_cmd("Checking alice's content.", "OK", client.getC(bob, alice.name))
+cse303.check_file_result(afile1, alice.name)
+
+# Persisting again replaces the file that is mapped
+cse303.do_cmd("Setting alice's content again.", "OK", client.setC(alice, afile2))
+cse303.do_cmd("Instructing server to persist data.", "OK", client.persist(alice))
+cse303.do_cmd("Stopping server.", "OK", client.bye(alice))
+cse303.await_server("Waiting for server to shut down.", "Server terminated", server.pid)
+cse303.line()
+server.pid = cse303.do_cmd("Restarting server.", "Loaded: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmd("Checking alice's new content.", "OK", client.getC(alice, alice.name))
+cse303.check_file_result(afile2, alice.name)
+cse303.do_cmd("Checking bob's content.", "OK", client.getC(alice, bob.name))
+cse303.check_file_result(bfile, bob.name)
+cse303.do_cmd("Stopping server.", "OK", client.bye(alice))
+cse303.await_server("Waiting for server to shut down.", "Server terminated", server.pid)
+cse303.line()
+
+# A header that promises more entries than the file holds must be refused
+f = open(server.dirfile, "r+b")
+f.seek(8)
+f.write(struct.pack("<Q", 3))
+f.close()
+server.pid = cse303.do_cmd("Starting server with a bad snapshot.", "Snapshot index does not match its header", server.launchcmd())
+server.pid.wait()
+cse303.line()
+
+# Clean up
+cse303.clean_common_files(server, client)
+cse303.delfile(bfile)
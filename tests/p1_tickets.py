@@ -0,0 +1,110 @@
+#!/usr/bin/python3
+import os
+import struct
+import cse303
+
+# Configure constants and users
+cse303.indentation = 80
+cse303.verbose = cse303.check_args_verbose()
+admin = cse303.UserConfig("admin", "admin_is_in_charge")
+alice = cse303.UserConfig("alice", "alice_is_awesome")
+bob = cse303.UserConfig("bob", "bob_is_the_best")
+carol = cse303.UserConfig("carol", "carol_rocks")
+afile = "server/server_args.h"
+batchfile = "batch.txt"
+metfile = "metrics.txt"
+
+# Create objects with server and client configuration.  Tickets expire after
+# two seconds.
+server = cse303.ServerConfig("./obj64/server.exe", "9999", "rsa", "company.dir", admin = admin.name, extra = ["-T", "2"])
+client = cse303.ClientConfig("./obj64/client.exe", "localhost", "9999", "localhost.pub")
+
+# Check if we should use spear's server or client
+cse303.override_exe(server, client)
+
+# Clean up the file system from the last run, kill active servers
+cse303.clean_common_files(server, client)
+cse303.delfile(metfile)
+cse303.killall("server.exe")
+
+def rsa_count(user):
+    """Return the number of RSA decryptions that the server has done"""
+    cse303.do_cmd("Getting metrics as admin.", "OK", client.cmd1(user, "MET", metfile))
+    f = open(metfile)
+    lines = [x.split() for x in f.readlines()]
+    f.close()
+    cse303.delfile(metfile)
+    return [int(x[1][len("count="):]) for x in lines if x[0] == "rsa"][0]
+
+def reg_body(user):
+    """Build the unencrypted ablock of a REG request"""
+    name = user.name.encode()
+    pwd = user.pwd.encode()
+    return struct.pack("<i", len(name)) + name + struct.pack("<i", len(pwd)) + pwd
+
+def ticket_request(key, user):
+    """Send a REG request that asks for a ticket, and return the ticket"""
+    ablock = cse303.aes_encrypt(key, reg_body(user))
+    # NB: RBLOCK_FLAG_TICKET is 1
+    rblock = cse303.rsa_encrypt(server.keyfile + ".pub", b"REG" + key + struct.pack("<i", len(ablock)) + struct.pack("<i", 1))
+    res = cse303.raw_request(server.port, rblock + ablock)
+    if len(res) < 4 or struct.unpack("<i", res[:4])[0] != 48:
+        return b""
+    return res[4:52]
+
+def resume_request(key, ticket, msg):
+    """Send msg as an RSM request with a ticket, and return the decrypted
+    response, or the unencrypted error"""
+    iv = os.urandom(16)
+    e = cse303.aes_encrypt(key[:32] + iv, msg)
+    header = (b"RSM" + ticket + struct.pack("<i", len(e))).ljust(256, b"\0")
+    res = cse303.raw_request(server.port, header + iv + e)
+    if len(res) < 20 or struct.unpack("<i", res[:4])[0] != len(res) - 20:
+        return res
+    return cse303.aes_decrypt(key[:32] + res[4:20], res[20:])
+
+server.pid = cse303.do_cmd("Starting server.", "File not found: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmd("Registering new user admin.", "OK", client.reg(admin))
+cse303.do_cmd("Registering new user alice.", "OK", client.reg(alice))
+cse303.line()
+
+# With tickets, each command of a batch is its own request, but only the first
+# pays for RSA
+rsa = rsa_count(admin)
+cse303.build_file_as(batchfile, "SET " + afile + "\nGET alice\nGET nobody\nGET alice\n")
+cse303.do_batch("Running a batch with tickets.", ["OK", "OK", "ERR_NO_USER", "OK"], client.batch(alice, batchfile) + ["-T"])
+cse303.check_file_result(afile, alice.name)
+cse303.check_value("Checking the RSA handshakes for the batch.", 1, rsa_count(admin) - rsa - 1)
+cse303.line()
+
+# A ticket resumes the key of the request that earned it, until it expires
+key = os.urandom(48)
+ticket = ticket_request(key, bob)
+cse303.check_value("Getting a ticket for bob's REG.", 48, len(ticket))
+res = resume_request(key, ticket, b"REG" + reg_body(carol))
+cse303.check_value("Registering carol with the ticket.", b"OK", res)
+cse303.do_cmd("Registering carol again.", "ERR_USER_EXISTS", client.reg(carol))
+cse303.waitfor(3)
+res = resume_request(key, ticket, b"REG" + reg_body(cse303.UserConfig("dave", "dave_is_late")))
+cse303.check_value("Registering dave with an expired ticket.", b"ERR_TICKET", res)
+cse303.line()
+
+# A forged ticket is refused, and the request has no effect
+res = resume_request(key, os.urandom(48), b"REG" + reg_body(cse303.UserConfig("eve", "eve_forges")))
+cse303.check_value("Registering eve with a forged ticket.", b"ERR_TICKET", res)
+key = os.urandom(48)
+ticket = ticket_request(key, cse303.UserConfig("frank", "frank_is_fine"))
+forged = ticket[:-1] + bytes([ticket[-1] ^ 1])
+res = resume_request(key, forged, b"REG" + reg_body(cse303.UserConfig("eve", "eve_forges")))
+cse303.check_value("Registering eve with an altered ticket.", b"ERR_TICKET", res)
+cse303.do_cmd("Registering dave.", "OK", client.reg(cse303.UserConfig("dave", "dave_is_late")))
+cse303.do_cmd("Registering eve.", "OK", client.reg(cse303.UserConfig("eve", "eve_forges")))
+cse303.line()
+
+# Clean up
+cse303.kill_server(server)
+cse303.clean_common_files(server, client)
+cse303.delfile(batchfile)
+cse303.delfile(metfile)
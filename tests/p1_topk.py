@@ -0,0 +1,63 @@
+#!/usr/bin/python3
+import cse303
+
+# Configure constants and users
+cse303.indentation = 80
+cse303.verbose = cse303.check_args_verbose()
+admin = cse303.UserConfig("admin", "admin_is_in_charge")
+alice = cse303.UserConfig("alice", "alice_is_awesome")
+bob = cse303.UserConfig("bob", "bob_is_the_best")
+carol = cse303.UserConfig("carol", "carol_rocks")
+afile = "server/server_args.h"
+metfile = "metrics.txt"
+
+# Create objects with server and client configuration.  The server reports
+# the two hottest GET and SET keys to its admin.
+server = cse303.ServerConfig("./obj64/server.exe", "9999", "rsa", "company.dir", top = "2", admin = admin.name)
+client = cse303.ClientConfig("./obj64/client.exe", "localhost", "9999", "localhost.pub")
+
+# Check if we should use spear's server or client
+cse303.override_exe(server, client)
+
+# Clean up the file system from the last run, kill active servers
+cse303.clean_common_files(server, client)
+cse303.delfile(metfile)
+cse303.killall("server.exe")
+
+def top_lines(filename):
+    """Return the top_get and top_set lines of a metrics report, in order, and
+    delete the report"""
+    f = open(filename)
+    lines = [x.strip() for x in f.readlines() if x.startswith("top_")]
+    f.close()
+    cse303.delfile(filename)
+    return lines
+
+server.pid = cse303.do_cmd("Starting server.", "File not found: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+for u in [admin, alice, bob, carol]:
+    cse303.do_cmd("Registering new user " + u.name + ".", "OK", client.reg(u))
+cse303.line()
+
+# Write and read each user's content a different number of times
+for u, sets, gets in [(alice, 1, 5), (bob, 3, 3), (carol, 2, 1)]:
+    for i in range(sets):
+        cse303.do_cmd("Setting " + u.name + "'s content.", "OK", client.setC(u, afile))
+    for i in range(gets):
+        cse303.do_cmd("Getting " + u.name + "'s content.", "OK", client.getC(admin, u.name))
+cse303.delfile(alice.name + ".file.dat")
+cse303.delfile(bob.name + ".file.dat")
+cse303.delfile(carol.name + ".file.dat")
+cse303.line()
+
+# Only the two hottest keys of each kind are reported, hottest first
+cse303.do_cmd("Getting metrics as admin.", "OK", client.cmd1(admin, "MET", metfile))
+cse303.check_value("Checking the hottest keys.", ["top_get alice 5", "top_get bob 3", "top_set bob 3", "top_set carol 2"], top_lines(metfile))
+cse303.do_cmd("Getting metrics as alice.", "ERR_LOGIN", client.cmd1(alice, "MET", metfile))
+cse303.line()
+
+# Clean up
+cse303.kill_server(server)
+cse303.clean_common_files(server, client)
+cse303.delfile(metfile)
@@ -0,0 +1,70 @@
+#!/usr/bin/python3
+import cse303
+
+# Configure constants and users
+cse303.indentation = 80
+cse303.verbose = cse303.check_args_verbose()
+alice = cse303.UserConfig("alice", "alice_is_awesome")
+bob = cse303.UserConfig("bob", "bob_is_the_best")
+afile1 = "server/server_args.h"
+afile2 = "server/server_storage.cc"
+
+# Create objects with server and client configuration.  The server keeps a
+# write-ahead log, and syncs it before it answers each change.
+server = cse303.ServerConfig("./obj64/server.exe", "9999", "rsa", "company.dir", extra = ["-l", "0"])
+client = cse303.ClientConfig("./obj64/client.exe", "localhost", "9999", "localhost.pub")
+logfile = server.dirfile + ".log"
+
+# Check if we should use spear's server or client
+cse303.override_exe(server, client)
+
+# Clean up the file system from the last run, kill active servers
+cse303.clean_common_files(server, client)
+cse303.delfile(logfile)
+cse303.killall("server.exe")
+
+def limitedcmd(server, size):
+    """Return a command that starts the server so that no file it writes can
+    grow past /size/ bytes.  A write past the limit fails, instead of killing
+    the server."""
+    return ["sh", "-c", "trap '' XFSZ; exec prlimit --fsize=" + str(size) + " \"$@\"", "sh"] + server.launchcmd()
+
+# Make a change that the log can hold
+server.pid = cse303.do_cmd("Starting server.", "File not found: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmd("Registering new user alice.", "OK", client.reg(alice))
+cse303.do_cmd("Setting alice's content.", "OK", client.setC(alice, afile1))
+cse303.kill_server(server)
+cse303.line()
+
+# Once the log can't grow, no change can be made durable, so each one must be
+# refused and undone, as if it never happened
+intact = cse303.get_len(logfile)
+server.pid = cse303.do_cmd("Restarting server with a log that can't grow.", "File not found: " + server.dirfile, limitedcmd(server, intact))
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmd("Registering new user bob.", "ERR_SERVER", client.reg(bob))
+cse303.do_cmd("Registering bob again.", "ERR_SERVER", client.reg(bob))
+cse303.do_cmd("Setting bob's content.", "ERR_LOGIN", client.setC(bob, afile1))
+cse303.do_cmd("Setting alice's content.", "ERR_SERVER", client.setC(alice, afile2))
+cse303.do_cmd("Checking alice's content.", "OK", client.getC(alice, alice.name))
+cse303.check_file_result(afile1, alice.name)
+cse303.verify_filesize(logfile, intact)
+cse303.kill_server(server)
+cse303.line()
+
+# None of the refused changes may be replayed
+server.pid = cse303.do_cmd("Restarting server.", "File not found: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmd("Checking alice's content.", "OK", client.getC(alice, alice.name))
+cse303.check_file_result(afile1, alice.name)
+cse303.do_cmd("Registering new user bob.", "OK", client.reg(bob))
+cse303.do_cmd("Stopping server.", "OK", client.bye(alice))
+cse303.await_server("Waiting for server to shut down.", "Server terminated", server.pid)
+cse303.line()
+
+# Clean up
+cse303.clean_common_files(server, client)
+cse303.delfile(logfile)
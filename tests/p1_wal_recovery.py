@@ -0,0 +1,75 @@
+#!/usr/bin/python3
+import struct
+import cse303
+
+# Configure constants and users
+cse303.indentation = 80
+cse303.verbose = cse303.check_args_verbose()
+alice = cse303.UserConfig("alice", "alice_is_awesome")
+afile1 = "server/server_args.h"
+afile2 = "server/server_args.cc"
+
+# Create objects with server and client configuration.  The server keeps a
+# write-ahead log, and syncs it before it answers each change.
+server = cse303.ServerConfig("./obj64/server.exe", "9999", "rsa", "company.dir", extra = ["-l", "0"])
+client = cse303.ClientConfig("./obj64/client.exe", "localhost", "9999", "localhost.pub")
+logfile = server.dirfile + ".log"
+
+# Check if we should use spear's server or client
+cse303.override_exe(server, client)
+
+# Clean up the file system from the last run, kill active servers
+cse303.clean_common_files(server, client)
+cse303.delfile(logfile)
+cse303.killall("server.exe")
+
+# Make changes, then crash before they are ever persisted
+server.pid = cse303.do_cmd("Starting server.", "File not found: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmd("Registering new user alice.", "OK", client.reg(alice))
+cse303.do_cmd("Setting alice's content.", "OK", client.setC(alice, afile1))
+cse303.kill_server(server)
+cse303.line()
+
+# Every acknowledged change must be replayed from the log
+server.pid = cse303.do_cmd("Restarting server after a crash.", "File not found: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmd("Re-registering alice.", "ERR_USER_EXISTS", client.reg(alice))
+cse303.do_cmd("Checking alice's content.", "OK", client.getC(alice, alice.name))
+cse303.check_file_result(afile1, alice.name)
+cse303.do_cmd("Setting alice's content again.", "OK", client.setC(alice, afile2))
+cse303.kill_server(server)
+cse303.line()
+
+# A crash in the middle of an append leaves a torn last record, which must be
+# discarded without losing the records before it
+intact = cse303.get_len(logfile)
+f = open(logfile, "ab")
+f.write(struct.pack("<i", 1000) + b"AUTHAUTH" + b"\0" * 20)
+f.close()
+server.pid = cse303.do_cmd("Restarting server with a torn log.", "File not found: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.verify_filesize(logfile, intact)
+cse303.do_cmd("Checking alice's newest content.", "OK", client.getC(alice, alice.name))
+cse303.check_file_result(afile2, alice.name)
+cse303.do_cmd("Setting alice's content after the repair.", "OK", client.setC(alice, afile1))
+cse303.do_cmd("Stopping server.", "OK", client.bye(alice))
+cse303.await_server_after_errors("Waiting for server to shut down.", "Server terminated", server.pid)
+cse303.line()
+
+# The record appended after the repair must replay too
+server.pid = cse303.do_cmd("Restarting server.", "File not found: " + server.dirfile, server.launchcmd())
+cse303.waitfor(2)
+cse303.line()
+cse303.do_cmd("Checking alice's content.", "OK", client.getC(alice, alice.name))
+cse303.check_file_result(afile1, alice.name)
+cse303.do_cmd("Stopping server.", "OK", client.bye(alice))
+cse303.await_server("Waiting for server to shut down.", "Server terminated", server.pid)
+cse303.line()
+
+# Clean up
+cse303.clean_common_files(server, client)
+cse303.delfile(logfile)